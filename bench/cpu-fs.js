@@ -0,0 +1,27 @@
+// The null filesystem from ./memfs with a CPU bound read handler (every block
+// is hashed a few times), loaded by path so it can run on worker_threads.
+
+const crypto = require('crypto')
+const createFS = require('./memfs')
+
+const ROUNDS = Number(process.env.FUSE_BENCH_ROUNDS) || 8
+
+module.exports = function () {
+  const ops = createFS({ files: 64 })
+  const read = ops.read
+  let fds = 0
+
+  // Distinct fds so reads of different files can be routed to different workers.
+  ops.open = function (path, flags, cb) {
+    return process.nextTick(cb, 0, ++fds)
+  }
+
+  ops.read = function (path, fd, buf, len, pos, cb) {
+    read(path, fd, buf, len, pos, function (res) {
+      for (let i = 0; i < ROUNDS; i++) crypto.createHash('sha256').update(buf.subarray(0, res)).digest()
+      cb(res)
+    })
+  }
+
+  return ops
+}
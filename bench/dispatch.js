@@ -0,0 +1,119 @@
+// Checks how much the JS dispatch layer allocates per request. A getattr that
+// replies synchronously with a prebuilt stat (so the handler allocates nothing
+// itself) is hammered by a separate client process, and the heap growth of
+// this process between two points without a GC in between is divided by the
+// number of requests served. Exits non-zero above --max bytes per request.
+//
+//   node bench/dispatch.js [--requests 200000] [--concurrency 32] [--max 64]
+
+const v8 = require('v8')
+const { spawn } = require('child_process')
+const { PerformanceObserver } = require('perf_hooks')
+
+const argv = parseArgs(process.argv.slice(2))
+
+if (argv.client) client()
+else if (!process.execArgv.some(arg => arg.startsWith('--max-semi-space-size'))) reexec()
+else measure()
+
+// A big young generation, so the measured window fits in it without a scavenge.
+function reexec () {
+  spawn(process.execPath, ['--max-semi-space-size=256', ...process.execArgv, __filename, ...process.argv.slice(2)], { stdio: 'inherit' })
+    .on('exit', code => { process.exitCode = code })
+}
+
+function measure () {
+  const Fuse = require('../')
+  const createMountpoint = require('../test/fixtures/mnt')
+  const stat = require('../test/fixtures/stat')
+
+  const mnt = createMountpoint()
+  const FILE = stat({ mode: 'file', size: 11 })
+  const DIR = stat({ mode: 'dir', size: 4096 })
+
+  let requests = 0
+
+  const ops = {
+    getattr (path, cb) {
+      requests++
+      cb(0, path === '/' ? DIR : FILE)
+    }
+  }
+
+  // Low-level mode with zero timeouts and no attr cache, so every stat reaches JS.
+  const fuse = new Fuse(mnt, ops, { force: true, lowlevel: true, attrTimeout: 0, entryTimeout: 0 })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    // Warm up (JIT, interned paths, one request object per FUSE thread) before measuring.
+    run(argv.requests / 4, function () {
+      let gcs = 0
+      const obs = new PerformanceObserver(list => { gcs += list.getEntries().length })
+      obs.observe({ entryTypes: ['gc'] })
+
+      const before = requests
+      const heap = v8.getHeapStatistics().used_heap_size
+
+      run(argv.requests, function () {
+        const bytes = v8.getHeapStatistics().used_heap_size - heap
+        const served = requests - before
+        obs.disconnect()
+
+        fuse.unmount(function () {
+          if (gcs) {
+            console.log('a GC ran during the measurement, rerun with a bigger --max-semi-space-size or fewer --requests')
+            process.exitCode = 2
+            return
+          }
+
+          const perRequest = Math.max(0, bytes) / served
+          console.log('%d requests, %d bytes allocated, %s bytes per request (max %d)', served, bytes, perRequest.toFixed(1), argv.max)
+          if (perRequest > argv.max) process.exitCode = 1
+        })
+      })
+    })
+  })
+
+  function run (n, cb) {
+    const child = spawn(process.execPath, [__filename, '--client', mnt, String(Math.round(n)), String(argv.concurrency)], { stdio: 'inherit' })
+    child.on('exit', code => {
+      if (code) throw new Error('client failed')
+      cb()
+    })
+  }
+}
+
+function client () {
+  process.env.UV_THREADPOOL_SIZE = argv.concurrency
+  const fs = require('fs')
+  const path = require('path')
+  let missing = argv.count
+
+  for (let i = 0; i < argv.concurrency; i++) loop(i)
+
+  function loop (i) {
+    if (missing-- <= 0) return
+    fs.stat(path.join(argv.mnt, 'file-' + (i % 64)), function (err) {
+      if (err) throw err
+      loop(i)
+    })
+  }
+}
+
+function parseArgs (args) {
+  const opts = { requests: 200000, concurrency: 32, max: 64, client: false }
+
+  if (args[0] === '--client') {
+    return { client: true, mnt: args[1], count: Number(args[2]), concurrency: Number(args[3]) }
+  }
+
+  for (let i = 0; i < args.length; i++) {
+    const arg = args[i]
+    if (arg === '--requests') opts.requests = Number(args[++i])
+    else if (arg === '--concurrency') opts.concurrency = Number(args[++i])
+    else if (arg === '--max') opts.max = Number(args[++i])
+  }
+
+  return opts
+}
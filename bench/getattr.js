@@ -0,0 +1,53 @@
+// Metadata storm: many concurrent stats against a getattr-only filesystem.
+// Run with `node bench/getattr.js [concurrency] [seconds]`.
+
+process.env.UV_THREADPOOL_SIZE = process.env.UV_THREADPOOL_SIZE || 64
+
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const concurrency = Number(process.argv[2]) || 64
+const seconds = Number(process.argv[3]) || 5
+const files = 1024
+
+const mnt = createMountpoint()
+
+const ops = {
+  getattr (path, cb) {
+    if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+    return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+  }
+}
+
+const fuse = new Fuse(mnt, ops, { force: true })
+
+fuse.mount(function (err) {
+  if (err) throw err
+
+  const end = Date.now() + seconds * 1000
+  let count = 0
+  let active = concurrency
+
+  for (let i = 0; i < concurrency; i++) loop(i)
+
+  function loop (i) {
+    if (Date.now() >= end) return done()
+    fs.stat(path.join(mnt, 'file-' + ((i + count) % files)), function (err) {
+      if (err) throw err
+      count++
+      loop(i)
+    })
+  }
+
+  function done () {
+    if (--active) return
+    console.log('getattr: %d ops/s (concurrency %d)', Math.round(count / seconds), concurrency)
+    fuse.unmount(function (err) {
+      if (err) throw err
+    })
+  }
+})
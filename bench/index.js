@@ -0,0 +1,250 @@
+// Throughput/latency suite. Mounts the null filesystem from ./memfs and drives it
+// with parallel readers, writers and a metadata storm (stat, open+close, readdir).
+//
+//   npm run bench -- [scenario...] [--duration 5] [--concurrency 1,4,16,64]
+//                    [--sizes 4096,65536,1048576] [--lowlevel] [--read-cache bytes] [--out results.json]
+//
+// Every request blocks one FUSE thread, so the concurrency is also the number of
+// FUSE threads libfuse ends up running. Results are printed and written as JSON
+// (bench/results/<commit>.json by default) so runs can be diffed between commits.
+
+const argv = parseArgs(process.argv.slice(2))
+
+process.env.UV_THREADPOOL_SIZE = Math.min(1024, Math.max(...argv.concurrency) + 4)
+
+const os = require('os')
+const fs = require('fs')
+const path = require('path')
+const { execSync } = require('child_process')
+
+const Fuse = require('../')
+const createFS = require('./memfs')
+const createMountpoint = require('../test/fixtures/mnt')
+
+const FILES = 1024
+
+const scenarios = {
+  read: { sized: true, run: read },
+  write: { sized: true, run: write },
+  metadata: { sized: false, run: metadata }
+}
+
+const mnt = createMountpoint()
+const fuse = new Fuse(mnt, createFS({ files: FILES }), {
+  force: true,
+  lowlevel: argv.lowlevel,
+  // Make every request reach the binding instead of the kernel or native caches.
+  directIo: true,
+  attrTimeout: 0,
+  entryTimeout: 0,
+  attrCacheSize: 0,
+  maxWrite: 1024 * 1024,
+  // Off unless asked for, blocks as small as the smallest read so every read can hit.
+  readCacheSize: argv.readCache,
+  readCacheBlockSize: Math.min(...argv.sizes)
+})
+
+const results = []
+const plan = []
+
+for (const name of argv.scenarios) {
+  if (!scenarios[name]) throw new Error('Unknown scenario: ' + name)
+  for (const concurrency of argv.concurrency) {
+    for (const size of scenarios[name].sized ? argv.sizes : [0]) {
+      plan.push({ name, concurrency, size })
+    }
+  }
+}
+
+fuse.mount(function (err) {
+  if (err) throw err
+  next()
+})
+
+function next () {
+  const job = plan.shift()
+  if (!job) return finish()
+
+  const samples = new Map()
+  const end = Date.now() + argv.duration * 1000
+  const start = process.hrtime.bigint()
+  let active = job.concurrency
+
+  for (let i = 0; i < job.concurrency; i++) {
+    scenarios[job.name].run(i, job.size, record, done)
+  }
+
+  function record (op, started) {
+    let list = samples.get(op)
+    if (!list) samples.set(op, list = [])
+    list.push(Number(process.hrtime.bigint() - started))
+    return Date.now() < end
+  }
+
+  function done (err) {
+    if (err) throw err
+    if (--active) return
+
+    const secs = Number(process.hrtime.bigint() - start) / 1e9
+
+    for (const [op, list] of samples) {
+      const sorted = Float64Array.from(list).sort()
+      const result = {
+        scenario: job.name,
+        op,
+        concurrency: job.concurrency,
+        size: job.size,
+        ops: sorted.length,
+        opsPerSec: Math.round(sorted.length / secs),
+        bytesPerSec: job.size ? Math.round(sorted.length * job.size / secs) : 0,
+        p50Us: percentile(sorted, 0.5),
+        p99Us: percentile(sorted, 0.99)
+      }
+      results.push(result)
+      console.log('%s %s c=%d%s: %d ops/s, p50 %dus, p99 %dus', result.scenario, result.op, result.concurrency, result.size ? ' size=' + result.size : '', result.opsPerSec, result.p50Us, result.p99Us)
+    }
+
+    next()
+  }
+}
+
+function finish () {
+  fuse.unmount(function (err) {
+    if (err) throw err
+
+    const commit = gitCommit()
+    const out = argv.out || path.join(__dirname, 'results', (commit || 'local') + '.json')
+    const report = {
+      commit,
+      date: new Date().toISOString(),
+      node: process.version,
+      platform: os.platform(),
+      kernel: os.release(),
+      cpus: os.cpus().length,
+      lowlevel: argv.lowlevel,
+      readCache: argv.readCache,
+      duration: argv.duration,
+      results
+    }
+
+    fs.mkdirSync(path.dirname(out), { recursive: true })
+    fs.writeFileSync(out, JSON.stringify(report, null, 2) + '\n')
+    console.log('wrote %s', out)
+  })
+}
+
+// Scenarios, each client loops until record() says time is up.
+
+function read (i, size, record, done) {
+  const buf = Buffer.alloc(size)
+  const blocks = Math.floor(1024 * 1024 * 1024 / size)
+
+  fs.open(path.join(mnt, 'file-' + i % FILES), 'r', function (err, fd) {
+    if (err) return done(err)
+    loop()
+
+    function loop () {
+      const started = process.hrtime.bigint()
+      fs.read(fd, buf, 0, size, Math.floor(Math.random() * blocks) * size, function (err) {
+        if (err) return done(err)
+        if (record('read', started)) return loop()
+        fs.close(fd, done)
+      })
+    }
+  })
+}
+
+function write (i, size, record, done) {
+  const buf = Buffer.alloc(size, 'w')
+  let pos = 0
+
+  fs.open(path.join(mnt, 'write-' + i), 'w', function (err, fd) {
+    if (err) return done(err)
+    loop()
+
+    function loop () {
+      const started = process.hrtime.bigint()
+      fs.write(fd, buf, 0, size, pos, function (err) {
+        if (err) return done(err)
+        pos += size
+        if (record('write', started)) return loop()
+        fs.close(fd, done)
+      })
+    }
+  })
+}
+
+function metadata (i, size, record, done) {
+  let n = i
+
+  statLoop()
+
+  function statLoop () {
+    const started = process.hrtime.bigint()
+    fs.stat(path.join(mnt, 'file-' + (n++ % FILES)), function (err) {
+      if (err) return done(err)
+      if (record('stat', started)) return openLoop()
+      done()
+    })
+  }
+
+  function openLoop () {
+    const started = process.hrtime.bigint()
+    fs.open(path.join(mnt, 'file-' + (n++ % FILES)), 'r', function (err, fd) {
+      if (err) return done(err)
+      fs.close(fd, function (err) {
+        if (err) return done(err)
+        if (record('open+close', started)) return readdirLoop()
+        done()
+      })
+    })
+  }
+
+  function readdirLoop () {
+    const started = process.hrtime.bigint()
+    fs.readdir(mnt, function (err) {
+      if (err) return done(err)
+      if (record('readdir', started)) return statLoop()
+      done()
+    })
+  }
+}
+
+function percentile (sorted, p) {
+  if (!sorted.length) return 0
+  return Math.round(sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] / 1000)
+}
+
+function gitCommit () {
+  try {
+    return execSync('git rev-parse --short HEAD', { cwd: __dirname, stdio: ['ignore', 'pipe', 'ignore'] }).toString().trim()
+  } catch (_) {
+    return null
+  }
+}
+
+function parseArgs (args) {
+  const opts = {
+    scenarios: [],
+    duration: 5,
+    concurrency: [1, 4, 16, 64],
+    sizes: [4096, 65536, 1048576],
+    lowlevel: false,
+    readCache: 0,
+    out: null
+  }
+
+  for (let i = 0; i < args.length; i++) {
+    const arg = args[i]
+    if (arg === '--duration') opts.duration = Number(args[++i])
+    else if (arg === '--concurrency') opts.concurrency = args[++i].split(',').map(Number)
+    else if (arg === '--sizes') opts.sizes = args[++i].split(',').map(Number)
+    else if (arg === '--lowlevel') opts.lowlevel = true
+    else if (arg === '--read-cache') opts.readCache = Number(args[++i])
+    else if (arg === '--out') opts.out = args[++i]
+    else opts.scenarios.push(arg)
+  }
+
+  if (!opts.scenarios.length) opts.scenarios = ['read', 'write', 'metadata']
+  return opts
+}
@@ -0,0 +1,80 @@
+// Deep tree lookups and renames, high-level vs low-level mode.
+// Run with `node bench/lowlevel.js [depth] [iterations]`.
+
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const depth = Number(process.argv[2]) || 32
+const iterations = Number(process.argv[3]) || 10000
+
+run(false, function () {
+  run(true, function () {})
+})
+
+function run (lowlevel, cb) {
+  const mnt = createMountpoint()
+  const entries = new Map([['/', 'dir']])
+
+  let dir = ''
+  for (let i = 0; i < depth; i++) {
+    dir += '/d' + i
+    entries.set(dir, 'dir')
+  }
+  entries.set(dir + '/a', 'file')
+
+  const ops = {
+    getattr (path, cb) {
+      const type = entries.get(path)
+      if (!type) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, stat({ mode: type, size: type === 'dir' ? 4096 : 0 }))
+    },
+    rename (src, dest, cb) {
+      const type = entries.get(src)
+      if (!type) return process.nextTick(cb, Fuse.ENOENT)
+      entries.delete(src)
+      entries.set(dest, type)
+      return process.nextTick(cb, 0)
+    }
+  }
+
+  // Keep the kernel from answering the stats on its own.
+  const fuse = new Fuse(mnt, ops, { force: true, lowlevel, entryTimeout: 0.001, attrTimeout: 0.001 })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    const a = path.join(mnt, dir, 'a')
+    const b = path.join(mnt, dir, 'b')
+    const start = process.hrtime()
+    let i = 0
+
+    loop()
+
+    function loop () {
+      if (i++ === iterations) return done()
+      const from = i & 1 ? a : b
+      const to = i & 1 ? b : a
+      fs.rename(from, to, function (err) {
+        if (err) throw err
+        fs.stat(to, function (err) {
+          if (err) throw err
+          loop()
+        })
+      })
+    }
+
+    function done () {
+      const [s, ns] = process.hrtime(start)
+      const secs = s + ns / 1e9
+      console.log('%s: %d rename+stat/s (depth %d)', lowlevel ? 'lowlevel' : 'highlevel', Math.round(iterations / secs), depth)
+      fuse.unmount(function (err) {
+        if (err) throw err
+        cb()
+      })
+    }
+  })
+}
@@ -0,0 +1,60 @@
+// Null/in-memory filesystem used by the bench suite. Reads are served from a
+// static pattern buffer and writes are dropped, so the numbers measure the
+// binding and the kernel round trip rather than the handlers.
+
+const Fuse = require('../')
+const stat = require('../test/fixtures/stat')
+
+module.exports = function createFS ({ files = 1024, fileSize = 1024 * 1024 * 1024 } = {}) {
+  const pattern = Buffer.alloc(1024 * 1024, 'fuse-native')
+  const names = []
+  const sizes = new Map()
+
+  for (let i = 0; i < files; i++) {
+    names.push('file-' + i)
+    sizes.set('/file-' + i, fileSize)
+  }
+
+  return {
+    getattr (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      const size = sizes.get(path)
+      if (size === undefined) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, stat({ mode: 'file', size }))
+    },
+    readdir (path, cb) {
+      if (path !== '/') return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, names)
+    },
+    open (path, flags, cb) {
+      if (!sizes.has(path)) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, 42)
+    },
+    create (path, mode, cb) {
+      sizes.set(path, 0)
+      return process.nextTick(cb, 0, 42)
+    },
+    release (path, fd, cb) {
+      return process.nextTick(cb, 0)
+    },
+    truncate (path, size, cb) {
+      sizes.set(path, size)
+      return process.nextTick(cb, 0)
+    },
+    ftruncate (path, fd, size, cb) {
+      sizes.set(path, size)
+      return process.nextTick(cb, 0)
+    },
+    read (path, fd, buf, len, pos, cb) {
+      const size = sizes.get(path) || 0
+      if (pos >= size) return process.nextTick(cb, 0)
+      len = Math.min(len, size - pos, pattern.length)
+      pattern.copy(buf, 0, 0, len)
+      return process.nextTick(cb, len)
+    },
+    write (path, fd, buf, len, pos, cb) {
+      if (pos + len > (sizes.get(path) || 0)) sizes.set(path, pos + len)
+      return process.nextTick(cb, len)
+    }
+  }
+}
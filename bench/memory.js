@@ -0,0 +1,136 @@
+// Baseline for handler overhead: the same file churn against a native memory mount and against a JS
+// in-memory filesystem over the same bindings. Run with `node bench/memory.js [seconds] [--concurrency 16]
+// [--size 4096]`, the gap between the two is what the JS layer costs per request.
+
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const { seconds, concurrency, size } = parseArgs(process.argv.slice(2))
+
+run('native memory', null, { memory: true }, function () {
+  run('js memfs', createJSFS(), {}, function () {})
+})
+
+function run (name, ops, opts, cb) {
+  const mnt = createMountpoint()
+  const fuse = new Fuse(mnt, ops, {
+    force: true,
+    // Every request has to reach the mount.
+    attrTimeout: 0,
+    entryTimeout: 0,
+    attrCacheSize: 0,
+    ...opts
+  })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    const data = Buffer.alloc(size, 'm')
+    const samples = []
+    const end = Date.now() + seconds * 1000
+    const start = process.hrtime.bigint()
+    let active = concurrency
+
+    for (let i = 0; i < concurrency; i++) loop(path.join(mnt, 'file-' + i))
+
+    function loop (file) {
+      const started = process.hrtime.bigint()
+
+      fs.writeFile(file, data, function (err) {
+        if (err) throw err
+        fs.stat(file, function (err) {
+          if (err) throw err
+          fs.readFile(file, function (err) {
+            if (err) throw err
+            fs.unlink(file, function (err) {
+              if (err) throw err
+              samples.push(Number(process.hrtime.bigint() - started))
+              if (Date.now() < end) return loop(file)
+              if (--active === 0) done()
+            })
+          })
+        })
+      })
+    }
+
+    function done () {
+      const secs = Number(process.hrtime.bigint() - start) / 1e9
+      const sorted = Float64Array.from(samples).sort()
+      console.log('%s: %d cycles/s (write+stat+read+unlink of %dB), p50 %dus, p99 %dus', name, Math.round(sorted.length / secs), size, us(sorted, 0.5), us(sorted, 0.99))
+
+      fuse.unmount(function (err) {
+        if (err) throw err
+        cb()
+      })
+    }
+  })
+}
+
+function createJSFS () {
+  const files = new Map()
+
+  return {
+    getattr (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      const file = files.get(path)
+      if (!file) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, stat({ mode: 'file', size: file.length }))
+    },
+    readdir (path, cb) {
+      return process.nextTick(cb, 0, [...files.keys()].map(p => p.slice(1)))
+    },
+    create (path, mode, cb) {
+      files.set(path, Buffer.alloc(0))
+      return process.nextTick(cb, 0, 42)
+    },
+    open (path, flags, cb) {
+      if (!files.has(path)) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, 42)
+    },
+    release (path, fd, cb) {
+      return process.nextTick(cb, 0)
+    },
+    truncate (path, size, cb) {
+      const file = files.get(path) || Buffer.alloc(0)
+      files.set(path, size <= file.length ? file.slice(0, size) : Buffer.concat([file, Buffer.alloc(size - file.length)]))
+      return process.nextTick(cb, 0)
+    },
+    read (path, fd, buf, len, pos, cb) {
+      const file = files.get(path)
+      if (!file) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, file.copy(buf, 0, pos, Math.min(file.length, pos + len)))
+    },
+    write (path, fd, buf, len, pos, cb) {
+      let file = files.get(path)
+      if (!file) return process.nextTick(cb, Fuse.ENOENT)
+      if (pos + len > file.length) files.set(path, file = Buffer.concat([file, Buffer.alloc(pos + len - file.length)]))
+      buf.copy(file, pos, 0, len)
+      return process.nextTick(cb, len)
+    },
+    unlink (path, cb) {
+      if (!files.delete(path)) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0)
+    }
+  }
+}
+
+function parseArgs (args) {
+  const opts = { seconds: 5, concurrency: 16, size: 4096 }
+
+  for (let i = 0; i < args.length; i++) {
+    if (args[i] === '--concurrency') opts.concurrency = Number(args[++i])
+    else if (args[i] === '--size') opts.size = Number(args[++i])
+    else opts.seconds = Number(args[i])
+  }
+
+  return opts
+}
+
+function us (sorted, p) {
+  if (!sorted.length) return 0
+  return Math.round(sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] / 1000)
+}
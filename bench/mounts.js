@@ -0,0 +1,46 @@
+// Time to bring up (and tear down) N mounts at once, and how long the event loop stalls meanwhile.
+// Run with `node bench/mounts.js [count]`, UV_THREADPOOL_SIZE caps how many fuse_mount calls overlap.
+
+const { monitorEventLoopDelay } = require('perf_hooks')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const count = Number(process.argv[2]) || 64
+
+const ops = {
+  getattr (path, cb) {
+    if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+    return process.nextTick(cb, Fuse.ENOENT)
+  }
+}
+
+const mounts = []
+for (let i = 0; i < count; i++) {
+  mounts.push(new Fuse(createMountpoint({ doNotCreate: true }) + '-' + i, ops, { force: true, mkdir: true }))
+}
+
+measure('mount', (fuse, cb) => fuse.mount(cb), function () {
+  measure('unmount', (fuse, cb) => fuse.unmount(cb), function () {})
+})
+
+function measure (name, run, cb) {
+  const delay = monitorEventLoopDelay({ resolution: 1 })
+  const start = process.hrtime.bigint()
+  let missing = mounts.length
+
+  delay.enable()
+
+  for (const fuse of mounts) {
+    run(fuse, function (err) {
+      if (err) throw err
+      if (--missing) return
+
+      delay.disable()
+      const ms = Number(process.hrtime.bigint() - start) / 1e6
+      console.log('%s x%d: %dms total, %dms per mount, event loop delay max %dms, p99 %dms', name, mounts.length, Math.round(ms), (ms / mounts.length).toFixed(2), Math.round(delay.max / 1e6), Math.round(delay.percentile(99) / 1e6))
+      cb()
+    })
+  }
+}
@@ -0,0 +1,80 @@
+// Read throughput of a backing file through a native passthrough mount vs. JS handlers proxying it with fs.
+// Run with `node bench/passthrough.js [size in MB]`, compare against reading the backing file directly.
+
+const fs = require('fs')
+const os = require('os')
+const path = require('path')
+const { execFile } = require('child_process')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+
+// The child process reading the mount, see run.
+if (process.argv[2] === '--time') {
+  process.stdout.write(String(time(process.argv[3])))
+  process.exit(0)
+}
+
+const size = (Number(process.argv[2]) || 256) * 1024 * 1024
+const backing = fs.mkdtempSync(path.join(os.tmpdir(), 'fuse-native-backing-'))
+const file = path.join(backing, 'file')
+
+fs.writeFileSync(file, Buffer.alloc(size, 'x'))
+
+const proxy = {
+  getattr (p, cb) {
+    fs.lstat(backing + p, (err, st) => cb(err ? Fuse.ENOENT : 0, st))
+  },
+  open (p, flags, cb) {
+    fs.open(backing + p, flags, (err, fd) => cb(err ? Fuse.ENOENT : 0, fd))
+  },
+  read (p, fd, buf, len, pos, cb) {
+    fs.read(fd, buf, 0, len, pos, (err, n) => cb(err ? Fuse.EIO : n))
+  },
+  release (p, fd, cb) {
+    fs.close(fd, () => cb(0))
+  }
+}
+
+report('direct', time(file))
+
+run('passthrough', null, { passthrough: backing }, function () {
+  run('js proxy', proxy, {}, function () {
+    fs.unlinkSync(file)
+    fs.rmdirSync(backing)
+  })
+})
+
+function run (name, ops, opts, cb) {
+  const mnt = createMountpoint()
+  const fuse = new Fuse(mnt, ops, { force: true, maxRead: 1024 * 1024, ...opts })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    // Reads through the proxy need the loop, so the mount is read from a child process.
+    execFile(process.execPath, [__filename, '--time', path.join(mnt, 'file')], function (err, stdout) {
+      if (err) throw err
+      report(name, Number(stdout))
+
+      fuse.unmount(function (err) {
+        if (err) throw err
+        cb()
+      })
+    })
+  })
+}
+
+function time (file) {
+  const buf = Buffer.allocUnsafe(1024 * 1024)
+  const fd = fs.openSync(file, 'r')
+  const start = process.hrtime.bigint()
+  while (fs.readSync(fd, buf, 0, buf.length, null) > 0);
+  const ms = Number(process.hrtime.bigint() - start) / 1e6
+  fs.closeSync(fd)
+  return ms
+}
+
+function report (name, ms) {
+  console.log('%s: %dMB in %dms, %dMB/s', name, size / 1024 / 1024, Math.round(ms), Math.round(size / 1024 / 1024 / (ms / 1000)))
+}
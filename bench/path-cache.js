@@ -0,0 +1,83 @@
+// Stat storm over a set of deep paths with and without path interning, reporting
+// throughput, GC count/time and the young generation allocation rate it implies.
+// Run with `node bench/path-cache.js [concurrency] [seconds]`.
+
+process.env.UV_THREADPOOL_SIZE = process.env.UV_THREADPOOL_SIZE || 64
+
+const fs = require('fs')
+const v8 = require('v8')
+const path = require('path')
+const { PerformanceObserver, constants } = require('perf_hooks')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const concurrency = Number(process.argv[2]) || 64
+const seconds = Number(process.argv[3]) || 5
+const files = 256
+const dir = '/node_modules/some-package/node_modules/another-package/lib'
+
+const mnt = createMountpoint()
+
+run('no interning', { pathCacheSize: 0 }, function () {
+  run('interned', { pathCacheSize: 1024 }, function () {})
+})
+
+function run (name, opts, cb) {
+  const ops = {
+    getattr (path, cb) {
+      if (path.endsWith('.json')) return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+      return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+    }
+  }
+
+  // Low-level mode applies the zero timeouts itself and the attr cache is off, so every stat reaches JS.
+  const fuse = new Fuse(mnt, ops, { force: true, lowlevel: true, attrTimeout: 0, entryTimeout: 0, ...opts })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    const gc = { minor: 0, major: 0, ms: 0 }
+    const obs = new PerformanceObserver(function (list) {
+      for (const entry of list.getEntries()) {
+        const kind = entry.detail ? entry.detail.kind : entry.kind
+        if (kind === constants.NODE_PERFORMANCE_GC_MINOR) gc.minor++
+        else gc.major++
+        gc.ms += entry.duration
+      }
+    })
+
+    obs.observe({ entryTypes: ['gc'] })
+
+    const end = Date.now() + seconds * 1000
+    let count = 0
+    let active = concurrency
+
+    for (let i = 0; i < concurrency; i++) loop(i)
+
+    function loop (i) {
+      if (Date.now() >= end) return done()
+      fs.stat(path.join(mnt, dir, 'package-' + ((i + count) % files) + '.json'), function () {
+        count++
+        loop(i)
+      })
+    }
+
+    function done () {
+      if (--active) return
+      obs.disconnect()
+
+      const newSpace = v8.getHeapSpaceStatistics().find(s => s.space_name === 'new_space')
+      const allocated = gc.minor * (newSpace ? newSpace.space_size / 2 : 0)
+
+      console.log('%s: %d stats/s, %d scavenges, %d mark-sweeps, %d ms in GC, ~%d MB/s allocated (concurrency %d)',
+        name, Math.round(count / seconds), gc.minor, gc.major, Math.round(gc.ms), Math.round(allocated / seconds / 1e6), concurrency)
+
+      fuse.unmount(function (err) {
+        if (err) throw err
+        cb()
+      })
+    }
+  })
+}
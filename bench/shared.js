@@ -0,0 +1,112 @@
+// Stress test for many mounts in one process: RSS, thread count and per-mount stat latency.
+// Run with `node bench/shared.js [count] [--shared] [--rounds 20]`, compare with and without --shared.
+
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const { count, shared, rounds } = parseArgs(process.argv.slice(2))
+
+const base = createMountpoint({ doNotCreate: true })
+const mounts = []
+
+for (let i = 0; i < count; i++) {
+  mounts.push(new Fuse(base + '-' + i, createOps(i), {
+    force: true,
+    mkdir: true,
+    shared,
+    // Every stat has to reach the binding.
+    attrTimeout: 0,
+    entryTimeout: 0,
+    attrCacheSize: 0
+  }))
+}
+
+const before = usage()
+const mountStart = process.hrtime.bigint()
+
+all(mounts, (fuse, cb) => fuse.mount(cb), function () {
+  const mountMs = Number(process.hrtime.bigint() - mountStart) / 1e6
+  const idle = usage()
+  const samples = []
+  let round = 0
+
+  loop()
+
+  function loop () {
+    if (round++ === rounds) return report()
+
+    all(mounts, function (fuse, cb) {
+      const started = process.hrtime.bigint()
+      fs.stat(path.join(fuse.mnt, 'file'), function (err) {
+        if (err) return cb(err)
+        samples.push(Number(process.hrtime.bigint() - started))
+        cb(null)
+      })
+    }, loop)
+  }
+
+  function report () {
+    const busy = usage()
+    const sorted = Float64Array.from(samples).sort()
+
+    console.log('%d %s mounts, up in %dms', count, shared ? 'shared' : 'separate', Math.round(mountMs))
+    console.log('threads: %d before, %d mounted, %d after load', before.threads, idle.threads, busy.threads)
+    console.log('rss: %dMB before, %dMB mounted, %dMB after load (%dKB per mount)', mb(before.rss), mb(idle.rss), mb(busy.rss), Math.round((busy.rss - before.rss) / count / 1024))
+    console.log('stat latency over %d requests: p50 %dus, p99 %dus, max %dus', sorted.length, us(sorted, 0.5), us(sorted, 0.99), us(sorted, 1))
+
+    all(mounts, (fuse, cb) => fuse.unmount(cb), function () {})
+  }
+})
+
+function createOps (i) {
+  return {
+    getattr (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/file') return process.nextTick(cb, 0, stat({ mode: 'file', size: i }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+}
+
+function all (list, fn, cb) {
+  let missing = list.length
+  for (const item of list) {
+    fn(item, function (err) {
+      if (err) throw err
+      if (--missing === 0) cb()
+    })
+  }
+}
+
+function usage () {
+  const status = fs.readFileSync('/proc/self/status', 'utf8')
+  return {
+    threads: Number(/^Threads:\s+(\d+)/m.exec(status)[1]),
+    rss: process.memoryUsage().rss
+  }
+}
+
+function parseArgs (args) {
+  const opts = { count: 256, shared: false, rounds: 20 }
+
+  for (let i = 0; i < args.length; i++) {
+    if (args[i] === '--shared') opts.shared = true
+    else if (args[i] === '--rounds') opts.rounds = Number(args[++i])
+    else opts.count = Number(args[i])
+  }
+
+  return opts
+}
+
+function mb (bytes) {
+  return Math.round(bytes / 1024 / 1024)
+}
+
+function us (sorted, p) {
+  if (!sorted.length) return 0
+  return Math.round(sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] / 1000)
+}
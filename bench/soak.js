@@ -0,0 +1,99 @@
+// Mount/unmount soak: RSS has to stay flat over many cycles, each of which spins up FUSE threads.
+// Run with `node --expose-gc bench/soak.js [cycles] [--parallel 8] [--max-growth 16]`, fails if RSS after
+// the warmup grows by more than --max-growth MB. Pass --shared to soak shared mounts instead.
+
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const { cycles, parallel, maxGrowth, shared } = parseArgs(process.argv.slice(2))
+const WARMUP = Math.min(500, Math.floor(cycles / 10))
+const SAMPLES = 20
+
+const mnt = createMountpoint()
+
+const ops = {
+  getattr (path, cb) {
+    if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+    if (path === '/file') return setImmediate(cb, 0, stat({ mode: 'file', size: 42 }))
+    return process.nextTick(cb, Fuse.ENOENT)
+  }
+}
+
+let cycle = 0
+let baseline = 0
+let peak = 0
+const start = Date.now()
+
+loop()
+
+function loop () {
+  if (cycle === WARMUP) baseline = rss()
+  if (cycle > WARMUP) peak = Math.max(peak, rss())
+  if (cycle % Math.max(1, Math.floor(cycles / SAMPLES)) === 0) report()
+  if (cycle++ === cycles) return finish()
+
+  const fuse = new Fuse(mnt, ops, {
+    force: true,
+    shared,
+    // Every stat has to reach a FUSE thread.
+    attrTimeout: 0,
+    entryTimeout: 0,
+    attrCacheSize: 0
+  })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    let missing = parallel
+    for (let i = 0; i < parallel; i++) {
+      fs.stat(path.join(mnt, 'file'), function (err) {
+        if (err) throw err
+        if (--missing) return
+        fuse.unmount(function (err) {
+          if (err) throw err
+          loop()
+        })
+      })
+    }
+  })
+}
+
+function report () {
+  console.log('cycle %d: rss %dMB, %ds', cycle, mb(rss()), Math.round((Date.now() - start) / 1000))
+}
+
+function finish () {
+  const growth = peak - baseline
+  console.log('%d cycles: rss %dMB after warmup, peak %dMB after (%sMB growth, %dB per cycle)', cycles, mb(baseline), mb(peak), (growth / 1024 / 1024).toFixed(1), Math.round(growth / Math.max(1, cycles - WARMUP)))
+
+  if (growth > maxGrowth * 1024 * 1024) {
+    console.error('rss grew by more than %dMB', maxGrowth)
+    process.exitCode = 1
+  }
+}
+
+function rss () {
+  if (global.gc) global.gc()
+  return process.memoryUsage().rss
+}
+
+function parseArgs (args) {
+  const opts = { cycles: 10000, parallel: 8, maxGrowth: 16, shared: false }
+
+  for (let i = 0; i < args.length; i++) {
+    if (args[i] === '--parallel') opts.parallel = Number(args[++i])
+    else if (args[i] === '--max-growth') opts.maxGrowth = Number(args[++i])
+    else if (args[i] === '--shared') opts.shared = true
+    else opts.cycles = Number(args[i])
+  }
+
+  return opts
+}
+
+function mb (bytes) {
+  return Math.round(bytes / 1024 / 1024)
+}
@@ -0,0 +1,66 @@
+// Stat heavy workload with the kernel caches off, with and without the native attr cache.
+// Run with `node bench/stat-cache.js [concurrency] [seconds]`.
+
+process.env.UV_THREADPOOL_SIZE = process.env.UV_THREADPOOL_SIZE || 64
+
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+const stat = require('../test/fixtures/stat')
+
+const concurrency = Number(process.argv[2]) || 64
+const seconds = Number(process.argv[3]) || 5
+const files = 1024
+
+const mnt = createMountpoint()
+
+run('no cache', {}, function () {
+  run('native cache', { attrCacheSize: 65536, cacheTimeout: 60, negativeTimeout: 60 }, function () {})
+})
+
+function run (name, opts, cb) {
+  let getattrs = 0
+
+  const ops = {
+    getattr (path, cb) {
+      getattrs++
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path.startsWith('/missing-')) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, attrTimeout: 0, entryTimeout: 0, ...opts })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    const end = Date.now() + seconds * 1000
+    let count = 0
+    let active = concurrency
+
+    for (let i = 0; i < concurrency; i++) loop(i)
+
+    function loop (i) {
+      if (Date.now() >= end) return done()
+      // One in eight stats hits a missing file to exercise negative entries.
+      const n = (i + count) % files
+      const name = (n % 8 === 0 ? 'missing-' : 'file-') + n
+      fs.stat(path.join(mnt, name), function () {
+        count++
+        loop(i)
+      })
+    }
+
+    function done () {
+      if (--active) return
+      console.log('%s: %d stats/s, %d getattrs reached JS (concurrency %d)', name, Math.round(count / seconds), getattrs, concurrency)
+      fuse.unmount(function (err) {
+        if (err) throw err
+        cb()
+      })
+    }
+  })
+}
@@ -0,0 +1,95 @@
+// Latency of a cached getattr answered synchronously (sent straight from the
+// dispatch) against the same answer given on the next tick (queued like any
+// async reply), with and without unrelated work keeping the loop busy. A
+// client process stats serially and reports p50/p99.
+// Run with `node bench/sync-reply.js [requests]`.
+
+const { spawn } = require('child_process')
+
+if (process.argv[2] === '--client') client(process.argv[3], Number(process.argv[4]))
+else main(Number(process.argv[2]) || 50000)
+
+function main (requests) {
+  const Fuse = require('../')
+  const createMountpoint = require('../test/fixtures/mnt')
+  const stat = require('../test/fixtures/stat')
+
+  const mnt = createMountpoint()
+  const FILE = stat({ mode: 'file', size: 11 })
+  const DIR = stat({ mode: 'dir', size: 4096 })
+  const runs = [
+    { name: 'sync', sync: true, busy: false },
+    { name: 'next tick', sync: false, busy: false },
+    { name: 'sync, busy loop', sync: true, busy: true },
+    { name: 'next tick, busy loop', sync: false, busy: true }
+  ]
+
+  next()
+
+  function next () {
+    const run = runs.shift()
+    if (!run) return
+
+    const ops = {
+      getattr (path, cb) {
+        const st = path === '/' ? DIR : FILE
+        if (run.sync) cb(0, st)
+        else process.nextTick(cb, 0, st)
+      }
+    }
+
+    // Low-level mode with zero timeouts and no attr cache, so every stat reaches JS.
+    const fuse = new Fuse(mnt, ops, { force: true, lowlevel: true, attrTimeout: 0, entryTimeout: 0 })
+    let busy = null
+
+    fuse.mount(function (err) {
+      if (err) throw err
+
+      // Unrelated callbacks doing a little work each, like a server would have queued up.
+      if (run.busy) busy = setInterval(spin, 1)
+
+      const child = spawn(process.execPath, [__filename, '--client', mnt, String(requests)], { stdio: ['ignore', 'pipe', 'inherit'] })
+      const out = []
+
+      child.stdout.on('data', data => out.push(data))
+      child.on('exit', function (code) {
+        if (code) throw new Error('client failed')
+        clearInterval(busy)
+
+        const { p50, p99 } = JSON.parse(Buffer.concat(out))
+        console.log('%s: p50 %dus, p99 %dus', run.name, p50, p99)
+
+        fuse.unmount(function (err) {
+          if (err) throw err
+          next()
+        })
+      })
+    })
+  }
+
+  function spin () {
+    const end = process.hrtime.bigint() + BigInt(200000)
+    while (process.hrtime.bigint() < end);
+  }
+}
+
+function client (mnt, requests) {
+  const fs = require('fs')
+  const path = require('path')
+  const samples = new Float64Array(requests)
+  const file = path.join(mnt, 'file')
+
+  for (let i = 0; i < 1000; i++) fs.statSync(file)
+
+  for (let i = 0; i < requests; i++) {
+    const start = process.hrtime.bigint()
+    fs.statSync(file)
+    samples[i] = Number(process.hrtime.bigint() - start) / 1000
+  }
+
+  samples.sort()
+  process.stdout.write(JSON.stringify({
+    p50: Math.round(samples[Math.floor(requests * 0.5)]),
+    p99: Math.round(samples[Math.floor(requests * 0.99)])
+  }))
+}
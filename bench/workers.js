@@ -0,0 +1,133 @@
+// Scaling of CPU bound handlers over worker_threads. Mounts ./cpu-fs with 0
+// (handlers on the main thread) up to --workers worker_threads and drives it
+// with parallel readers, each block read costs a few sha256 rounds in JS.
+//
+//   node bench/workers.js [--workers 1,2,4,8] [--duration 5] [--concurrency 32]
+//                         [--size 65536] [--lowlevel] [--out results.json]
+
+const argv = parseArgs(process.argv.slice(2))
+
+process.env.UV_THREADPOOL_SIZE = Math.min(1024, argv.concurrency + 4)
+
+const os = require('os')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('../test/fixtures/mnt')
+
+const mnt = createMountpoint()
+const counts = [0, ...argv.workers]
+const results = []
+
+next()
+
+function next () {
+  if (!counts.length) return finish()
+
+  const workers = counts.shift()
+  const fuse = new Fuse(mnt, require.resolve('./cpu-fs'), {
+    force: true,
+    lowlevel: argv.lowlevel,
+    directIo: true,
+    workers,
+    maxRead: argv.size,
+    maxWrite: argv.size
+  })
+
+  fuse.mount(function (err) {
+    if (err) throw err
+
+    run(function (err, ops, secs) {
+      if (err) throw err
+
+      const opsPerSec = Math.round(ops / secs)
+      const base = results.length ? results[0].opsPerSec : opsPerSec
+      const result = { workers, opsPerSec, bytesPerSec: opsPerSec * argv.size, speedup: Math.round(opsPerSec / base * 100) / 100 }
+
+      results.push(result)
+      console.log('workers=%d: %d ops/s, %d MB/s, %dx', workers, opsPerSec, Math.round(result.bytesPerSec / 1e6), result.speedup)
+
+      fuse.unmount(function (err) {
+        if (err) throw err
+        next()
+      })
+    })
+  })
+}
+
+function run (cb) {
+  const end = Date.now() + argv.duration * 1000
+  const start = process.hrtime.bigint()
+  const blocks = Math.floor(1024 * 1024 * 1024 / argv.size)
+  let active = argv.concurrency
+  let ops = 0
+
+  for (let i = 0; i < argv.concurrency; i++) reader(i)
+
+  function reader (i) {
+    const buf = Buffer.alloc(argv.size)
+
+    fs.open(path.join(mnt, 'file-' + i % 64), 'r', function (err, fd) {
+      if (err) return cb(err)
+      loop()
+
+      function loop () {
+        fs.read(fd, buf, 0, argv.size, Math.floor(Math.random() * blocks) * argv.size, function (err) {
+          if (err) return cb(err)
+          ops++
+          if (Date.now() < end) return loop()
+          fs.close(fd, done)
+        })
+      }
+    })
+  }
+
+  function done (err) {
+    if (err) return cb(err)
+    if (--active) return
+    cb(null, ops, Number(process.hrtime.bigint() - start) / 1e9)
+  }
+}
+
+function finish () {
+  if (!argv.out) return
+
+  const report = {
+    date: new Date().toISOString(),
+    node: process.version,
+    platform: os.platform(),
+    cpus: os.cpus().length,
+    lowlevel: argv.lowlevel,
+    duration: argv.duration,
+    concurrency: argv.concurrency,
+    size: argv.size,
+    results
+  }
+
+  fs.writeFileSync(argv.out, JSON.stringify(report, null, 2) + '\n')
+  console.log('wrote %s', argv.out)
+}
+
+function parseArgs (args) {
+  const opts = {
+    workers: [1, 2, 4, 8].filter(n => n <= require('os').cpus().length),
+    duration: 5,
+    concurrency: 32,
+    size: 65536,
+    lowlevel: false,
+    out: null
+  }
+
+  for (let i = 0; i < args.length; i++) {
+    const arg = args[i]
+    if (arg === '--workers') opts.workers = args[++i].split(',').map(Number)
+    else if (arg === '--duration') opts.duration = Number(args[++i])
+    else if (arg === '--concurrency') opts.concurrency = Number(args[++i])
+    else if (arg === '--size') opts.size = Number(args[++i])
+    else if (arg === '--lowlevel') opts.lowlevel = true
+    else if (arg === '--out') opts.out = args[++i]
+  }
+
+  return opts
+}
@@ -1,5 +1,9 @@
 #define FUSE_USE_VERSION 29
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <uv.h>
 #include <node_api.h>
 #include <napi-macros.h>
@@ -8,6 +12,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
 
 #include <fuse.h>
 #include <fuse_opt.h>
@@ -17,6 +24,16 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#endif
 
 static int IS_ARRAY_BUFFER_DETACH_SUPPORTED = 0;
 
@@ -35,11 +52,15 @@ napi_status napi_detach_arraybuffer(napi_env env, napi_value buf);
 
 #define FUSE_NATIVE_HANDLER(name, blk)\
   fuse_thread_locals_t *l = get_thread_locals();\
+  if (l->spliced_length > 0) fuse_native_spliced_close(l);\
   l->op = op_##name;\
   l->op_fn = fuse_native_dispatch_##name;\
   blk\
-  uv_async_send(&(l->async));\
-  uv_sem_wait(&(l->sem));\
+  if (l->fuse->interrupts && fuse_native_interrupt_begin(l)) return -EINTR;\
+  if (l->fuse->stats != NULL) fuse_native_stats_enqueue(l);\
+  fuse_native_enqueue(l);\
+  fuse_native_wait(l);\
+  if (l->abandoned) return fuse_native_abandon_thread_locals(l);\
   return l->res;
 
 #define FUSE_METHOD(name, callbackArgs, signalArgs, signature, callBlk, callbackBlk, signalBlk)\
@@ -47,7 +68,7 @@ napi_status napi_detach_arraybuffer(napi_env env, napi_value buf);
     uint32_t op = op_##name;\
     FUSE_NATIVE_CALLBACK(ft->handlers[op], {\
       napi_value argv[callbackArgs + 2];\
-      napi_get_reference_value(env, l->self, &(argv[0]));\
+      fuse_native_locals_value(env, ft, l, &(argv[0]));\
       napi_create_uint32(env, l->op, &(argv[1]));\
       callbackBlk\
       NAPI_MAKE_CALLBACK(env, NULL, ctx, callback, callbackArgs + 2, argv, NULL)\
@@ -57,7 +78,10 @@ napi_status napi_detach_arraybuffer(napi_env env, napi_value buf);
     NAPI_ARGV(signalArgs + 2)\
     NAPI_ARGV_BUFFER_CAST(fuse_thread_locals_t *, l, 0);\
     NAPI_ARGV_INT32(res, 1);\
+    if (l == NULL || l->abandoned) return NULL;\
+    fuse_native_settle(env, l);\
     signalBlk\
+    if (l->fuse->stats != NULL) fuse_native_stats_signal(l, res);\
     l->res = res;\
     uv_sem_post(&(l->sem));\
     return NULL;\
@@ -112,38 +136,562 @@ static const uint32_t op_link = 30;
 static const uint32_t op_symlink = 31;
 static const uint32_t op_mkdir = 32;
 static const uint32_t op_rmdir = 33;
+static const uint32_t op_lookup = 34;
+static const uint32_t op_readbuf = 35;
+static const uint32_t op_writebuf = 36;
+
+// Not a FUSE operation, tells JS that the kernel interrupted a request it is still serving
+static const uint32_t op_abort = 37;
+
+#define FUSE_NATIVE_OPS 38
+
+static const uint32_t op_count = FUSE_NATIVE_OPS;
+
+// Mount config slots
+
+static const uint32_t config_lowlevel = 0;
+static const uint32_t config_entry_timeout = 1;
+static const uint32_t config_attr_timeout = 2;
+static const uint32_t config_attr_cache_size = 3;
+static const uint32_t config_cache_timeout = 4;
+static const uint32_t config_negative_timeout = 5;
+static const uint32_t config_stats = 6;
+static const uint32_t config_workers = 7;
+static const uint32_t config_path_cache_size = 8;
+static const uint32_t config_max_threads = 9;
+static const uint32_t config_max_idle_threads = 10;
+static const uint32_t config_single_threaded = 11;
+static const uint32_t config_interrupts = 12;
+static const uint32_t config_read_cache_size = 13;
+static const uint32_t config_read_cache_block_size = 14;
+static const uint32_t config_write_back_size = 15;
+static const uint32_t config_write_back_age = 16;
+static const uint32_t config_handles = 17;
+static const uint32_t config_shared = 18;
+static const uint32_t config_memory = 19;
+static const uint32_t config_memory_size = 20;
+static const uint32_t config_use_ino = 21;
+static const uint32_t config_length = 22;
+
+// CPUs the FUSE threads can be pinned to
+
+#define FUSE_NATIVE_MAX_CPUS 1024
+
+// Workers
+// A mount can be served by up to this many worker_threads, each with its own loop and handlers.
+
+#define FUSE_NATIVE_MAX_WORKERS 64
+
+static const uint32_t max_workers = FUSE_NATIVE_MAX_WORKERS;
+
+// Shared mounts
+// Thread budget of the group serving every mount with the shared option, unless configured otherwise.
+
+#define FUSE_NATIVE_GROUP_MAX_THREADS 64
+#define FUSE_NATIVE_GROUP_MAX_IDLE 4
+
+// Stat encoding
+// 64 bit fields take two slots (low, high), times are seconds (low, high) + nanoseconds.
+
+#define FUSE_NATIVE_STAT_LENGTH 24
+
+static const uint32_t stat_length = FUSE_NATIVE_STAT_LENGTH;
+
+#ifndef UTIME_NOW
+#define UTIME_NOW ((1l << 30) - 1l)
+#define UTIME_OMIT ((1l << 30) - 2l)
+#endif
+
+static const uint32_t utime_omit = UTIME_OMIT;
+
+// Op stats
+// Latencies go in log-linear buckets, four per power of two nanoseconds (up to ~18 minutes).
+
+#define FUSE_NATIVE_STATS_ERRNOS 128
+#define FUSE_NATIVE_STATS_BUCKETS 160
+
+static const uint32_t stats_errnos = FUSE_NATIVE_STATS_ERRNOS;
+static const uint32_t stats_buckets = FUSE_NATIVE_STATS_BUCKETS;
+
+// Timeout wheel
+// Deadlines are rounded up to ticks, a wheel covers SLOTS * TICK ms and longer ones wait for their round.
+
+#define FUSE_NATIVE_WHEEL_SLOTS 512
+#define FUSE_NATIVE_WHEEL_TICK 50
+
+// Interrupts
+// The high-level library of libfuse 2 interrupts a request by signalling the thread serving it, Node
+// already owns SIGUSR1 so a realtime signal is used instead.
+
+#ifdef SIGRTMIN
+#define FUSE_NATIVE_INTR_SIGNAL (SIGRTMIN + 4)
+#else
+#define FUSE_NATIVE_INTR_SIGNAL SIGUSR2
+#endif
+
+// Stored in place of the FUSE request an interrupt belongs to
+#define FUSE_NATIVE_INTERRUPTED ((void *) 1)
+
+// How long an unmount waits for the FUSE threads to finish, in ms. A lazy unmount of a filesystem
+// that is still in use keeps them running, the mount is left as is then.
+#define FUSE_NATIVE_UNMOUNT_TIMEOUT 2000
 
 // Data structures
 
+// Requests of a mount may be dispatched on several worker loops, so every counter is a relaxed atomic.
+typedef struct {
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t bytes;
+  uint64_t in_flight;
+  uint64_t queue_wait_total;
+  uint64_t service_time_total;
+  uint64_t errnos[FUSE_NATIVE_STATS_ERRNOS];
+  uint64_t queue_wait[FUSE_NATIVE_STATS_BUCKETS];
+  uint64_t service_time[FUSE_NATIVE_STATS_BUCKETS];
+} fuse_native_op_stats_t;
+
+typedef struct fuse_native_inode {
+  fuse_ino_t ino;
+  fuse_ino_t parent;
+  uint64_t nlookup;
+  char *name;
+  int linked;
+
+  struct fuse_native_inode *ino_next;
+  struct fuse_native_inode *name_next;
+} fuse_native_inode_t;
+
+typedef struct {
+  uv_rwlock_t lock;
+  fuse_native_inode_t root;
+  fuse_native_inode_t **by_ino;
+  fuse_native_inode_t **by_name;
+  size_t buckets;
+  size_t count;
+  fuse_ino_t next_ino;
+} fuse_native_inodes_t;
+
+#define FUSE_NATIVE_ATTR_CACHE_SHARDS 16
+
+typedef struct fuse_native_attr_entry {
+  struct fuse_native_attr_entry *next;
+  struct fuse_native_attr_entry *lru_prev;
+  struct fuse_native_attr_entry *lru_next;
+  size_t hash;
+  uint64_t expires;
+  int negative;
+  struct stat stat;
+  char path[];
+} fuse_native_attr_entry_t;
+
+typedef struct {
+  uv_mutex_t lock;
+  fuse_native_attr_entry_t **buckets;
+  size_t buckets_length;
+  size_t count;
+  size_t max;
+  fuse_native_attr_entry_t lru;
+} fuse_native_attr_shard_t;
+
+typedef struct {
+  int enabled;
+  uint64_t ttl;
+  uint64_t negative_ttl;
+  uint64_t generation;
+  fuse_native_attr_shard_t shards[FUSE_NATIVE_ATTR_CACHE_SHARDS];
+} fuse_native_attr_cache_t;
+
+#define FUSE_NATIVE_BLOCK_CACHE_SHARDS 16
+
+typedef struct fuse_native_block {
+  struct fuse_native_block *next;
+  struct fuse_native_block *lru_prev;
+  struct fuse_native_block *lru_next;
+  size_t path_hash;
+  uint64_t index;
+  size_t size;
+  char *path;
+  char data[];
+} fuse_native_block_t;
+
+typedef struct {
+  uv_mutex_t lock;
+  fuse_native_block_t **buckets;
+  size_t buckets_length;
+  size_t count;
+  size_t max;
+  fuse_native_block_t lru;
+} fuse_native_block_shard_t;
+
+typedef struct {
+  int enabled;
+  size_t block_size;
+  uint64_t generation;
+  fuse_native_block_shard_t shards[FUSE_NATIVE_BLOCK_CACHE_SHARDS];
+} fuse_native_block_cache_t;
+
+// File handles that index the handle table have this bit set, JS numbers never reach it.
+#define FUSE_NATIVE_HANDLE ((uint64_t) 1 << 63)
+#define FUSE_NATIVE_MAX_SAFE_INTEGER 9007199254740991ULL
+
+// JS values returned by open, create and opendir, only used on the loop thread
+typedef struct {
+  int enabled;
+  napi_ref *refs;
+  uint32_t length;
+  uint32_t *free;
+  uint32_t free_length;
+} fuse_native_handles_t;
+
+// File handles opened natively by a passthrough mount have this bit set, see fuse_native_passthrough_open.
+#define FUSE_NATIVE_PASSTHROUGH_FH ((uint64_t) 1 << 62)
+
+// Backing directory of a passthrough mount and the path prefixes JS handlers are called for
+typedef struct {
+  int enabled;
+  int dirfd;
+  char root[PATH_MAX];
+  char **intercept;
+  size_t *intercept_lengths;
+  uint32_t intercept_length;
+} fuse_native_passthrough_t;
+
+// Memory filesystem, file data is cut into extents of this size and inodes come out of arenas of this many.
+#define FUSE_NATIVE_MEMFS_EXTENT 65536
+#define FUSE_NATIVE_MEMFS_ARENA 1024
+#define FUSE_NATIVE_MEMFS_BUCKETS 1024
+
+typedef struct fuse_native_memfs_dirent {
+  struct fuse_native_memfs_inode *parent;
+  struct fuse_native_memfs_inode *inode;
+  size_t hash;
+  struct fuse_native_memfs_dirent *hash_next;
+
+  // Entries of the same directory, in the order they were made, which is the order of their cookies
+  struct fuse_native_memfs_dirent *next;
+  struct fuse_native_memfs_dirent **pprev;
+  uint64_t cookie;
+
+  char name[];
+} fuse_native_memfs_dirent_t;
+
+typedef struct fuse_native_memfs_inode {
+  uint64_t ino;
+  mode_t mode;
+  nlink_t nlink;
+  uid_t uid;
+  gid_t gid;
+  dev_t rdev;
+  size_t size;
+  struct timespec atime;
+  struct timespec mtime;
+  struct timespec ctime;
+
+  // Regular files, NULL extents are holes
+  char **extents;
+  size_t extents_length;
+  size_t bytes;
+
+  // Symlinks
+  char *target;
+
+  // Directories
+  fuse_native_memfs_dirent_t *entries;
+  fuse_native_memfs_dirent_t **entries_tail;
+
+  // Open handles, an unlinked inode lives on until the last one is released
+  uint32_t open;
+
+  struct fuse_native_memfs_inode *free_next;
+} fuse_native_memfs_inode_t;
+
+typedef struct fuse_native_memfs_arena {
+  struct fuse_native_memfs_arena *next;
+  fuse_native_memfs_inode_t inodes[FUSE_NATIVE_MEMFS_ARENA];
+} fuse_native_memfs_arena_t;
+
+typedef struct {
+  int enabled;
+  pthread_rwlock_t lock;
+
+  fuse_native_memfs_inode_t *root;
+  fuse_native_memfs_arena_t *arenas;
+  uint32_t arena_used;
+  fuse_native_memfs_inode_t *free;
+  uint64_t next_ino;
+  uint64_t inodes;
+  uint64_t next_cookie;
+
+  // Directory entries by parent and name
+  fuse_native_memfs_dirent_t **buckets;
+  size_t buckets_length;
+  size_t entries;
+
+  // Bytes held in extents, and the cap on them (0 for none)
+  size_t bytes;
+  size_t max_bytes;
+} fuse_native_memfs_t;
+
+#define FUSE_NATIVE_WRITE_BACK_BUCKETS 256
+
+// Pending writes of one file handle, lock is held while they are appended to or sent out
+typedef struct fuse_native_extent {
+  struct fuse_native_extent *next;
+  uv_mutex_t lock;
+  uint64_t fh;
+  uint32_t refs;
+  int released;
+  struct fuse_file_info info;
+  char *path;
+  char *data;
+  size_t len;
+  off_t offset;
+  uint64_t started;
+  int error;
+} fuse_native_extent_t;
+
+typedef struct {
+  int enabled;
+  size_t max;
+  uint64_t max_age;
+  uint32_t pending;
+  uv_mutex_t lock;
+  fuse_native_extent_t *buckets[FUSE_NATIVE_WRITE_BACK_BUCKETS];
+
+  // Handed to the flusher, which keeps its locals for the mount here, see fuse_native_flusher_run
+  int flushing;
+  int stopping;
+  struct fuse_thread_locals *flusher_locals;
+} fuse_native_write_back_t;
+
+typedef struct {
+  char *name;
+  int has_stat;
+  struct stat stat;
+} fuse_native_listing_entry_t;
+
+// A directory opened for JS. The kernel holds a pointer to this, info carries what ops.opendir returned.
+// Entries the kernel has yet to take are kept here: the whole listing in low-level mode, where nothing
+// else would, or the current page of a paged listing along with the cursor of the next one.
+typedef struct {
+  struct fuse_file_info info;
+  fuse_native_listing_entry_t *entries;
+  uint32_t length;
+  uint64_t page;
+  uint64_t fetching;
+  int held;
+  int done;
+  napi_valuetype cursor_type;
+  double cursor_number;
+  char *cursor_string;
+} fuse_native_dir_t;
+
+typedef struct {
+  struct fuse_session *session;
+  size_t bufsize;
+  uv_mutex_t lock;
+  uv_sem_t done;
+  uint32_t max_threads;
+  uint32_t max_idle;
+  uint32_t threads;
+  uint32_t available;
+  int error;
+} fuse_native_pool_t;
+
 typedef struct {
+  uv_timer_t timer;
+  uint64_t epoch;
+  uint64_t tick;
+  uint32_t count;
+  struct fuse_thread_locals *slots[FUSE_NATIVE_WHEEL_SLOTS];
+} fuse_native_wheel_t;
+
+typedef struct fuse_native_path_entry {
+  struct fuse_native_path_entry *next;
+  struct fuse_native_path_entry *lru_prev;
+  struct fuse_native_path_entry *lru_next;
+  size_t hash;
+  uint32_t index;
+  char *path;
+} fuse_native_path_entry_t;
+
+typedef struct {
+  napi_ref strings;
+  fuse_native_path_entry_t *entries;
+  fuse_native_path_entry_t **buckets;
+  size_t buckets_length;
+  size_t count;
+  size_t max;
+  fuse_native_path_entry_t lru;
+} fuse_native_path_cache_t;
+
+typedef struct fuse_thread {
   napi_env env;
   pthread_t thread;
   pthread_attr_t attr;
   napi_ref ctx;
-  napi_ref malloc;
 
   // Operation handlers
-  napi_ref handlers[35];
+  napi_ref handlers[FUSE_NATIVE_OPS];
 
   struct fuse *fuse;
+  struct fuse_session *session;
   struct fuse_chan *ch;
   char mnt[1024];
   char mntopts[1024];
   int mounted;
 
+  // Execution model, libfuse's unbounded pool unless set
+  int single_threaded;
+  fuse_native_pool_t pool;
+  uint32_t cpus[FUSE_NATIVE_MAX_CPUS];
+  uint32_t cpus_length;
+
+  // Let the kernel interrupt requests, see fuse_native_interrupt
+  int interrupts;
+
   uv_async_t async;
   uv_mutex_t mut;
   uv_sem_t sem;
+
+  // Request ring, drained by a single async handle on the loop
+  uv_async_t dispatch;
+  napi_async_context dispatch_ctx;
+  struct fuse_thread_locals *pending;
+
+  // Requests the kernel interrupted, drained by the same dispatch pass
+  struct fuse_thread_locals *aborts;
+
+  // Locals their FUSE thread let go of, freed by the same dispatch pass, see fuse_native_retire
+  struct fuse_thread_locals *retired;
+
+  // Every locals made for this mount and not freed yet, only used on the loop thread
+  struct fuse_thread_locals *locals;
+
+  // Set once the FUSE threads are done with the mount, which they tell an unmount waiting for it, see fuse_native_unmount
+  uv_mutex_t stop_lock;
+  struct fuse_native_unmount *unmount;
+  int stopped;
+
+  // Paths recently handed to JS, only used on the loop thread of this dispatcher
+  fuse_native_path_cache_t paths;
+
+  // Deadlines of the requests this dispatcher has handed to JS, in ms per op (0 for none)
+  uint32_t timeouts[FUSE_NATIVE_OPS];
+  fuse_native_wheel_t wheel;
+
+  // Low-level mode
+  uint32_t implemented[FUSE_NATIVE_OPS];
+  double entry_timeout;
+  double attr_timeout;
+  double negative_timeout;
+  int use_ino;
+  fuse_native_inodes_t inodes;
+
+  // Attributes seen in getattr/readdir, served to getattr/lookup without a JS round trip
+  fuse_native_attr_cache_t attr_cache;
+
+  // Blocks of file data from earlier reads, served without a JS round trip
+  fuse_native_block_cache_t block_cache;
+
+  // Small writes acknowledged right away and handed to JS in bigger extents
+  fuse_native_write_back_t write_back;
+
+  // Values handed back to the ops of an open file instead of its number
+  fuse_native_handles_t handles;
+
+  // Directory the ops JS does not intercept are served from
+  fuse_native_passthrough_t passthrough;
+
+  // Or the in-memory filesystem they are served from
+  fuse_native_memfs_t memfs;
+
+  // Per op counters and latency histograms, NULL unless enabled
+  fuse_native_op_stats_t *stats;
+
+  // Dispatchers of the worker_threads serving this mount, requests are spread over them
+  struct fuse_thread *workers[FUSE_NATIVE_MAX_WORKERS];
+  uint32_t workers_length;
+  uint32_t next_worker;
+
+  // Set on a worker's dispatcher, which only uses env, ctx, handlers and the request ring
+  struct fuse_thread *main;
+  uint32_t worker_index;
+
+  // Set on a shared mount, it is served by the threads and the dispatcher of its group
+  struct fuse_native_group *group;
+  uint32_t group_slot;
+  uint32_t group_generation;
+  uint32_t group_busy;
+  int group_exited;
+
+  // Set on the dispatcher of a group, which runs every request with the handlers of its own mount
+  int shared;
 } fuse_thread_t;
 
+// Mounts sharing one pool of FUSE threads and one dispatcher on the loop. The threads wait on the
+// channels of all mounts at once and serve whichever has a request, so the thread count is bounded
+// by max_threads no matter how many mounts there are. Slots are reused, the generation tells an
+// event of a mount that went away from one of the mount now in its slot.
+typedef struct fuse_native_group {
+  fuse_thread_t dispatcher;
+  int initialized;
+  uint32_t mounted;
+  int epfd;
+  uv_mutex_t lock;
+  uint32_t max_threads;
+  uint32_t max_idle;
+  uint32_t threads;
+  uint32_t available;
+  fuse_thread_t **mounts;
+  uint32_t *generations;
+  uint32_t mounts_length;
+  uint32_t next_generation;
+} fuse_native_group_t;
+
+static fuse_native_group_t shared_group;
+
+// The one thread of the process that sends out extents left waiting too long, for every write-back mount.
 typedef struct {
+  uv_mutex_t lock;
+  uv_cond_t wake;
+  uv_cond_t stopped;
+  int started;
+  uint32_t stopping;
+  fuse_thread_t *current;
+  fuse_thread_t **mounts;
+  uint32_t mounts_length;
+  uint32_t mounts_size;
+} fuse_native_flusher_t;
+
+static fuse_native_flusher_t flusher;
+
+typedef struct fuse_thread_locals {
   napi_ref self;
 
+  // The same buffer as seen from each worker, made on first use
+  napi_ref worker_self[FUSE_NATIVE_MAX_WORKERS];
+
   // Opcode
   uint32_t op;
   void *op_fn;
 
+  // Block cache generation when a read went to JS, its reply is only cached if nothing was invalidated since
+  uint64_t block_generation;
+
+  // Same for the attr cache, when a getattr or readdir went to JS
+  uint64_t attr_generation;
+
+  // Set while a write-back extent goes out, so it is not buffered again
+  int write_through;
+
+  // Timestamps for the op stats
+  uint64_t enqueued;
+  uint64_t dispatched;
+
   // Payloads
+  uint64_t ino;
   const char *path;
   const char *dest;
   char *linkname;
@@ -155,8 +703,8 @@ typedef struct {
   dev_t dev;
   uid_t uid;
   gid_t gid;
-  size_t atime;
-  size_t mtime;
+  struct timespec atime;
+  struct timespec mtime;
   int32_t res;
 
   // Extended attributes
@@ -173,16 +721,113 @@ typedef struct {
 
   // Readdir
   fuse_fill_dir_t readdir_filler;
+  fuse_native_dir_t *dir;
+
+  // Encoded stat replies are written here by JS, one slot per thread
+  uint32_t stat_slot[FUSE_NATIVE_STAT_LENGTH];
+
+  // Low-level mode, the inode number the request is about as low and high 32 bits, read by JS
+  uint32_t ino_slot[2];
+
+  // Read buf, and our own duplicates of the descriptors JS replied with, open until the splice is done
+  struct fuse_bufvec **bufp;
+  int *spliced;
+  size_t spliced_length;
+  size_t spliced_capacity;
+
+  // Write buf
+  off_t *target_position;
+
+  // Timeout wheel
+  struct fuse_thread *wheel;
+  struct fuse_thread_locals *wheel_next;
+  struct fuse_thread_locals **wheel_pprev;
+  uint64_t deadline;
+
+  // Set on the loop while JS holds the request. A request that times out or is interrupted gets its
+  // borrowed buffer detached and is abandoned, its FUSE thread moves on without these locals.
+  int held;
+  napi_ref borrowed;
+  int abandoned;
+
+  // Interrupts, intr is the FUSE request being served or FUSE_NATIVE_INTERRUPTED
+  void *intr;
+  void *req;
+  int waiting;
+  int abort_queued;
+  struct fuse_thread_locals *abort_next;
+  struct fuse_thread *dispatcher;
 
   // Internal bookkeeping
   fuse_thread_t *fuse;
   uv_sem_t sem;
-  uv_async_t async;
+  struct fuse_thread_locals *next;
+  struct fuse_thread_locals *retired_next;
+  struct fuse_thread_locals *locals_next;
+  struct fuse_thread_locals **locals_pprev;
 
 } fuse_thread_locals_t;
 
 static pthread_key_t thread_locals_key;
+
+// The same locals, for the interrupt signal handler, which cannot call pthread_getspecific.
+static __thread fuse_thread_locals_t *thread_locals_current;
+
+static void fuse_native_set_thread_locals (fuse_thread_locals_t *l) {
+  pthread_setspecific(thread_locals_key, (void *) l);
+  __atomic_store_n(&thread_locals_current, l, __ATOMIC_RELEASE);
+}
 static fuse_thread_locals_t* get_thread_locals();
+static fuse_thread_locals_t* fuse_native_thread_locals (fuse_thread_t *ft);
+static void fuse_native_enqueue (fuse_thread_locals_t *l);
+static void fuse_native_locals_value (napi_env env, fuse_thread_t *ft, fuse_thread_locals_t *l, napi_value *result);
+static int fuse_native_abandon_thread_locals (fuse_thread_locals_t *l);
+static int fuse_native_interrupt_begin (fuse_thread_locals_t *l);
+static void fuse_native_wait (fuse_thread_locals_t *l);
+static void fuse_native_spliced_close (fuse_thread_locals_t *l);
+static void fuse_native_settle (napi_env env, fuse_thread_locals_t *l);
+static void fuse_native_borrow (napi_env env, fuse_thread_locals_t *l, napi_value buf);
+
+// Op stats
+
+static uint32_t fuse_native_stats_bucket (uint64_t ns) {
+  if (ns < 4) return (uint32_t) ns;
+  uint32_t msb = 63 - __builtin_clzll(ns);
+  uint32_t bucket = (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+  return bucket < FUSE_NATIVE_STATS_BUCKETS ? bucket : FUSE_NATIVE_STATS_BUCKETS - 1;
+}
+
+static void fuse_native_stats_enqueue (fuse_thread_locals_t *l) {
+  l->enqueued = uv_hrtime();
+  __atomic_fetch_add(&(l->fuse->stats[l->op].in_flight), 1, __ATOMIC_RELAXED);
+}
+
+static void fuse_native_stats_dispatch (fuse_thread_locals_t *l) {
+  fuse_native_op_stats_t *stats = &(l->fuse->stats[l->op]);
+  l->dispatched = uv_hrtime();
+
+  uint64_t wait = l->dispatched - l->enqueued;
+  __atomic_fetch_add(&(stats->queue_wait_total), wait, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(stats->queue_wait[fuse_native_stats_bucket(wait)]), 1, __ATOMIC_RELAXED);
+}
+
+static void fuse_native_stats_signal (fuse_thread_locals_t *l, int res) {
+  fuse_native_op_stats_t *stats = &(l->fuse->stats[l->op]);
+  uint64_t service = uv_hrtime() - l->dispatched;
+
+  __atomic_fetch_add(&(stats->calls), 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(stats->service_time_total), service, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(stats->service_time[fuse_native_stats_bucket(service)]), 1, __ATOMIC_RELAXED);
+
+  if (res < 0) {
+    __atomic_fetch_add(&(stats->errors), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(stats->errnos[-res < FUSE_NATIVE_STATS_ERRNOS ? -res : FUSE_NATIVE_STATS_ERRNOS - 1]), 1, __ATOMIC_RELAXED);
+  } else if (l->op == op_read || l->op == op_write) {
+    __atomic_fetch_add(&(stats->bytes), res, __ATOMIC_RELAXED);
+  }
+
+  __atomic_fetch_sub(&(stats->in_flight), 1, __ATOMIC_RELAXED);
+}
 
 // Helpers
 // TODO: Extract into a separate file.
@@ -194,14 +839,14 @@ static uint64_t uint32s_to_uint64 (uint32_t **ints) {
 }
 
 static void uint32s_to_timespec (struct timespec* ts, uint32_t** ints) {
-  uint64_t ms = uint32s_to_uint64(ints);
-  ts->tv_sec = ms / 1000;
-  ts->tv_nsec = (ms % 1000) * 1000000;
+  ts->tv_sec = uint32s_to_uint64(ints);
+  ts->tv_nsec = *((*ints)++);
 }
 
-static uint64_t timespec_to_uint64 (const struct timespec* ts) {
-  uint64_t ms = (ts->tv_sec * 1000) + (ts->tv_nsec / 1000000);
-  return ms;
+// Times for utimens keep their nanoseconds, UTIME_NOW is resolved here and UTIME_OMIT left to JS.
+static void utimens_timespec (struct timespec *ts, const struct timespec *tv) {
+  if (tv == NULL || tv->tv_nsec == UTIME_NOW) clock_gettime(CLOCK_REALTIME, ts);
+  else *ts = *tv;
 }
 
 static void populate_stat (uint32_t *ints, struct stat* stat) {
@@ -209,10 +854,10 @@ static void populate_stat (uint32_t *ints, struct stat* stat) {
   stat->st_uid = *ints++;
   stat->st_gid = *ints++;
   stat->st_size = uint32s_to_uint64(&ints);
-  stat->st_dev = *ints++;
+  stat->st_dev = uint32s_to_uint64(&ints);
   stat->st_nlink = *ints++;
-  stat->st_ino = *ints++;
-  stat->st_rdev = *ints++;
+  stat->st_ino = uint32s_to_uint64(&ints);
+  stat->st_rdev = uint32s_to_uint64(&ints);
   stat->st_blksize = *ints++;
   stat->st_blocks = uint32s_to_uint64(&ints);
 #ifdef __APPLE__
@@ -240,667 +885,6017 @@ static void populate_statvfs (uint32_t *ints, struct statvfs* statvfs) {
   statvfs->f_namemax = *ints++;
 }
 
-// Methods
+// Inode table
+// Backs the low-level mode, mapping the inode numbers handed to the kernel to a
+// parent + name so paths only have to be built for the path based handlers.
 
-FUSE_METHOD(statfs, 1, 1, (const char * path, struct statvfs *statvfs), {
-  l->path = path;
-  l->statvfs = statvfs;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-}, {
-  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
-  populate_statvfs(ints, l->statvfs);
-})
+static size_t fuse_native_hash (uint64_t seed, const char *name) {
+  uint64_t hash = 14695981039346656037ULL ^ seed;
+  while (*name) {
+    hash ^= (unsigned char) *name++;
+    hash *= 1099511628211ULL;
+  }
+  return (size_t) hash;
+}
 
-FUSE_METHOD(getattr, 1, 1, (const char *path, struct stat *stat), {
-  l->path = path;
-  l->stat = stat;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-}, {
-  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
-  populate_stat(ints, l->stat);
-})
+// Shards are picked by the high half of a hash and buckets by its low bits, size_t is 32 bits wide on ia32.
+static size_t fuse_native_hash_high (size_t hash) {
+  return hash >> (sizeof(size_t) * 4);
+}
 
-FUSE_METHOD(fgetattr, 2, 1, (const char *path, struct stat *stat, struct fuse_file_info *info), {
-  l->path = path;
-  l->stat = stat;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[3]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
-  }
-}, {
-  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
-  populate_stat(ints, l->stat);
-})
+static void fuse_native_inodes_init (fuse_native_inodes_t *inodes) {
+  uv_rwlock_init(&(inodes->lock));
+  inodes->buckets = 1024;
+  inodes->by_ino = calloc(inodes->buckets, sizeof(fuse_native_inode_t *));
+  inodes->by_name = calloc(inodes->buckets, sizeof(fuse_native_inode_t *));
+  inodes->count = 0;
+  inodes->next_ino = FUSE_ROOT_ID + 1;
+  inodes->root.ino = FUSE_ROOT_ID;
+  inodes->root.parent = FUSE_ROOT_ID;
+  inodes->root.nlookup = 1;
+  inodes->root.name = "";
+  inodes->root.linked = 1;
+}
 
-FUSE_METHOD_VOID(access, 2, 0, (const char *path, int mode), {
-  l->path = path;
-  l->mode = mode;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-})
+static fuse_native_inode_t* fuse_native_inode_get (fuse_native_inodes_t *inodes, fuse_ino_t ino) {
+  if (ino == FUSE_ROOT_ID) return &(inodes->root);
+  fuse_native_inode_t *node = inodes->by_ino[ino & (inodes->buckets - 1)];
+  while (node != NULL && node->ino != ino) node = node->ino_next;
+  return node;
+}
 
-FUSE_METHOD(open, 2, 1, (const char *path, struct fuse_file_info *info), {
-  l->path = path;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->flags, &(argv[3]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
-  }
-}, {
-  NAPI_ARGV_INT32(fd, 2)
-  if (fd != 0) {
-    l->info->fh = fd;
-  }
-})
+static fuse_native_inode_t* fuse_native_inode_find (fuse_native_inodes_t *inodes, fuse_ino_t parent, const char *name) {
+  fuse_native_inode_t *node = inodes->by_name[fuse_native_hash(parent, name) & (inodes->buckets - 1)];
+  while (node != NULL && (node->parent != parent || strcmp(node->name, name) != 0)) node = node->name_next;
+  return node;
+}
 
-FUSE_METHOD(opendir, 3, 1, (const char *path, struct fuse_file_info *info), {
-  l->path = path;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[3]));
-    napi_create_uint32(env, l->info->flags, &(argv[4]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
-    napi_create_uint32(env, 0, &(argv[4]));
-  }
-}, {
-  NAPI_ARGV_INT32(fd, 2)
-  if (fd != 0) {
-    l->info->fh = fd;
-  }
-})
+static void fuse_native_inode_link (fuse_native_inodes_t *inodes, fuse_native_inode_t *node) {
+  size_t i = fuse_native_hash(node->parent, node->name) & (inodes->buckets - 1);
+  node->name_next = inodes->by_name[i];
+  inodes->by_name[i] = node;
+  node->linked = 1;
+}
 
-FUSE_METHOD(create, 2, 1, (const char *path, mode_t mode, struct fuse_file_info *info), {
-  l->path = path;
-  l->mode = mode;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-}, {
-  NAPI_ARGV_INT32(fd, 2)
-  if (fd != 0) {
-    l->info->fh = fd;
-  }
-})
+static void fuse_native_inode_unlink_node (fuse_native_inodes_t *inodes, fuse_native_inode_t *node) {
+  if (!node->linked) return;
+  fuse_native_inode_t **prev = &(inodes->by_name[fuse_native_hash(node->parent, node->name) & (inodes->buckets - 1)]);
+  while (*prev != node) prev = &((*prev)->name_next);
+  *prev = node->name_next;
+  node->linked = 0;
+}
 
-FUSE_METHOD_VOID(utimens, 5, 0, (const char *path, const struct timespec tv[2]), {
-  l->path = path;
-  l->atime = timespec_to_uint64(&tv[0]);
-  l->mtime = timespec_to_uint64(&tv[1]);
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  FUSE_UINT64_TO_INTS_ARGV(l->atime, 3)
-  FUSE_UINT64_TO_INTS_ARGV(l->atime, 5)
-})
+static void fuse_native_inodes_grow (fuse_native_inodes_t *inodes) {
+  size_t buckets = inodes->buckets * 2;
+  fuse_native_inode_t **by_ino = calloc(buckets, sizeof(fuse_native_inode_t *));
+  fuse_native_inode_t **by_name = calloc(buckets, sizeof(fuse_native_inode_t *));
 
-FUSE_METHOD_VOID(release, 2, 0, (const char *path, struct fuse_file_info *info), {
-  l->path = path;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[3]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
+  if (by_ino == NULL || by_name == NULL) {
+    free(by_ino);
+    free(by_name);
+    return;
   }
-})
 
-FUSE_METHOD_VOID(releasedir, 2, 0, (const char *path, struct fuse_file_info *info), {
-  l->path = path;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[3]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
+  for (size_t i = 0; i < inodes->buckets; i++) {
+    fuse_native_inode_t *node = inodes->by_ino[i];
+    while (node != NULL) {
+      fuse_native_inode_t *next = node->ino_next;
+      size_t j = node->ino & (buckets - 1);
+      node->ino_next = by_ino[j];
+      by_ino[j] = node;
+      if (node->linked) {
+        j = fuse_native_hash(node->parent, node->name) & (buckets - 1);
+        node->name_next = by_name[j];
+        by_name[j] = node;
+      }
+      node = next;
+    }
   }
-})
-
-FUSE_METHOD(read, 6, 2, (const char *path, char *buf, size_t len, off_t offset, struct fuse_file_info *info), {
-  l->path = path;
-  l->buf = buf;
-  l->len = len;
-  l->offset = offset;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->info->fh, &(argv[3]));
-  napi_create_external_buffer(env, l->len, (char *) l->buf, NULL, NULL, &(argv[4]));
-  napi_create_uint32(env, l->len, &(argv[5]));
-  FUSE_UINT64_TO_INTS_ARGV(l->offset, 6)
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[3]) == napi_ok);
-})
 
-FUSE_METHOD(write, 6, 2, (const char *path, const char *buf, size_t len, off_t offset, struct fuse_file_info *info), {
-  l->path = path;
-  l->buf = buf;
-  l->len = len;
-  l->offset = offset;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->info->fh, &(argv[3]));
-  napi_create_external_buffer(env, l->len, (char *) l->buf, NULL, NULL, &(argv[4]));
-  napi_create_uint32(env, l->len, &(argv[5]));
-  FUSE_UINT64_TO_INTS_ARGV(l->offset, 6)
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[3]) == napi_ok);
-})
+  free(inodes->by_ino);
+  free(inodes->by_name);
+  inodes->by_ino = by_ino;
+  inodes->by_name = by_name;
+  inodes->buckets = buckets;
+}
 
-FUSE_METHOD(readdir, 1, 2, (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *info), {
-  l->buf = buf;
-  l->path = path;
-  l->offset = offset;
-  l->info = info;
-  l->readdir_filler = filler;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-}, {
-  uint32_t stats_length;
-  uint32_t names_length;
-  napi_get_array_length(env, argv[3], &stats_length);
-  napi_get_array_length(env, argv[2], &names_length);
+// Looks up (or creates) the inode of parent/name and bumps its lookup count, returns 0 on ENOMEM.
+static fuse_ino_t fuse_native_inode_ref (fuse_native_inodes_t *inodes, fuse_ino_t parent, const char *name) {
+  uv_rwlock_wrlock(&(inodes->lock));
 
-  napi_value raw_names = argv[2];
-  napi_value raw_stats = argv[3];
+  fuse_native_inode_t *node = fuse_native_inode_find(inodes, parent, name);
 
-  if (names_length != stats_length) {
-    NAPI_FOR_EACH(raw_names, raw_name) {
-      NAPI_UTF8(name, 1024, raw_name)
-      int err = l->readdir_filler((char *) l->buf, name, NULL, 0);
-      if (err == 1) {
-        break;
-      }
-    }
-  } else {
-    NAPI_FOR_EACH(raw_names, raw_name) {
-      NAPI_UTF8(name, 1024, raw_name)
-      napi_value raw_stat;
-      napi_get_element(env, raw_stats, i, &raw_stat);
-
-      NAPI_BUFFER_CAST(uint32_t*, stats_array, raw_stat);
-      struct stat st;
-      populate_stat(stats_array, &st);
-
-      // TODO: It turns out readdirplus likely won't work with FUSE 29...
-      // Metadata caching between readdir/getattr will be enabled when we upgrade fuse-shared-library
-      int err = l->readdir_filler((char *) l->buf, name, (struct stat *) &st, 0);
-      if (err == 1) {
-        break;
-      }
+  if (node == NULL) {
+    node = calloc(1, sizeof(fuse_native_inode_t));
+    if (node != NULL) node->name = strdup(name);
+    if (node == NULL || node->name == NULL) {
+      free(node);
+      uv_rwlock_wrunlock(&(inodes->lock));
+      return 0;
     }
-  }
-})
+
+    if (inodes->count >= inodes->buckets) fuse_native_inodes_grow(inodes);
+
+    node->ino = inodes->next_ino++;
+    node->parent = parent;
+
+    size_t i = node->ino & (inodes->buckets - 1);
+    node->ino_next = inodes->by_ino[i];
+    inodes->by_ino[i] = node;
+    fuse_native_inode_link(inodes, node);
+    inodes->count++;
+  }
+
+  node->nlookup++;
+  fuse_ino_t ino = node->ino;
+
+  uv_rwlock_wrunlock(&(inodes->lock));
+  return ino;
+}
+
+static void fuse_native_inode_forget (fuse_native_inodes_t *inodes, fuse_ino_t ino, uint64_t nlookup) {
+  if (ino == FUSE_ROOT_ID) return;
+
+  uv_rwlock_wrlock(&(inodes->lock));
+
+  fuse_native_inode_t *node = fuse_native_inode_get(inodes, ino);
+
+  if (node != NULL) {
+    node->nlookup = nlookup < node->nlookup ? node->nlookup - nlookup : 0;
+
+    if (node->nlookup == 0) {
+      fuse_native_inode_unlink_node(inodes, node);
+      fuse_native_inode_t **prev = &(inodes->by_ino[ino & (inodes->buckets - 1)]);
+      while (*prev != node) prev = &((*prev)->ino_next);
+      *prev = node->ino_next;
+      inodes->count--;
+      free(node->name);
+      free(node);
+    }
+  }
+
+  uv_rwlock_wrunlock(&(inodes->lock));
+}
+
+// Drops parent/name from the name index, the inode itself lives on until it is forgotten.
+static void fuse_native_inode_unlink (fuse_native_inodes_t *inodes, fuse_ino_t parent, const char *name) {
+  uv_rwlock_wrlock(&(inodes->lock));
+  fuse_native_inode_t *node = fuse_native_inode_find(inodes, parent, name);
+  if (node != NULL) fuse_native_inode_unlink_node(inodes, node);
+  uv_rwlock_wrunlock(&(inodes->lock));
+}
+
+static void fuse_native_inode_rename (fuse_native_inodes_t *inodes, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname) {
+  uv_rwlock_wrlock(&(inodes->lock));
+
+  fuse_native_inode_t *replaced = fuse_native_inode_find(inodes, newparent, newname);
+  if (replaced != NULL) fuse_native_inode_unlink_node(inodes, replaced);
+
+  fuse_native_inode_t *node = fuse_native_inode_find(inodes, parent, name);
+  char *dup = node == NULL ? NULL : strdup(newname);
+
+  if (dup != NULL) {
+    fuse_native_inode_unlink_node(inodes, node);
+    free(node->name);
+    node->name = dup;
+    node->parent = newparent;
+    fuse_native_inode_link(inodes, node);
+  }
+
+  uv_rwlock_wrunlock(&(inodes->lock));
+}
+
+static int fuse_native_path_prepend (char *path, size_t *pos, const char *str) {
+  size_t len = strlen(str);
+  if (len + 1 > *pos) return -ENAMETOOLONG;
+  *pos -= len;
+  memcpy(path + *pos, str, len);
+  path[--(*pos)] = '/';
+  return 0;
+}
+
+// Writes the path of ino (with /name appended if set) into path, and the inode number of that path into
+// target if asked for, 0 if the kernel has not looked the name up (yet).
+static int fuse_native_inode_path (fuse_native_inodes_t *inodes, fuse_ino_t ino, const char *name, char *path, size_t len, fuse_ino_t *target) {
+  size_t pos = len - 1;
+  int err = 0;
+  path[pos] = '\0';
+
+  if (name != NULL) err = fuse_native_path_prepend(path, &pos, name);
+
+  uv_rwlock_rdlock(&(inodes->lock));
+
+  if (target != NULL && name == NULL) {
+    *target = ino;
+  } else if (target != NULL) {
+    fuse_native_inode_t *child = fuse_native_inode_find(inodes, ino, name);
+    *target = child == NULL ? 0 : child->ino;
+  }
+
+  fuse_native_inode_t *node = fuse_native_inode_get(inodes, ino);
+
+  while (err == 0 && node != NULL && node->ino != FUSE_ROOT_ID) {
+    err = fuse_native_path_prepend(path, &pos, node->name);
+    node = fuse_native_inode_get(inodes, node->parent);
+  }
+
+  uv_rwlock_rdunlock(&(inodes->lock));
+
+  if (err < 0) return err;
+  if (node == NULL) return -ESTALE;
+
+  if (pos == len - 1) path[--pos] = '/';
+  memmove(path, path + pos, len - pos);
+
+  return 0;
+}
+
+// Frees every inode, once the session is gone.
+static void fuse_native_inodes_destroy (fuse_native_inodes_t *inodes) {
+  if (inodes->by_ino == NULL) return;
+
+  for (size_t i = 0; i < inodes->buckets; i++) {
+    fuse_native_inode_t *node = inodes->by_ino[i];
+    while (node != NULL) {
+      fuse_native_inode_t *next = node->ino_next;
+      free(node->name);
+      free(node);
+      node = next;
+    }
+  }
+
+  free(inodes->by_ino);
+  free(inodes->by_name);
+  inodes->by_ino = inodes->by_name = NULL;
+  uv_rwlock_destroy(&(inodes->lock));
+}
+
+// Finds the inode of an absolute path, 0 if the kernel never looked it up.
+static fuse_ino_t fuse_native_inode_resolve (fuse_native_inodes_t *inodes, const char *path) {
+  char name[NAME_MAX + 1];
+  fuse_ino_t ino = FUSE_ROOT_ID;
+
+  uv_rwlock_rdlock(&(inodes->lock));
+
+  while (ino != 0) {
+    while (*path == '/') path++;
+
+    size_t len = strcspn(path, "/");
+    if (len == 0) break;
+
+    if (len > NAME_MAX) {
+      ino = 0;
+      break;
+    }
+
+    memcpy(name, path, len);
+    name[len] = '\0';
+    path += len;
+
+    fuse_native_inode_t *node = fuse_native_inode_find(inodes, ino, name);
+    ino = node == NULL ? 0 : node->ino;
+  }
+
+  uv_rwlock_rdunlock(&(inodes->lock));
+  return ino;
+}
+
+// Path cache
+// Paths passed to the handlers are interned per dispatcher, so a hot path is the same JS string on every request
+// instead of a fresh allocation each time. The strings live in a JS array (references to strings need a newer
+// N-API), the native side maps the raw bytes to an index in it and recycles the least recently used one when full.
+
+static void fuse_native_path_cache_init (napi_env env, fuse_native_path_cache_t *cache, size_t max) {
+  size_t buckets = 1;
+  while (buckets < max) buckets *= 2;
+
+  cache->max = 0;
+  cache->count = 0;
+  cache->lru.lru_prev = cache->lru.lru_next = &(cache->lru);
+
+  if (max == 0) return;
+
+  cache->entries = calloc(max, sizeof(fuse_native_path_entry_t));
+  cache->buckets = calloc(buckets, sizeof(fuse_native_path_entry_t *));
+
+  if (cache->entries == NULL || cache->buckets == NULL) {
+    free(cache->entries);
+    free(cache->buckets);
+    return;
+  }
+
+  napi_value strings;
+  napi_create_array_with_length(env, max, &strings);
+  napi_create_reference(env, strings, 1, &(cache->strings));
+
+  cache->buckets_length = buckets;
+  cache->max = max;
+}
+
+static fuse_native_path_entry_t** fuse_native_path_cache_slot (fuse_native_path_cache_t *cache, size_t hash, const char *path) {
+  fuse_native_path_entry_t **slot = &(cache->buckets[hash & (cache->buckets_length - 1)]);
+  while (*slot != NULL && ((*slot)->hash != hash || strcmp((*slot)->path, path) != 0)) slot = &((*slot)->next);
+  return slot;
+}
+
+static void fuse_native_path_value (napi_env env, fuse_native_path_cache_t *cache, const char *path, napi_value *result) {
+  if (cache->max == 0 || path == NULL) {
+    napi_create_string_utf8(env, path, NAPI_AUTO_LENGTH, result);
+    return;
+  }
+
+  napi_value strings;
+  napi_get_reference_value(env, cache->strings, &strings);
+
+  size_t hash = fuse_native_hash(0, path);
+  fuse_native_path_entry_t **slot = fuse_native_path_cache_slot(cache, hash, path);
+  fuse_native_path_entry_t *entry = *slot;
+
+  if (entry != NULL) {
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+    napi_get_element(env, strings, entry->index, result);
+  } else {
+    char *copy = strdup(path);
+
+    if (copy == NULL) {
+      napi_create_string_utf8(env, path, NAPI_AUTO_LENGTH, result);
+      return;
+    }
+
+    if (cache->count < cache->max) {
+      entry = &(cache->entries[cache->count]);
+      entry->index = cache->count++;
+    } else {
+      entry = cache->lru.lru_prev;
+      fuse_native_path_entry_t **oldest = fuse_native_path_cache_slot(cache, entry->hash, entry->path);
+      *oldest = entry->next;
+      entry->lru_prev->lru_next = entry->lru_next;
+      entry->lru_next->lru_prev = entry->lru_prev;
+      free(entry->path);
+      slot = fuse_native_path_cache_slot(cache, hash, path);
+    }
+
+    entry->path = copy;
+    entry->hash = hash;
+    entry->next = NULL;
+    *slot = entry;
+
+    napi_create_string_utf8(env, path, NAPI_AUTO_LENGTH, result);
+    napi_set_element(env, strings, entry->index, *result);
+  }
+
+  entry->lru_prev = &(cache->lru);
+  entry->lru_next = cache->lru.lru_next;
+  cache->lru.lru_next->lru_prev = entry;
+  cache->lru.lru_next = entry;
+}
+
+static void fuse_native_path_cache_destroy (napi_env env, fuse_native_path_cache_t *cache) {
+  if (cache->max == 0) return;
+
+  for (size_t i = 0; i < cache->count; i++) free(cache->entries[i].path);
+  free(cache->entries);
+  free(cache->buckets);
+  napi_delete_reference(env, cache->strings);
+  cache->max = cache->count = 0;
+}
+
+// Attribute cache
+// Stats from getattr and readdir are kept here for cache_timeout seconds (attr_timeout by default),
+// so repeated stats and the getattrs the kernel sends for every entry after a listing never reach JS.
+// Missing paths are remembered for negative_timeout seconds if set. fuse.invalidate drops entries early.
+// Every drop bumps the generation, so a stat that was in flight meanwhile does not put stale attrs back.
+
+static void fuse_native_attr_cache_init (fuse_native_attr_cache_t *cache, size_t max, double ttl, double negative_ttl) {
+  size_t shard_max = max / FUSE_NATIVE_ATTR_CACHE_SHARDS;
+  if (shard_max == 0 && max > 0) shard_max = 1;
+
+  size_t buckets = 1;
+  while (buckets < shard_max) buckets *= 2;
+
+  cache->enabled = shard_max > 0 && (ttl > 0 || negative_ttl > 0);
+  cache->ttl = (uint64_t) (ttl * 1e9);
+  cache->negative_ttl = (uint64_t) (negative_ttl * 1e9);
+  cache->generation = 0;
+
+  if (!cache->enabled) return;
+
+  for (int i = 0; i < FUSE_NATIVE_ATTR_CACHE_SHARDS; i++) {
+    fuse_native_attr_shard_t *shard = &(cache->shards[i]);
+    uv_mutex_init(&(shard->lock));
+    shard->buckets = calloc(buckets, sizeof(fuse_native_attr_entry_t *));
+    shard->buckets_length = buckets;
+    shard->count = 0;
+    shard->max = shard_max;
+    shard->lru.lru_prev = shard->lru.lru_next = &(shard->lru);
+    if (shard->buckets == NULL) cache->enabled = 0;
+  }
+}
+
+static fuse_native_attr_shard_t* fuse_native_attr_cache_shard (fuse_native_attr_cache_t *cache, size_t hash) {
+  return &(cache->shards[fuse_native_hash_high(hash) % FUSE_NATIVE_ATTR_CACHE_SHARDS]);
+}
+
+static fuse_native_attr_entry_t** fuse_native_attr_cache_slot (fuse_native_attr_shard_t *shard, size_t hash, const char *path) {
+  fuse_native_attr_entry_t **slot = &(shard->buckets[hash & (shard->buckets_length - 1)]);
+  while (*slot != NULL && ((*slot)->hash != hash || strcmp((*slot)->path, path) != 0)) slot = &((*slot)->next);
+  return slot;
+}
+
+static void fuse_native_attr_cache_remove (fuse_native_attr_shard_t *shard, fuse_native_attr_entry_t **slot) {
+  fuse_native_attr_entry_t *entry = *slot;
+  *slot = entry->next;
+  entry->lru_prev->lru_next = entry->lru_next;
+  entry->lru_next->lru_prev = entry->lru_prev;
+  shard->count--;
+  free(entry);
+}
+
+// Returns 1 on a hit, -ENOENT on a negative hit and 0 on a miss.
+static int fuse_native_attr_cache_get (fuse_native_attr_cache_t *cache, const char *path, struct stat *stat) {
+  if (!cache->enabled) return 0;
+
+  size_t hash = fuse_native_hash(0, path);
+  fuse_native_attr_shard_t *shard = fuse_native_attr_cache_shard(cache, hash);
+  int hit = 0;
+
+  uv_mutex_lock(&(shard->lock));
+
+  fuse_native_attr_entry_t **slot = fuse_native_attr_cache_slot(shard, hash, path);
+  fuse_native_attr_entry_t *entry = *slot;
+
+  if (entry != NULL) {
+    if (entry->expires > uv_hrtime()) {
+      if (entry->negative) {
+        hit = -ENOENT;
+      } else {
+        memcpy(stat, &(entry->stat), sizeof(struct stat));
+        hit = 1;
+      }
+    } else {
+      fuse_native_attr_cache_remove(shard, slot);
+    }
+  }
+
+  uv_mutex_unlock(&(shard->lock));
+  return hit;
+}
+
+// A NULL stat stores a negative entry.
+static void fuse_native_attr_cache_put (fuse_native_attr_cache_t *cache, const char *path, const struct stat *stat) {
+  uint64_t ttl = stat == NULL ? cache->negative_ttl : cache->ttl;
+  if (!cache->enabled || ttl == 0) return;
+
+  size_t hash = fuse_native_hash(0, path);
+  fuse_native_attr_shard_t *shard = fuse_native_attr_cache_shard(cache, hash);
+
+  uv_mutex_lock(&(shard->lock));
+
+  fuse_native_attr_entry_t **slot = fuse_native_attr_cache_slot(shard, hash, path);
+  fuse_native_attr_entry_t *entry = *slot;
+
+  if (entry == NULL) {
+    if (shard->count >= shard->max) {
+      fuse_native_attr_entry_t *oldest = shard->lru.lru_prev;
+      fuse_native_attr_cache_remove(shard, fuse_native_attr_cache_slot(shard, oldest->hash, oldest->path));
+      slot = fuse_native_attr_cache_slot(shard, hash, path);
+    }
+
+    size_t len = strlen(path) + 1;
+    entry = malloc(sizeof(fuse_native_attr_entry_t) + len);
+
+    if (entry == NULL) {
+      uv_mutex_unlock(&(shard->lock));
+      return;
+    }
+
+    memcpy(entry->path, path, len);
+    entry->hash = hash;
+    entry->next = NULL;
+    *slot = entry;
+    shard->count++;
+  } else {
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+  }
+
+  entry->negative = stat == NULL;
+  if (stat != NULL) memcpy(&(entry->stat), stat, sizeof(struct stat));
+  entry->expires = uv_hrtime() + ttl;
+
+  entry->lru_prev = &(shard->lru);
+  entry->lru_next = shard->lru.lru_next;
+  shard->lru.lru_next->lru_prev = entry;
+  shard->lru.lru_next = entry;
+
+  uv_mutex_unlock(&(shard->lock));
+}
+
+static void fuse_native_attr_cache_del (fuse_native_attr_cache_t *cache, const char *path) {
+  if (!cache->enabled) return;
+
+  __atomic_add_fetch(&(cache->generation), 1, __ATOMIC_ACQ_REL);
+
+  size_t hash = fuse_native_hash(0, path);
+  fuse_native_attr_shard_t *shard = fuse_native_attr_cache_shard(cache, hash);
+
+  uv_mutex_lock(&(shard->lock));
+  fuse_native_attr_entry_t **slot = fuse_native_attr_cache_slot(shard, hash, path);
+  if (*slot != NULL) fuse_native_attr_cache_remove(shard, slot);
+  uv_mutex_unlock(&(shard->lock));
+}
+
+// Drops every entry below path, used when a directory moves or goes away.
+static void fuse_native_attr_cache_del_prefix (fuse_native_attr_cache_t *cache, const char *path) {
+  if (!cache->enabled) return;
+
+  __atomic_add_fetch(&(cache->generation), 1, __ATOMIC_ACQ_REL);
+
+  size_t len = strlen(path);
+
+  for (int i = 0; i < FUSE_NATIVE_ATTR_CACHE_SHARDS; i++) {
+    fuse_native_attr_shard_t *shard = &(cache->shards[i]);
+    uv_mutex_lock(&(shard->lock));
+
+    for (size_t j = 0; shard->count > 0 && j < shard->buckets_length; j++) {
+      fuse_native_attr_entry_t **slot = &(shard->buckets[j]);
+      while (*slot != NULL) {
+        if (strncmp((*slot)->path, path, len) == 0 && (*slot)->path[len] == '/') fuse_native_attr_cache_remove(shard, slot);
+        else slot = &((*slot)->next);
+      }
+    }
+
+    uv_mutex_unlock(&(shard->lock));
+  }
+}
+
+// Drops path and the directory it lives in, whose mtime/nlink change with it.
+static void fuse_native_attr_cache_invalidate (fuse_native_attr_cache_t *cache, const char *path) {
+  if (!cache->enabled) return;
+
+  fuse_native_attr_cache_del(cache, path);
+
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL) return;
+
+  char parent[PATH_MAX];
+  size_t len = slash == path ? 1 : (size_t) (slash - path);
+  if (len >= PATH_MAX) return;
+
+  memcpy(parent, path, len);
+  parent[len] = '\0';
+  fuse_native_attr_cache_del(cache, parent);
+}
+
+static uint64_t fuse_native_attr_cache_generation (fuse_native_attr_cache_t *cache) {
+  return __atomic_load_n(&(cache->generation), __ATOMIC_ACQUIRE);
+}
+
+// Stores what a stat that started at generation returned, unless something was dropped since.
+static void fuse_native_attr_cache_store (fuse_native_attr_cache_t *cache, const char *path, int res, const struct stat *stat, uint64_t generation) {
+  if (!cache->enabled || fuse_native_attr_cache_generation(cache) != generation) return;
+  if (res == 0) fuse_native_attr_cache_put(cache, path, stat);
+  else if (res == -ENOENT) fuse_native_attr_cache_put(cache, path, NULL);
+}
+
+static void fuse_native_attr_cache_destroy (fuse_native_attr_cache_t *cache) {
+  if (!cache->enabled) return;
+
+  for (int i = 0; i < FUSE_NATIVE_ATTR_CACHE_SHARDS; i++) {
+    fuse_native_attr_shard_t *shard = &(cache->shards[i]);
+    fuse_native_attr_entry_t *entry = shard->lru.lru_next;
+
+    while (entry != &(shard->lru)) {
+      fuse_native_attr_entry_t *next = entry->lru_next;
+      free(entry);
+      entry = next;
+    }
+
+    free(shard->buckets);
+    uv_mutex_destroy(&(shard->lock));
+  }
+
+  cache->enabled = 0;
+}
+
+// Block cache
+// Read replies are cut into block_size blocks keyed by path and block index, up to a byte budget, and reads
+// that are fully covered are answered on the FUSE thread. A short block marks the end of the file. Changes
+// made through the mount drop the blocks they touch, fuse.invalidate drops the rest. Every drop bumps the
+// generation, so a read that was in flight meanwhile does not put stale data back.
+
+static void fuse_native_block_cache_init (fuse_native_block_cache_t *cache, size_t max_bytes, size_t block_size) {
+  size_t max = block_size > 0 ? max_bytes / block_size : 0;
+  size_t shard_max = max / FUSE_NATIVE_BLOCK_CACHE_SHARDS;
+  if (shard_max == 0 && max > 0) shard_max = 1;
+
+  size_t buckets = 1;
+  while (buckets < shard_max) buckets *= 2;
+
+  cache->enabled = shard_max > 0;
+  cache->block_size = block_size;
+  cache->generation = 0;
+
+  if (!cache->enabled) return;
+
+  for (int i = 0; i < FUSE_NATIVE_BLOCK_CACHE_SHARDS; i++) {
+    fuse_native_block_shard_t *shard = &(cache->shards[i]);
+    uv_mutex_init(&(shard->lock));
+    shard->buckets = calloc(buckets, sizeof(fuse_native_block_t *));
+    shard->buckets_length = buckets;
+    shard->count = 0;
+    shard->max = shard_max;
+    shard->lru.lru_prev = shard->lru.lru_next = &(shard->lru);
+    if (shard->buckets == NULL) cache->enabled = 0;
+  }
+}
+
+// Consecutive blocks of a file land in different shards, so threads streaming one file do not contend.
+static size_t fuse_native_block_hash (size_t path_hash, uint64_t index) {
+  uint64_t hash = path_hash ^ (index * 0x9e3779b97f4a7c15ULL);
+  return (size_t) (hash ^ (hash >> 29));
+}
+
+static fuse_native_block_shard_t* fuse_native_block_cache_shard (fuse_native_block_cache_t *cache, size_t hash) {
+  return &(cache->shards[fuse_native_hash_high(hash) % FUSE_NATIVE_BLOCK_CACHE_SHARDS]);
+}
+
+static fuse_native_block_t** fuse_native_block_cache_slot (fuse_native_block_shard_t *shard, size_t hash, size_t path_hash, uint64_t index, const char *path) {
+  fuse_native_block_t **slot = &(shard->buckets[hash & (shard->buckets_length - 1)]);
+  while (*slot != NULL && ((*slot)->path_hash != path_hash || (*slot)->index != index || strcmp((*slot)->path, path) != 0)) slot = &((*slot)->next);
+  return slot;
+}
+
+static void fuse_native_block_cache_remove (fuse_native_block_shard_t *shard, fuse_native_block_t **slot) {
+  fuse_native_block_t *block = *slot;
+  *slot = block->next;
+  block->lru_prev->lru_next = block->lru_next;
+  block->lru_next->lru_prev = block->lru_prev;
+  shard->count--;
+  free(block);
+}
+
+static void fuse_native_block_cache_touch (fuse_native_block_shard_t *shard, fuse_native_block_t *block) {
+  block->lru_prev->lru_next = block->lru_next;
+  block->lru_next->lru_prev = block->lru_prev;
+  block->lru_prev = &(shard->lru);
+  block->lru_next = shard->lru.lru_next;
+  shard->lru.lru_next->lru_prev = block;
+  shard->lru.lru_next = block;
+}
+
+// Returns the bytes read, or -1 unless every block the read covers is cached.
+static int fuse_native_block_cache_read (fuse_native_block_cache_t *cache, const char *path, char *buf, size_t len, off_t offset) {
+  if (!cache->enabled || len == 0 || offset < 0) return -1;
+
+  size_t path_hash = fuse_native_hash(0, path);
+  size_t done = 0;
+
+  while (done < len) {
+    uint64_t pos = (uint64_t) offset + done;
+    uint64_t index = pos / cache->block_size;
+    size_t skip = pos % cache->block_size;
+    size_t hash = fuse_native_block_hash(path_hash, index);
+    fuse_native_block_shard_t *shard = fuse_native_block_cache_shard(cache, hash);
+
+    uv_mutex_lock(&(shard->lock));
+
+    fuse_native_block_t *block = *fuse_native_block_cache_slot(shard, hash, path_hash, index, path);
+
+    if (block == NULL) {
+      uv_mutex_unlock(&(shard->lock));
+      return -1;
+    }
+
+    size_t n = block->size > skip ? block->size - skip : 0;
+    if (n > len - done) n = len - done;
+    memcpy(buf + done, block->data + skip, n);
+    int eof = block->size < cache->block_size;
+
+    fuse_native_block_cache_touch(shard, block);
+    uv_mutex_unlock(&(shard->lock));
+
+    done += n;
+    if (eof) break;
+  }
+
+  return (int) done;
+}
+
+static void fuse_native_block_cache_put (fuse_native_block_cache_t *cache, const char *path, size_t path_hash, uint64_t index, const char *data, size_t size) {
+  size_t hash = fuse_native_block_hash(path_hash, index);
+  fuse_native_block_shard_t *shard = fuse_native_block_cache_shard(cache, hash);
+
+  uv_mutex_lock(&(shard->lock));
+
+  fuse_native_block_t **slot = fuse_native_block_cache_slot(shard, hash, path_hash, index, path);
+  fuse_native_block_t *block = *slot;
+
+  if (block == NULL) {
+    if (shard->count >= shard->max) {
+      fuse_native_block_t *oldest = shard->lru.lru_prev;
+      fuse_native_block_cache_remove(shard, fuse_native_block_cache_slot(shard, fuse_native_block_hash(oldest->path_hash, oldest->index), oldest->path_hash, oldest->index, oldest->path));
+      slot = fuse_native_block_cache_slot(shard, hash, path_hash, index, path);
+    }
+
+    size_t path_len = strlen(path) + 1;
+    block = malloc(sizeof(fuse_native_block_t) + cache->block_size + path_len);
+
+    if (block == NULL) {
+      uv_mutex_unlock(&(shard->lock));
+      return;
+    }
+
+    block->path = block->data + cache->block_size;
+    memcpy(block->path, path, path_len);
+    block->path_hash = path_hash;
+    block->index = index;
+    block->next = NULL;
+    block->lru_prev = block->lru_next = block;
+    *slot = block;
+    shard->count++;
+  }
+
+  memcpy(block->data, data, size);
+  block->size = size;
+  fuse_native_block_cache_touch(shard, block);
+
+  uv_mutex_unlock(&(shard->lock));
+}
+
+static uint64_t fuse_native_block_cache_generation (fuse_native_block_cache_t *cache) {
+  return __atomic_load_n(&(cache->generation), __ATOMIC_ACQUIRE);
+}
+
+// Caches the whole blocks of a read reply, and the last one if the reply came up short.
+static void fuse_native_block_cache_store (fuse_native_block_cache_t *cache, const char *path, const char *buf, size_t len, off_t offset, int res, uint64_t generation) {
+  if (!cache->enabled || res < 0 || offset < 0 || (size_t) res > len) return;
+  if (fuse_native_block_cache_generation(cache) != generation) return;
+
+  size_t bs = cache->block_size;
+  uint64_t start = (uint64_t) offset;
+  uint64_t end = start + (uint64_t) res;
+  int eof = (size_t) res < len;
+  size_t path_hash = fuse_native_hash(0, path);
+
+  for (uint64_t index = (start + bs - 1) / bs; index * bs <= end; index++) {
+    uint64_t pos = index * bs;
+    if (pos + bs <= end) fuse_native_block_cache_put(cache, path, path_hash, index, buf + (pos - start), bs);
+    else if (eof) fuse_native_block_cache_put(cache, path, path_hash, index, buf + (pos - start), (size_t) (end - pos));
+    else break;
+  }
+}
+
+// Drops the blocks of path from first to last (inclusive).
+static void fuse_native_block_cache_drop (fuse_native_block_cache_t *cache, const char *path, uint64_t first, uint64_t last) {
+  if (!cache->enabled) return;
+
+  __atomic_add_fetch(&(cache->generation), 1, __ATOMIC_ACQ_REL);
+
+  size_t path_hash = fuse_native_hash(0, path);
+
+  // A short range is looked up block by block, anything longer is cheaper to find with one sweep.
+  if (last - first < 64) {
+    for (uint64_t index = first; index <= last; index++) {
+      size_t hash = fuse_native_block_hash(path_hash, index);
+      fuse_native_block_shard_t *shard = fuse_native_block_cache_shard(cache, hash);
+
+      uv_mutex_lock(&(shard->lock));
+      fuse_native_block_t **slot = fuse_native_block_cache_slot(shard, hash, path_hash, index, path);
+      if (*slot != NULL) fuse_native_block_cache_remove(shard, slot);
+      uv_mutex_unlock(&(shard->lock));
+    }
+    return;
+  }
+
+  for (int i = 0; i < FUSE_NATIVE_BLOCK_CACHE_SHARDS; i++) {
+    fuse_native_block_shard_t *shard = &(cache->shards[i]);
+    uv_mutex_lock(&(shard->lock));
+
+    for (size_t j = 0; shard->count > 0 && j < shard->buckets_length; j++) {
+      fuse_native_block_t **slot = &(shard->buckets[j]);
+      while (*slot != NULL) {
+        fuse_native_block_t *block = *slot;
+        if (block->path_hash == path_hash && block->index >= first && block->index <= last && strcmp(block->path, path) == 0) fuse_native_block_cache_remove(shard, slot);
+        else slot = &(block->next);
+      }
+    }
+
+    uv_mutex_unlock(&(shard->lock));
+  }
+}
+
+// A length of 0 drops everything from offset on.
+static void fuse_native_block_cache_drop_range (fuse_native_block_cache_t *cache, const char *path, off_t offset, size_t len) {
+  if (!cache->enabled) return;
+
+  uint64_t first = offset > 0 ? (uint64_t) offset / cache->block_size : 0;
+  uint64_t last = len == 0 ? UINT64_MAX : ((uint64_t) (offset > 0 ? offset : 0) + len - 1) / cache->block_size;
+  fuse_native_block_cache_drop(cache, path, first, last);
+}
+
+static void fuse_native_block_cache_destroy (fuse_native_block_cache_t *cache) {
+  if (!cache->enabled) return;
+
+  for (int i = 0; i < FUSE_NATIVE_BLOCK_CACHE_SHARDS; i++) {
+    fuse_native_block_shard_t *shard = &(cache->shards[i]);
+    fuse_native_block_t *block = shard->lru.lru_next;
+
+    while (block != &(shard->lru)) {
+      fuse_native_block_t *next = block->lru_next;
+      free(block);
+      block = next;
+    }
+
+    free(shard->buckets);
+    uv_mutex_destroy(&(shard->lock));
+  }
+
+  cache->enabled = 0;
+}
+
+static int fuse_native_child_path (char *child, size_t size, const char *path, const char *name) {
+  int len = snprintf(child, size, strcmp(path, "/") == 0 ? "%s%s" : "%s/%s", path, name);
+  return len > 0 && (size_t) len < size;
+}
+
+// Handle table
+// With handles on, whatever open, create and opendir return that is not a number is kept in a slot here
+// and the file handle becomes the slot index (tagged with FUSE_NATIVE_HANDLE), so the ops on the handle
+// get the value back without a lookup in JS. The slot is freed when release or releasedir is dispatched.
+
+static void fuse_native_handles_init (fuse_native_handles_t *h, int enabled) {
+  h->enabled = enabled;
+  h->refs = NULL;
+  h->length = 0;
+  h->free = NULL;
+  h->free_length = 0;
+}
+
+static int fuse_native_handles_grow (fuse_native_handles_t *h) {
+  uint32_t length = h->length == 0 ? 64 : h->length * 2;
+
+  napi_ref *refs = realloc(h->refs, length * sizeof(napi_ref));
+  if (refs == NULL) return -ENOMEM;
+  h->refs = refs;
+
+  uint32_t *free_slots = realloc(h->free, length * sizeof(uint32_t));
+  if (free_slots == NULL) return -ENOMEM;
+  h->free = free_slots;
+
+  // Lowest slots on top, so handles stay small and dense.
+  for (uint32_t i = length; i > h->length; i--) {
+    h->refs[i - 1] = NULL;
+    h->free[h->free_length++] = i - 1;
+  }
+
+  h->length = length;
+  return 0;
+}
+
+static int fuse_native_handles_put (napi_env env, fuse_native_handles_t *h, napi_value value, uint64_t *fh) {
+  if (h->free_length == 0) {
+    int err = fuse_native_handles_grow(h);
+    if (err < 0) return err;
+  }
+
+  uint32_t slot = h->free[--(h->free_length)];
+  napi_create_reference(env, value, 1, &(h->refs[slot]));
+  *fh = FUSE_NATIVE_HANDLE | slot;
+  return 0;
+}
+
+static napi_ref fuse_native_handles_ref (fuse_native_handles_t *h, uint64_t fh) {
+  if (!h->enabled || !(fh & FUSE_NATIVE_HANDLE)) return NULL;
+  uint64_t slot = fh & ~FUSE_NATIVE_HANDLE;
+  return slot < h->length ? h->refs[slot] : NULL;
+}
+
+static void fuse_native_handles_release (napi_env env, fuse_native_handles_t *h, struct fuse_file_info *info) {
+  if (info == NULL) return;
+
+  napi_ref ref = fuse_native_handles_ref(h, info->fh);
+  if (ref == NULL) return;
+
+  uint32_t slot = (uint32_t) (info->fh & ~FUSE_NATIVE_HANDLE);
+  napi_delete_reference(env, ref);
+  h->refs[slot] = NULL;
+  h->free[h->free_length++] = slot;
+}
+
+// The file handle as JS sees it, the stored value or the number (a BigInt past 2^53).
+// Values of handles the kernel never released, the mount is gone.
+static void fuse_native_handles_destroy (napi_env env, fuse_native_handles_t *h) {
+  for (uint32_t i = 0; i < h->length; i++) {
+    if (h->refs[i] != NULL) napi_delete_reference(env, h->refs[i]);
+  }
+
+  free(h->refs);
+  free(h->free);
+  fuse_native_handles_init(h, 0);
+}
+
+static void fuse_native_fh_value (napi_env env, fuse_thread_t *ft, struct fuse_file_info *info, napi_value *value) {
+  uint64_t fh = info != NULL ? info->fh : 0;
+  napi_ref ref = fuse_native_handles_ref(&(ft->handles), fh);
+
+  if (ref != NULL) napi_get_reference_value(env, ref, value);
+  else if (fh <= FUSE_NATIVE_MAX_SAFE_INTEGER) napi_create_double(env, (double) fh, value);
+  else napi_create_bigint_uint64(env, fh, value);
+}
+
+// Sets the file handle from what open, create or opendir returned, 0, null and undefined leave it alone.
+static int fuse_native_fh_set (napi_env env, fuse_thread_t *ft, struct fuse_file_info *info, napi_value value, int res) {
+  napi_valuetype type;
+  napi_typeof(env, value, &type);
+
+  if (type == napi_number) {
+    int64_t fh;
+    napi_get_value_int64(env, value, &fh);
+    if (fh != 0) info->fh = (uint64_t) fh;
+    return res;
+  }
+
+  if (type == napi_bigint && !ft->handles.enabled) {
+    uint64_t fh;
+    bool lossless;
+    napi_get_value_bigint_uint64(env, value, &fh, &lossless);
+    if (fh != 0) info->fh = fh;
+    return res;
+  }
+
+  if (type == napi_undefined || type == napi_null || !ft->handles.enabled || res < 0) return res;
+
+  int err = fuse_native_handles_put(env, &(ft->handles), value, &(info->fh));
+  return err < 0 ? err : res;
+}
+
+// Write-back
+// Writes to a handle are appended to its extent and acknowledged without calling into JS, as long as they
+// continue where the last one ended. The extent goes out as one JS write once it is full or too old,
+// before a write that does not extend it, and on flush, fsync and release of the handle. Reads, stats,
+// truncates, renames and unlinks of the path send pending extents out first, so JS never sees a file
+// that is missing acknowledged data. A failed extent is reported by the next flush or fsync.
+// Extents go out as JS writes on the FUSE thread that triggers them, which can only be done while the
+// thread's locals are not in use, or by handing the caller its (possibly new) locals back. Those left
+// waiting past max_age are sent out by the flusher thread of the process.
+
+static int fuse_native_write (const char *path, const char *buf, size_t len, off_t offset, struct fuse_file_info *info);
+static void fuse_native_retire (fuse_thread_locals_t *l);
+
+static void fuse_native_write_back_init (fuse_native_write_back_t *wb, size_t max, double max_age) {
+  wb->enabled = max > 0;
+  wb->max = max;
+  wb->max_age = (uint64_t) (max_age * 1e6);
+  wb->pending = 0;
+  wb->flushing = 0;
+  wb->stopping = 0;
+  wb->flusher_locals = NULL;
+
+  if (!wb->enabled) return;
+
+  uv_mutex_init(&(wb->lock));
+  memset(wb->buckets, 0, sizeof(wb->buckets));
+}
+
+static fuse_native_extent_t** fuse_native_write_back_slot (fuse_native_write_back_t *wb, uint64_t fh) {
+  fuse_native_extent_t **slot = &(wb->buckets[fh & (FUSE_NATIVE_WRITE_BACK_BUCKETS - 1)]);
+  while (*slot != NULL && (*slot)->fh != fh) slot = &((*slot)->next);
+  return slot;
+}
+
+// Takes a reference on the extent of a handle, made on its first write.
+static fuse_native_extent_t* fuse_native_write_back_get (fuse_native_write_back_t *wb, const char *path, struct fuse_file_info *info) {
+  uv_mutex_lock(&(wb->lock));
+
+  fuse_native_extent_t **slot = fuse_native_write_back_slot(wb, info->fh);
+  fuse_native_extent_t *e = *slot;
+
+  if (e == NULL) {
+    e = calloc(1, sizeof(fuse_native_extent_t));
+    char *data = malloc(wb->max);
+    char *copy = strdup(path);
+
+    if (e == NULL || data == NULL || copy == NULL) {
+      free(e);
+      free(data);
+      free(copy);
+      uv_mutex_unlock(&(wb->lock));
+      return NULL;
+    }
+
+    uv_mutex_init(&(e->lock));
+    e->fh = info->fh;
+    e->info = *info;
+    e->path = copy;
+    e->data = data;
+    *slot = e;
+  }
+
+  e->refs++;
+  uv_mutex_unlock(&(wb->lock));
+  return e;
+}
+
+static void fuse_native_write_back_put (fuse_native_write_back_t *wb, fuse_native_extent_t *e) {
+  uv_mutex_lock(&(wb->lock));
+  int last = --(e->refs) == 0 && e->released;
+  uv_mutex_unlock(&(wb->lock));
+
+  if (!last) return;
+
+  uv_mutex_destroy(&(e->lock));
+  free(e->path);
+  free(e->data);
+  free(e);
+}
+
+// Extents of handles that were never released, what they hold can no longer be written.
+static void fuse_native_write_back_destroy (fuse_native_write_back_t *wb) {
+  if (!wb->enabled) return;
+
+  for (int i = 0; i < FUSE_NATIVE_WRITE_BACK_BUCKETS; i++) {
+    fuse_native_extent_t *e = wb->buckets[i];
+    while (e != NULL) {
+      fuse_native_extent_t *next = e->next;
+      uv_mutex_destroy(&(e->lock));
+      free(e->path);
+      free(e->data);
+      free(e);
+      e = next;
+    }
+    wb->buckets[i] = NULL;
+  }
+
+  uv_mutex_destroy(&(wb->lock));
+  wb->enabled = 0;
+}
+
+static int fuse_native_write_back_dispatch (fuse_thread_t *ft, const char *path, const char *buf, size_t len, off_t offset, struct fuse_file_info *info) {
+  fuse_thread_locals_t *l = fuse_native_thread_locals(ft);
+  l->write_through = 1;
+  int res = fuse_native_write(path, buf, len, offset, info);
+  l->write_through = 0;
+  return res;
+}
+
+// Called with the extent locked. Only fails if the request that triggered it was interrupted, the data is
+// kept for the next try then.
+static int fuse_native_write_back_flush (fuse_thread_t *ft, fuse_native_extent_t *e) {
+  if (e->len == 0) return 0;
+
+  int res = fuse_native_write_back_dispatch(ft, e->path, e->data, e->len, e->offset, &(e->info));
+  if (res == -EINTR) return res;
+
+  if (res < 0) e->error = res;
+  else if ((size_t) res < e->len) e->error = -EIO;
+
+  __atomic_store_n(&(e->len), 0, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&(ft->write_back.pending), 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int fuse_native_write_back_write (fuse_thread_t *ft, const char *path, const char *buf, size_t len, off_t offset, struct fuse_file_info *info) {
+  fuse_native_write_back_t *wb = &(ft->write_back);
+
+  if (len == 0) return 0;
+
+  fuse_native_extent_t *e = fuse_native_write_back_get(wb, path, info);
+  if (e == NULL) return fuse_native_write_back_dispatch(ft, path, buf, len, offset, info);
+
+  uv_mutex_lock(&(e->lock));
+
+  uint64_t now = uv_hrtime();
+  int res = 0;
+
+  if (e->len > 0 && (offset != e->offset + (off_t) e->len || e->len + len > wb->max || now - e->started > wb->max_age || strcmp(e->path, path) != 0)) {
+    res = fuse_native_write_back_flush(ft, e);
+  }
+
+  // The file was renamed since, the path only changes under the table lock, see fuse_native_write_back_flush_path.
+  if (res == 0 && strcmp(e->path, path) != 0) {
+    char *copy = strdup(path);
+    if (copy != NULL) {
+      uv_mutex_lock(&(wb->lock));
+      free(e->path);
+      e->path = copy;
+      uv_mutex_unlock(&(wb->lock));
+    }
+  }
+
+  if (res < 0) {
+    // Interrupted, nothing was written
+  } else if (len > wb->max) {
+    res = fuse_native_write_back_dispatch(ft, path, buf, len, offset, info);
+  } else {
+    if (e->len == 0) {
+      e->offset = offset;
+      e->started = now;
+      __atomic_add_fetch(&(wb->pending), 1, __ATOMIC_RELEASE);
+    }
+    memcpy(e->data + e->len, buf, len);
+    __atomic_store_n(&(e->len), e->len + len, __ATOMIC_RELEASE);
+    res = (int) len;
+  }
+
+  uv_mutex_unlock(&(e->lock));
+  fuse_native_write_back_put(wb, e);
+  return res;
+}
+
+static int fuse_native_write_back_overlaps (fuse_native_extent_t *e, const char *path, off_t offset, size_t len) {
+  size_t pending = __atomic_load_n(&(e->len), __ATOMIC_ACQUIRE);
+  if (pending == 0 || strcmp(e->path, path) != 0) return 0;
+  return len == 0 || (offset < e->offset + (off_t) pending && e->offset < offset + (off_t) len);
+}
+
+// The caller's locals were lent to the writes, op and op_fn are set again on the ones it continues with.
+// Those it had may have been abandoned and handed back meanwhile, so they are not looked at again.
+static void fuse_native_write_back_restore (fuse_thread_locals_t **lp, fuse_thread_t *ft, uint32_t op, void *op_fn) {
+  fuse_thread_locals_t *l = fuse_native_thread_locals(ft);
+  l->op = op;
+  l->op_fn = op_fn;
+  *lp = l;
+}
+
+// Sends out the extents on path overlapping offset..offset + len, all of them if len is 0.
+static void fuse_native_write_back_flush_path (fuse_thread_locals_t **lp, const char *path, off_t offset, size_t len) {
+  fuse_thread_t *ft = (*lp)->fuse;
+  fuse_native_write_back_t *wb = &(ft->write_back);
+
+  if (!wb->enabled || __atomic_load_n(&(wb->pending), __ATOMIC_ACQUIRE) == 0) return;
+
+  uint32_t op = (*lp)->op;
+  void *op_fn = (*lp)->op_fn;
+  int flushed = 0;
+
+  while (1) {
+    fuse_native_extent_t *e = NULL;
+
+    uv_mutex_lock(&(wb->lock));
+    for (int i = 0; e == NULL && i < FUSE_NATIVE_WRITE_BACK_BUCKETS; i++) {
+      for (fuse_native_extent_t *c = wb->buckets[i]; e == NULL && c != NULL; c = c->next) {
+        if (fuse_native_write_back_overlaps(c, path, offset, len)) e = c;
+      }
+    }
+    if (e != NULL) e->refs++;
+    uv_mutex_unlock(&(wb->lock));
+
+    if (e == NULL) break;
+
+    uv_mutex_lock(&(e->lock));
+    int res = fuse_native_write_back_overlaps(e, path, offset, len) ? fuse_native_write_back_flush(ft, e) : 0;
+    uv_mutex_unlock(&(e->lock));
+    fuse_native_write_back_put(wb, e);
+
+    flushed = 1;
+    if (res < 0) break;
+  }
+
+  if (flushed) fuse_native_write_back_restore(lp, ft, op, op_fn);
+}
+
+// Flush, fsync and release of a handle. Returns the error of an extent that failed since the last call.
+static int fuse_native_write_back_sync (fuse_thread_locals_t **lp, struct fuse_file_info *info, int release) {
+  fuse_thread_t *ft = (*lp)->fuse;
+  fuse_native_write_back_t *wb = &(ft->write_back);
+
+  if (!wb->enabled || info == NULL) return 0;
+
+  uv_mutex_lock(&(wb->lock));
+  fuse_native_extent_t **slot = fuse_native_write_back_slot(wb, info->fh);
+  fuse_native_extent_t *e = *slot;
+  if (e != NULL) {
+    e->refs++;
+    if (release) {
+      *slot = e->next;
+      e->released = 1;
+    }
+  }
+  uv_mutex_unlock(&(wb->lock));
+
+  if (e == NULL) return 0;
+
+  uint32_t op = (*lp)->op;
+  void *op_fn = (*lp)->op_fn;
+
+  uv_mutex_lock(&(e->lock));
+  int flushed = e->len > 0;
+  int res = fuse_native_write_back_flush(ft, e);
+  if (res == 0) {
+    res = e->error;
+    e->error = 0;
+  }
+  uv_mutex_unlock(&(e->lock));
+  fuse_native_write_back_put(wb, e);
+
+  if (flushed) fuse_native_write_back_restore(lp, ft, op, op_fn);
+  return res;
+}
+
+static int fuse_native_write_back_aged (fuse_native_extent_t *e, uint64_t age) {
+  return __atomic_load_n(&(e->len), __ATOMIC_ACQUIRE) > 0 && e->started + age <= uv_hrtime();
+}
+
+// Sends out the extents that have waited age or longer.
+static void fuse_native_write_back_flush_aged (fuse_thread_t *ft, uint64_t age) {
+  fuse_native_write_back_t *wb = &(ft->write_back);
+
+  for (int i = 0; i < FUSE_NATIVE_WRITE_BACK_BUCKETS; i++) {
+    while (1) {
+      fuse_native_extent_t *e = NULL;
+
+      uv_mutex_lock(&(wb->lock));
+      for (fuse_native_extent_t *c = wb->buckets[i]; e == NULL && c != NULL; c = c->next) {
+        if (fuse_native_write_back_aged(c, age)) e = c;
+      }
+      if (e != NULL) e->refs++;
+      uv_mutex_unlock(&(wb->lock));
+
+      if (e == NULL) break;
+
+      uv_mutex_lock(&(e->lock));
+      int res = fuse_native_write_back_aged(e, age) ? fuse_native_write_back_flush(ft, e) : 0;
+      uv_mutex_unlock(&(e->lock));
+      fuse_native_write_back_put(wb, e);
+
+      if (res < 0) return;
+    }
+  }
+}
+
+// Without further writes nothing looks at the age of an extent, so one thread for all mounts checks each
+// of them every half max_age (of the mount aging fastest). It sends the writes like a FUSE thread would,
+// waiting for JS, which the loop itself can not, with locals of its own for each mount it serves.
+// Whatever is still pending when a mount stops goes out before the mount is let go of.
+
+static uint64_t fuse_native_flusher_interval () {
+  uint64_t interval = UINT64_MAX;
+
+  for (uint32_t i = 0; i < flusher.mounts_length; i++) {
+    uint64_t half = flusher.mounts[i]->write_back.max_age / 2;
+    if (half < interval) interval = half;
+  }
+
+  return interval > 1000000 ? interval : 1000000;
+}
+
+// Called with the flusher locked, mounts keep no particular order.
+static void fuse_native_flusher_remove (fuse_thread_t *ft) {
+  for (uint32_t i = 0; i < flusher.mounts_length; i++) {
+    if (flusher.mounts[i] != ft) continue;
+    flusher.mounts[i] = flusher.mounts[--flusher.mounts_length];
+    break;
+  }
+
+  ft->write_back.flushing = 0;
+}
+
+static void* fuse_native_flusher_run (void *data) {
+  uv_mutex_lock(&(flusher.lock));
+
+  while (1) {
+    if (flusher.stopping == 0) {
+      if (flusher.mounts_length == 0) uv_cond_wait(&(flusher.wake), &(flusher.lock));
+      else uv_cond_timedwait(&(flusher.wake), &(flusher.lock), fuse_native_flusher_interval());
+    }
+
+    // Mounts are added and removed meanwhile, one moved past i is looked at next time.
+    for (uint32_t i = 0; i < flusher.mounts_length; i++) {
+      fuse_thread_t *ft = flusher.mounts[i];
+      fuse_native_write_back_t *wb = &(ft->write_back);
+      int stopping = wb->stopping;
+
+      flusher.current = ft;
+      uv_mutex_unlock(&(flusher.lock));
+
+      if (__atomic_load_n(&(wb->pending), __ATOMIC_ACQUIRE) > 0) {
+        fuse_native_set_thread_locals(wb->flusher_locals);
+        fuse_native_write_back_flush_aged(ft, stopping ? 0 : wb->max_age);
+        wb->flusher_locals = (fuse_thread_locals_t *) pthread_getspecific(thread_locals_key);
+        fuse_native_set_thread_locals(NULL);
+      }
+
+      if (stopping && wb->flusher_locals != NULL) {
+        fuse_native_retire(wb->flusher_locals);
+        wb->flusher_locals = NULL;
+      }
+
+      uv_mutex_lock(&(flusher.lock));
+      flusher.current = NULL;
+
+      if (stopping) {
+        fuse_native_flusher_remove(ft);
+        flusher.stopping--;
+        i--;
+      }
+
+      uv_cond_broadcast(&(flusher.stopped));
+    }
+  }
+
+  return NULL;
+}
+
+static void fuse_native_flusher_init (void) {
+  uv_mutex_init(&(flusher.lock));
+  uv_cond_init(&(flusher.wake));
+  uv_cond_init(&(flusher.stopped));
+}
+
+// Hands the mount to the flusher, starting it for the first. Without it extents only age out on writes.
+static void fuse_native_write_back_start (fuse_thread_t *ft) {
+  fuse_native_write_back_t *wb = &(ft->write_back);
+
+  if (!wb->enabled) return;
+
+  static pthread_once_t flusher_once = PTHREAD_ONCE_INIT;
+  pthread_once(&flusher_once, fuse_native_flusher_init);
+
+  uv_mutex_lock(&(flusher.lock));
+
+  if (!flusher.started) {
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    flusher.started = pthread_create(&thread, &attr, fuse_native_flusher_run, NULL) == 0;
+    pthread_attr_destroy(&attr);
+  }
+
+  if (flusher.started && flusher.mounts_length == flusher.mounts_size) {
+    uint32_t size = flusher.mounts_size == 0 ? 16 : flusher.mounts_size * 2;
+    fuse_thread_t **mounts = realloc(flusher.mounts, size * sizeof(fuse_thread_t *));
+    if (mounts != NULL) {
+      flusher.mounts = mounts;
+      flusher.mounts_size = size;
+    }
+  }
+
+  if (flusher.started && flusher.mounts_length < flusher.mounts_size) {
+    wb->stopping = 0;
+    wb->flushing = 1;
+    flusher.mounts[flusher.mounts_length++] = ft;
+    uv_cond_signal(&(flusher.wake));
+  }
+
+  uv_mutex_unlock(&(flusher.lock));
+}
+
+// Called by the FUSE threads on their way out, while the loop still answers the last writes.
+static void fuse_native_write_back_stop (fuse_native_write_back_t *wb) {
+  if (!wb->flushing) return;
+
+  uv_mutex_lock(&(flusher.lock));
+  wb->stopping = 1;
+  flusher.stopping++;
+  uv_cond_signal(&(flusher.wake));
+  while (wb->flushing) uv_cond_wait(&(flusher.stopped), &(flusher.lock));
+  uv_mutex_unlock(&(flusher.lock));
+}
+
+// Same for a mount that failed to start on the loop, which must not wait for writes of other mounts the
+// flusher may be sending. Nothing was written to this one, so it is only taken off the list.
+static void fuse_native_write_back_cancel (fuse_thread_t *ft) {
+  if (!ft->write_back.flushing) return;
+
+  uv_mutex_lock(&(flusher.lock));
+  while (flusher.current == ft) uv_cond_wait(&(flusher.stopped), &(flusher.lock));
+  fuse_native_flusher_remove(ft);
+  uv_mutex_unlock(&(flusher.lock));
+}
+
+// Directory listings
+// Entries get the offset (page << 32) | (index + 1), page 0 being the whole listing if it is not paged.
+// The kernel resumes after the last entry it took, from the page held for the handle if that is where
+// it stopped, or else from the page after it, which JS is asked for with the cursor it left.
+
+// The kernel holds a pointer to the dir of a handle, the JS methods get the info inside it.
+static fuse_native_dir_t* fuse_native_dir (struct fuse_file_info *info) {
+  return (fuse_native_dir_t *) (uintptr_t) info->fh;
+}
+
+static fuse_native_dir_t* fuse_native_dir_of (struct fuse_file_info *info) {
+  return (fuse_native_dir_t *) ((char *) info - offsetof(fuse_native_dir_t, info));
+}
+
+static void fuse_native_dir_clear (fuse_native_dir_t *d) {
+  for (uint32_t i = 0; i < d->length; i++) free(d->entries[i].name);
+  free(d->entries);
+  d->entries = NULL;
+  d->length = 0;
+  d->held = 0;
+}
+
+static void fuse_native_dir_cursor (fuse_native_dir_t *d, napi_valuetype type, double number, char *string) {
+  free(d->cursor_string);
+  d->cursor_type = type;
+  d->cursor_number = number;
+  d->cursor_string = string;
+}
+
+static void fuse_native_dir_free (fuse_native_dir_t *d) {
+  fuse_native_dir_clear(d);
+  free(d->cursor_string);
+  free(d);
+}
+
+static int fuse_native_dir_fill (fuse_native_dir_t *d, uint32_t from, void *buf, fuse_fill_dir_t filler) {
+  for (uint32_t i = from; i < d->length; i++) {
+    fuse_native_listing_entry_t *e = &(d->entries[i]);
+    if (filler(buf, e->name, e->has_stat ? &(e->stat) : NULL, (off_t) ((d->page << 32) | (i + 1)))) break;
+  }
+  return 0;
+}
+
+// Methods
+
+FUSE_METHOD(statfs, 1, 1, (const char * path, struct statvfs *statvfs), {
+  l->path = path;
+  l->statvfs = statvfs;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+}, {
+  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
+  populate_statvfs(ints, l->statvfs);
+})
+
+FUSE_METHOD(getattr, 1, 1, (const char *path, struct stat *stat), {
+  fuse_native_write_back_flush_path(&l, path, 0, 0);
+  int cached = fuse_native_attr_cache_get(&(l->fuse->attr_cache), path, stat);
+  if (cached) return cached < 0 ? cached : 0;
+  l->attr_generation = fuse_native_attr_cache_generation(&(l->fuse->attr_cache));
+  l->path = path;
+  l->stat = stat;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+}, {
+  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
+  populate_stat(ints, l->stat);
+  fuse_native_attr_cache_store(&(l->fuse->attr_cache), l->path, res, l->stat, l->attr_generation);
+})
+
+FUSE_METHOD(fgetattr, 2, 1, (const char *path, struct stat *stat, struct fuse_file_info *info), {
+  fuse_native_write_back_flush_path(&l, path, 0, 0);
+  l->path = path;
+  l->stat = stat;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+}, {
+  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
+  populate_stat(ints, l->stat);
+})
+
+FUSE_METHOD_VOID(access, 2, 0, (const char *path, int mode), {
+  l->path = path;
+  l->mode = mode;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+})
+
+FUSE_METHOD(open, 2, 1, (const char *path, struct fuse_file_info *info), {
+  l->path = path;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  if (l->info != NULL) {
+    napi_create_uint32(env, l->info->flags, &(argv[3]));
+  } else {
+    napi_create_uint32(env, 0, &(argv[3]));
+  }
+}, {
+  res = fuse_native_fh_set(env, l->fuse, l->info, argv[2], res);
+})
+
+FUSE_METHOD(opendir, 2, 1, (const char *path, struct fuse_file_info *info), {
+  l->path = path;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  if (l->info != NULL) {
+    napi_create_uint32(env, l->info->flags, &(argv[3]));
+  } else {
+    napi_create_uint32(env, 0, &(argv[3]));
+  }
+}, {
+  res = fuse_native_fh_set(env, l->fuse, l->info, argv[2], res);
+})
+
+FUSE_METHOD(create, 2, 1, (const char *path, mode_t mode, struct fuse_file_info *info), {
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), path);
+  l->path = path;
+  l->mode = mode;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+}, {
+  res = fuse_native_fh_set(env, l->fuse, l->info, argv[2], res);
+})
+
+FUSE_METHOD_VOID(utimens, 5, 0, (const char *path, const struct timespec tv[2]), {
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  l->path = path;
+  utimens_timespec(&(l->atime), tv == NULL ? NULL : &tv[0]);
+  utimens_timespec(&(l->mtime), tv == NULL ? NULL : &tv[1]);
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_int64(env, (int64_t) l->atime.tv_sec, &(argv[3]));
+  napi_create_uint32(env, (uint32_t) l->atime.tv_nsec, &(argv[4]));
+  napi_create_int64(env, (int64_t) l->mtime.tv_sec, &(argv[5]));
+  napi_create_uint32(env, (uint32_t) l->mtime.tv_nsec, &(argv[6]));
+})
+
+FUSE_METHOD_VOID(release, 2, 0, (const char *path, struct fuse_file_info *info), {
+  int err = fuse_native_write_back_sync(&l, info, 1);
+  if (!l->fuse->implemented[op_release]) return err;
+  l->path = path;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  fuse_native_handles_release(env, &(ft->handles), l->info);
+})
+
+FUSE_METHOD_VOID(releasedir, 2, 0, (const char *path, struct fuse_file_info *info), {
+  l->path = path;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  fuse_native_handles_release(env, &(ft->handles), l->info);
+})
+
+FUSE_METHOD(read, 6, 2, (const char *path, char *buf, size_t len, off_t offset, struct fuse_file_info *info), {
+  fuse_native_write_back_flush_path(&l, path, offset, len);
+  int cached = fuse_native_block_cache_read(&(l->fuse->block_cache), path, buf, len, offset);
+  if (cached >= 0) return cached;
+  l->block_generation = fuse_native_block_cache_generation(&(l->fuse->block_cache));
+  l->path = path;
+  l->buf = buf;
+  l->len = len;
+  l->offset = offset;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  napi_create_external_buffer(env, l->len, (char *) l->buf, NULL, NULL, &(argv[4]));
+  fuse_native_borrow(env, l, argv[4]);
+  napi_create_uint32(env, l->len, &(argv[5]));
+  FUSE_UINT64_TO_INTS_ARGV(l->offset, 6)
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[3]) == napi_ok);
+  fuse_native_block_cache_store(&(l->fuse->block_cache), l->path, l->buf, l->len, l->offset, res, l->block_generation);
+})
+
+// Handlers may close their descriptors as soon as they replied, so the splice works on duplicates made
+// while the reply is signalled. libfuse splices a read_buf reply after we return, so those are closed
+// when the FUSE thread takes its next request (or exits), in low-level mode right after the reply.
+static int fuse_native_spliced_dup (fuse_thread_locals_t *l, int fd) {
+  if (l->spliced_length == l->spliced_capacity) {
+    size_t capacity = l->spliced_capacity == 0 ? 4 : 2 * l->spliced_capacity;
+    int *spliced = realloc(l->spliced, capacity * sizeof(int));
+    if (spliced == NULL) return -ENOMEM;
+    l->spliced = spliced;
+    l->spliced_capacity = capacity;
+  }
+
+  int dup = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (dup < 0) return -errno;
+
+  l->spliced[l->spliced_length++] = dup;
+  return dup;
+}
+
+static void fuse_native_spliced_close (fuse_thread_locals_t *l) {
+  for (size_t i = 0; i < l->spliced_length; i++) close(l->spliced[i]);
+  l->spliced_length = 0;
+}
+
+static int fuse_native_fd_bufvec (fuse_thread_locals_t *l, struct fuse_bufvec **bufp, double *segments, size_t count, size_t max) {
+  struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec) + (count > 1 ? count - 1 : 0) * sizeof(struct fuse_buf));
+  if (bufv == NULL) return -ENOMEM;
+
+  *bufv = FUSE_BUFVEC_INIT(0);
+  bufv->count = 0;
+
+  int src = -1;
+  int fd = -1;
+
+  for (size_t i = 0; i < count && max > 0; i++) {
+    size_t size = (size_t) segments[3 * i + 2];
+    if (size > max) size = max;
+    if (size == 0) continue;
+
+    // Segments of one file share a duplicate.
+    if (fd < 0 || (int) segments[3 * i] != src) {
+      src = (int) segments[3 * i];
+      fd = fuse_native_spliced_dup(l, src);
+    }
+
+    if (fd < 0) {
+      fuse_native_spliced_close(l);
+      free(bufv);
+      return fd;
+    }
+
+    struct fuse_buf *b = &(bufv->buf[bufv->count++]);
+    b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY;
+    b->mem = NULL;
+    b->fd = fd;
+    b->pos = (off_t) segments[3 * i + 1];
+    b->size = size;
+    max -= size;
+  }
+
+  // Nothing to read is replied as a single empty buffer
+  if (bufv->count == 0) bufv->count = 1;
+
+  *bufp = bufv;
+  return 0;
+}
+
+// The reply only references file descriptors, libfuse splices them into /dev/fuse without copying through JS.
+FUSE_METHOD(readbuf, 5, 1, (const char *path, struct fuse_bufvec **bufp, size_t len, off_t offset, struct fuse_file_info *info), {
+  l->path = path;
+  l->bufp = bufp;
+  l->len = len;
+  l->offset = offset;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  napi_create_uint32(env, l->len, &(argv[4]));
+  FUSE_UINT64_TO_INTS_ARGV(l->offset, 5)
+}, {
+  if (res >= 0) {
+    NAPI_ARGV_BUFFER(segments, 2)
+    res = fuse_native_fd_bufvec(l, l->bufp, (double *) segments, segments_len / (3 * sizeof(double)), l->len);
+  }
+})
+
+// Only asks JS where the data should go, the splice itself happens on the FUSE thread.
+FUSE_METHOD(writebuf, 5, 1, (const char *path, size_t len, off_t offset, struct fuse_file_info *info, off_t *target_position), {
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  if (len > 0) fuse_native_block_cache_drop_range(&(l->fuse->block_cache), path, offset, len);
+  l->path = path;
+  l->len = len;
+  l->offset = offset;
+  l->info = info;
+  l->target_position = target_position;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  napi_create_uint32(env, l->len, &(argv[4]));
+  FUSE_UINT64_TO_INTS_ARGV(l->offset, 5)
+}, {
+  if (res >= 0) {
+    NAPI_ARGV_INT64(position, 2)
+    *(l->target_position) = position;
+    res = fuse_native_spliced_dup(l, res);
+  }
+})
+
+static int fuse_native_write_buf (const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *info) {
+  fuse_native_block_cache_t *cache = &(get_thread_locals()->fuse->block_cache);
+  size_t len = fuse_buf_size(buf);
+  off_t position = offset;
+
+  int fd = fuse_native_writebuf(path, len, offset, info, &position);
+  if (fd < 0) return fd;
+
+  struct fuse_bufvec dst = FUSE_BUFVEC_INIT(len);
+  dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+  dst.buf[0].fd = fd;
+  dst.buf[0].pos = position;
+
+  int res = (int) fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_MOVE);
+  fuse_native_spliced_close(get_thread_locals());
+
+  // Again once the data landed, a read that raced the splice may have cached what was there before.
+  if (len > 0) fuse_native_block_cache_drop_range(cache, path, offset, len);
+
+  return res;
+}
+
+FUSE_METHOD(write, 6, 2, (const char *path, const char *buf, size_t len, off_t offset, struct fuse_file_info *info), {
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  if (len > 0) fuse_native_block_cache_drop_range(&(l->fuse->block_cache), path, offset, len);
+  if (l->fuse->write_back.enabled && info != NULL && !l->write_through) return fuse_native_write_back_write(l->fuse, path, buf, len, offset, info);
+  l->path = path;
+  l->buf = buf;
+  l->len = len;
+  l->offset = offset;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  napi_create_external_buffer(env, l->len, (char *) l->buf, NULL, NULL, &(argv[4]));
+  fuse_native_borrow(env, l, argv[4]);
+  napi_create_uint32(env, l->len, &(argv[5]));
+  FUSE_UINT64_TO_INTS_ARGV(l->offset, 6)
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[3]) == napi_ok);
+  // Again once JS wrote it, a read that raced the write may have cached what was there before.
+  if (l->len > 0) fuse_native_block_cache_drop_range(&(l->fuse->block_cache), l->path, l->offset, l->len);
+})
+
+FUSE_METHOD(readdir, 2, 3, (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *info), {
+  l->attr_generation = fuse_native_attr_cache_generation(&(l->fuse->attr_cache));
+  l->buf = buf;
+  l->path = path;
+  l->offset = offset;
+  l->info = info;
+  l->readdir_filler = filler;
+  l->dir = fuse_native_dir_of(info);
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  if (l->dir->cursor_type == napi_string) napi_create_string_utf8(env, l->dir->cursor_string, NAPI_AUTO_LENGTH, &(argv[3]));
+  else napi_create_double(env, l->dir->cursor_number, &(argv[3]));
+}, {
+  // A paged listing passes the cursor of the page after it (null after the last), a full listing nothing.
+  napi_valuetype next_type;
+  napi_typeof(env, argv[4], &next_type);
+  int paged = next_type != napi_undefined;
+
+  // Stats arrive as one flat array, FUSE_NATIVE_STAT_LENGTH slots per entry.
+  NAPI_ARGV_BUFFER_CAST(uint32_t*, stats, 3)
+  uint32_t stats_length = stats_len / (FUSE_NATIVE_STAT_LENGTH * sizeof(uint32_t));
+  uint32_t names_length = 0;
+  napi_get_array_length(env, argv[2], &names_length);
+  int with_stats = names_length == stats_length;
+
+  fuse_native_attr_cache_t *cache = &(l->fuse->attr_cache);
+  int cache_stats = with_stats && cache->enabled && fuse_native_attr_cache_generation(cache) == l->attr_generation;
+  char child[PATH_MAX];
+
+  // libfuse keeps full listings itself in high-level mode, those are filled in as they come.
+  fuse_native_dir_t *d = l->dir;
+  int hold = paged || l->fuse->fuse == NULL;
+  int full = 0;
+
+  if (hold && res >= 0) {
+    fuse_native_dir_clear(d);
+    d->entries = calloc(names_length > 0 ? names_length : 1, sizeof(fuse_native_listing_entry_t));
+    if (d->entries == NULL) res = -ENOMEM;
+  }
+
+  for (uint32_t i = 0; res >= 0 && !full && i < names_length; i++) {
+    napi_value raw_name;
+    napi_get_element(env, argv[2], i, &raw_name);
+    NAPI_UTF8(name, 1024, raw_name)
+
+    struct stat st;
+    if (with_stats) populate_stat(stats + i * FUSE_NATIVE_STAT_LENGTH, &st);
+
+    // FUSE 29 has no readdirplus, so the follow-up lookups are answered from the attr cache instead.
+    if (cache_stats && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && fuse_native_child_path(child, PATH_MAX, l->path, name)) {
+      fuse_native_attr_cache_put(cache, child, &st);
+    }
+
+    if (!hold) {
+      full = l->readdir_filler((char *) l->buf, name, with_stats ? &st : NULL, 0) == 1;
+      continue;
+    }
+
+    fuse_native_listing_entry_t *e = &(d->entries[d->length]);
+    e->name = strdup(name);
+    if (e->name == NULL) {
+      res = -ENOMEM;
+      continue;
+    }
+    e->has_stat = with_stats;
+    if (with_stats) e->stat = st;
+    d->length++;
+  }
+
+  if (hold && res >= 0) {
+    d->held = 1;
+    d->page = d->fetching;
+    d->done = !paged || names_length == 0 || (next_type != napi_string && next_type != napi_number);
+
+    if (next_type == napi_number) {
+      double number;
+      napi_get_value_double(env, argv[4], &number);
+      fuse_native_dir_cursor(d, napi_number, number, NULL);
+    } else if (next_type == napi_string) {
+      size_t len;
+      napi_get_value_string_utf8(env, argv[4], NULL, 0, &len);
+      char *string = malloc(len + 1);
+      if (string != NULL) napi_get_value_string_utf8(env, argv[4], string, len + 1, &len);
+      if (string == NULL) d->done = 1;
+      fuse_native_dir_cursor(d, napi_string, 0, string);
+    }
+
+    fuse_native_dir_fill(d, 0, (char *) l->buf, l->readdir_filler);
+  } else if (hold) {
+    fuse_native_dir_clear(d);
+  }
+})
 
 #ifdef __APPLE__
 
-FUSE_METHOD(setxattr, 5, 1, (const char *path, const char *name, const char *value, size_t size, int flags, uint32_t position), {
-  l->path = path;
-  l->name = name;
-  l->value = value;
-  l->size = size;
-  l->flags = flags;
-  l->position = position;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
-  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
-  napi_create_uint32(env, l->position, &(argv[5]));
-  napi_create_uint32(env, l->flags, &(argv[6]));
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
-})
+FUSE_METHOD(setxattr, 5, 1, (const char *path, const char *name, const char *value, size_t size, int flags, uint32_t position), {
+  l->path = path;
+  l->name = name;
+  l->value = value;
+  l->size = size;
+  l->flags = flags;
+  l->position = position;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
+  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
+  fuse_native_borrow(env, l, argv[4]);
+  napi_create_uint32(env, l->position, &(argv[5]));
+  napi_create_uint32(env, l->flags, &(argv[6]));
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
+})
+
+FUSE_METHOD(getxattr, 4, 1, (const char *path, const char *name, char *value, size_t size, uint32_t position), {
+  l->path = path;
+  l->name = name;
+  l->value = value;
+  l->size = size;
+  l->position = position;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
+  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
+  fuse_native_borrow(env, l, argv[4]);
+  napi_create_uint32(env, l->position, &(argv[5]));
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
+})
+
+#else
+
+FUSE_METHOD(setxattr, 5, 1, (const char *path, const char *name, const char *value, size_t size, int flags), {
+  l->path = path;
+  l->name = name;
+  l->value = value;
+  l->size = size;
+  l->flags = flags;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
+  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
+  fuse_native_borrow(env, l, argv[4]);
+  napi_create_uint32(env, 0, &(argv[5])); // normalize apis between mac and linux
+  napi_create_uint32(env, l->flags, &(argv[6]));
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
+})
+
+FUSE_METHOD(getxattr, 4, 1, (const char *path, const char *name, char *value, size_t size), {
+  l->path = path;
+  l->name = name;
+  l->value = value;
+  l->size = size;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
+  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
+  fuse_native_borrow(env, l, argv[4]);
+  napi_create_uint32(env, 0, &(argv[5]));
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
+})
+
+#endif
+
+FUSE_METHOD(listxattr, 2, 1, (const char *path, char *list, size_t size), {
+  l->path = path;
+  l->list = list;
+  l->size = size;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_external_buffer(env, l->size, l->list, NULL, NULL, &(argv[3]));
+  fuse_native_borrow(env, l, argv[3]);
+}, {
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
+})
+
+FUSE_METHOD_VOID(removexattr, 2, 0, (const char *path, const char *name), {
+  l->path = path;
+  l->name = name;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(flush, 2, 0, (const char *path, struct fuse_file_info *info), {
+  int err = fuse_native_write_back_sync(&l, info, 0);
+  if (err < 0 || !l->fuse->implemented[op_flush]) return err;
+  l->path = path;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(fsync, 3, 0, (const char *path, int datasync, struct fuse_file_info *info), {
+  int err = fuse_native_write_back_sync(&l, info, 0);
+  if (err < 0 || !l->fuse->implemented[op_fsync]) return err;
+  l->path = path;
+  l->mode = datasync;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[4]));
+})
+
+FUSE_METHOD_VOID(fsyncdir, 3, 0, (const char *path, int datasync, struct fuse_file_info *info), {
+  l->path = path;
+  l->mode = datasync;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[4]));
+})
+
+// What libfuse and the low-level handlers call for the directories JS serves, see fuse_native_dir_t.
+static int fuse_native_dir_opendir (const char *path, struct fuse_file_info *info) {
+  fuse_thread_t *ft = get_thread_locals()->fuse;
+  fuse_native_dir_t *d = calloc(1, sizeof(fuse_native_dir_t));
+  if (d == NULL) return -ENOMEM;
+
+  d->info = *info;
+  d->cursor_type = napi_number;
+
+  int res = ft->implemented[op_opendir] ? fuse_native_opendir(path, &(d->info)) : 0;
+  if (res < 0) {
+    free(d);
+    return res;
+  }
+
+  *info = d->info;
+  info->fh = (uint64_t) (uintptr_t) d;
+  return res;
+}
+
+// The kernel takes the entries of a handle in order, and starts over from 0 on rewinddir.
+static int fuse_native_dir_readdir (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *info) {
+  fuse_native_dir_t *d = fuse_native_dir(info);
+  uint64_t page = (uint64_t) offset >> 32;
+  uint32_t from = (uint32_t) offset;
+
+  if (offset == 0) {
+    fuse_native_dir_clear(d);
+    fuse_native_dir_cursor(d, napi_number, 0, NULL);
+    d->fetching = 0;
+    d->done = 0;
+  } else if (!d->held || page != d->page) {
+    // Only a seekdir to an earlier page gets here, those are gone.
+    return -EINVAL;
+  } else if (from < d->length) {
+    return fuse_native_dir_fill(d, from, buf, filler);
+  } else if (d->done) {
+    return 0;
+  } else {
+    d->fetching = d->page + 1;
+  }
+
+  return fuse_native_readdir(path, buf, filler, offset, &(d->info));
+}
+
+static int fuse_native_dir_releasedir (const char *path, struct fuse_file_info *info) {
+  fuse_thread_t *ft = get_thread_locals()->fuse;
+  fuse_native_dir_t *d = fuse_native_dir(info);
+  int res = ft->implemented[op_releasedir] ? fuse_native_releasedir(path, &(d->info)) : 0;
+  fuse_native_dir_free(d);
+  return res;
+}
+
+static int fuse_native_dir_fsyncdir (const char *path, int datasync, struct fuse_file_info *info) {
+  return fuse_native_fsyncdir(path, datasync, &(fuse_native_dir(info)->info));
+}
+
+// Every directory op goes through the wrappers above once one of them is implemented.
+static int fuse_native_dir_ops (uint32_t *implemented) {
+  return implemented[op_opendir] || implemented[op_readdir] || implemented[op_releasedir] || implemented[op_fsyncdir];
+}
+
+
+FUSE_METHOD_VOID(truncate, 3, 0, (const char *path, off_t size), {
+  fuse_native_write_back_flush_path(&l, path, 0, 0);
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  fuse_native_block_cache_drop_range(&(l->fuse->block_cache), path, size, 0);
+  l->path = path;
+  l->offset = size;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  FUSE_UINT64_TO_INTS_ARGV(l->offset, 3)
+})
+
+FUSE_METHOD_VOID(ftruncate, 4, 0, (const char *path, off_t size, struct fuse_file_info *info), {
+  fuse_native_write_back_flush_path(&l, path, 0, 0);
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  fuse_native_block_cache_drop_range(&(l->fuse->block_cache), path, size, 0);
+  l->path = path;
+  l->offset = size;
+  l->info = info;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_fh_value(env, ft, l->info, &(argv[3]));
+  FUSE_UINT64_TO_INTS_ARGV(l->offset, 4)
+})
+
+FUSE_METHOD(readlink, 1, 1, (const char *path, char *linkname, size_t len), {
+  l->path = path;
+  l->linkname = linkname;
+  l->len = len;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+}, {
+  NAPI_ARGV_UTF8(linkname, l->len, 2)
+  strncpy(l->linkname, linkname, l->len);
+})
+
+FUSE_METHOD_VOID(chown, 3, 0, (const char *path, uid_t uid, gid_t gid), {
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  l->path = path;
+  l->uid = uid;
+  l->gid = gid;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->uid, &(argv[3]));
+  napi_create_uint32(env, l->gid, &(argv[4]));
+})
+
+FUSE_METHOD_VOID(chmod, 2, 0, (const char *path, mode_t mode), {
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  l->path = path;
+  l->mode = mode;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(mknod, 3, 0, (const char *path, mode_t mode, dev_t dev), {
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), path);
+  l->path = path;
+  l->mode = mode;
+  l->dev = dev;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+  napi_create_uint32(env, l->dev, &(argv[4]));
+})
+
+FUSE_METHOD_VOID(unlink, 1, 0, (const char *path), {
+  fuse_native_write_back_flush_path(&l, path, 0, 0);
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), path);
+  fuse_native_block_cache_drop_range(&(l->fuse->block_cache), path, 0, 0);
+  l->path = path;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+})
+
+FUSE_METHOD_VOID(rename, 2, 0, (const char *path, const char *dest), {
+  fuse_native_write_back_flush_path(&l, path, 0, 0);
+  fuse_native_write_back_flush_path(&l, dest, 0, 0);
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), path);
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), dest);
+  fuse_native_attr_cache_del_prefix(&(l->fuse->attr_cache), path);
+  fuse_native_attr_cache_del_prefix(&(l->fuse->attr_cache), dest);
+  fuse_native_block_cache_drop_range(&(l->fuse->block_cache), path, 0, 0);
+  fuse_native_block_cache_drop_range(&(l->fuse->block_cache), dest, 0, 0);
+  l->path = path;
+  l->dest = dest;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_path_value(env, &(ft->paths), l->dest, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(link, 2, 0, (const char *path, const char *dest), {
+  fuse_native_attr_cache_del(&(l->fuse->attr_cache), path);
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), dest);
+  l->path = path;
+  l->dest = dest;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_path_value(env, &(ft->paths), l->dest, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(symlink, 2, 0, (const char *path, const char *dest), {
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), dest);
+  l->path = path;
+  l->dest = dest;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  fuse_native_path_value(env, &(ft->paths), l->dest, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(mkdir, 2, 0, (const char *path, mode_t mode), {
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), path);
+  l->path = path;
+  l->mode = mode;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+  napi_create_uint32(env, l->mode, &(argv[3]));
+})
+
+FUSE_METHOD_VOID(rmdir, 1, 0, (const char *path), {
+  fuse_native_attr_cache_invalidate(&(l->fuse->attr_cache), path);
+  fuse_native_attr_cache_del_prefix(&(l->fuse->attr_cache), path);
+  l->path = path;
+}, {
+  fuse_native_path_value(env, &(ft->paths), l->path, &(argv[2]));
+})
+
+FUSE_METHOD(lookup, 2, 1, (fuse_ino_t parent, const char *name, struct stat *stat), {
+  l->ino = parent;
+  l->name = name;
+  l->stat = stat;
+}, {
+  napi_create_int64(env, (int64_t) l->ino, &(argv[2]));
+  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
+}, {
+  NAPI_ARGV_BUFFER_CAST(uint32_t*, ints, 2)
+  populate_stat(ints, l->stat);
+})
+
+static void fuse_native_dispatch_init (uv_async_t* handle, fuse_thread_locals_t* l, fuse_thread_t* ft) {\
+  FUSE_NATIVE_CALLBACK(ft->handlers[op_init], {
+    napi_value argv[2];
+
+    napi_get_reference_value(env, l->self, &(argv[0]));
+    napi_create_uint32(env, l->op, &(argv[1]));
+
+    NAPI_MAKE_CALLBACK(env, NULL, ctx, callback, 2, argv, NULL);
+  })
+}
+
+NAPI_METHOD(fuse_native_signal_init) {
+  NAPI_ARGV(2)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_locals_t *, l, 0);
+  NAPI_ARGV_INT32(res, 1);
+  l->res = res;
+  uv_sem_post(&(l->sem));
+  return NULL;
+}
+
+static void * fuse_native_init (struct fuse_conn_info *conn) {
+  fuse_thread_locals_t *l = get_thread_locals();
+
+  l->op = op_init;
+  l->op_fn = fuse_native_dispatch_init;
+
+  fuse_native_enqueue(l);
+  uv_sem_wait(&(l->sem));
+
+  if (l->fuse->implemented[op_readbuf]) conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+  if (l->fuse->implemented[op_writebuf]) conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_MOVE);
+  if (l->fuse->passthrough.dirfd >= 0) conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+
+  return l->fuse;
+}
+
+// Memory filesystem
+// A mount with memory set is a filesystem held in this process, served on the FUSE thread without calling
+// into JS (see fuse_native_memfs_getattr). Inodes are carved out of arenas and recycled through a free list,
+// directory entries live in one hash table keyed by parent and name (and in a list per directory, for
+// readdir), and file data in fixed size extents that are only allocated once written to, so holes are free.
+// One rwlock guards it all, lookups and reads share it. JS can put files in with fuse.populate.
+
+static void fuse_native_memfs_now (struct timespec *ts) {
+  clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static void fuse_native_memfs_touch (fuse_native_memfs_inode_t *node) {
+  fuse_native_memfs_now(&(node->mtime));
+  node->ctime = node->mtime;
+}
+
+static fuse_native_memfs_inode_t* fuse_native_memfs_inode_new (fuse_native_memfs_t *m, mode_t mode, uid_t uid, gid_t gid) {
+  fuse_native_memfs_inode_t *node = m->free;
+
+  if (node != NULL) {
+    m->free = node->free_next;
+  } else {
+    if (m->arenas == NULL || m->arena_used == FUSE_NATIVE_MEMFS_ARENA) {
+      fuse_native_memfs_arena_t *arena = calloc(1, sizeof(fuse_native_memfs_arena_t));
+      if (arena == NULL) return NULL;
+      arena->next = m->arenas;
+      m->arenas = arena;
+      m->arena_used = 0;
+    }
+    node = &(m->arenas->inodes[m->arena_used++]);
+  }
+
+  memset(node, 0, sizeof(fuse_native_memfs_inode_t));
+  node->ino = ++(m->next_ino);
+  node->mode = mode;
+  node->uid = uid;
+  node->gid = gid;
+
+  // Directories link themselves as ".", everything else gets its links from the entries pointing at it.
+  if (S_ISDIR(mode)) {
+    node->nlink = 2;
+    node->entries_tail = &(node->entries);
+  }
+
+  fuse_native_memfs_touch(node);
+  node->atime = node->mtime;
+
+  m->inodes++;
+  return node;
+}
+
+static void fuse_native_memfs_extents_free (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *node, size_t first) {
+  for (size_t i = first; i < node->extents_length; i++) {
+    if (node->extents[i] == NULL) continue;
+    free(node->extents[i]);
+    node->extents[i] = NULL;
+    node->bytes -= FUSE_NATIVE_MEMFS_EXTENT;
+    m->bytes -= FUSE_NATIVE_MEMFS_EXTENT;
+  }
+}
+
+// Frees the inode once nothing links to it and no handle has it open.
+static void fuse_native_memfs_inode_put (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *node) {
+  if (node->nlink > 0 || node->open > 0) return;
+
+  fuse_native_memfs_extents_free(m, node, 0);
+  free(node->extents);
+  free(node->target);
+
+  memset(node, 0, sizeof(fuse_native_memfs_inode_t));
+  node->free_next = m->free;
+  m->free = node;
+  m->inodes--;
+}
+
+static fuse_native_memfs_dirent_t** fuse_native_memfs_slot (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *dir, const char *name) {
+  size_t hash = fuse_native_hash(dir->ino, name);
+  fuse_native_memfs_dirent_t **slot = &(m->buckets[hash & (m->buckets_length - 1)]);
+  while (*slot != NULL && ((*slot)->parent != dir || strcmp((*slot)->name, name) != 0)) slot = &((*slot)->hash_next);
+  return slot;
+}
+
+static void fuse_native_memfs_grow (fuse_native_memfs_t *m) {
+  size_t length = m->buckets_length * 2;
+  fuse_native_memfs_dirent_t **buckets = calloc(length, sizeof(fuse_native_memfs_dirent_t *));
+  if (buckets == NULL) return; // Longer chains, still correct.
+
+  for (size_t i = 0; i < m->buckets_length; i++) {
+    fuse_native_memfs_dirent_t *e = m->buckets[i];
+    while (e != NULL) {
+      fuse_native_memfs_dirent_t *next = e->hash_next;
+      fuse_native_memfs_dirent_t **bucket = &(buckets[e->hash & (length - 1)]);
+      e->hash_next = *bucket;
+      *bucket = e;
+      e = next;
+    }
+  }
+
+  free(m->buckets);
+  m->buckets = buckets;
+  m->buckets_length = length;
+}
+
+static fuse_native_memfs_dirent_t* fuse_native_memfs_entry_new (const char *name) {
+  size_t len = strlen(name);
+  fuse_native_memfs_dirent_t *e = malloc(sizeof(fuse_native_memfs_dirent_t) + len + 1);
+  if (e != NULL) memcpy(e->name, name, len + 1);
+  return e;
+}
+
+static void fuse_native_memfs_entry_link (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *dir, fuse_native_memfs_dirent_t *e, fuse_native_memfs_inode_t *node) {
+  e->parent = dir;
+  e->inode = node;
+  e->hash = fuse_native_hash(dir->ino, e->name);
+
+  fuse_native_memfs_dirent_t **bucket = &(m->buckets[e->hash & (m->buckets_length - 1)]);
+  e->hash_next = *bucket;
+  *bucket = e;
+
+  // Readdir offsets, never reused so removing entries does not move the others. 1 and 2 are . and ..
+  e->cookie = 2 + ++(m->next_cookie);
+  e->next = NULL;
+  e->pprev = dir->entries_tail;
+  *(dir->entries_tail) = e;
+  dir->entries_tail = &(e->next);
+
+  // A subdirectory links back to its parent as "..".
+  if (S_ISDIR(node->mode)) dir->nlink++;
+  else node->nlink++;
+
+  if (++(m->entries) > m->buckets_length) fuse_native_memfs_grow(m);
+}
+
+static int fuse_native_memfs_entry_add (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *dir, const char *name, fuse_native_memfs_inode_t *node) {
+  fuse_native_memfs_dirent_t *e = fuse_native_memfs_entry_new(name);
+  if (e == NULL) return -ENOMEM;
+
+  fuse_native_memfs_entry_link(m, dir, e, node);
+  return 0;
+}
+
+// Drops the entry in slot, the caller puts the inode it pointed to.
+static fuse_native_memfs_inode_t* fuse_native_memfs_entry_remove (fuse_native_memfs_t *m, fuse_native_memfs_dirent_t **slot) {
+  fuse_native_memfs_dirent_t *e = *slot;
+  fuse_native_memfs_inode_t *node = e->inode;
+
+  *slot = e->hash_next;
+
+  *(e->pprev) = e->next;
+  if (e->next != NULL) e->next->pprev = e->pprev;
+  else e->parent->entries_tail = e->pprev;
+
+  if (S_ISDIR(node->mode)) e->parent->nlink--;
+  else node->nlink--;
+
+  free(e);
+  m->entries--;
+  return node;
+}
+
+// Finds the directory holding path, name gets its last component (empty for the root).
+static int fuse_native_memfs_parent (fuse_native_memfs_t *m, const char *path, fuse_native_memfs_inode_t **dir, char *name) {
+  fuse_native_memfs_inode_t *node = m->root;
+  name[0] = '\0';
+
+  while (1) {
+    while (*path == '/') path++;
+    if (*path == '\0') break;
+
+    const char *end = strchr(path, '/');
+    size_t len = end == NULL ? strlen(path) : (size_t) (end - path);
+    if (len > NAME_MAX) return -ENAMETOOLONG;
+
+    // Everything but the last component has to be a directory on the way.
+    if (name[0] != '\0') {
+      if (!S_ISDIR(node->mode)) return -ENOTDIR;
+      fuse_native_memfs_dirent_t *e = *fuse_native_memfs_slot(m, node, name);
+      if (e == NULL) return -ENOENT;
+      node = e->inode;
+    }
+
+    memcpy(name, path, len);
+    name[len] = '\0';
+    path += len;
+  }
+
+  if (!S_ISDIR(node->mode)) return -ENOTDIR;
+
+  *dir = node;
+  return 0;
+}
+
+static int fuse_native_memfs_resolve (fuse_native_memfs_t *m, const char *path, fuse_native_memfs_inode_t **node) {
+  fuse_native_memfs_inode_t *dir;
+  char name[NAME_MAX + 1];
+
+  int res = fuse_native_memfs_parent(m, path, &dir, name);
+  if (res < 0) return res;
+
+  if (name[0] == '\0') {
+    *node = dir;
+    return 0;
+  }
+
+  fuse_native_memfs_dirent_t *e = *fuse_native_memfs_slot(m, dir, name);
+  if (e == NULL) return -ENOENT;
+
+  *node = e->inode;
+  return 0;
+}
+
+static int fuse_native_memfs_data_read (fuse_native_memfs_inode_t *node, char *buf, size_t len, off_t offset) {
+  if (offset < 0 || (size_t) offset >= node->size) return 0;
+  if (len > node->size - offset) len = node->size - offset;
+
+  for (size_t done = 0; done < len;) {
+    size_t pos = offset + done;
+    size_t i = pos / FUSE_NATIVE_MEMFS_EXTENT;
+    size_t at = pos % FUSE_NATIVE_MEMFS_EXTENT;
+    size_t n = FUSE_NATIVE_MEMFS_EXTENT - at;
+    if (n > len - done) n = len - done;
+
+    if (i < node->extents_length && node->extents[i] != NULL) memcpy(buf + done, node->extents[i] + at, n);
+    else memset(buf + done, 0, n);
+
+    done += n;
+  }
+
+  return (int) len;
+}
+
+static int fuse_native_memfs_data_write (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *node, const char *buf, size_t len, off_t offset) {
+  if (len == 0) return 0;
+  if (offset < 0) return -EINVAL;
+
+  size_t end = offset + len;
+  size_t first = offset / FUSE_NATIVE_MEMFS_EXTENT;
+  size_t last = (end - 1) / FUSE_NATIVE_MEMFS_EXTENT;
+
+  if (last >= node->extents_length) {
+    size_t length = node->extents_length ? node->extents_length : 4;
+    while (length <= last) length *= 2;
+
+    char **extents = realloc(node->extents, length * sizeof(char *));
+    if (extents == NULL) return -ENOMEM;
+
+    memset(extents + node->extents_length, 0, (length - node->extents_length) * sizeof(char *));
+    node->extents = extents;
+    node->extents_length = length;
+  }
+
+  // Checked up front, so a write that does not fit changes nothing.
+  size_t missing = 0;
+  for (size_t i = first; i <= last; i++) {
+    if (node->extents[i] == NULL) missing++;
+  }
+  if (m->max_bytes > 0 && m->bytes + missing * FUSE_NATIVE_MEMFS_EXTENT > m->max_bytes) return -ENOSPC;
+
+  for (size_t i = first; i <= last; i++) {
+    if (node->extents[i] != NULL) continue;
+    node->extents[i] = calloc(1, FUSE_NATIVE_MEMFS_EXTENT);
+    if (node->extents[i] == NULL) return -ENOMEM;
+    node->bytes += FUSE_NATIVE_MEMFS_EXTENT;
+    m->bytes += FUSE_NATIVE_MEMFS_EXTENT;
+  }
+
+  for (size_t done = 0; done < len;) {
+    size_t pos = offset + done;
+    size_t at = pos % FUSE_NATIVE_MEMFS_EXTENT;
+    size_t n = FUSE_NATIVE_MEMFS_EXTENT - at;
+    if (n > len - done) n = len - done;
+
+    memcpy(node->extents[pos / FUSE_NATIVE_MEMFS_EXTENT] + at, buf + done, n);
+    done += n;
+  }
+
+  if (end > node->size) node->size = end;
+  fuse_native_memfs_touch(node);
+
+  return (int) len;
+}
+
+static void fuse_native_memfs_data_truncate (fuse_native_memfs_t *m, fuse_native_memfs_inode_t *node, size_t size) {
+  size_t keep = (size + FUSE_NATIVE_MEMFS_EXTENT - 1) / FUSE_NATIVE_MEMFS_EXTENT;
+  size_t tail = size % FUSE_NATIVE_MEMFS_EXTENT;
+
+  fuse_native_memfs_extents_free(m, node, keep);
+
+  // Past the end of a file always reads as zeros, should it grow again.
+  if (tail > 0 && keep - 1 < node->extents_length && node->extents[keep - 1] != NULL) {
+    memset(node->extents[keep - 1] + tail, 0, FUSE_NATIVE_MEMFS_EXTENT - tail);
+  }
+
+  node->size = size;
+  fuse_native_memfs_touch(node);
+}
+
+static int fuse_native_memfs_init (fuse_native_memfs_t *m, size_t max_bytes) {
+  memset(m, 0, sizeof(fuse_native_memfs_t));
+
+  m->buckets_length = FUSE_NATIVE_MEMFS_BUCKETS;
+  m->buckets = calloc(m->buckets_length, sizeof(fuse_native_memfs_dirent_t *));
+  if (m->buckets == NULL) return -ENOMEM;
+
+  m->root = fuse_native_memfs_inode_new(m, S_IFDIR | 0755, getuid(), getgid());
+  if (m->root == NULL) {
+    free(m->buckets);
+    return -ENOMEM;
+  }
+
+  m->max_bytes = max_bytes;
+  pthread_rwlock_init(&(m->lock), NULL);
+  m->enabled = 1;
+  return 0;
+}
+
+static void fuse_native_memfs_destroy (fuse_native_memfs_t *m) {
+  if (!m->enabled) return;
+  m->enabled = 0;
+
+  for (size_t i = 0; i < m->buckets_length; i++) {
+    fuse_native_memfs_dirent_t *e = m->buckets[i];
+    while (e != NULL) {
+      fuse_native_memfs_dirent_t *next = e->hash_next;
+      free(e);
+      e = next;
+    }
+  }
+  free(m->buckets);
+
+  // Inodes on the free list and the unused tail of the newest arena hold nothing.
+  while (m->arenas != NULL) {
+    fuse_native_memfs_arena_t *arena = m->arenas;
+    m->arenas = arena->next;
+
+    for (uint32_t i = 0; i < FUSE_NATIVE_MEMFS_ARENA; i++) {
+      fuse_native_memfs_inode_t *node = &(arena->inodes[i]);
+      for (size_t j = 0; j < node->extents_length; j++) free(node->extents[j]);
+      free(node->extents);
+      free(node->target);
+    }
+
+    free(arena);
+  }
+
+  pthread_rwlock_destroy(&(m->lock));
+}
+
+// Puts a file with data at path (a directory if dir is set), making the directories leading to it.
+// An existing file is overwritten.
+static int fuse_native_memfs_populate (fuse_native_memfs_t *m, const char *path, int dir, const char *data, size_t len, mode_t mode) {
+  fuse_native_memfs_inode_t *node = m->root;
+  char name[NAME_MAX + 1];
+
+  while (1) {
+    while (*path == '/') path++;
+    if (*path == '\0') break;
+
+    const char *end = strchr(path, '/');
+    size_t name_len = end == NULL ? strlen(path) : (size_t) (end - path);
+    if (name_len > NAME_MAX) return -ENAMETOOLONG;
+
+    memcpy(name, path, name_len);
+    name[name_len] = '\0';
+    path += name_len;
+    while (*path == '/') path++;
+
+    if (!S_ISDIR(node->mode)) return -ENOTDIR;
+
+    fuse_native_memfs_dirent_t *e = *fuse_native_memfs_slot(m, node, name);
+    if (e != NULL) {
+      node = e->inode;
+      continue;
+    }
+
+    int file = *path == '\0' && !dir;
+    mode_t perm = *path == '\0' && mode != 0 ? (mode & 07777) : (file ? 0644 : 0755);
+
+    fuse_native_memfs_inode_t *child = fuse_native_memfs_inode_new(m, (file ? S_IFREG : S_IFDIR) | perm, getuid(), getgid());
+    if (child == NULL) return -ENOMEM;
+
+    if (fuse_native_memfs_entry_add(m, node, name, child) < 0) {
+      if (S_ISDIR(child->mode)) child->nlink = 0;
+      fuse_native_memfs_inode_put(m, child);
+      return -ENOMEM;
+    }
+
+    fuse_native_memfs_touch(node);
+    node = child;
+  }
+
+  if (dir) return S_ISDIR(node->mode) ? 0 : -EEXIST;
+  if (!S_ISREG(node->mode)) return -EISDIR;
+
+  fuse_native_memfs_data_truncate(m, node, 0);
+  int res = fuse_native_memfs_data_write(m, node, data, len, 0);
+  return res < 0 ? res : 0;
+}
+
+// Passthrough
+// A mount with a backing directory serves every op from it on the FUSE thread, on paths relative to the
+// directory and with real file descriptors as file handles, so file data is spliced between the backing file
+// and /dev/fuse without a copy. Ops JS implements are still called for the intercepted paths (all of them
+// unless a list of prefixes was given). Which side opened a file decides which side serves the ops on it.
+
+// Memory mounts intercept the same way, without a backing directory.
+static int fuse_native_passthrough_init (napi_env env, fuse_native_passthrough_t *p, const char *root, napi_value intercept, int memory) {
+  p->enabled = 0;
+  p->dirfd = -1;
+  p->root[0] = '\0';
+  p->intercept = NULL;
+  p->intercept_lengths = NULL;
+  p->intercept_length = 0;
+
+  if (*root == '\0' && !memory) return 0;
+
+  if (*root != '\0') {
+    strncpy(p->root, root, PATH_MAX - 1);
+    p->root[PATH_MAX - 1] = '\0';
+
+    p->dirfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (p->dirfd < 0) return -errno;
+  }
+
+  uint32_t length;
+  napi_get_array_length(env, intercept, &length);
+  p->intercept = calloc(length + 1, sizeof(char *));
+  p->intercept_lengths = calloc(length + 1, sizeof(size_t));
+
+  if (p->intercept == NULL || p->intercept_lengths == NULL) {
+    free(p->intercept);
+    free(p->intercept_lengths);
+    if (p->dirfd >= 0) close(p->dirfd);
+    p->dirfd = -1;
+    return -ENOMEM;
+  }
+
+  // Prefixes come without a trailing slash, so the root is the empty string.
+  NAPI_FOR_EACH(intercept, prefix) {
+    size_t len;
+    napi_get_value_string_utf8(env, prefix, NULL, 0, &len);
+    char *str = malloc(len + 1);
+    if (str == NULL) continue;
+    napi_get_value_string_utf8(env, prefix, str, len + 1, &len);
+    p->intercept[p->intercept_length] = str;
+    p->intercept_lengths[p->intercept_length++] = len;
+  }
+
+  p->enabled = 1;
+  return 0;
+}
+
+static void fuse_native_passthrough_destroy (fuse_native_passthrough_t *p) {
+  if (!p->enabled) return;
+  p->enabled = 0;
+
+  for (uint32_t i = 0; i < p->intercept_length; i++) free(p->intercept[i]);
+  free(p->intercept);
+  free(p->intercept_lengths);
+  p->intercept = NULL;
+  p->intercept_lengths = NULL;
+  p->intercept_length = 0;
+
+  if (p->dirfd >= 0) close(p->dirfd);
+  p->dirfd = -1;
+}
+
+#ifdef __linux__
+
+// Open directories of the backing directory, readdir resumes from the entry that did not fit last time.
+typedef struct {
+  DIR *dp;
+  struct dirent *entry;
+  off_t offset;
+} fuse_native_passthrough_dir_t;
+
+static fuse_thread_t* fuse_native_passthrough_mount () {
+  return (fuse_thread_t *) fuse_get_context()->private_data;
+}
+
+// Paths relative to the backing directory, "." for its root.
+static const char* fuse_native_passthrough_path (const char *path) {
+  while (*path == '/') path++;
+  return *path == '\0' ? "." : path;
+}
+
+static int fuse_native_passthrough_intercepts (fuse_thread_t *ft, const char *path) {
+  fuse_native_passthrough_t *p = &(ft->passthrough);
+
+  for (uint32_t i = 0; i < p->intercept_length; i++) {
+    size_t len = p->intercept_lengths[i];
+    if (strncmp(path, p->intercept[i], len) == 0 && (path[len] == '\0' || path[len] == '/')) return 1;
+  }
+
+  return 0;
+}
+
+static int fuse_native_passthrough_js (fuse_thread_t *ft, uint32_t op, const char *path) {
+  return ft->implemented[op] && fuse_native_passthrough_intercepts(ft, path);
+}
+
+// JS opens the files of an intercepted path as soon as it implements any op on their data.
+static int fuse_native_passthrough_js_file (fuse_thread_t *ft, const char *path) {
+  uint32_t *impl = ft->implemented;
+  if (!(impl[op_open] || impl[op_read] || impl[op_readbuf] || impl[op_write] || impl[op_writebuf])) return 0;
+  return fuse_native_passthrough_intercepts(ft, path);
+}
+
+static int fuse_native_passthrough_owned (struct fuse_file_info *info) {
+  return info != NULL && (info->fh & FUSE_NATIVE_PASSTHROUGH_FH) != 0;
+}
+
+static int fuse_native_passthrough_fd (struct fuse_file_info *info) {
+  return (int) (info->fh & ~FUSE_NATIVE_PASSTHROUGH_FH);
+}
+
+static fuse_native_passthrough_dir_t* fuse_native_passthrough_dir (struct fuse_file_info *info) {
+  return (fuse_native_passthrough_dir_t *) (uintptr_t) (info->fh & ~FUSE_NATIVE_PASSTHROUGH_FH);
+}
+
+static int fuse_native_passthrough_res (int res) {
+  return res < 0 ? -errno : 0;
+}
+
+// Native changes the attr cache may have seen JS stats of.
+static void fuse_native_passthrough_changed (fuse_thread_t *ft, const char *path) {
+  fuse_native_attr_cache_invalidate(&(ft->attr_cache), path);
+}
+
+// Calls the JS op on intercepted paths, sets up base and rel for the native one otherwise.
+#define FUSE_NATIVE_PASSTHROUGH_PATH(name, path, ...)\
+  fuse_thread_t *ft = fuse_native_passthrough_mount();\
+  if (fuse_native_passthrough_js(ft, op_##name, path)) return fuse_native_##name(__VA_ARGS__);\
+  int base = ft->passthrough.dirfd;\
+  const char *rel = fuse_native_passthrough_path(path);
+
+// Calls the JS op (or returns fallback) on handles JS opened, sets up fd for the native one otherwise.
+#define FUSE_NATIVE_PASSTHROUGH_HANDLE(name, info, fallback, ...)\
+  fuse_thread_t *ft = fuse_native_passthrough_mount();\
+  if (!fuse_native_passthrough_owned(info)) return ft->implemented[op_##name] ? fuse_native_##name(__VA_ARGS__) : (fallback);\
+  int fd = fuse_native_passthrough_fd(info);
+
+static int fuse_native_passthrough_getattr (const char *path, struct stat *stat) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(getattr, path, path, stat)
+  return fuse_native_passthrough_res(fstatat(base, rel, stat, AT_SYMLINK_NOFOLLOW));
+}
+
+static int fuse_native_passthrough_fgetattr (const char *path, struct stat *stat, struct fuse_file_info *info) {
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(fgetattr, info, fuse_native_passthrough_getattr(path, stat), path, stat, info)
+  return fuse_native_passthrough_res(fstat(fd, stat));
+}
+
+// Checked against the daemon's credentials, the caller's were checked by the kernel (default_permissions).
+static int fuse_native_passthrough_access (const char *path, int mode) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(access, path, path, mode)
+  return fuse_native_passthrough_res(faccessat(base, rel, mode, 0));
+}
+
+static int fuse_native_passthrough_readlink (const char *path, char *linkname, size_t len) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(readlink, path, path, linkname, len)
+  ssize_t n = readlinkat(base, rel, linkname, len - 1);
+  if (n < 0) return -errno;
+  linkname[n] = '\0';
+  return 0;
+}
+
+static int fuse_native_passthrough_mknod (const char *path, mode_t mode, dev_t dev) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(mknod, path, path, mode, dev)
+  fuse_native_passthrough_changed(ft, path);
+
+  int res;
+  if (S_ISREG(mode)) {
+    res = openat(base, rel, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, mode);
+    if (res >= 0) res = close(res);
+  } else if (S_ISFIFO(mode)) {
+    res = mkfifoat(base, rel, mode);
+  } else {
+    res = mknodat(base, rel, mode, dev);
+  }
+
+  return fuse_native_passthrough_res(res);
+}
+
+static int fuse_native_passthrough_mkdir (const char *path, mode_t mode) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(mkdir, path, path, mode)
+  fuse_native_passthrough_changed(ft, path);
+  return fuse_native_passthrough_res(mkdirat(base, rel, mode));
+}
+
+static int fuse_native_passthrough_unlink (const char *path) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(unlink, path, path)
+  fuse_native_passthrough_changed(ft, path);
+  return fuse_native_passthrough_res(unlinkat(base, rel, 0));
+}
+
+static int fuse_native_passthrough_rmdir (const char *path) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(rmdir, path, path)
+  fuse_native_passthrough_changed(ft, path);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), path);
+  return fuse_native_passthrough_res(unlinkat(base, rel, AT_REMOVEDIR));
+}
+
+static int fuse_native_passthrough_symlink (const char *path, const char *dest) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(symlink, dest, path, dest)
+  fuse_native_passthrough_changed(ft, dest);
+  return fuse_native_passthrough_res(symlinkat(path, base, rel));
+}
+
+// Renames and links go to JS if either side is intercepted.
+static int fuse_native_passthrough_rename (const char *path, const char *dest) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  if (ft->implemented[op_rename] && (fuse_native_passthrough_intercepts(ft, path) || fuse_native_passthrough_intercepts(ft, dest))) return fuse_native_rename(path, dest);
+
+  fuse_native_passthrough_changed(ft, path);
+  fuse_native_passthrough_changed(ft, dest);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), path);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), dest);
+
+  int base = ft->passthrough.dirfd;
+  return fuse_native_passthrough_res(renameat(base, fuse_native_passthrough_path(path), base, fuse_native_passthrough_path(dest)));
+}
+
+static int fuse_native_passthrough_link (const char *path, const char *dest) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  if (ft->implemented[op_link] && (fuse_native_passthrough_intercepts(ft, path) || fuse_native_passthrough_intercepts(ft, dest))) return fuse_native_link(path, dest);
+
+  fuse_native_passthrough_changed(ft, path);
+  fuse_native_passthrough_changed(ft, dest);
+
+  int base = ft->passthrough.dirfd;
+  return fuse_native_passthrough_res(linkat(base, fuse_native_passthrough_path(path), base, fuse_native_passthrough_path(dest), 0));
+}
+
+static int fuse_native_passthrough_chmod (const char *path, mode_t mode) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(chmod, path, path, mode)
+  fuse_native_passthrough_changed(ft, path);
+  return fuse_native_passthrough_res(fchmodat(base, rel, mode, 0));
+}
+
+static int fuse_native_passthrough_chown (const char *path, uid_t uid, gid_t gid) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(chown, path, path, uid, gid)
+  fuse_native_passthrough_changed(ft, path);
+  return fuse_native_passthrough_res(fchownat(base, rel, uid, gid, AT_SYMLINK_NOFOLLOW));
+}
+
+static int fuse_native_passthrough_truncate (const char *path, off_t size) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(truncate, path, path, size)
+  fuse_native_passthrough_changed(ft, path);
+
+  int fd = openat(base, rel, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return -errno;
+
+  int res = fuse_native_passthrough_res(ftruncate(fd, size));
+  close(fd);
+  return res;
+}
+
+static int fuse_native_passthrough_ftruncate (const char *path, off_t size, struct fuse_file_info *info) {
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(ftruncate, info, fuse_native_passthrough_truncate(path, size), path, size, info)
+  fuse_native_passthrough_changed(ft, path);
+  return fuse_native_passthrough_res(ftruncate(fd, size));
+}
+
+static int fuse_native_passthrough_utimens (const char *path, const struct timespec tv[2]) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(utimens, path, path, tv)
+  fuse_native_passthrough_changed(ft, path);
+  return fuse_native_passthrough_res(utimensat(base, rel, tv, AT_SYMLINK_NOFOLLOW));
+}
+
+static int fuse_native_passthrough_open (const char *path, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  // Without ops.open the file handle is left at 0, the other ops on it still go to JS.
+  if (fuse_native_passthrough_js_file(ft, path)) return ft->implemented[op_open] ? fuse_native_open(path, info) : 0;
+
+  int fd = openat(ft->passthrough.dirfd, fuse_native_passthrough_path(path), info->flags | O_CLOEXEC);
+  if (fd < 0) return -errno;
+
+  info->fh = FUSE_NATIVE_PASSTHROUGH_FH | (uint64_t) fd;
+  return 0;
+}
+
+static int fuse_native_passthrough_create (const char *path, mode_t mode, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  // Failing create makes the kernel stop sending it for the whole mount, so without ops.create JS gets a
+  // mknod and an open instead, like libfuse does for filesystems that do not implement it.
+  if (fuse_native_passthrough_js_file(ft, path)) {
+    if (ft->implemented[op_create]) return fuse_native_create(path, mode, info);
+    int res = fuse_native_passthrough_mknod(path, (mode & 07777) | S_IFREG, 0);
+    return res < 0 ? res : fuse_native_passthrough_open(path, info);
+  }
+
+  fuse_native_passthrough_changed(ft, path);
+
+  int fd = openat(ft->passthrough.dirfd, fuse_native_passthrough_path(path), info->flags | O_CREAT | O_CLOEXEC, mode);
+  if (fd < 0) return -errno;
+
+  info->fh = FUSE_NATIVE_PASSTHROUGH_FH | (uint64_t) fd;
+  return 0;
+}
+
+// A reply of len bytes of memory, libfuse frees both once it is sent.
+static struct fuse_bufvec* fuse_native_passthrough_mem_bufvec (size_t len) {
+  struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec));
+  char *mem = malloc(len > 0 ? len : 1);
+
+  if (bufv == NULL || mem == NULL) {
+    free(bufv);
+    free(mem);
+    return NULL;
+  }
+
+  *bufv = FUSE_BUFVEC_INIT(len);
+  bufv->buf[0].mem = mem;
+  return bufv;
+}
+
+// The data of a write in memory, it may still be in a pipe. Returns NULL with the error in len.
+static char* fuse_native_passthrough_buf_copy (struct fuse_bufvec *buf, ssize_t *len) {
+  size_t size = fuse_buf_size(buf);
+  char *mem = malloc(size > 0 ? size : 1);
+
+  if (mem == NULL) {
+    *len = -ENOMEM;
+    return NULL;
+  }
+
+  struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+  dst.buf[0].mem = mem;
+
+  *len = fuse_buf_copy(&dst, buf, 0);
+  if (*len >= 0) return mem;
+
+  free(mem);
+  return NULL;
+}
+
+// Reads and writes on handles JS opened, with ops.read and ops.write standing in for the buffer ops.
+static int fuse_native_passthrough_read_js (const char *path, struct fuse_bufvec **bufp, size_t len, off_t offset, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  if (ft->implemented[op_readbuf]) return fuse_native_readbuf(path, bufp, len, offset, info);
+  if (!ft->implemented[op_read]) return -ENOSYS;
+
+  struct fuse_bufvec *bufv = fuse_native_passthrough_mem_bufvec(len);
+  if (bufv == NULL) return -ENOMEM;
+
+  int res = fuse_native_read(path, bufv->buf[0].mem, len, offset, info);
+
+  if (res < 0) {
+    free(bufv->buf[0].mem);
+    free(bufv);
+    return res;
+  }
+
+  bufv->buf[0].size = res;
+  *bufp = bufv;
+  return 0;
+}
+
+static int fuse_native_passthrough_write_js (const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  if (ft->implemented[op_writebuf]) return fuse_native_write_buf(path, buf, offset, info);
+  if (!ft->implemented[op_write]) return -ENOSYS;
+
+  ssize_t len;
+  char *mem = fuse_native_passthrough_buf_copy(buf, &len);
+  if (mem == NULL) return (int) len;
+
+  int res = fuse_native_write(path, mem, (size_t) len, offset, info);
+  free(mem);
+  return res;
+}
+
+// The reply references the backing file, libfuse splices it into /dev/fuse.
+static int fuse_native_passthrough_read_buf (const char *path, struct fuse_bufvec **bufp, size_t len, off_t offset, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_read_js(path, bufp, len, offset, info);
+
+  struct fuse_bufvec *bufv = malloc(sizeof(struct fuse_bufvec));
+  if (bufv == NULL) return -ENOMEM;
+
+  *bufv = FUSE_BUFVEC_INIT(len);
+  bufv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+  bufv->buf[0].fd = fuse_native_passthrough_fd(info);
+  bufv->buf[0].pos = offset;
+
+  *bufp = bufv;
+  return 0;
+}
+
+static int fuse_native_passthrough_write_buf (const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_write_js(path, buf, offset, info);
+
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  fuse_native_attr_cache_del(&(ft->attr_cache), path);
+
+  struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+  dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+  dst.buf[0].fd = fuse_native_passthrough_fd(info);
+  dst.buf[0].pos = offset;
+
+  return (int) fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+}
+
+static int fuse_native_passthrough_statfs (const char *path, struct statvfs *statvfs) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(statfs, path, path, statvfs)
+  (void) rel;
+  return fuse_native_passthrough_res(fstatvfs(base, statvfs));
+}
+
+// Flush, fsync and release of JS handles always reach fuse_native_*, which send out write-back extents.
+static int fuse_native_passthrough_flush (const char *path, struct fuse_file_info *info) {
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(flush, info, fuse_native_flush(path, info), path, info)
+  // Closing a duplicate reports the errors close(2) of the backing file would, without closing it.
+  return fuse_native_passthrough_res(close(dup(fd)));
+}
+
+static int fuse_native_passthrough_release (const char *path, struct fuse_file_info *info) {
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(release, info, fuse_native_release(path, info), path, info)
+  close(fd);
+  return 0;
+}
+
+static int fuse_native_passthrough_fsync (const char *path, int datasync, struct fuse_file_info *info) {
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(fsync, info, fuse_native_fsync(path, datasync, info), path, datasync, info)
+  return fuse_native_passthrough_res(datasync ? fdatasync(fd) : fsync(fd));
+}
+
+static int fuse_native_passthrough_opendir (const char *path, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  if (fuse_native_passthrough_intercepts(ft, path) && (ft->implemented[op_opendir] || ft->implemented[op_readdir])) {
+    return fuse_native_dir_opendir(path, info);
+  }
+
+  fuse_native_passthrough_dir_t *d = calloc(1, sizeof(fuse_native_passthrough_dir_t));
+  if (d == NULL) return -ENOMEM;
+
+  int fd = openat(ft->passthrough.dirfd, fuse_native_passthrough_path(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd >= 0) d->dp = fdopendir(fd);
+
+  if (d->dp == NULL) {
+    int err = -errno;
+    if (fd >= 0) close(fd);
+    free(d);
+    return err;
+  }
+
+  info->fh = FUSE_NATIVE_PASSTHROUGH_FH | (uint64_t) (uintptr_t) d;
+  return 0;
+}
+
+static int fuse_native_passthrough_readdir (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_mount()->implemented[op_readdir] ? fuse_native_dir_readdir(path, buf, filler, offset, info) : -ENOSYS;
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(readdir, info, -ENOSYS, path, buf, filler, offset, info)
+  (void) fd;
+  fuse_native_passthrough_dir_t *d = fuse_native_passthrough_dir(info);
+
+  if (offset != d->offset) {
+    seekdir(d->dp, offset);
+    d->entry = NULL;
+    d->offset = offset;
+  }
+
+  while (1) {
+    if (d->entry == NULL) {
+      d->entry = readdir(d->dp);
+      if (d->entry == NULL) break;
+    }
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = d->entry->d_ino;
+    st.st_mode = d->entry->d_type << 12;
+
+    off_t next = telldir(d->dp);
+    if (filler(buf, d->entry->d_name, &st, next)) break;
+
+    d->entry = NULL;
+    d->offset = next;
+  }
+
+  return 0;
+}
+
+static int fuse_native_passthrough_releasedir (const char *path, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_dir_releasedir(path, info);
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(releasedir, info, 0, path, info)
+  (void) fd;
+  fuse_native_passthrough_dir_t *d = fuse_native_passthrough_dir(info);
+  closedir(d->dp);
+  free(d);
+  return 0;
+}
+
+static int fuse_native_passthrough_fsyncdir (const char *path, int datasync, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_mount()->implemented[op_fsyncdir] ? fuse_native_dir_fsyncdir(path, datasync, info) : 0;
+  FUSE_NATIVE_PASSTHROUGH_HANDLE(fsyncdir, info, 0, path, datasync, info)
+  (void) fd;
+  int dir = dirfd(fuse_native_passthrough_dir(info)->dp);
+  return fuse_native_passthrough_res(datasync ? fdatasync(dir) : fsync(dir));
+}
+
+// Xattrs have no *at variants, they go through the absolute path of the backing file.
+static int fuse_native_passthrough_real_path (fuse_thread_t *ft, const char *path, char *real) {
+  int n = snprintf(real, PATH_MAX, "%s%s", ft->passthrough.root, path);
+  return n < 0 || n >= PATH_MAX ? -ENAMETOOLONG : 0;
+}
+
+static int fuse_native_passthrough_setxattr (const char *path, const char *name, const char *value, size_t size, int flags) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(setxattr, path, path, name, value, size, flags)
+  (void) base;
+  (void) rel;
+  char real[PATH_MAX];
+  int err = fuse_native_passthrough_real_path(ft, path, real);
+  if (err < 0) return err;
+  return fuse_native_passthrough_res(lsetxattr(real, name, value, size, flags));
+}
+
+static int fuse_native_passthrough_getxattr (const char *path, const char *name, char *value, size_t size) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(getxattr, path, path, name, value, size)
+  (void) base;
+  (void) rel;
+  char real[PATH_MAX];
+  int err = fuse_native_passthrough_real_path(ft, path, real);
+  if (err < 0) return err;
+  ssize_t n = lgetxattr(real, name, value, size);
+  return n < 0 ? -errno : (int) n;
+}
+
+static int fuse_native_passthrough_listxattr (const char *path, char *list, size_t size) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(listxattr, path, path, list, size)
+  (void) base;
+  (void) rel;
+  char real[PATH_MAX];
+  int err = fuse_native_passthrough_real_path(ft, path, real);
+  if (err < 0) return err;
+  ssize_t n = llistxattr(real, list, size);
+  return n < 0 ? -errno : (int) n;
+}
+
+static int fuse_native_passthrough_removexattr (const char *path, const char *name) {
+  FUSE_NATIVE_PASSTHROUGH_PATH(removexattr, path, path, name)
+  (void) base;
+  (void) rel;
+  char real[PATH_MAX];
+  int err = fuse_native_passthrough_real_path(ft, path, real);
+  if (err < 0) return err;
+  return fuse_native_passthrough_res(lremovexattr(real, name));
+}
+
+static void fuse_native_passthrough_ops (struct fuse_operations *ops) {
+  ops->getattr = fuse_native_passthrough_getattr;
+  ops->fgetattr = fuse_native_passthrough_fgetattr;
+  ops->access = fuse_native_passthrough_access;
+  ops->readlink = fuse_native_passthrough_readlink;
+  ops->mknod = fuse_native_passthrough_mknod;
+  ops->mkdir = fuse_native_passthrough_mkdir;
+  ops->unlink = fuse_native_passthrough_unlink;
+  ops->rmdir = fuse_native_passthrough_rmdir;
+  ops->symlink = fuse_native_passthrough_symlink;
+  ops->rename = fuse_native_passthrough_rename;
+  ops->link = fuse_native_passthrough_link;
+  ops->chmod = fuse_native_passthrough_chmod;
+  ops->chown = fuse_native_passthrough_chown;
+  ops->truncate = fuse_native_passthrough_truncate;
+  ops->ftruncate = fuse_native_passthrough_ftruncate;
+  ops->utimens = fuse_native_passthrough_utimens;
+  ops->open = fuse_native_passthrough_open;
+  ops->create = fuse_native_passthrough_create;
+  ops->read = NULL;
+  ops->read_buf = fuse_native_passthrough_read_buf;
+  ops->write = NULL;
+  ops->write_buf = fuse_native_passthrough_write_buf;
+  ops->statfs = fuse_native_passthrough_statfs;
+  ops->flush = fuse_native_passthrough_flush;
+  ops->release = fuse_native_passthrough_release;
+  ops->fsync = fuse_native_passthrough_fsync;
+  ops->opendir = fuse_native_passthrough_opendir;
+  ops->readdir = fuse_native_passthrough_readdir;
+  ops->releasedir = fuse_native_passthrough_releasedir;
+  ops->fsyncdir = fuse_native_passthrough_fsyncdir;
+  ops->setxattr = fuse_native_passthrough_setxattr;
+  ops->getxattr = fuse_native_passthrough_getxattr;
+  ops->listxattr = fuse_native_passthrough_listxattr;
+  ops->removexattr = fuse_native_passthrough_removexattr;
+}
+
+// The memory filesystem behind the same intercepts, native handles point at the open inode.
+
+#define FUSE_NATIVE_MEMFS_PATH(name, path, ...)\
+  fuse_thread_t *ft = fuse_native_passthrough_mount();\
+  if (fuse_native_passthrough_js(ft, op_##name, path)) return fuse_native_##name(__VA_ARGS__);\
+  fuse_native_memfs_t *m = &(ft->memfs);
+
+#define FUSE_NATIVE_MEMFS_HANDLE(name, info, fallback, ...)\
+  fuse_thread_t *ft = fuse_native_passthrough_mount();\
+  if (!fuse_native_passthrough_owned(info)) return ft->implemented[op_##name] ? fuse_native_##name(__VA_ARGS__) : (fallback);\
+  fuse_native_memfs_t *m = &(ft->memfs);\
+  fuse_native_memfs_inode_t *node = (fuse_native_memfs_inode_t *) (uintptr_t) (info->fh & ~FUSE_NATIVE_PASSTHROUGH_FH);
+
+static void fuse_native_memfs_stat (fuse_native_memfs_inode_t *node, struct stat *stat) {
+  memset(stat, 0, sizeof(struct stat));
+  stat->st_ino = node->ino;
+  stat->st_mode = node->mode;
+  stat->st_nlink = node->nlink;
+  stat->st_uid = node->uid;
+  stat->st_gid = node->gid;
+  stat->st_rdev = node->rdev;
+  stat->st_size = node->size;
+  stat->st_blksize = 4096;
+  stat->st_blocks = node->bytes / 512;
+  stat->st_atim = node->atime;
+  stat->st_mtim = node->mtime;
+  stat->st_ctim = node->ctime;
+}
+
+static void fuse_native_memfs_hold (fuse_native_memfs_inode_t *node, struct fuse_file_info *info) {
+  node->open++;
+  info->fh = FUSE_NATIVE_PASSTHROUGH_FH | (uint64_t) (uintptr_t) node;
+}
+
+// Makes a new inode at path, owned by the caller. Called with the lock held for writing.
+static int fuse_native_memfs_make (fuse_native_memfs_t *m, const char *path, mode_t mode, dev_t dev, const char *target, fuse_native_memfs_inode_t **result) {
+  fuse_native_memfs_inode_t *dir;
+  char name[NAME_MAX + 1];
+
+  int res = fuse_native_memfs_parent(m, path, &dir, name);
+  if (res < 0) return res;
+  if (name[0] == '\0' || *fuse_native_memfs_slot(m, dir, name) != NULL) return -EEXIST;
+
+  struct fuse_context *ctx = fuse_get_context();
+  fuse_native_memfs_inode_t *node = fuse_native_memfs_inode_new(m, mode, ctx->uid, ctx->gid);
+  if (node == NULL) return -ENOMEM;
+
+  node->rdev = dev;
+
+  if (target != NULL) {
+    node->target = strdup(target);
+    node->size = strlen(target);
+  }
+
+  if ((target != NULL && node->target == NULL) || fuse_native_memfs_entry_add(m, dir, name, node) < 0) {
+    if (S_ISDIR(mode)) node->nlink = 0;
+    fuse_native_memfs_inode_put(m, node);
+    return -ENOMEM;
+  }
+
+  fuse_native_memfs_touch(dir);
+  if (result != NULL) *result = node;
+  return 0;
+}
+
+static int fuse_native_memfs_getattr (const char *path, struct stat *stat) {
+  FUSE_NATIVE_MEMFS_PATH(getattr, path, path, stat)
+  fuse_native_memfs_inode_t *node;
+
+  pthread_rwlock_rdlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0) fuse_native_memfs_stat(node, stat);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_fgetattr (const char *path, struct stat *stat, struct fuse_file_info *info) {
+  FUSE_NATIVE_MEMFS_HANDLE(fgetattr, info, fuse_native_memfs_getattr(path, stat), path, stat, info)
+
+  pthread_rwlock_rdlock(&(m->lock));
+  fuse_native_memfs_stat(node, stat);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return 0;
+}
+
+// Memory mounts always run with default_permissions, the kernel checks the mode, this only tells whether path exists.
+static int fuse_native_memfs_access (const char *path, int mode) {
+  FUSE_NATIVE_MEMFS_PATH(access, path, path, mode)
+  fuse_native_memfs_inode_t *node;
+
+  pthread_rwlock_rdlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_readlink (const char *path, char *linkname, size_t len) {
+  FUSE_NATIVE_MEMFS_PATH(readlink, path, path, linkname, len)
+  fuse_native_memfs_inode_t *node;
+
+  pthread_rwlock_rdlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0 && node->target == NULL) res = -EINVAL;
+  if (res == 0) {
+    strncpy(linkname, node->target, len - 1);
+    linkname[len - 1] = '\0';
+  }
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_mknod (const char *path, mode_t mode, dev_t dev) {
+  FUSE_NATIVE_MEMFS_PATH(mknod, path, path, mode, dev)
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_make(m, path, mode, dev, NULL, NULL);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_mkdir (const char *path, mode_t mode) {
+  FUSE_NATIVE_MEMFS_PATH(mkdir, path, path, mode)
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_make(m, path, S_IFDIR | (mode & 07777), 0, NULL, NULL);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_symlink (const char *path, const char *dest) {
+  FUSE_NATIVE_MEMFS_PATH(symlink, dest, path, dest)
+  fuse_native_passthrough_changed(ft, dest);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_make(m, dest, S_IFLNK | 0777, 0, path, NULL);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+// Unlink and rmdir, dir tells which one.
+static int fuse_native_memfs_remove (fuse_native_memfs_t *m, const char *path, int dir) {
+  fuse_native_memfs_inode_t *parent;
+  char name[NAME_MAX + 1];
+
+  int res = fuse_native_memfs_parent(m, path, &parent, name);
+  if (res < 0) return res;
+  if (name[0] == '\0') return -EBUSY;
+
+  fuse_native_memfs_dirent_t **slot = fuse_native_memfs_slot(m, parent, name);
+  if (*slot == NULL) return -ENOENT;
+
+  fuse_native_memfs_inode_t *node = (*slot)->inode;
+  if (dir && !S_ISDIR(node->mode)) return -ENOTDIR;
+  if (!dir && S_ISDIR(node->mode)) return -EISDIR;
+  if (dir && node->entries != NULL) return -ENOTEMPTY;
+
+  fuse_native_memfs_entry_remove(m, slot);
+  if (dir) node->nlink = 0;
+
+  fuse_native_memfs_now(&(node->ctime));
+  fuse_native_memfs_touch(parent);
+  fuse_native_memfs_inode_put(m, node);
+
+  return 0;
+}
+
+static int fuse_native_memfs_unlink (const char *path) {
+  FUSE_NATIVE_MEMFS_PATH(unlink, path, path)
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_remove(m, path, 0);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_rmdir (const char *path) {
+  FUSE_NATIVE_MEMFS_PATH(rmdir, path, path)
+  fuse_native_passthrough_changed(ft, path);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_remove(m, path, 1);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_move (fuse_native_memfs_t *m, const char *path, const char *dest) {
+  fuse_native_memfs_inode_t *from;
+  fuse_native_memfs_inode_t *to;
+  char name[NAME_MAX + 1];
+  char dest_name[NAME_MAX + 1];
+
+  int res = fuse_native_memfs_parent(m, path, &from, name);
+  if (res < 0) return res;
+  res = fuse_native_memfs_parent(m, dest, &to, dest_name);
+  if (res < 0) return res;
+  if (name[0] == '\0' || dest_name[0] == '\0') return -EBUSY;
+
+  fuse_native_memfs_dirent_t **slot = fuse_native_memfs_slot(m, from, name);
+  if (*slot == NULL) return -ENOENT;
+
+  fuse_native_memfs_inode_t *node = (*slot)->inode;
+
+  // A directory cannot move into itself.
+  size_t len = strlen(path);
+  if (S_ISDIR(node->mode) && strncmp(dest, path, len) == 0 && dest[len] == '/') return -EINVAL;
+
+  fuse_native_memfs_dirent_t **dest_slot = fuse_native_memfs_slot(m, to, dest_name);
+  fuse_native_memfs_inode_t *replaced = *dest_slot != NULL ? (*dest_slot)->inode : NULL;
+
+  if (replaced != NULL) {
+    if (replaced == node) return 0;
+    if (S_ISDIR(node->mode) && !S_ISDIR(replaced->mode)) return -ENOTDIR;
+    if (!S_ISDIR(node->mode) && S_ISDIR(replaced->mode)) return -EISDIR;
+    if (S_ISDIR(replaced->mode) && replaced->entries != NULL) return -ENOTEMPTY;
+  }
+
+  // The only allocation goes first, a rename that fails leaves both paths as they were.
+  fuse_native_memfs_dirent_t *e = fuse_native_memfs_entry_new(dest_name);
+  if (e == NULL) return -ENOMEM;
+
+  if (replaced != NULL) {
+    fuse_native_memfs_entry_remove(m, dest_slot);
+    if (S_ISDIR(replaced->mode)) replaced->nlink = 0;
+    fuse_native_memfs_inode_put(m, replaced);
+  }
+
+  fuse_native_memfs_entry_link(m, to, e, node);
+
+  // Linking may have moved the old entry to another bucket.
+  fuse_native_memfs_entry_remove(m, fuse_native_memfs_slot(m, from, name));
+
+  fuse_native_memfs_now(&(node->ctime));
+  fuse_native_memfs_touch(from);
+  fuse_native_memfs_touch(to);
+
+  return 0;
+}
+
+static int fuse_native_memfs_rename (const char *path, const char *dest) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  if (ft->implemented[op_rename] && (fuse_native_passthrough_intercepts(ft, path) || fuse_native_passthrough_intercepts(ft, dest))) return fuse_native_rename(path, dest);
+
+  fuse_native_memfs_t *m = &(ft->memfs);
+
+  fuse_native_passthrough_changed(ft, path);
+  fuse_native_passthrough_changed(ft, dest);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), path);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), dest);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_move(m, path, dest);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_link (const char *path, const char *dest) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  if (ft->implemented[op_link] && (fuse_native_passthrough_intercepts(ft, path) || fuse_native_passthrough_intercepts(ft, dest))) return fuse_native_link(path, dest);
+
+  fuse_native_memfs_t *m = &(ft->memfs);
+  fuse_native_memfs_inode_t *node;
+  fuse_native_memfs_inode_t *dir;
+  char name[NAME_MAX + 1];
+
+  fuse_native_passthrough_changed(ft, path);
+  fuse_native_passthrough_changed(ft, dest);
+
+  pthread_rwlock_wrlock(&(m->lock));
+
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0 && S_ISDIR(node->mode)) res = -EPERM;
+  if (res == 0) res = fuse_native_memfs_parent(m, dest, &dir, name);
+  if (res == 0 && (name[0] == '\0' || *fuse_native_memfs_slot(m, dir, name) != NULL)) res = -EEXIST;
+  if (res == 0) res = fuse_native_memfs_entry_add(m, dir, name, node);
+
+  if (res == 0) {
+    fuse_native_memfs_now(&(node->ctime));
+    fuse_native_memfs_touch(dir);
+  }
+
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_chmod (const char *path, mode_t mode) {
+  FUSE_NATIVE_MEMFS_PATH(chmod, path, path, mode)
+  fuse_native_memfs_inode_t *node;
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0) {
+    node->mode = (node->mode & S_IFMT) | (mode & 07777);
+    fuse_native_memfs_now(&(node->ctime));
+  }
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_chown (const char *path, uid_t uid, gid_t gid) {
+  FUSE_NATIVE_MEMFS_PATH(chown, path, path, uid, gid)
+  fuse_native_memfs_inode_t *node;
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0) {
+    if (uid != (uid_t) -1) node->uid = uid;
+    if (gid != (gid_t) -1) node->gid = gid;
+    fuse_native_memfs_now(&(node->ctime));
+  }
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_truncate (const char *path, off_t size) {
+  FUSE_NATIVE_MEMFS_PATH(truncate, path, path, size)
+  fuse_native_memfs_inode_t *node;
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0 && S_ISDIR(node->mode)) res = -EISDIR;
+  else if (res == 0 && !S_ISREG(node->mode)) res = -EINVAL;
+  if (res == 0) fuse_native_memfs_data_truncate(m, node, size);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_ftruncate (const char *path, off_t size, struct fuse_file_info *info) {
+  FUSE_NATIVE_MEMFS_HANDLE(ftruncate, info, fuse_native_memfs_truncate(path, size), path, size, info)
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  fuse_native_memfs_data_truncate(m, node, size);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return 0;
+}
+
+static void fuse_native_memfs_time (struct timespec *time, const struct timespec *tv, const struct timespec *now) {
+  if (tv->tv_nsec == UTIME_OMIT) return;
+  *time = tv->tv_nsec == UTIME_NOW ? *now : *tv;
+}
+
+static int fuse_native_memfs_utimens (const char *path, const struct timespec tv[2]) {
+  FUSE_NATIVE_MEMFS_PATH(utimens, path, path, tv)
+  fuse_native_memfs_inode_t *node;
+  struct timespec now;
+  fuse_native_memfs_now(&now);
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0) {
+    if (tv == NULL) {
+      node->atime = node->mtime = now;
+    } else {
+      fuse_native_memfs_time(&(node->atime), &tv[0], &now);
+      fuse_native_memfs_time(&(node->mtime), &tv[1], &now);
+    }
+    node->ctime = now;
+  }
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_open (const char *path, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  if (fuse_native_passthrough_js_file(ft, path)) return ft->implemented[op_open] ? fuse_native_open(path, info) : 0;
+
+  fuse_native_memfs_t *m = &(ft->memfs);
+  fuse_native_memfs_inode_t *node;
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0 && S_ISDIR(node->mode) && (info->flags & O_ACCMODE) != O_RDONLY) res = -EISDIR;
+  if (res == 0 && S_ISREG(node->mode) && (info->flags & O_TRUNC)) fuse_native_memfs_data_truncate(m, node, 0);
+  if (res == 0) fuse_native_memfs_hold(node, info);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_create (const char *path, mode_t mode, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  // See fuse_native_passthrough_create.
+  if (fuse_native_passthrough_js_file(ft, path)) {
+    if (ft->implemented[op_create]) return fuse_native_create(path, mode, info);
+    int res = fuse_native_memfs_mknod(path, (mode & 07777) | S_IFREG, 0);
+    return res < 0 ? res : fuse_native_memfs_open(path, info);
+  }
+
+  fuse_native_memfs_t *m = &(ft->memfs);
+  fuse_native_memfs_inode_t *node;
+  fuse_native_passthrough_changed(ft, path);
+
+  pthread_rwlock_wrlock(&(m->lock));
+
+  int res = fuse_native_memfs_resolve(m, path, &node);
+
+  if (res == 0) {
+    if (info->flags & O_EXCL) res = -EEXIST;
+    else if (S_ISDIR(node->mode)) res = -EISDIR;
+    else if (S_ISREG(node->mode) && (info->flags & O_TRUNC)) fuse_native_memfs_data_truncate(m, node, 0);
+  } else if (res == -ENOENT) {
+    res = fuse_native_memfs_make(m, path, S_IFREG | (mode & 07777), 0, NULL, &node);
+  }
+
+  if (res == 0) fuse_native_memfs_hold(node, info);
+
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+static int fuse_native_memfs_read_buf (const char *path, struct fuse_bufvec **bufp, size_t len, off_t offset, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_read_js(path, bufp, len, offset, info);
+
+  fuse_native_memfs_t *m = &(fuse_native_passthrough_mount()->memfs);
+  fuse_native_memfs_inode_t *node = (fuse_native_memfs_inode_t *) (uintptr_t) (info->fh & ~FUSE_NATIVE_PASSTHROUGH_FH);
+
+  struct fuse_bufvec *bufv = fuse_native_passthrough_mem_bufvec(len);
+  if (bufv == NULL) return -ENOMEM;
+
+  pthread_rwlock_rdlock(&(m->lock));
+  bufv->buf[0].size = fuse_native_memfs_data_read(node, bufv->buf[0].mem, len, offset);
+  pthread_rwlock_unlock(&(m->lock));
+
+  *bufp = bufv;
+  return 0;
+}
+
+static int fuse_native_memfs_write_buf (const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_write_js(path, buf, offset, info);
+
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+  fuse_native_memfs_t *m = &(ft->memfs);
+  fuse_native_memfs_inode_t *node = (fuse_native_memfs_inode_t *) (uintptr_t) (info->fh & ~FUSE_NATIVE_PASSTHROUGH_FH);
+  fuse_native_attr_cache_del(&(ft->attr_cache), path);
+
+  // Most writes arrive as one buffer in memory, which is copied into the extents as is.
+  if (buf->count == 1 && buf->idx == 0 && buf->off == 0 && !(buf->buf[0].flags & FUSE_BUF_IS_FD)) {
+    pthread_rwlock_wrlock(&(m->lock));
+    int res = fuse_native_memfs_data_write(m, node, buf->buf[0].mem, buf->buf[0].size, offset);
+    pthread_rwlock_unlock(&(m->lock));
+    return res;
+  }
+
+  ssize_t len;
+  char *mem = fuse_native_passthrough_buf_copy(buf, &len);
+  if (mem == NULL) return (int) len;
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_data_write(m, node, mem, (size_t) len, offset);
+  pthread_rwlock_unlock(&(m->lock));
+
+  free(mem);
+  return res;
+}
+
+static int fuse_native_memfs_statfs (const char *path, struct statvfs *statvfs) {
+  FUSE_NATIVE_MEMFS_PATH(statfs, path, path, statvfs)
+
+  // Without a cap the filesystem can grow as big as physical memory.
+  size_t total = m->max_bytes;
+  if (total == 0) total = (size_t) sysconf(_SC_PHYS_PAGES) * (size_t) sysconf(_SC_PAGESIZE);
+
+  pthread_rwlock_rdlock(&(m->lock));
+  size_t used = m->bytes < total ? m->bytes : total;
+  uint64_t inodes = m->inodes;
+  pthread_rwlock_unlock(&(m->lock));
+
+  memset(statvfs, 0, sizeof(struct statvfs));
+  statvfs->f_bsize = 4096;
+  statvfs->f_frsize = 4096;
+  statvfs->f_blocks = total / 4096;
+  statvfs->f_bfree = (total - used) / 4096;
+  statvfs->f_bavail = statvfs->f_bfree;
+  statvfs->f_files = UINT32_MAX;
+  statvfs->f_ffree = UINT32_MAX - (inodes < UINT32_MAX ? inodes : UINT32_MAX);
+  statvfs->f_favail = statvfs->f_ffree;
+  statvfs->f_namemax = NAME_MAX;
+
+  return 0;
+}
+
+// Nothing to write back, flush, fsync and fsyncdir only matter for handles JS opened.
+static int fuse_native_memfs_flush (const char *path, struct fuse_file_info *info) {
+  FUSE_NATIVE_MEMFS_HANDLE(flush, info, fuse_native_flush(path, info), path, info)
+  (void) m;
+  (void) node;
+  return 0;
+}
+
+static int fuse_native_memfs_fsync (const char *path, int datasync, struct fuse_file_info *info) {
+  FUSE_NATIVE_MEMFS_HANDLE(fsync, info, fuse_native_fsync(path, datasync, info), path, datasync, info)
+  (void) m;
+  (void) node;
+  return 0;
+}
+
+static int fuse_native_memfs_fsyncdir (const char *path, int datasync, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_mount()->implemented[op_fsyncdir] ? fuse_native_dir_fsyncdir(path, datasync, info) : 0;
+  FUSE_NATIVE_MEMFS_HANDLE(fsyncdir, info, 0, path, datasync, info)
+  (void) m;
+  (void) node;
+  return 0;
+}
+
+static int fuse_native_memfs_release (const char *path, struct fuse_file_info *info) {
+  FUSE_NATIVE_MEMFS_HANDLE(release, info, fuse_native_release(path, info), path, info)
+
+  pthread_rwlock_wrlock(&(m->lock));
+  node->open--;
+  fuse_native_memfs_inode_put(m, node);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return 0;
+}
+
+static int fuse_native_memfs_opendir (const char *path, struct fuse_file_info *info) {
+  fuse_thread_t *ft = fuse_native_passthrough_mount();
+
+  if (fuse_native_passthrough_intercepts(ft, path) && (ft->implemented[op_opendir] || ft->implemented[op_readdir])) {
+    return fuse_native_dir_opendir(path, info);
+  }
+
+  fuse_native_memfs_t *m = &(ft->memfs);
+  fuse_native_memfs_inode_t *node;
+
+  pthread_rwlock_wrlock(&(m->lock));
+  int res = fuse_native_memfs_resolve(m, path, &node);
+  if (res == 0 && !S_ISDIR(node->mode)) res = -ENOTDIR;
+  if (res == 0) fuse_native_memfs_hold(node, info);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return res;
+}
+
+// Offsets are entry cookies, "." and ".." are 1 and 2.
+static int fuse_native_memfs_readdir (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_passthrough_mount()->implemented[op_readdir] ? fuse_native_dir_readdir(path, buf, filler, offset, info) : -ENOSYS;
+  FUSE_NATIVE_MEMFS_HANDLE(readdir, info, -ENOSYS, path, buf, filler, offset, info)
+
+  if (offset < 1 && filler(buf, ".", NULL, 1)) return 0;
+  if (offset < 2 && filler(buf, "..", NULL, 2)) return 0;
+
+  pthread_rwlock_rdlock(&(m->lock));
+
+  for (fuse_native_memfs_dirent_t *e = node->entries; e != NULL; e = e->next) {
+    if (e->cookie <= (uint64_t) offset) continue;
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = e->inode->ino;
+    st.st_mode = e->inode->mode;
+
+    if (filler(buf, e->name, &st, (off_t) e->cookie)) break;
+  }
+
+  pthread_rwlock_unlock(&(m->lock));
+
+  return 0;
+}
+
+static int fuse_native_memfs_releasedir (const char *path, struct fuse_file_info *info) {
+  if (!fuse_native_passthrough_owned(info)) return fuse_native_dir_releasedir(path, info);
+  FUSE_NATIVE_MEMFS_HANDLE(releasedir, info, 0, path, info)
+
+  pthread_rwlock_wrlock(&(m->lock));
+  node->open--;
+  fuse_native_memfs_inode_put(m, node);
+  pthread_rwlock_unlock(&(m->lock));
+
+  return 0;
+}
+
+// No xattrs are kept, only intercepted paths have them.
+static int fuse_native_memfs_setxattr (const char *path, const char *name, const char *value, size_t size, int flags) {
+  FUSE_NATIVE_MEMFS_PATH(setxattr, path, path, name, value, size, flags)
+  (void) m;
+  return -ENOTSUP;
+}
+
+static int fuse_native_memfs_getxattr (const char *path, const char *name, char *value, size_t size) {
+  FUSE_NATIVE_MEMFS_PATH(getxattr, path, path, name, value, size)
+  (void) m;
+  return -ENOTSUP;
+}
+
+static int fuse_native_memfs_listxattr (const char *path, char *list, size_t size) {
+  FUSE_NATIVE_MEMFS_PATH(listxattr, path, path, list, size)
+  (void) m;
+  return 0;
+}
+
+static int fuse_native_memfs_removexattr (const char *path, const char *name) {
+  FUSE_NATIVE_MEMFS_PATH(removexattr, path, path, name)
+  (void) m;
+  return -ENOTSUP;
+}
+
+static void fuse_native_memfs_ops (struct fuse_operations *ops) {
+  ops->getattr = fuse_native_memfs_getattr;
+  ops->fgetattr = fuse_native_memfs_fgetattr;
+  ops->access = fuse_native_memfs_access;
+  ops->readlink = fuse_native_memfs_readlink;
+  ops->mknod = fuse_native_memfs_mknod;
+  ops->mkdir = fuse_native_memfs_mkdir;
+  ops->unlink = fuse_native_memfs_unlink;
+  ops->rmdir = fuse_native_memfs_rmdir;
+  ops->symlink = fuse_native_memfs_symlink;
+  ops->rename = fuse_native_memfs_rename;
+  ops->link = fuse_native_memfs_link;
+  ops->chmod = fuse_native_memfs_chmod;
+  ops->chown = fuse_native_memfs_chown;
+  ops->truncate = fuse_native_memfs_truncate;
+  ops->ftruncate = fuse_native_memfs_ftruncate;
+  ops->utimens = fuse_native_memfs_utimens;
+  ops->open = fuse_native_memfs_open;
+  ops->create = fuse_native_memfs_create;
+  ops->read = NULL;
+  ops->read_buf = fuse_native_memfs_read_buf;
+  ops->write = NULL;
+  ops->write_buf = fuse_native_memfs_write_buf;
+  ops->statfs = fuse_native_memfs_statfs;
+  ops->flush = fuse_native_memfs_flush;
+  ops->release = fuse_native_memfs_release;
+  ops->fsync = fuse_native_memfs_fsync;
+  ops->opendir = fuse_native_memfs_opendir;
+  ops->readdir = fuse_native_memfs_readdir;
+  ops->releasedir = fuse_native_memfs_releasedir;
+  ops->fsyncdir = fuse_native_memfs_fsyncdir;
+  ops->setxattr = fuse_native_memfs_setxattr;
+  ops->getxattr = fuse_native_memfs_getxattr;
+  ops->listxattr = fuse_native_memfs_listxattr;
+  ops->removexattr = fuse_native_memfs_removexattr;
+}
+
+#endif
+
+// Low-level mode
+// Requests arrive as inode numbers, the path based handlers above are reused by
+// resolving the inode table back into paths, so the JS ops API stays the same.
+
+#ifndef __APPLE__
+
+#define FUSE_NATIVE_UNKNOWN_INO 0xffffffff
+
+static void fuse_native_interrupt (fuse_thread_locals_t *l, void *intr);
+
+static void fuse_native_ll_interrupt (fuse_req_t req, void *data) {
+  fuse_native_interrupt((fuse_thread_locals_t *) data, (void *) req);
+}
+
+static void fuse_native_ll_locals (fuse_req_t req, fuse_thread_t *ft) {
+  fuse_thread_locals_t *l = fuse_native_thread_locals(ft);
+
+  if (!ft->interrupts) return;
+
+  // Tag the locals first, libfuse runs the callback right away if the request was interrupted already.
+  l->req = (void *) req;
+  __atomic_store_n(&(l->intr), (void *) req, __ATOMIC_RELEASE);
+  fuse_req_interrupt_func(req, fuse_native_ll_interrupt, l);
+}
+
+// Every handler called for the request gets it, next to the path.
+static void fuse_native_ll_ino (fuse_thread_t *ft, fuse_ino_t ino) {
+  fuse_thread_locals_t *l = fuse_native_thread_locals(ft);
+  l->ino_slot[0] = (uint32_t) ino;
+  l->ino_slot[1] = (uint32_t) ((uint64_t) ino >> 32);
+}
+
+#define FUSE_NATIVE_LL_HANDLER()\
+  fuse_thread_t *ft = (fuse_thread_t *) fuse_req_userdata(req);\
+  fuse_native_ll_locals(req, ft);
+
+// Also hands JS the inode number of the path, see fuse_native_ll_ino.
+#define FUSE_NATIVE_LL_PATH(path, ino, name)\
+  char path[PATH_MAX];\
+  fuse_ino_t path##_ino;\
+  {\
+    int path_err = fuse_native_inode_path(&(ft->inodes), ino, name, path, PATH_MAX, &path##_ino);\
+    if (path_err < 0) {\
+      fuse_reply_err(req, -path_err);\
+      return;\
+    }\
+    fuse_native_ll_ino(ft, path##_ino);\
+  }
+
+#define FUSE_NATIVE_LL_CALL(name, ...)\
+  (ft->implemented[op_##name] ? fuse_native_##name(__VA_ARGS__) : -ENOSYS)
+
+typedef struct {
+  fuse_req_t req;
+  char *buf;
+  size_t size;
+  size_t pos;
+} fuse_native_dirbuf_t;
+
+static void fuse_native_ll_reply_entry (fuse_req_t req, fuse_thread_t *ft, fuse_ino_t parent, const char *name, int res, struct fuse_entry_param *e, struct fuse_file_info *info) {
+  if (res < 0) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  e->ino = fuse_native_inode_ref(&(ft->inodes), parent, name);
+
+  if (e->ino == 0) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  if (!ft->use_ino || e->attr.st_ino == 0) e->attr.st_ino = e->ino;
+  e->attr_timeout = ft->attr_timeout;
+  e->entry_timeout = ft->entry_timeout;
+
+  if (info != NULL) fuse_reply_create(req, e, info);
+  else fuse_reply_entry(req, e);
+}
+
+static void fuse_native_ll_entry (fuse_req_t req, fuse_thread_t *ft, fuse_ino_t parent, const char *name, const char *path, int res, struct fuse_file_info *info) {
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+  if (res == 0) res = fuse_native_getattr(path, &(e.attr));
+  fuse_native_ll_reply_entry(req, ft, parent, name, res, &e, info);
+}
+
+static void fuse_native_ll_reply_attr (fuse_req_t req, fuse_thread_t *ft, fuse_ino_t ino, int res, struct stat *st) {
+  if (res < 0) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  // With use_ino stat() reports the handler's inode numbers, the kernel still addresses the file by ours.
+  if (!ft->use_ino || st->st_ino == 0) st->st_ino = ino;
+  fuse_reply_attr(req, st, ft->attr_timeout);
+}
+
+static int fuse_native_ll_filler (void *buf, const char *name, const struct stat *stbuf, off_t off) {
+  fuse_native_dirbuf_t *d = (fuse_native_dirbuf_t *) buf;
+
+  fuse_thread_t *ft = (fuse_thread_t *) fuse_req_userdata(d->req);
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  st.st_ino = FUSE_NATIVE_UNKNOWN_INO;
+  if (stbuf != NULL) st.st_mode = stbuf->st_mode;
+  if (stbuf != NULL && ft->use_ino && stbuf->st_ino != 0) st.st_ino = stbuf->st_ino;
+
+  size_t size = fuse_add_direntry(d->req, d->buf + d->pos, d->size - d->pos, name, &st, off);
+  if (size > d->size - d->pos) return 1;
+
+  d->pos += size;
+  return 0;
+}
+
+static void fuse_native_ll_init (void *userdata, struct fuse_conn_info *conn) {
+  fuse_native_thread_locals((fuse_thread_t *) userdata);
+  fuse_native_init(conn);
+}
+
+static void fuse_native_ll_lookup (fuse_req_t req, fuse_ino_t parent, const char *name) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+
+  int res = fuse_native_attr_cache_get(&(ft->attr_cache), path, &(e.attr));
+
+  if (res > 0) {
+    res = 0;
+  } else if (res == 0 && ft->implemented[op_lookup]) {
+    uint64_t generation = fuse_native_attr_cache_generation(&(ft->attr_cache));
+    res = fuse_native_lookup(parent, name, &(e.attr));
+    fuse_native_attr_cache_store(&(ft->attr_cache), path, res, &(e.attr), generation);
+  } else if (res == 0) {
+    res = fuse_native_getattr(path, &(e.attr));
+  }
+
+  // A zero inode tells the kernel to remember the miss for entry_timeout.
+  if (res == -ENOENT && ft->negative_timeout > 0) {
+    e.entry_timeout = ft->negative_timeout;
+    fuse_reply_entry(req, &e);
+    return;
+  }
+
+  fuse_native_ll_reply_entry(req, ft, parent, name, res, &e, NULL);
+}
+
+static void fuse_native_ll_forget (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+  fuse_thread_t *ft = (fuse_thread_t *) fuse_req_userdata(req);
+  fuse_native_inode_forget(&(ft->inodes), ino, nlookup);
+  fuse_reply_none(req);
+}
+
+static void fuse_native_ll_getattr (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+
+  int res = (info != NULL && ft->implemented[op_fgetattr])
+    ? fuse_native_fgetattr(path, &st, info)
+    : fuse_native_getattr(path, &st);
+
+  fuse_native_ll_reply_attr(req, ft, ino, res, &st);
+}
+
+static void fuse_native_ll_setattr (fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  int res = 0;
+
+  if (to_set & FUSE_SET_ATTR_MODE) {
+    res = FUSE_NATIVE_LL_CALL(chmod, path, attr->st_mode);
+  }
+
+  if (res == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+    uid_t uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t) -1;
+    gid_t gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t) -1;
+    res = FUSE_NATIVE_LL_CALL(chown, path, uid, gid);
+  }
+
+  if (res == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+    res = (info != NULL && ft->implemented[op_ftruncate])
+      ? fuse_native_ftruncate(path, attr->st_size, info)
+      : FUSE_NATIVE_LL_CALL(truncate, path, attr->st_size);
+  }
+
+  if (res == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+    // utimens wants both times, keep the current value of the one not being set.
+    struct timespec tv[2];
+    res = fuse_native_getattr(path, &st);
+    tv[0] = st.st_atim;
+    tv[1] = st.st_mtim;
+
+    if (to_set & FUSE_SET_ATTR_ATIME_NOW) clock_gettime(CLOCK_REALTIME, &tv[0]);
+    else if (to_set & FUSE_SET_ATTR_ATIME) tv[0] = attr->st_atim;
+    if (to_set & FUSE_SET_ATTR_MTIME_NOW) clock_gettime(CLOCK_REALTIME, &tv[1]);
+    else if (to_set & FUSE_SET_ATTR_MTIME) tv[1] = attr->st_mtim;
+
+    if (res == 0) res = FUSE_NATIVE_LL_CALL(utimens, path, tv);
+  }
+
+  if (res == 0) res = fuse_native_getattr(path, &st);
+  fuse_native_ll_reply_attr(req, ft, ino, res, &st);
+}
+
+static void fuse_native_ll_readlink (fuse_req_t req, fuse_ino_t ino) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  char linkname[PATH_MAX];
+  int res = fuse_native_readlink(path, linkname, PATH_MAX - 1);
+  linkname[PATH_MAX - 1] = '\0';
+
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_readlink(req, linkname);
+}
+
+static void fuse_native_ll_mknod (fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+  fuse_native_ll_entry(req, ft, parent, name, path, fuse_native_mknod(path, mode, rdev), NULL);
+}
+
+static void fuse_native_ll_mkdir (fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+  fuse_native_ll_entry(req, ft, parent, name, path, fuse_native_mkdir(path, mode), NULL);
+}
+
+static void fuse_native_ll_symlink (fuse_req_t req, const char *linkname, fuse_ino_t parent, const char *name) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+  fuse_native_ll_entry(req, ft, parent, name, path, fuse_native_symlink(linkname, path), NULL);
+}
+
+static void fuse_native_ll_link (fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  FUSE_NATIVE_LL_PATH(dest, newparent, newname)
+  fuse_native_ll_ino(ft, path_ino);
+  fuse_native_ll_entry(req, ft, newparent, newname, dest, fuse_native_link(path, dest), NULL);
+}
+
+static void fuse_native_ll_unlink (fuse_req_t req, fuse_ino_t parent, const char *name) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+
+  int res = fuse_native_unlink(path);
+  if (res == 0) fuse_native_inode_unlink(&(ft->inodes), parent, name);
+  fuse_reply_err(req, -res);
+}
+
+static void fuse_native_ll_rmdir (fuse_req_t req, fuse_ino_t parent, const char *name) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+
+  int res = fuse_native_rmdir(path);
+  if (res == 0) fuse_native_inode_unlink(&(ft->inodes), parent, name);
+  fuse_reply_err(req, -res);
+}
+
+static void fuse_native_ll_rename (fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+  FUSE_NATIVE_LL_PATH(dest, newparent, newname)
+  fuse_native_ll_ino(ft, path_ino);
+
+  int res = fuse_native_rename(path, dest);
+  if (res == 0) fuse_native_inode_rename(&(ft->inodes), parent, name, newparent, newname);
+  fuse_reply_err(req, -res);
+}
+
+static void fuse_native_ll_open (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  int res = fuse_native_open(path, info);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_open(req, info);
+}
+
+static void fuse_native_ll_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  if (ft->implemented[op_readbuf]) {
+    struct fuse_bufvec *bufv = NULL;
+    int res = fuse_native_readbuf(path, &bufv, size, off, info);
+    if (res < 0) fuse_reply_err(req, -res);
+    else fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+    fuse_native_spliced_close(fuse_native_thread_locals(ft));
+    free(bufv);
+    return;
+  }
+
+  char *buf = malloc(size);
+
+  if (buf == NULL) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  int res = fuse_native_read(path, buf, size, off, info);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_buf(req, buf, res);
+
+  free(buf);
+}
+
+static void fuse_native_ll_write_buf (fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  int res = fuse_native_write_buf(path, bufv, off, info);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_write(req, res);
+}
+
+static void fuse_native_ll_write (fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  int res = fuse_native_write(path, buf, size, off, info);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_write(req, res);
+}
+
+static void fuse_native_ll_flush (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_flush(path, info));
+}
+
+static void fuse_native_ll_release (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_release(path, info));
+}
+
+static void fuse_native_ll_fsync (fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_fsync(path, datasync, info));
+}
+
+static void fuse_native_ll_opendir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  int res = fuse_native_dir_opendir(path, info);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_open(req, info);
+}
+
+static void fuse_native_ll_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  fuse_native_dirbuf_t d = { req, malloc(size), size, 0 };
+
+  if (d.buf == NULL) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  int res = fuse_native_dir_readdir(path, &d, fuse_native_ll_filler, off, info);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_buf(req, d.buf, d.pos);
+
+  free(d.buf);
+}
+
+static void fuse_native_ll_releasedir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_dir_releasedir(path, info));
+}
+
+static void fuse_native_ll_fsyncdir (fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_dir_fsyncdir(path, datasync, info));
+}
+
+static void fuse_native_ll_statfs (fuse_req_t req, fuse_ino_t ino) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  struct statvfs st;
+  memset(&st, 0, sizeof(st));
+
+  int res = fuse_native_statfs(path, &st);
+  if (res < 0) fuse_reply_err(req, -res);
+  else fuse_reply_statfs(req, &st);
+}
+
+static void fuse_native_ll_setxattr (fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_setxattr(path, name, value, size, flags));
+}
+
+static void fuse_native_ll_getxattr (fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  // A zero size is a probe for the length of the value.
+  char empty = 0;
+  char *value = size == 0 ? &empty : malloc(size);
+
+  if (value == NULL) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  int res = fuse_native_getxattr(path, name, value, size);
+  if (res < 0) fuse_reply_err(req, -res);
+  else if (size == 0) fuse_reply_xattr(req, res);
+  else if ((size_t) res > size) fuse_reply_err(req, ERANGE);
+  else fuse_reply_buf(req, value, res);
+
+  if (size > 0) free(value);
+}
+
+static void fuse_native_ll_listxattr (fuse_req_t req, fuse_ino_t ino, size_t size) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+
+  char empty = 0;
+  char *list = size == 0 ? &empty : malloc(size);
+
+  if (list == NULL) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  int res = fuse_native_listxattr(path, list, size);
+  if (res < 0) fuse_reply_err(req, -res);
+  else if (size == 0) fuse_reply_xattr(req, res);
+  else if ((size_t) res > size) fuse_reply_err(req, ERANGE);
+  else fuse_reply_buf(req, list, res);
+
+  if (size > 0) free(list);
+}
+
+static void fuse_native_ll_removexattr (fuse_req_t req, fuse_ino_t ino, const char *name) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_removexattr(path, name));
+}
+
+static void fuse_native_ll_access (fuse_req_t req, fuse_ino_t ino, int mask) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, ino, NULL)
+  fuse_reply_err(req, -fuse_native_access(path, mask));
+}
+
+static void fuse_native_ll_create (fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *info) {
+  FUSE_NATIVE_LL_HANDLER()
+  FUSE_NATIVE_LL_PATH(path, parent, name)
+  fuse_native_ll_entry(req, ft, parent, name, path, fuse_native_create(path, mode, info), info);
+}
+
+static void fuse_native_lowlevel_ops (struct fuse_lowlevel_ops *ops, uint32_t *implemented) {
+  ops->init = fuse_native_ll_init;
+  ops->lookup = fuse_native_ll_lookup;
+  ops->forget = fuse_native_ll_forget;
+  ops->getattr = fuse_native_ll_getattr;
+  if (implemented[op_chmod] || implemented[op_chown] || implemented[op_truncate] || implemented[op_ftruncate] || implemented[op_utimens]) ops->setattr = fuse_native_ll_setattr;
+  if (implemented[op_readlink]) ops->readlink = fuse_native_ll_readlink;
+  if (implemented[op_mknod]) ops->mknod = fuse_native_ll_mknod;
+  if (implemented[op_mkdir]) ops->mkdir = fuse_native_ll_mkdir;
+  if (implemented[op_symlink]) ops->symlink = fuse_native_ll_symlink;
+  if (implemented[op_link]) ops->link = fuse_native_ll_link;
+  if (implemented[op_unlink]) ops->unlink = fuse_native_ll_unlink;
+  if (implemented[op_rmdir]) ops->rmdir = fuse_native_ll_rmdir;
+  if (implemented[op_rename]) ops->rename = fuse_native_ll_rename;
+  if (implemented[op_open]) ops->open = fuse_native_ll_open;
+  if (implemented[op_read] || implemented[op_readbuf]) ops->read = fuse_native_ll_read;
+  if (implemented[op_write]) ops->write = fuse_native_ll_write;
+  if (implemented[op_writebuf]) ops->write_buf = fuse_native_ll_write_buf;
+  if (implemented[op_flush]) ops->flush = fuse_native_ll_flush;
+  if (implemented[op_release]) ops->release = fuse_native_ll_release;
+  if (implemented[op_fsync]) ops->fsync = fuse_native_ll_fsync;
+  if (fuse_native_dir_ops(implemented)) ops->opendir = fuse_native_ll_opendir;
+  if (implemented[op_readdir]) ops->readdir = fuse_native_ll_readdir;
+  if (fuse_native_dir_ops(implemented)) ops->releasedir = fuse_native_ll_releasedir;
+  if (implemented[op_fsyncdir]) ops->fsyncdir = fuse_native_ll_fsyncdir;
+  if (implemented[op_statfs]) ops->statfs = fuse_native_ll_statfs;
+  if (implemented[op_setxattr]) ops->setxattr = fuse_native_ll_setxattr;
+  if (implemented[op_getxattr]) ops->getxattr = fuse_native_ll_getxattr;
+  if (implemented[op_listxattr]) ops->listxattr = fuse_native_ll_listxattr;
+  if (implemented[op_removexattr]) ops->removexattr = fuse_native_ll_removexattr;
+  if (implemented[op_access]) ops->access = fuse_native_ll_access;
+  if (implemented[op_create]) ops->create = fuse_native_ll_create;
+}
+
+#endif
+
+// Request ring
+
+// FUSE threads push their locals onto a lock-free LIFO per dispatcher (the mount or one of its workers).
+// Only the push that finds the ring empty wakes up the loop, every other request
+// rides along with the dispatch pass that is already pending.
+// The dispatcher running a mount's requests on the loop, which also creates its thread locals.
+static fuse_thread_t* fuse_native_dispatcher (fuse_thread_t *ft) {
+  return ft->group != NULL ? &(ft->group->dispatcher) : ft;
+}
+
+// The mount whose handlers run a request taken off the ring of ft.
+static fuse_thread_t* fuse_native_target (fuse_thread_t *ft, fuse_thread_locals_t *l) {
+  return ft->shared ? l->fuse : ft;
+}
+
+static void fuse_native_push (fuse_thread_t *ft, fuse_thread_locals_t *l) {
+  __atomic_store_n(&(l->dispatcher), ft, __ATOMIC_RELEASE);
+
+  fuse_thread_locals_t *head = __atomic_load_n(&(ft->pending), __ATOMIC_RELAXED);
+
+  do {
+    l->next = head;
+  } while (!__atomic_compare_exchange_n(&(ft->pending), &head, l, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  if (head == NULL) uv_async_send(&(ft->dispatch));
+}
+
+// Requests on an open file stick to one worker per fh and mutations to one worker per path,
+// so handlers see those in order. Lookups and reads of metadata go round robin.
+static fuse_thread_t* fuse_native_route (fuse_thread_t *ft, fuse_thread_locals_t *l) {
+  uint32_t op = l->op;
+  uint64_t key;
+
+  if (op == op_init) return ft;
+
+  if (op == op_read || op == op_write || op == op_readbuf || op == op_writebuf ||
+      op == op_flush || op == op_fsync || op == op_release || op == op_ftruncate ||
+      op == op_fgetattr || op == op_releasedir || op == op_fsyncdir) {
+    key = l->info != NULL ? l->info->fh : 0;
+  } else if (op == op_getattr || op == op_access || op == op_statfs || op == op_readdir ||
+             op == op_readlink || op == op_getxattr || op == op_listxattr || op == op_lookup ||
+             op == op_open || op == op_opendir) {
+    key = __atomic_fetch_add(&(ft->next_worker), 1, __ATOMIC_RELAXED);
+  } else {
+    key = fuse_native_hash(0, l->path != NULL ? l->path : "");
+  }
+
+  // A worker that went away hands its share back to the main thread.
+  fuse_thread_t *worker = __atomic_load_n(&(ft->workers[key % ft->workers_length]), __ATOMIC_ACQUIRE);
+  return worker == NULL ? ft : worker;
+}
+
+static void fuse_native_enqueue (fuse_thread_locals_t *l) {
+  fuse_thread_t *ft = l->fuse;
+  fuse_native_push(ft->workers_length == 0 ? fuse_native_dispatcher(ft) : fuse_native_route(ft, l), l);
+}
+
+static fuse_thread_locals_t* fuse_native_dequeue_all (fuse_thread_t *ft) {
+  fuse_thread_locals_t *l = __atomic_exchange_n(&(ft->pending), NULL, __ATOMIC_ACQUIRE);
+  fuse_thread_locals_t *batch = NULL;
+
+  // The ring is a stack, reverse it so requests are dispatched in arrival order.
+  while (l != NULL) {
+    fuse_thread_locals_t *next = l->next;
+    l->next = batch;
+    batch = l;
+    l = next;
+  }
+
+  return batch;
+}
+
+// Thread locals lifecycle
+// Locals belong to their FUSE thread until it exits (the key destructor), or a request it waited on was abandoned.
+// They are handed to the dispatcher of their mount then, whose loop frees them in its next pass. JS only ever
+// reached them through buffers that get detached first, a late reply finds an empty handle and is dropped.
+// With workers the views they hold can only go with them, so those locals wait for fuse_native_reclaim.
+
+static void fuse_native_retire (fuse_thread_locals_t *l) {
+  fuse_thread_t *ft = fuse_native_dispatcher(l->fuse);
+  fuse_thread_locals_t *head = __atomic_load_n(&(ft->retired), __ATOMIC_RELAXED);
+
+  do {
+    l->retired_next = head;
+  } while (!__atomic_compare_exchange_n(&(ft->retired), &head, l, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  if (head == NULL) uv_async_send(&(ft->dispatch));
+}
+
+// libfuse lets idle threads exit on their own, one doing so as the mount stops leaves its locals to fuse_native_reclaim.
+static void fuse_native_thread_locals_destroy (void *data) {
+  fuse_thread_locals_t *l = (fuse_thread_locals_t *) data;
+  fuse_thread_t *ft = l->fuse;
+
+  uv_mutex_lock(&(ft->stop_lock));
+  if (!ft->stopped) fuse_native_retire(l);
+  uv_mutex_unlock(&(ft->stop_lock));
+}
+
+// For threads nobody joins, they hand back their locals while the mount is sure to be around.
+static void fuse_native_drop_thread_locals () {
+  fuse_thread_locals_t *l = (fuse_thread_locals_t *) pthread_getspecific(thread_locals_key);
+  if (l == NULL) return;
+
+  fuse_native_set_thread_locals(NULL);
+  fuse_native_retire(l);
+}
+
+static void fuse_native_locals_free (napi_env env, fuse_thread_locals_t *l) {
+  if (l->self != NULL) {
+    napi_value buf;
+    napi_value arraybuffer;
+    napi_get_reference_value(env, l->self, &buf);
+    napi_get_typedarray_info(env, buf, NULL, NULL, NULL, &arraybuffer, NULL);
+    napi_detach_arraybuffer(env, arraybuffer);
+    napi_delete_reference(env, l->self);
+  }
+
+  *(l->locals_pprev) = l->locals_next;
+  if (l->locals_next != NULL) l->locals_next->locals_pprev = l->locals_pprev;
+
+  fuse_native_spliced_close(l);
+  free(l->spliced);
+  uv_sem_destroy(&(l->sem));
+  free(l);
+}
+
+static void fuse_native_release_locals (napi_env env, fuse_thread_locals_t *l) {
+  // Without detaching, JS could still write to them.
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 0 || l->fuse->workers_length > 0) return;
+
+  // Queued for an interrupt that raced the hand over, see fuse_native_abort. Try again next pass.
+  if (__atomic_load_n(&(l->abort_queued), __ATOMIC_ACQUIRE)) {
+    fuse_native_retire(l);
+    return;
+  }
+
+  fuse_native_locals_free(env, l);
+}
+
+// Timeout wheel
+// Every dispatcher tracks the deadlines of the requests it handed to JS on its own loop, so the wheel, the
+// replies and the timeouts never race. An overdue request is completed with ETIMEDOUT and its FUSE thread
+// drops its thread locals, leaving them abandoned, so a late reply from JS is ignored instead of
+// completing whatever request the thread is serving by then. Only timed out requests pay for that.
+
+static uint64_t fuse_native_wheel_now (fuse_native_wheel_t *wheel) {
+  return (uv_now(wheel->timer.loop) - wheel->epoch) / FUSE_NATIVE_WHEEL_TICK;
+}
+
+static void fuse_native_wheel_init (uv_loop_t *loop, fuse_thread_t *ft) {
+  fuse_native_wheel_t *wheel = &(ft->wheel);
+
+  uv_timer_init(loop, &(wheel->timer));
+  uv_unref((uv_handle_t *) &(wheel->timer));
+  wheel->timer.data = ft;
+  wheel->epoch = uv_now(loop);
+  wheel->tick = 0;
+  wheel->count = 0;
+}
+
+// Returns the result of the abandoned request, the locals are not touched after they are handed back.
+static int fuse_native_abandon_thread_locals (fuse_thread_locals_t *l) {
+  int res = l->res;
+
+  fuse_native_set_thread_locals(NULL);
+
+#ifndef __APPLE__
+  // Waits for an interrupt callback in progress, none runs on these locals afterwards.
+  if (l->req != NULL) fuse_req_interrupt_func((fuse_req_t) l->req, NULL, NULL);
+#endif
+
+  fuse_native_retire(l);
+  return res;
+}
+
+static void fuse_native_wheel_unlink (fuse_thread_locals_t *l) {
+  fuse_native_wheel_t *wheel = &(l->wheel->wheel);
+
+  *(l->wheel_pprev) = l->wheel_next;
+  if (l->wheel_next != NULL) l->wheel_next->wheel_pprev = l->wheel_pprev;
+  l->wheel = NULL;
+
+  if (--wheel->count == 0) uv_timer_stop(&(wheel->timer));
+}
+
+// Completes a request JS still holds, on the loop that dispatched it.
+static void fuse_native_cancel (napi_env env, fuse_thread_locals_t *l, int res) {
+  l->held = 0;
+
+  if (l->wheel != NULL) fuse_native_wheel_unlink(l);
+
+  if (l->borrowed != NULL) {
+    napi_value buf;
+    napi_value arraybuffer;
+    napi_get_reference_value(env, l->borrowed, &buf);
+    napi_get_typedarray_info(env, buf, NULL, NULL, NULL, &arraybuffer, NULL);
+    if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) napi_detach_arraybuffer(env, arraybuffer);
+    napi_delete_reference(env, l->borrowed);
+    l->borrowed = NULL;
+  }
+
+  if (l->fuse->stats != NULL) fuse_native_stats_signal(l, res);
+
+  l->abandoned = 1;
+  l->res = res;
+  uv_sem_post(&(l->sem));
+}
+
+static void fuse_native_wheel_tick (uv_timer_t *timer) {
+  fuse_thread_t *ft = (fuse_thread_t *) timer->data;
+  fuse_native_wheel_t *wheel = &(ft->wheel);
+  uint64_t now = fuse_native_wheel_now(wheel);
+
+  // After a stall every slot is visited once, deadlines are absolute so nothing is missed.
+  if (now - wheel->tick > FUSE_NATIVE_WHEEL_SLOTS) wheel->tick = now - FUSE_NATIVE_WHEEL_SLOTS;
+
+  napi_env env = ft->env;
+  napi_handle_scope scope;
+  napi_open_handle_scope(env, &scope);
+
+  while (wheel->tick < now && wheel->count > 0) {
+    fuse_thread_locals_t *l = wheel->slots[++wheel->tick % FUSE_NATIVE_WHEEL_SLOTS];
+
+    while (l != NULL) {
+      fuse_thread_locals_t *next = l->wheel_next;
+      if (l->deadline <= wheel->tick) fuse_native_cancel(env, l, -ETIMEDOUT);
+      l = next;
+    }
+  }
+
+  wheel->tick = now;
+  napi_close_handle_scope(env, scope);
+}
+
+static void fuse_native_wheel_add (fuse_thread_t *ft, fuse_thread_locals_t *l, uint32_t timeout) {
+  fuse_native_wheel_t *wheel = &(ft->wheel);
+
+  uint64_t now = fuse_native_wheel_now(wheel);
+
+  if (wheel->count++ == 0) {
+    wheel->tick = now;
+    uv_timer_start(&(wheel->timer), fuse_native_wheel_tick, FUSE_NATIVE_WHEEL_TICK, FUSE_NATIVE_WHEEL_TICK);
+  }
+
+  l->deadline = now + (timeout + FUSE_NATIVE_WHEEL_TICK - 1) / FUSE_NATIVE_WHEEL_TICK;
+  l->wheel = ft;
+
+  fuse_thread_locals_t **slot = &(wheel->slots[l->deadline % FUSE_NATIVE_WHEEL_SLOTS]);
+  l->wheel_next = *slot;
+  l->wheel_pprev = slot;
+  if (*slot != NULL) (*slot)->wheel_pprev = &(l->wheel_next);
+  *slot = l;
+}
+
+// Called when JS replies in time.
+static void fuse_native_settle (napi_env env, fuse_thread_locals_t *l) {
+  l->held = 0;
+
+  if (l->wheel != NULL) fuse_native_wheel_unlink(l);
+
+  if (l->borrowed != NULL) {
+    napi_delete_reference(env, l->borrowed);
+    l->borrowed = NULL;
+  }
+}
+
+// Buffers pointing into FUSE memory are tracked while the request can be completed without JS.
+static void fuse_native_borrow (napi_env env, fuse_thread_locals_t *l, napi_value buf) {
+  if (l->wheel != NULL || l->fuse->interrupts) napi_create_reference(env, buf, 1, &(l->borrowed));
+}
+
+// Interrupts
+// The kernel interrupts a request when the process waiting on it got a signal. The low-level session
+// hands over a callback per request, the high-level library signals the FUSE thread instead. Either way
+// the locals are tagged and queued on the dispatcher serving them, whose loop completes the request
+// with EINTR and aborts it in JS. The tag carries the FUSE request, an interrupt that shows up after the
+// thread moved on to the next one is dropped.
+
+static void fuse_native_abort_push (fuse_thread_locals_t *l) {
+  if (__atomic_exchange_n(&(l->abort_queued), 1, __ATOMIC_ACQ_REL)) return;
+
+  fuse_thread_t *ft = __atomic_load_n(&(l->dispatcher), __ATOMIC_ACQUIRE);
+  if (ft == NULL) ft = fuse_native_dispatcher(l->fuse);
+
+  // A worker that went away took its requests with it.
+  if (ft->main != NULL && __atomic_load_n(&(ft->main->workers[ft->worker_index]), __ATOMIC_ACQUIRE) != ft) {
+    __atomic_store_n(&(l->abort_queued), 0, __ATOMIC_RELEASE);
+    return;
+  }
+
+  fuse_thread_locals_t *head = __atomic_load_n(&(ft->aborts), __ATOMIC_RELAXED);
+
+  do {
+    l->abort_next = head;
+  } while (!__atomic_compare_exchange_n(&(ft->aborts), &head, l, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  if (head == NULL) uv_async_send(&(ft->dispatch));
+}
+
+// Runs on a libfuse thread or in a signal handler, so only atomics and uv_async_send.
+static void fuse_native_interrupt (fuse_thread_locals_t *l, void *intr) {
+  if (!__atomic_compare_exchange_n(&(l->intr), &intr, FUSE_NATIVE_INTERRUPTED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return;
+  fuse_native_abort_push(l);
+}
+
+static int fuse_native_interrupted (fuse_thread_locals_t *l) {
+  return __atomic_load_n(&(l->intr), __ATOMIC_ACQUIRE) == FUSE_NATIVE_INTERRUPTED;
+}
+
+// Returns 1 if the request was interrupted before reaching JS. A low-level request is tagged by its
+// handler, a high-level one is a request of its own every time.
+static int fuse_native_interrupt_begin (fuse_thread_locals_t *l) {
+  if (l->fuse->fuse != NULL) {
+    __atomic_store_n(&(l->intr), (void *) l, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  return fuse_native_interrupted(l);
+}
+
+// The signal handler runs on the thread itself, between any two instructions of it.
+static void fuse_native_wait (fuse_thread_locals_t *l) {
+  __atomic_store_n(&(l->waiting), 1, __ATOMIC_SEQ_CST);
+  uv_sem_wait(&(l->sem));
+  __atomic_store_n(&(l->waiting), 0, __ATOMIC_SEQ_CST);
+}
+
+// libfuse keeps signalling the thread until the request completes, so one that lands between two
+// requests is simply ignored.
+static void fuse_native_intr_signal_handler (int sig) {
+  fuse_thread_locals_t *l = __atomic_load_n(&thread_locals_current, __ATOMIC_ACQUIRE);
+  if (l != NULL && __atomic_load_n(&(l->waiting), __ATOMIC_SEQ_CST)) fuse_native_interrupt(l, (void *) l);
+}
+
+static void fuse_native_intr_signal_install (void) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&(sa.sa_mask));
+  sa.sa_handler = fuse_native_intr_signal_handler;
+  sa.sa_flags = SA_RESTART;
+  sigaction(FUSE_NATIVE_INTR_SIGNAL, &sa, NULL);
+}
+
+static void fuse_native_dispatch_abort (fuse_thread_locals_t *l, fuse_thread_t *ft) {
+  if (ft->handlers[op_abort] == NULL) return;
+
+  FUSE_NATIVE_CALLBACK(ft->handlers[op_abort], {
+    napi_value argv[2];
+
+    fuse_native_locals_value(env, ft, l, &(argv[0]));
+    napi_create_uint32(env, op_abort, &(argv[1]));
+
+    NAPI_MAKE_CALLBACK(env, NULL, ctx, callback, 2, argv, NULL);
+  })
+}
+
+static void fuse_native_abort (fuse_thread_t *ft, fuse_thread_locals_t *l) {
+  __atomic_store_n(&(l->abort_queued), 0, __ATOMIC_RELEASE);
+
+  if (!fuse_native_interrupted(l)) return;
+
+  // The thread was routed elsewhere after the interrupt picked a dispatcher.
+  if (__atomic_load_n(&(l->dispatcher), __ATOMIC_ACQUIRE) != ft) {
+    fuse_native_abort_push(l);
+    return;
+  }
+
+  if (!l->held || l->abandoned) return;
+
+  fuse_native_cancel(ft->env, l, -EINTR);
+  fuse_native_dispatch_abort(l, fuse_native_target(ft, l));
+}
+
+// Top-level dispatcher
+
+static void fuse_native_dispatch (uv_async_t* handle) {
+  fuse_thread_t *ft = (fuse_thread_t *) handle->data;
+  fuse_thread_locals_t *l = fuse_native_dequeue_all(ft);
+  fuse_thread_locals_t *aborts = __atomic_exchange_n(&(ft->aborts), NULL, __ATOMIC_ACQUIRE);
+  fuse_thread_locals_t *retired = __atomic_exchange_n(&(ft->retired), NULL, __ATOMIC_ACQUIRE);
+
+  if (l == NULL && aborts == NULL && retired == NULL) return;
+
+  napi_env env = ft->env;
+  napi_handle_scope scope;
+  napi_open_handle_scope(env, &scope);
+  napi_value ctx;
+  napi_get_reference_value(env, ft->ctx, &ctx);
+
+  // Run the whole batch in one callback scope, so the nextTick'd signals of every
+  // request in it are flushed back to the FUSE threads together when it closes.
+  napi_callback_scope callback_scope;
+  napi_open_callback_scope(env, ctx, ft->dispatch_ctx, &callback_scope);
+
+  while (l != NULL) {
+    // Read the link first, the signal may hand l back to its FUSE thread.
+    fuse_thread_locals_t *next = l->next;
+    void (*fn)(uv_async_t *, fuse_thread_locals_t *, fuse_thread_t *) = l->op_fn;
+
+    if (l->op != op_init) {
+      if (l->fuse->stats != NULL) fuse_native_stats_dispatch(l);
+      if (l->fuse->timeouts[l->op] != 0) fuse_native_wheel_add(ft, l, l->fuse->timeouts[l->op]);
+      l->held = 1;
+      l->borrowed = NULL;
+    }
+
+    // Interrupted while it was queued, JS never sees it.
+    if (l->held && l->fuse->interrupts && fuse_native_interrupted(l)) fuse_native_cancel(env, l, -EINTR);
+    else fn(handle, l, fuse_native_target(ft, l));
+
+    l = next;
+  }
+
+  while (aborts != NULL) {
+    fuse_thread_locals_t *next = aborts->abort_next;
+    fuse_native_abort(ft, aborts);
+    aborts = next;
+  }
+
+  while (retired != NULL) {
+    fuse_thread_locals_t *next = retired->retired_next;
+    fuse_native_release_locals(env, retired);
+    retired = next;
+  }
+
+  napi_close_callback_scope(env, callback_scope);
+  napi_close_handle_scope(env, scope);
+}
+
+// The thread locals buffer lives in the main isolate, workers get a view of it instead. Each worker keeps
+// its view, so JS sees one stable object per FUSE thread and can hang its per thread state off of it.
+static void fuse_native_locals_value (napi_env env, fuse_thread_t *ft, fuse_thread_locals_t *l, napi_value *result) {
+  napi_ref *ref = ft->main == NULL ? &(l->self) : &(l->worker_self[ft->worker_index]);
+
+  if (*ref == NULL) {
+    napi_create_external_buffer(env, sizeof(fuse_thread_locals_t), l, NULL, NULL, result);
+    napi_create_reference(env, *result, 1, ref);
+    return;
+  }
+
+  napi_get_reference_value(env, *ref, result);
+}
+
+static void fuse_native_async_init (uv_async_t* handle) {
+  fuse_thread_t *ft = (fuse_thread_t *) handle->data;
+  fuse_thread_locals_t *l = calloc(1, sizeof(fuse_thread_locals_t));
+
+  napi_env env = ft->env;
+  napi_handle_scope scope;
+  napi_open_handle_scope(env, &scope);
+
+  napi_value buf;
+  napi_create_external_buffer(env, sizeof(fuse_thread_locals_t), l, NULL, NULL, &buf);
+  napi_create_reference(env, buf, 1, &(l->self));
+
+  napi_close_handle_scope(env, scope);
+
+  uv_sem_init(&(l->sem), 0);
+  handle->data = l;
+  l->fuse = ft;
+
+  l->locals_next = ft->locals;
+  l->locals_pprev = &(ft->locals);
+  if (ft->locals != NULL) ft->locals->locals_pprev = &(l->locals_next);
+  ft->locals = l;
+
+  uv_sem_post(&(fuse_native_dispatcher(ft)->sem));
+}
+
+static fuse_thread_locals_t* get_thread_locals () {
+  void *data = pthread_getspecific(thread_locals_key);
+
+  if (data != NULL) {
+    return (fuse_thread_locals_t *) data;
+  }
+
+  // Only valid in high-level mode, low-level handlers set up their locals up front.
+  struct fuse_context *ctx = fuse_get_context();
+  return fuse_native_thread_locals((fuse_thread_t *) ctx->private_data);
+}
+
+static fuse_thread_locals_t* fuse_native_thread_locals (fuse_thread_t *ft) {
+  void *data = pthread_getspecific(thread_locals_key);
+
+  if (data != NULL) {
+    return (fuse_thread_locals_t *) data;
+  }
+
+  // Shared mounts make theirs through the dispatcher of the group.
+  fuse_thread_t *boot = fuse_native_dispatcher(ft);
+
+  // Need to lock the mutation of l->async.
+  uv_mutex_lock(&(boot->mut));
+  boot->async.data = ft;
+
+  // Notify the main thread to uv_async_init l->async.
+  uv_async_send(&(boot->async));
+  uv_sem_wait(&(boot->sem));
+
+  fuse_thread_locals_t *l = (fuse_thread_locals_t*) boot->async.data;
+
+  fuse_native_set_thread_locals(l);
+  uv_mutex_unlock(&(boot->mut));
+
+  return l;
+}
+
+// FUSE thread pool
+// Used instead of fuse_session_loop_mt when a max thread or idle count is set. libfuse 2 spawns a thread
+// whenever none is left waiting for the kernel and never retires one, so a burst leaves dozens behind.
+// Here spawning stops at max_threads, and a thread that finds more than max_idle others waiting exits.
+
+static int fuse_native_pool_spawn (fuse_thread_t *ft);
+
+static void* fuse_native_pool_worker (void *data) {
+  fuse_thread_t *ft = (fuse_thread_t *) data;
+  fuse_native_pool_t *pool = &(ft->pool);
+  void *mem = malloc(pool->bufsize);
+  int retired = 0;
+
+  while (mem != NULL && !fuse_session_exited(pool->session)) {
+    struct fuse_buf buf = { pool->bufsize, (enum fuse_buf_flags) 0, mem, -1, 0 };
+    struct fuse_chan *ch = ft->ch;
+
+    int res = fuse_session_receive_buf(pool->session, &buf, &ch);
+
+    if (res == -EINTR) continue;
+    if (res <= 0) {
+      if (res < 0) {
+        fuse_session_exit(pool->session);
+        pool->error = -1;
+      }
+      break;
+    }
+
+    uv_mutex_lock(&(pool->lock));
+    if (--pool->available == 0 && pool->threads < pool->max_threads) fuse_native_pool_spawn(ft);
+    uv_mutex_unlock(&(pool->lock));
+
+    fuse_session_process_buf(pool->session, &buf, ch);
 
-FUSE_METHOD(getxattr, 4, 1, (const char *path, const char *name, char *value, size_t size, uint32_t position), {
-  l->path = path;
-  l->name = name;
-  l->value = value;
-  l->size = size;
-  l->position = position;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
-  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
-  napi_create_uint32(env, l->position, &(argv[5]));
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
-})
+    uv_mutex_lock(&(pool->lock));
+    retired = ++pool->available > pool->max_idle && pool->threads > 1;
+    if (retired) {
+      pool->available--;
+      pool->threads--;
+      // Before the last thread can post done, the mount may be torn down right after.
+      fuse_native_drop_thread_locals();
+    }
+    uv_mutex_unlock(&(pool->lock));
 
-#else
+    if (retired) break;
+  }
 
-FUSE_METHOD(setxattr, 5, 1, (const char *path, const char *name, const char *value, size_t size, int flags), {
-  l->path = path;
-  l->name = name;
-  l->value = value;
-  l->size = size;
-  l->flags = flags;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
-  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
-  napi_create_uint32(env, 0, &(argv[5])); // normalize apis between mac and linux
-  napi_create_uint32(env, l->flags, &(argv[6]));
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
-})
+  free(mem);
+  if (retired) return NULL;
 
-FUSE_METHOD(getxattr, 4, 1, (const char *path, const char *name, char *value, size_t size), {
-  l->path = path;
-  l->name = name;
-  l->value = value;
-  l->size = size;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
-  napi_create_external_buffer(env, l->size, (char *) l->value, NULL, NULL, &(argv[4]));
-  napi_create_uint32(env, 0, &(argv[5]));
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
-})
+  if (mem == NULL) {
+    fuse_session_exit(pool->session);
+    pool->error = -1;
+  }
+
+  fuse_native_drop_thread_locals();
+
+  uv_mutex_lock(&(pool->lock));
+  pool->available--;
+  int last = --pool->threads == 0;
+  uv_mutex_unlock(&(pool->lock));
+
+  if (last) uv_sem_post(&(pool->done));
+  return NULL;
+}
+
+// Called with the pool locked.
+static int fuse_native_pool_spawn (fuse_thread_t *ft) {
+  fuse_native_pool_t *pool = &(ft->pool);
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&thread, &attr, fuse_native_pool_worker, ft);
+  pthread_attr_destroy(&attr);
+
+  if (err != 0) return -1;
+
+  pool->threads++;
+  pool->available++;
+  return 0;
+}
+
+static int fuse_native_pool_loop (fuse_thread_t *ft, struct fuse_session *session) {
+  fuse_native_pool_t *pool = &(ft->pool);
+
+  pool->session = session;
+  pool->bufsize = fuse_chan_bufsize(ft->ch);
+  pool->threads = 0;
+  pool->available = 0;
+  pool->error = 0;
+  uv_mutex_init(&(pool->lock));
+  uv_sem_init(&(pool->done), 0);
+
+  uv_mutex_lock(&(pool->lock));
+  int err = fuse_native_pool_spawn(ft);
+  uv_mutex_unlock(&(pool->lock));
+
+  if (err == 0) uv_sem_wait(&(pool->done));
+
+  uv_sem_destroy(&(pool->done));
+  uv_mutex_destroy(&(pool->lock));
+
+  return err < 0 ? err : pool->error;
+}
+
+// Unmounts and frees what fuse_native_mount_work set up, once nothing is served on it anymore.
+static void fuse_native_teardown (fuse_thread_t *ft) {
+  if (ft->session != NULL) {
+    fuse_session_remove_chan(ft->ch);
+    fuse_session_destroy(ft->session);
+    fuse_unmount(ft->mnt, ft->ch);
+    return;
+  }
+
+  fuse_unmount(ft->mnt, ft->ch);
+  fuse_session_remove_chan(ft->ch);
+  fuse_destroy(ft->fuse);
+}
+
+// Shared mounts
+// The group's threads wait for any of its channels to become readable (each armed one shot, and rearmed
+// as soon as a request was read off it so other threads can take the next), then serve that request with
+// the thread locals they keep for its mount. The last thread done with a mount that exited tears it down.
+
+#ifdef __linux__
+
+static int fuse_native_group_spawn (fuse_native_group_t *g);
+static void fuse_native_stopped (fuse_thread_t *ft);
+
+static int fuse_native_group_arm (fuse_native_group_t *g, fuse_thread_t *ft, int op) {
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.u64 = ((uint64_t) ft->group_generation << 32) | ft->group_slot;
+  return epoll_ctl(g->epfd, op, fuse_chan_fd(ft->ch), &ev);
+}
+
+static struct fuse_session* fuse_native_group_session (fuse_thread_t *ft) {
+  return ft->session != NULL ? ft->session : fuse_get_session(ft->fuse);
+}
+
+// Same as the end of start_fuse_thread, the slot was given up already.
+static void fuse_native_group_stop (fuse_native_group_t *g, fuse_thread_t *ft) {
+  epoll_ctl(g->epfd, EPOLL_CTL_DEL, fuse_chan_fd(ft->ch), NULL);
+  fuse_native_teardown(ft);
+  fuse_native_stopped(ft);
+}
+
+typedef struct {
+  uint32_t generation;
+  fuse_thread_locals_t *l;
+} fuse_native_group_locals_t;
+
+static void* fuse_native_group_worker (void *data) {
+  fuse_native_group_t *g = (fuse_native_group_t *) data;
+  fuse_native_group_locals_t *locals = NULL;
+  uint32_t locals_length = 0;
+  void *mem = NULL;
+  size_t bufsize = 0;
+  int retired = 0;
+
+  while (!retired) {
+    struct epoll_event ev;
+    int n = epoll_wait(g->epfd, &ev, 1, -1);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+
+    uint32_t slot = (uint32_t) ev.data.u64;
+    uint32_t generation = (uint32_t) (ev.data.u64 >> 32);
+
+    uv_mutex_lock(&(g->lock));
+    fuse_thread_t *ft = slot < g->mounts_length && g->generations[slot] == generation ? g->mounts[slot] : NULL;
+    if (ft != NULL) {
+      ft->group_busy++;
+      if (--g->available == 0 && g->threads < g->max_threads) fuse_native_group_spawn(g);
+    }
+    uv_mutex_unlock(&(g->lock));
+
+    // The mount went away after the event fired.
+    if (ft == NULL) continue;
+
+    struct fuse_session *se = fuse_native_group_session(ft);
+    struct fuse_chan *ch = ft->ch;
+    size_t size = fuse_chan_bufsize(ch);
+    int res = -ENOMEM;
+
+    if (size > bufsize) {
+      void *grown = realloc(mem, size);
+      if (grown != NULL) {
+        mem = grown;
+        bufsize = size;
+      }
+    }
+
+    if (slot >= locals_length) {
+      uint32_t length = slot + 16;
+      fuse_native_group_locals_t *grown = realloc(locals, length * sizeof(fuse_native_group_locals_t));
+      if (grown != NULL) {
+        memset(grown + locals_length, 0, (length - locals_length) * sizeof(fuse_native_group_locals_t));
+        locals = grown;
+        locals_length = length;
+      }
+    }
+
+    struct fuse_buf buf = { bufsize, (enum fuse_buf_flags) 0, mem, -1, 0 };
+    if (bufsize >= size && slot < locals_length) res = fuse_session_receive_buf(se, &buf, &ch);
+
+    int exited = res == 0 || (res < 0 && res != -EAGAIN && res != -EINTR) || fuse_session_exited(se);
+    if (exited) fuse_session_exit(se);
+    else fuse_native_group_arm(g, ft, EPOLL_CTL_MOD);
+
+    if (res > 0) {
+      fuse_native_group_locals_t *cached = &(locals[slot]);
+      fuse_native_set_thread_locals(cached->generation == generation ? cached->l : NULL);
+      fuse_session_process_buf(se, &buf, ch);
+      cached->l = (fuse_thread_locals_t *) pthread_getspecific(thread_locals_key);
+      cached->generation = generation;
+      fuse_native_set_thread_locals(NULL);
+    }
+
+    uv_mutex_lock(&(g->lock));
+    if (exited) ft->group_exited = 1;
+    int last = --ft->group_busy == 0 && ft->group_exited;
+    if (last) {
+      g->mounts[slot] = NULL;
+      g->generations[slot] = 0;
+    }
+    retired = ++g->available > g->max_idle && g->threads > 1;
+    if (retired) {
+      g->available--;
+      g->threads--;
+    }
+    uv_mutex_unlock(&(g->lock));
+
+    if (last) fuse_native_group_stop(g, ft);
+  }
+
+  // Locals of mounts still up go back to them, those of mounts gone were freed along with the mount.
+  uv_mutex_lock(&(g->lock));
+  for (uint32_t i = 0; i < locals_length && i < g->mounts_length; i++) {
+    if (locals[i].l != NULL && g->generations[i] == locals[i].generation) fuse_native_retire(locals[i].l);
+  }
+  uv_mutex_unlock(&(g->lock));
+
+  free(mem);
+  free(locals);
+  return NULL;
+}
+
+// Called with the group locked.
+static int fuse_native_group_spawn (fuse_native_group_t *g) {
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int err = pthread_create(&thread, &attr, fuse_native_group_worker, g);
+  pthread_attr_destroy(&attr);
+
+  if (err != 0) return -1;
+
+  g->threads++;
+  g->available++;
+  return 0;
+}
+
+static void fuse_native_async_init (uv_async_t* handle);
+static void fuse_native_dispatch (uv_async_t* handle);
+static void fuse_native_wheel_init (uv_loop_t *loop, fuse_thread_t *ft);
+
+// Sets up the group's dispatcher on the loop of the first shared mount, the others must share that loop.
+static int fuse_native_group_init (napi_env env, fuse_native_group_t *g) {
+  fuse_thread_t *d = &(g->dispatcher);
+
+  if (g->initialized) return d->env == env ? 0 : -EINVAL;
+
+  g->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (g->epfd < 0) return -errno;
+
+  uv_mutex_init(&(g->lock));
+  if (g->max_threads == 0) g->max_threads = FUSE_NATIVE_GROUP_MAX_THREADS;
+  if (g->max_idle == 0) g->max_idle = FUSE_NATIVE_GROUP_MAX_IDLE;
+
+  d->env = env;
+  d->shared = 1;
+  d->pending = NULL;
+  d->aborts = NULL;
+  d->retired = NULL;
+  uv_mutex_init(&(d->mut));
+  uv_sem_init(&(d->sem), 0);
+
+  uv_loop_t *loop;
+  napi_get_uv_event_loop(env, &loop);
+
+  uv_async_init(loop, &(d->async), (uv_async_cb) fuse_native_async_init);
+  uv_unref((uv_handle_t *) &(d->async));
+  uv_async_init(loop, &(d->dispatch), (uv_async_cb) fuse_native_dispatch);
+  uv_unref((uv_handle_t *) &(d->dispatch));
+  d->dispatch.data = d;
+  fuse_native_wheel_init(loop, d);
+
+  napi_value ctx;
+  napi_value dispatch_name;
+  napi_create_object(env, &ctx);
+  napi_create_reference(env, ctx, 1, &(d->ctx));
+  napi_create_string_utf8(env, "fuse-native", NAPI_AUTO_LENGTH, &dispatch_name);
+  napi_async_init(env, ctx, dispatch_name, &(d->dispatch_ctx));
+
+  g->initialized = 1;
+  return 0;
+}
+
+static int fuse_native_group_add (napi_env env, fuse_thread_t *ft) {
+  fuse_native_group_t *g = ft->group;
+
+  int err = fuse_native_group_init(env, g);
+  if (err < 0) return err;
+
+  // Threads only read a channel they were told is readable, a racing one gets EAGAIN instead of blocking.
+  int fd = fuse_chan_fd(ft->ch);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  uv_mutex_lock(&(g->lock));
+
+  uint32_t slot = 0;
+  while (slot < g->mounts_length && g->mounts[slot] != NULL) slot++;
+
+  if (slot == g->mounts_length) {
+    uint32_t length = g->mounts_length == 0 ? 16 : g->mounts_length * 2;
+    fuse_thread_t **mounts = realloc(g->mounts, length * sizeof(fuse_thread_t *));
+    uint32_t *generations = mounts == NULL ? NULL : realloc(g->generations, length * sizeof(uint32_t));
+
+    if (mounts != NULL) g->mounts = mounts;
+    if (generations == NULL) {
+      uv_mutex_unlock(&(g->lock));
+      return -ENOMEM;
+    }
+
+    g->generations = generations;
+    for (uint32_t i = g->mounts_length; i < length; i++) {
+      g->mounts[i] = NULL;
+      g->generations[i] = 0;
+    }
+    g->mounts_length = length;
+  }
+
+  if (++g->next_generation == 0) g->next_generation = 1;
+
+  ft->group_slot = slot;
+  ft->group_generation = g->next_generation;
+  ft->group_busy = 0;
+  ft->group_exited = 0;
+  g->mounts[slot] = ft;
+  g->generations[slot] = ft->group_generation;
+
+  err = g->threads == 0 ? fuse_native_group_spawn(g) : 0;
+  uv_mutex_unlock(&(g->lock));
+
+  if (err < 0 || fuse_native_group_arm(g, ft, EPOLL_CTL_ADD) < 0) {
+    uv_mutex_lock(&(g->lock));
+    g->mounts[slot] = NULL;
+    g->generations[slot] = 0;
+    uv_mutex_unlock(&(g->lock));
+    return -EIO;
+  }
+
+  // Holds the loop open while shared mounts are up, like the async handle of a mount of its own.
+  if (g->mounted++ == 0) uv_ref((uv_handle_t *) &(g->dispatcher.async));
+  return 0;
+}
 
 #endif
 
-FUSE_METHOD(listxattr, 2, 1, (const char *path, char *list, size_t size), {
-  l->path = path;
-  l->list = list;
-  l->size = size;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_external_buffer(env, l->size, l->list, NULL, NULL, &(argv[3]));
-}, {
-  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) assert(napi_detach_arraybuffer(env, argv[2]) == napi_ok);
-})
+// Threads inherit the affinity of the thread creating them, so pinning the mount thread pins every FUSE thread.
+static void fuse_native_pin_thread (fuse_thread_t *ft) {
+#ifdef __linux__
+  if (ft->cpus_length == 0) return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (uint32_t i = 0; i < ft->cpus_length; i++) {
+    if (ft->cpus[i] < CPU_SETSIZE) CPU_SET(ft->cpus[i], &set);
+  }
+
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#endif
+}
+
+static void fuse_native_unmount_notify (fuse_thread_t *ft);
+
+// Lets fuse_native_unmount know the FUSE threads are done with ft.
+static void fuse_native_stopped (fuse_thread_t *ft) {
+  fuse_native_write_back_stop(&(ft->write_back));
+
+  uv_mutex_lock(&(ft->stop_lock));
+  ft->stopped = 1;
+  fuse_native_unmount_notify(ft);
+  uv_mutex_unlock(&(ft->stop_lock));
+}
+
+static void* start_fuse_thread (void *data) {
+  fuse_thread_t *ft = (fuse_thread_t *) data;
+
+  fuse_native_pin_thread(ft);
+
+  if (ft->session != NULL) {
+    if (ft->single_threaded) fuse_session_loop(ft->session);
+    else if (ft->pool.max_threads) fuse_native_pool_loop(ft, ft->session);
+    else fuse_session_loop_mt(ft->session);
+  } else if (ft->single_threaded) {
+    fuse_loop(ft->fuse);
+  } else if (ft->pool.max_threads) {
+    // Same as fuse_loop_mt, which also runs the thread that forgets old nodes for the remember option.
+    if (fuse_start_cleanup_thread(ft->fuse) == 0) {
+      fuse_native_pool_loop(ft, fuse_get_session(ft->fuse));
+      fuse_stop_cleanup_thread(ft->fuse);
+    }
+  } else {
+    fuse_loop_mt(ft->fuse);
+  }
+
+  fuse_native_teardown(ft);
+  fuse_native_stopped(ft);
+  return NULL;
+}
+
+// A mount in progress. fuse_mount can fork fusermount and wait for it, so it runs on the libuv
+// threadpool together with fuse_new, everything touching the loop or JS happens before and after.
+typedef struct {
+  uv_work_t work;
+  fuse_thread_t *ft;
+  napi_ref callback;
+  int lowlevel;
+  int argc;
+  char *argv[2];
+  struct fuse_operations ops;
+#ifndef __APPLE__
+  struct fuse_lowlevel_ops ll_ops;
+#endif
+  const char *error;
+} fuse_native_mount_t;
+
+static void fuse_native_mount_work (uv_work_t *work) {
+  fuse_native_mount_t *m = (fuse_native_mount_t *) work;
+  fuse_thread_t *ft = m->ft;
+
+  struct fuse_args args = FUSE_ARGS_INIT(m->argc, m->argv);
+  struct fuse_chan *ch = fuse_mount(ft->mnt, &args);
+
+  if (ch == NULL) {
+    fuse_opt_free_args(&args);
+    m->error = "fuse_mount failed";
+    return;
+  }
+
+#ifndef __APPLE__
+  if (m->lowlevel) {
+    ft->session = fuse_lowlevel_new(&args, &(m->ll_ops), sizeof(struct fuse_lowlevel_ops), ft);
+    if (ft->session != NULL) fuse_session_add_chan(ft->session, ch);
+  }
+#endif
+
+  if (!m->lowlevel) ft->fuse = fuse_new(ch, &args, &(m->ops), sizeof(struct fuse_operations), ft);
+
+  fuse_opt_free_args(&args);
+
+  if (ft->fuse == NULL && ft->session == NULL) {
+    fuse_unmount(ft->mnt, ch);
+    m->error = "fuse_new failed";
+    return;
+  }
+
+  ft->ch = ch;
+}
+
+// Back on the loop, hooks the mount up to it and starts the FUSE thread. Undoes all of that if it fails,
+// the session is left to fuse_native_mount_abort.
+static int fuse_native_mount_start (napi_env env, fuse_thread_t *ft) {
+  uv_mutex_init(&(ft->stop_lock));
+  ft->unmount = NULL;
+  ft->stopped = 0;
+  ft->retired = NULL;
+  ft->locals = NULL;
+
+#ifdef __linux__
+  if (ft->group != NULL) {
+    // Started before the threads that stop it.
+    fuse_native_write_back_start(ft);
+    int err = fuse_native_group_add(env, ft);
+    if (err < 0) fuse_native_write_back_cancel(ft);
+    else ft->mounted++;
+    return err;
+  }
+#endif
+
+  int err = uv_async_init(uv_default_loop(), &(ft->async), (uv_async_cb) fuse_native_async_init);
+  if (err < 0) return err;
+
+  ft->pending = NULL;
+  ft->aborts = NULL;
+  err = uv_async_init(uv_default_loop(), &(ft->dispatch), (uv_async_cb) fuse_native_dispatch);
+  if (err < 0) {
+    uv_close((uv_handle_t *) &(ft->async), NULL);
+    return err;
+  }
+
+  uv_mutex_init(&(ft->mut));
+  uv_sem_init(&(ft->sem), 0);
+
+  ft->dispatch.data = ft;
+  uv_unref((uv_handle_t *) &(ft->dispatch));
+
+  fuse_native_wheel_init(uv_default_loop(), ft);
+
+  napi_value ctx;
+  napi_value dispatch_name;
+  napi_get_reference_value(env, ft->ctx, &ctx);
+  napi_create_string_utf8(env, "fuse-native", NAPI_AUTO_LENGTH, &dispatch_name);
+  napi_async_init(env, ctx, dispatch_name, &(ft->dispatch_ctx));
+
+  fuse_native_write_back_start(ft);
+
+  pthread_attr_init(&(ft->attr));
+  err = pthread_create(&(ft->thread), &(ft->attr), start_fuse_thread, ft);
+  pthread_attr_destroy(&(ft->attr));
+
+  if (err != 0) {
+    fuse_native_write_back_cancel(ft);
+    uv_close((uv_handle_t *) &(ft->async), NULL);
+    uv_close((uv_handle_t *) &(ft->dispatch), NULL);
+    uv_close((uv_handle_t *) &(ft->wheel.timer), NULL);
+    napi_async_destroy(env, ft->dispatch_ctx);
+    uv_mutex_destroy(&(ft->mut));
+    uv_sem_destroy(&(ft->sem));
+    return -err;
+  }
+
+  ft->mounted++;
+  return 0;
+}
+
+// Frees the caches, state and references fuse_native_mount set up.
+static void fuse_native_mount_free (napi_env env, fuse_thread_t *ft) {
+  fuse_native_attr_cache_destroy(&(ft->attr_cache));
+  fuse_native_block_cache_destroy(&(ft->block_cache));
+  fuse_native_write_back_destroy(&(ft->write_back));
+  fuse_native_handles_destroy(env, &(ft->handles));
+  fuse_native_path_cache_destroy(env, &(ft->paths));
+  fuse_native_inodes_destroy(&(ft->inodes));
+  fuse_native_passthrough_destroy(&(ft->passthrough));
+  fuse_native_memfs_destroy(&(ft->memfs));
+
+  free(ft->stats);
+  ft->stats = NULL;
+
+  for (int i = 0; i < FUSE_NATIVE_OPS; i++) {
+    if (ft->handlers[i] != NULL) napi_delete_reference(env, ft->handlers[i]);
+    ft->handlers[i] = NULL;
+  }
+
+  napi_delete_reference(env, ft->ctx);
+  ft->ctx = NULL;
+}
+
+// A mount that did not come up, whatever part of it did goes away again. Nothing was served on it,
+// so unlike fuse_native_reclaim there are no locals, and no threads to wait for.
+static void fuse_native_mount_abort (napi_env env, fuse_thread_t *ft) {
+  if (ft->ch != NULL) fuse_native_teardown(ft);
+  ft->ch = NULL;
+  fuse_native_mount_free(env, ft);
+}
+
+static void fuse_native_mount_done (uv_work_t *work, int status) {
+  fuse_native_mount_t *m = (fuse_native_mount_t *) work;
+  fuse_thread_t *ft = m->ft;
+  napi_env env = ft->env;
+
+  const char *error = status < 0 ? "mount cancelled" : m->error;
+  if (error == NULL && fuse_native_mount_start(env, ft) < 0) error = "fuse failed";
+
+  napi_handle_scope scope;
+  napi_open_handle_scope(env, &scope);
+
+  // The reference goes with the mount if it failed.
+  napi_value ctx;
+  napi_get_reference_value(env, ft->ctx, &ctx);
+  if (error != NULL) fuse_native_mount_abort(env, ft);
+
+  napi_value callback;
+  napi_get_reference_value(env, m->callback, &callback);
+
+  napi_value argv[1];
+
+  if (error != NULL) {
+    napi_value code;
+    napi_value msg;
+    napi_create_string_utf8(env, "fuse failed", NAPI_AUTO_LENGTH, &code);
+    napi_create_string_utf8(env, error, NAPI_AUTO_LENGTH, &msg);
+    napi_create_error(env, code, msg, &(argv[0]));
+  } else {
+    napi_get_null(env, &(argv[0]));
+  }
+
+  napi_delete_reference(env, m->callback);
+  free(m);
+
+  NAPI_MAKE_CALLBACK(env, NULL, ctx, callback, 1, argv, NULL)
+  napi_close_handle_scope(env, scope);
+}
+
+NAPI_METHOD(fuse_native_mount) {
+  NAPI_ARGV(12)
+
+  NAPI_ARGV_UTF8(mnt, 1024, 0);
+  NAPI_ARGV_UTF8(mntopts, 1024, 1);
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 2);
+  napi_value ctx = argv[3];
+  napi_value handlers = argv[4];
+  NAPI_ARGV_BUFFER_CAST(uint32_t *, implemented, 5)
+  NAPI_ARGV_BUFFER_CAST(double *, config, 6)
+  NAPI_ARGV_BUFFER_CAST(uint32_t *, timeouts, 7)
+  NAPI_ARGV_BUFFER_CAST(uint32_t *, cpus, 8)
+  NAPI_ARGV_UTF8(passthrough, PATH_MAX, 9)
+  napi_value intercept = argv[10];
+  napi_value callback = argv[11];
+
+#ifdef __APPLE__
+  if (config[config_lowlevel]) {
+    napi_throw_error(env, "fuse failed", "low-level mode is not supported on this platform");
+    return NULL;
+  }
+#endif
+
+  ft->group = NULL;
+
+  if (config[config_shared]) {
+#ifdef __linux__
+    ft->group = &shared_group;
+#else
+    napi_throw_error(env, "fuse failed", "shared mounts are not supported on this platform");
+    return NULL;
+#endif
+  }
+
+  int memory = config[config_memory] ? 1 : 0;
+
+  if (*passthrough != '\0' || memory) {
+#ifdef __linux__
+    if (config[config_lowlevel]) {
+      napi_throw_error(env, "fuse failed", "passthrough and memory mounts are not supported in low-level mode");
+      return NULL;
+    }
+    if (*passthrough != '\0' && memory) {
+      napi_throw_error(env, "fuse failed", "a mount cannot be both passthrough and memory");
+      return NULL;
+    }
+#else
+    napi_throw_error(env, "fuse failed", "passthrough and memory mounts are not supported on this platform");
+    return NULL;
+#endif
+  }
 
-FUSE_METHOD_VOID(removexattr, 2, 0, (const char *path, const char *name), {
-  l->path = path;
-  l->name = name;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->name, NAPI_AUTO_LENGTH, &(argv[3]));
-})
+  if (fuse_native_passthrough_init(env, &(ft->passthrough), passthrough, intercept, memory) < 0) {
+    napi_throw_error(env, "fuse failed", "cannot open the passthrough directory");
+    return NULL;
+  }
 
-FUSE_METHOD_VOID(flush, 2, 0, (const char *path, struct fuse_file_info *info), {
-  l->path = path;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[3]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
+  ft->memfs.enabled = 0;
+
+  if (memory && fuse_native_memfs_init(&(ft->memfs), (size_t) config[config_memory_size]) < 0) {
+    fuse_native_passthrough_destroy(&(ft->passthrough));
+    napi_throw_error(env, "fuse failed", "out of memory");
+    return NULL;
   }
-})
 
-FUSE_METHOD_VOID(fsync, 3, 0, (const char *path, int datasync, struct fuse_file_info *info), {
-  l->path = path;
-  l->mode = datasync;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[4]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[4]));
+  fuse_native_mount_t *m = calloc(1, sizeof(fuse_native_mount_t));
+  if (m == NULL) {
+    fuse_native_passthrough_destroy(&(ft->passthrough));
+    fuse_native_memfs_destroy(&(ft->memfs));
+    napi_throw_error(env, "fuse failed", "out of memory");
+    return NULL;
   }
-})
 
-FUSE_METHOD_VOID(fsyncdir, 3, 0, (const char *path, int datasync, struct fuse_file_info *info), {
-  l->path = path;
-  l->mode = datasync;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[4]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[4]));
+  for (int i = 0; i < FUSE_NATIVE_OPS; i++) {
+    ft->handlers[i] = NULL;
+    ft->implemented[i] = implemented[i];
   }
-})
 
+  NAPI_FOR_EACH(handlers, handler) {
+    napi_create_reference(env, handler, 1, &ft->handlers[i]);
+  }
 
-FUSE_METHOD_VOID(truncate, 3, 0, (const char *path, off_t size), {
-  l->path = path;
-  l->offset = size;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  FUSE_UINT64_TO_INTS_ARGV(l->offset, 3)
-})
+  napi_create_reference(env, ctx, 1, &(ft->ctx));
+  ft->env = env;
 
-FUSE_METHOD_VOID(ftruncate, 4, 0, (const char *path, off_t size, struct fuse_file_info *info), {
-  l->path = path;
-  l->offset = size;
-  l->info = info;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  if (l->info != NULL) {
-    napi_create_uint32(env, l->info->fh, &(argv[3]));
-  } else {
-    napi_create_uint32(env, 0, &(argv[3]));
+  // Ops libfuse should call, write-back needs to see every flush, fsync and release even if JS does not.
+  uint32_t hooks[FUSE_NATIVE_OPS];
+  memcpy(hooks, implemented, sizeof(hooks));
+  if (config[config_write_back_size] > 0 && implemented[op_write]) {
+    hooks[op_flush] = hooks[op_fsync] = hooks[op_release] = 1;
   }
-  FUSE_UINT64_TO_INTS_ARGV(l->offset, 4)
-})
 
-FUSE_METHOD(readlink, 1, 1, (const char *path, char *linkname, size_t len), {
-  l->path = path;
-  l->linkname = linkname;
-  l->len = len;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-}, {
-  NAPI_ARGV_UTF8(linkname, l->len, 2)
-  strncpy(l->linkname, linkname, l->len);
-})
+  if (implemented[op_access]) m->ops.access = fuse_native_access;
+  if (implemented[op_truncate]) m->ops.truncate = fuse_native_truncate;
+  if (implemented[op_ftruncate]) m->ops.ftruncate = fuse_native_ftruncate;
+  if (implemented[op_getattr]) m->ops.getattr = fuse_native_getattr;
+  if (implemented[op_fgetattr]) m->ops.fgetattr = fuse_native_fgetattr;
+  if (hooks[op_flush]) m->ops.flush = fuse_native_flush;
+  if (hooks[op_fsync]) m->ops.fsync = fuse_native_fsync;
+  if (implemented[op_fsyncdir]) m->ops.fsyncdir = fuse_native_dir_fsyncdir;
+  if (implemented[op_readdir]) m->ops.readdir = fuse_native_dir_readdir;
+  if (implemented[op_readlink]) m->ops.readlink = fuse_native_readlink;
+  if (implemented[op_chown]) m->ops.chown = fuse_native_chown;
+  if (implemented[op_chmod]) m->ops.chmod = fuse_native_chmod;
+  if (implemented[op_mknod]) m->ops.mknod = fuse_native_mknod;
+  if (implemented[op_setxattr]) m->ops.setxattr = fuse_native_setxattr;
+  if (implemented[op_getxattr]) m->ops.getxattr = fuse_native_getxattr;
+  if (implemented[op_listxattr]) m->ops.listxattr = fuse_native_listxattr;
+  if (implemented[op_removexattr]) m->ops.removexattr = fuse_native_removexattr;
+  if (implemented[op_statfs]) m->ops.statfs = fuse_native_statfs;
+  if (implemented[op_open]) m->ops.open = fuse_native_open;
+  if (fuse_native_dir_ops(implemented)) m->ops.opendir = fuse_native_dir_opendir;
+  if (implemented[op_read]) m->ops.read = fuse_native_read;
+  if (implemented[op_readbuf]) m->ops.read_buf = fuse_native_readbuf;
+  if (implemented[op_write]) m->ops.write = fuse_native_write;
+  if (implemented[op_writebuf]) m->ops.write_buf = fuse_native_write_buf;
+  if (hooks[op_release]) m->ops.release = fuse_native_release;
+  if (fuse_native_dir_ops(implemented)) m->ops.releasedir = fuse_native_dir_releasedir;
+  if (implemented[op_create]) m->ops.create = fuse_native_create;
+  if (implemented[op_utimens]) m->ops.utimens = fuse_native_utimens;
+  if (implemented[op_unlink]) m->ops.unlink = fuse_native_unlink;
+  if (implemented[op_rename]) m->ops.rename = fuse_native_rename;
+  if (implemented[op_link]) m->ops.link = fuse_native_link;
+  if (implemented[op_symlink]) m->ops.symlink = fuse_native_symlink;
+  if (implemented[op_mkdir]) m->ops.mkdir = fuse_native_mkdir;
+  if (implemented[op_rmdir]) m->ops.rmdir = fuse_native_rmdir;
+  if (implemented[op_init]) m->ops.init = fuse_native_init;
+
+#ifdef __linux__
+  if (ft->memfs.enabled) fuse_native_memfs_ops(&(m->ops));
+  else if (ft->passthrough.enabled) fuse_native_passthrough_ops(&(m->ops));
+#endif
 
-FUSE_METHOD_VOID(chown, 3, 0, (const char *path, uid_t uid, gid_t gid), {
-  l->path = path;
-  l->uid = uid;
-  l->gid = gid;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->uid, &(argv[3]));
-  napi_create_uint32(env, l->gid, &(argv[4]));
-})
+  strncpy(ft->mnt, mnt, 1024);
+  strncpy(ft->mntopts, mntopts, 1024);
 
-FUSE_METHOD_VOID(chmod, 2, 0, (const char *path, mode_t mode), {
-  l->path = path;
-  l->mode = mode;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-})
+  m->ft = ft;
+  m->lowlevel = config[config_lowlevel] ? 1 : 0;
+  m->argc = (strcmp(mntopts, "-o") <= 0) ? 1 : 2;
+  m->argv[0] = (char *) "fuse_bindings_dummy";
+  m->argv[1] = ft->mntopts;
+
+  ft->entry_timeout = config[config_entry_timeout];
+  ft->attr_timeout = config[config_attr_timeout];
+  ft->negative_timeout = config[config_negative_timeout];
+  ft->use_ino = config[config_use_ino] ? 1 : 0;
+  fuse_native_attr_cache_init(&(ft->attr_cache), (size_t) config[config_attr_cache_size], config[config_cache_timeout], ft->negative_timeout);
+  ft->stats = config[config_stats] ? calloc(FUSE_NATIVE_OPS, sizeof(fuse_native_op_stats_t)) : NULL;
+
+  fuse_native_path_cache_init(env, &(ft->paths), (size_t) config[config_path_cache_size]);
+  fuse_native_block_cache_init(&(ft->block_cache), (size_t) config[config_read_cache_size], (size_t) config[config_read_cache_block_size]);
+  fuse_native_write_back_init(&(ft->write_back), (size_t) config[config_write_back_size], config[config_write_back_age]);
+  fuse_native_handles_init(&(ft->handles), config[config_handles] != 0);
+
+  ft->single_threaded = config[config_single_threaded] ? 1 : 0;
+  ft->interrupts = config[config_interrupts] ? 1 : 0;
+
+  // Process wide, the handler finds its request through the thread locals.
+  static pthread_once_t intr_signal_once = PTHREAD_ONCE_INIT;
+  if (ft->interrupts && !config[config_lowlevel]) pthread_once(&intr_signal_once, fuse_native_intr_signal_install);
+  ft->pool.max_threads = (uint32_t) config[config_max_threads];
+  ft->pool.max_idle = (uint32_t) config[config_max_idle_threads];
+  if (ft->pool.max_idle > 0 && ft->pool.max_threads == 0) ft->pool.max_threads = UINT32_MAX;
+  if (ft->pool.max_threads > 0 && ft->pool.max_idle == 0) ft->pool.max_idle = 1;
+
+  ft->cpus_length = cpus_len / sizeof(uint32_t);
+  if (ft->cpus_length > FUSE_NATIVE_MAX_CPUS) ft->cpus_length = FUSE_NATIVE_MAX_CPUS;
+  memcpy(ft->cpus, cpus, ft->cpus_length * sizeof(uint32_t));
+
+  // The workers attached themselves before the mount, see fuse_native_worker_attach.
+  ft->workers_length = (uint32_t) config[config_workers];
+  if (ft->workers_length > FUSE_NATIVE_MAX_WORKERS) ft->workers_length = FUSE_NATIVE_MAX_WORKERS;
+
+#ifndef __APPLE__
+  if (m->lowlevel) {
+    fuse_native_lowlevel_ops(&(m->ll_ops), hooks);
+    fuse_native_inodes_init(&(ft->inodes));
+  }
+#endif
 
-FUSE_METHOD_VOID(mknod, 3, 0, (const char *path, mode_t mode, dev_t dev), {
-  l->path = path;
-  l->mode = mode;
-  l->dev = dev;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-  napi_create_uint32(env, l->dev, &(argv[4]));
-})
+  memcpy(ft->timeouts, timeouts, sizeof(ft->timeouts));
 
-FUSE_METHOD_VOID(unlink, 1, 0, (const char *path), {
-  l->path = path;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-})
+  ft->fuse = NULL;
+  ft->session = NULL;
+  ft->ch = NULL;
 
-FUSE_METHOD_VOID(rename, 2, 0, (const char *path, const char *dest), {
-  l->path = path;
-  l->dest = dest;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->dest, NAPI_AUTO_LENGTH, &(argv[3]));
-})
+  napi_create_reference(env, callback, 1, &(m->callback));
 
-FUSE_METHOD_VOID(link, 2, 0, (const char *path, const char *dest), {
-  l->path = path;
-  l->dest = dest;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->dest, NAPI_AUTO_LENGTH, &(argv[3]));
-})
+  int err = uv_queue_work(uv_default_loop(), &(m->work), fuse_native_mount_work, fuse_native_mount_done);
 
-FUSE_METHOD_VOID(symlink, 2, 0, (const char *path, const char *dest), {
-  l->path = path;
-  l->dest = dest;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_string_utf8(env, l->dest, NAPI_AUTO_LENGTH, &(argv[3]));
-})
+  if (err < 0) {
+    napi_delete_reference(env, m->callback);
+    free(m);
+    fuse_native_mount_free(env, ft);
+    napi_throw_error(env, "fuse failed", "fuse failed");
+    return NULL;
+  }
 
-FUSE_METHOD_VOID(mkdir, 2, 0, (const char *path, mode_t mode), {
-  l->path = path;
-  l->mode = mode;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-  napi_create_uint32(env, l->mode, &(argv[3]));
-})
+  return NULL;
+}
 
-FUSE_METHOD_VOID(rmdir, 1, 0, (const char *path), {
-  l->path = path;
-}, {
-  napi_create_string_utf8(env, l->path, NAPI_AUTO_LENGTH, &(argv[2]));
-})
+static void fuse_native_worker_cleanup (void *data) {
+  fuse_thread_t *w = (fuse_thread_t *) data;
+  fuse_thread_t *ft = w->main;
 
-static void fuse_native_dispatch_init (uv_async_t* handle, fuse_thread_locals_t* l, fuse_thread_t* ft) {\
-  FUSE_NATIVE_CALLBACK(ft->handlers[op_init], {
-    napi_value argv[2];
+  __atomic_store_n(&(ft->workers[w->worker_index]), NULL, __ATOMIC_RELEASE);
 
-    napi_get_reference_value(env, l->self, &(argv[0]));
-    napi_create_uint32(env, l->op, &(argv[1]));
+  // Requests that were queued here but never dispatched go to the main thread instead.
+  fuse_thread_locals_t *l = fuse_native_dequeue_all(w);
+  while (l != NULL) {
+    fuse_thread_locals_t *next = l->next;
+    fuse_native_push(ft, l);
+    l = next;
+  }
 
-    NAPI_MAKE_CALLBACK(env, NULL, ctx, callback, 2, argv, NULL);
-  })
+  l = __atomic_exchange_n(&(w->aborts), NULL, __ATOMIC_ACQUIRE);
+  while (l != NULL) {
+    fuse_thread_locals_t *next = l->abort_next;
+    __atomic_store_n(&(l->abort_queued), 0, __ATOMIC_RELEASE);
+    l = next;
+  }
+
+  uv_close((uv_handle_t *) &(w->wheel.timer), NULL);
+  uv_close((uv_handle_t *) &(w->dispatch), NULL);
+  fuse_native_path_cache_destroy(w->env, &(w->paths));
 }
 
-NAPI_METHOD(fuse_native_signal_init) {
-  NAPI_ARGV(2)
-  NAPI_ARGV_BUFFER_CAST(fuse_thread_locals_t *, l, 0);
-  NAPI_ARGV_INT32(res, 1);
-  l->res = res;
-  uv_sem_post(&(l->sem));
+// Called from a worker_thread: w becomes the dispatcher of slot index of the mount ft
+// (shared with the main thread through a SharedArrayBuffer), running handlers on this isolate's loop.
+NAPI_METHOD(fuse_native_worker_attach) {
+  NAPI_ARGV(6)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 0);
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, w, 1);
+  NAPI_ARGV_UINT32(index, 2)
+  napi_value ctx = argv[3];
+  napi_value handlers = argv[4];
+  NAPI_ARGV_UINT32(path_cache_size, 5)
+
+  if (index >= FUSE_NATIVE_MAX_WORKERS) {
+    napi_throw_error(env, "fuse failed", "too many workers");
+    return NULL;
+  }
+
+  w->env = env;
+  w->main = ft;
+  w->worker_index = index;
+  w->pending = NULL;
+  w->aborts = NULL;
+  napi_create_reference(env, ctx, 1, &(w->ctx));
+  fuse_native_path_cache_init(env, &(w->paths), path_cache_size);
+  fuse_native_handles_init(&(w->handles), 0);
+
+  for (int i = 0; i < FUSE_NATIVE_OPS; i++) {
+    w->handlers[i] = NULL;
+  }
+
+  NAPI_FOR_EACH(handlers, handler) {
+    napi_create_reference(env, handler, 1, &w->handlers[i]);
+  }
+
+  uv_loop_t *loop;
+  napi_get_uv_event_loop(env, &loop);
+
+  // Unlike the mount's own handle this one stays referenced, it keeps the worker alive
+  // for as long as the mount needs it. The main thread terminates it on unmount.
+  if (uv_async_init(loop, &(w->dispatch), (uv_async_cb) fuse_native_dispatch) < 0) {
+    napi_throw_error(env, "fuse failed", "fuse failed");
+    return NULL;
+  }
+
+  w->dispatch.data = w;
+  fuse_native_wheel_init(loop, w);
+
+  napi_value dispatch_name;
+  napi_create_string_utf8(env, "fuse-native:worker", NAPI_AUTO_LENGTH, &dispatch_name);
+  napi_async_init(env, ctx, dispatch_name, &(w->dispatch_ctx));
+  napi_add_env_cleanup_hook(env, fuse_native_worker_cleanup, w);
+
+  __atomic_store_n(&(ft->workers[index]), w, __ATOMIC_RELEASE);
+
   return NULL;
 }
 
-static void * fuse_native_init (struct fuse_conn_info *conn) {
-  fuse_thread_locals_t *l = get_thread_locals();
+// Drops the cached attributes of path and, in low-level mode, tells the kernel to do the same.
+NAPI_METHOD(fuse_native_invalidate) {
+  NAPI_ARGV(4)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 0);
+  NAPI_ARGV_UTF8(path, PATH_MAX, 1);
+  NAPI_ARGV_INT64(offset, 2)
+  NAPI_ARGV_INT64(length, 3)
 
-  l->op = op_init;
-  l->op_fn = fuse_native_dispatch_init;
+  fuse_native_attr_cache_del(&(ft->attr_cache), path);
+  fuse_native_block_cache_drop_range(&(ft->block_cache), path, (off_t) offset, (size_t) length);
 
-  uv_async_send(&(l->async));
-  uv_sem_wait(&(l->sem));
+  int res = 0;
 
-  return l->fuse;
+#ifndef __APPLE__
+  fuse_ino_t ino = ft->session == NULL ? 0 : fuse_native_inode_resolve(&(ft->inodes), path);
+  if (ino != 0) res = fuse_lowlevel_notify_inval_inode(ft->ch, ino, offset, length);
+#endif
+
+  // The kernel may have dropped the inode on its own already.
+  NAPI_RETURN_INT32(res == -ENOENT ? 0 : res)
 }
 
-// Top-level dispatcher
+// Puts a file (a directory if data is null) into a memory mount, see fuse_native_memfs_populate.
+NAPI_METHOD(fuse_native_populate) {
+  NAPI_ARGV(4)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 0);
+  NAPI_ARGV_UTF8(path, PATH_MAX, 1);
+  NAPI_ARGV_UINT32(mode, 3)
 
-static void fuse_native_dispatch (uv_async_t* handle) {
-  fuse_thread_locals_t *l = (fuse_thread_locals_t *) handle->data;
-  fuse_thread_t *ft = l->fuse;
-  void (*fn)(uv_async_t *, fuse_thread_locals_t *, fuse_thread_t *) = l->op_fn;
+  if (!ft->memfs.enabled) {
+    NAPI_RETURN_INT32(-EINVAL)
+  }
 
-  fn(handle, l, ft);
-}
+  napi_valuetype type;
+  napi_typeof(env, argv[2], &type);
 
-static void fuse_native_async_init (uv_async_t* handle) {
-  fuse_thread_t *ft = (fuse_thread_t *) handle->data;
-  fuse_thread_locals_t *l;
+  int dir = type == napi_null || type == napi_undefined;
+  char *data = NULL;
+  size_t len = 0;
 
-  FUSE_NATIVE_CALLBACK(ft->malloc, {
-    napi_value argv[1];
-    napi_create_uint32(ft->env, (uint32_t) sizeof(fuse_thread_locals_t), &(argv[0]));
+  if (!dir) napi_get_buffer_info(env, argv[2], (void **) &data, &len);
 
-    napi_value buf;
-    NAPI_MAKE_CALLBACK(ft->env, NULL, ctx, callback, 1, argv, &buf);
+  pthread_rwlock_wrlock(&(ft->memfs.lock));
+  int res = fuse_native_memfs_populate(&(ft->memfs), path, dir, data, len, mode);
+  pthread_rwlock_unlock(&(ft->memfs.lock));
 
-    size_t l_len;
+  fuse_native_attr_cache_invalidate(&(ft->attr_cache), path);
 
-    napi_get_buffer_info(env, buf, (void **) &l, &l_len);
-    napi_create_reference(env, buf, 1, &(l->self));
-  })
+  NAPI_RETURN_INT32(res)
+}
 
+// Same as above for the name -> inode mapping, parent is a path or (in low-level mode) an inode number.
+NAPI_METHOD(fuse_native_invalidate_entry) {
+  NAPI_ARGV(3)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 0);
+  NAPI_ARGV_UTF8(name, NAME_MAX + 1, 2);
 
-  int err = uv_async_init(uv_default_loop(), &(l->async), (uv_async_cb) fuse_native_dispatch);
-  assert(err >= 0);
+  char path[PATH_MAX];
+  fuse_ino_t parent = 0;
 
-  uv_unref((uv_handle_t *) &(l->async));
+  napi_valuetype type;
+  napi_typeof(env, argv[1], &type);
 
-  uv_sem_init(&(l->sem), 0);
-  l->async.data = l;
-  ft->async.data = l;
-  l->fuse = ft;
+  if (type == napi_number) {
+    int64_t ino;
+    napi_get_value_int64(env, argv[1], &ino);
+    if (ft->session == NULL || ino <= 0) {
+      NAPI_RETURN_INT32(-EINVAL)
+    }
 
-  uv_sem_post(&(ft->sem));
-}
+    parent = (fuse_ino_t) ino;
+    int err = fuse_native_inode_path(&(ft->inodes), parent, name, path, PATH_MAX, NULL);
 
-static fuse_thread_locals_t* get_thread_locals () {
-  struct fuse_context *ctx = fuse_get_context();
-  fuse_thread_t *ft = (fuse_thread_t *) ctx->private_data;
+    if (err < 0) {
+      NAPI_RETURN_INT32(err == -ESTALE ? 0 : err)
+    }
+  } else {
+    NAPI_ARGV_UTF8(dir, PATH_MAX, 1);
 
-  void *data = pthread_getspecific(thread_locals_key);
+    if (!fuse_native_child_path(path, PATH_MAX, dir, name)) {
+      NAPI_RETURN_INT32(-ENAMETOOLONG)
+    }
 
-  if (data != NULL) {
-    return (fuse_thread_locals_t *) data;
+    if (ft->session != NULL) parent = fuse_native_inode_resolve(&(ft->inodes), dir);
   }
 
-  // Need to lock the mutation of l->async.
-  uv_mutex_lock(&(ft->mut));
-  ft->async.data = ft;
+  fuse_native_attr_cache_del(&(ft->attr_cache), path);
+  fuse_native_attr_cache_del_prefix(&(ft->attr_cache), path);
 
-  // Notify the main thread to uv_async_init l->async.
-  uv_async_send(&(ft->async));
-  uv_sem_wait(&(ft->sem));
+  int res = 0;
 
-  fuse_thread_locals_t *l = (fuse_thread_locals_t*) ft->async.data;
+#ifndef __APPLE__
+  if (parent != 0) res = fuse_lowlevel_notify_inval_entry(ft->ch, parent, name, strlen(name));
+#endif
 
-  pthread_setspecific(thread_locals_key, (void *) l);
-  uv_mutex_unlock(&(ft->mut));
+  NAPI_RETURN_INT32(res == -ENOENT ? 0 : res)
+}
 
-  return l;
+// Returns a snapshot of the op stats, one fuse_native_op_stats_t per opcode, or null if disabled.
+NAPI_METHOD(fuse_native_stats) {
+  NAPI_ARGV(1)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 0);
+
+  napi_value result;
+
+  if (ft->stats == NULL) {
+    napi_get_null(env, &result);
+    return result;
+  }
+
+  NAPI_STATUS_THROWS(napi_create_buffer_copy(env, FUSE_NATIVE_OPS * sizeof(fuse_native_op_stats_t), ft->stats, NULL, &result))
+  return result;
 }
 
-static void* start_fuse_thread (void *data) {
-  fuse_thread_t *ft = (fuse_thread_t *) data;
-  fuse_loop_mt(ft->fuse);
+// Thread budget of the shared mounts, applies to threads started from here on.
+NAPI_METHOD(fuse_native_configure_shared) {
+  NAPI_ARGV(2)
+  NAPI_ARGV_UINT32(max_threads, 0)
+  NAPI_ARGV_UINT32(max_idle, 1)
 
-  fuse_unmount(ft->mnt, ft->ch);
-  fuse_session_remove_chan(ft->ch);
-  fuse_destroy(ft->fuse);
+  if (shared_group.initialized) uv_mutex_lock(&(shared_group.lock));
+  shared_group.max_threads = max_threads > 0 ? max_threads : FUSE_NATIVE_GROUP_MAX_THREADS;
+  shared_group.max_idle = max_idle > 0 ? max_idle : FUSE_NATIVE_GROUP_MAX_IDLE;
+  if (shared_group.initialized) uv_mutex_unlock(&(shared_group.lock));
 
   return NULL;
 }
 
-NAPI_METHOD(fuse_native_mount) {
-  NAPI_ARGV(7)
+// An unmount in progress. Once fusermount is done the session ends and the FUSE threads finish what
+// JS still holds, the loop serves those meanwhile and hears from the last of them through stopped,
+// or gives up on them when timeout fires.
+typedef struct fuse_native_unmount {
+  uv_async_t stopped;
+  uv_timer_t timeout;
+  fuse_thread_t *ft;
+  napi_ref callback;
+  int closed;
+} fuse_native_unmount_t;
+
+// Called with stop_lock held, by the thread stopping the mount or by fuse_native_unmount if it stopped already.
+static void fuse_native_unmount_notify (fuse_thread_t *ft) {
+  if (ft->unmount != NULL) uv_async_send(&(ft->unmount->stopped));
+}
 
-  NAPI_ARGV_UTF8(mnt, 1024, 0);
-  NAPI_ARGV_UTF8(mntopts, 1024, 1);
-  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 2);
-  napi_create_reference(env, argv[3], 1, &(ft->ctx));
-  napi_create_reference(env, argv[4], 1, &(ft->malloc));
-  napi_value handlers = argv[5];
-  NAPI_ARGV_BUFFER_CAST(uint32_t *, implemented, 6)
+static void fuse_native_unmount_close (uv_handle_t *handle) {
+  fuse_native_unmount_t *u = (fuse_native_unmount_t *) handle->data;
+  if (++u->closed == 2) free(u);
+}
 
-  for (int i = 0; i < 35; i++) {
-    ft->handlers[i] = NULL;
+static void fuse_native_unmount_done (fuse_native_unmount_t *u) {
+  fuse_thread_t *ft = u->ft;
+  napi_env env = ft->env;
+
+  // From here on the threads no longer see the unmount, nothing is sent on the handle being closed.
+  uv_mutex_lock(&(ft->stop_lock));
+  int stopped = ft->stopped;
+  ft->unmount = NULL;
+  uv_mutex_unlock(&(ft->stop_lock));
+
+  napi_ref ref = u->callback;
+  uv_close((uv_handle_t *) &(u->stopped), fuse_native_unmount_close);
+  uv_close((uv_handle_t *) &(u->timeout), fuse_native_unmount_close);
+
+  // Shared mounts have no thread of their own, the group stopped serving them. The thread of one
+  // that stopped is on its way out after telling us, one that did not is left running.
+  if (ft->group == NULL) {
+    if (stopped) pthread_join(ft->thread, NULL);
+    else pthread_detach(ft->thread);
   }
 
-  NAPI_FOR_EACH(handlers, handler) {
-    napi_create_reference(env, handler, 1, &ft->handlers[i]);
+  // Whatever the threads queued on their way out goes first, mostly locals they handed back.
+  if (stopped) fuse_native_dispatch(&(fuse_native_dispatcher(ft)->dispatch));
+
+  if (ft->group != NULL) {
+    if (--ft->group->mounted == 0) uv_unref((uv_handle_t *) &(ft->group->dispatcher.async));
+  } else if (stopped) {
+    uv_close((uv_handle_t *) &(ft->async), NULL);
+    uv_close((uv_handle_t *) &(ft->dispatch), NULL);
+    uv_close((uv_handle_t *) &(ft->wheel.timer), NULL);
+  } else {
+    // Still in use, the threads keep their handles and the mount stays as it is.
+    uv_unref((uv_handle_t *) &(ft->async));
   }
 
-  ft->env = env;
+  ft->mounted--;
 
-  struct fuse_operations ops = { };
-  if (implemented[op_access]) ops.access = fuse_native_access;
-  if (implemented[op_truncate]) ops.truncate = fuse_native_truncate;
-  if (implemented[op_ftruncate]) ops.ftruncate = fuse_native_ftruncate;
-  if (implemented[op_getattr]) ops.getattr = fuse_native_getattr;
-  if (implemented[op_fgetattr]) ops.fgetattr = fuse_native_fgetattr;
-  if (implemented[op_flush]) ops.flush = fuse_native_flush;
-  if (implemented[op_fsync]) ops.fsync = fuse_native_fsync;
-  if (implemented[op_fsyncdir]) ops.fsyncdir = fuse_native_fsyncdir;
-  if (implemented[op_readdir]) ops.readdir = fuse_native_readdir;
-  if (implemented[op_readlink]) ops.readlink = fuse_native_readlink;
-  if (implemented[op_chown]) ops.chown = fuse_native_chown;
-  if (implemented[op_chmod]) ops.chmod = fuse_native_chmod;
-  if (implemented[op_mknod]) ops.mknod = fuse_native_mknod;
-  if (implemented[op_setxattr]) ops.setxattr = fuse_native_setxattr;
-  if (implemented[op_getxattr]) ops.getxattr = fuse_native_getxattr;
-  if (implemented[op_listxattr]) ops.listxattr = fuse_native_listxattr;
-  if (implemented[op_removexattr]) ops.removexattr = fuse_native_removexattr;
-  if (implemented[op_statfs]) ops.statfs = fuse_native_statfs;
-  if (implemented[op_open]) ops.open = fuse_native_open;
-  if (implemented[op_opendir]) ops.opendir = fuse_native_opendir;
-  if (implemented[op_read]) ops.read = fuse_native_read;
-  if (implemented[op_write]) ops.write = fuse_native_write;
-  if (implemented[op_release]) ops.release = fuse_native_release;
-  if (implemented[op_releasedir]) ops.releasedir = fuse_native_releasedir;
-  if (implemented[op_create]) ops.create = fuse_native_create;
-  if (implemented[op_utimens]) ops.utimens = fuse_native_utimens;
-  if (implemented[op_unlink]) ops.unlink = fuse_native_unlink;
-  if (implemented[op_rename]) ops.rename = fuse_native_rename;
-  if (implemented[op_link]) ops.link = fuse_native_link;
-  if (implemented[op_symlink]) ops.symlink = fuse_native_symlink;
-  if (implemented[op_mkdir]) ops.mkdir = fuse_native_mkdir;
-  if (implemented[op_rmdir]) ops.rmdir = fuse_native_rmdir;
-  if (implemented[op_init]) ops.init = fuse_native_init;
-
-  int _argc = (strcmp(mntopts, "-o") <= 0) ? 1 : 2;
-  char *_argv[] = {
-    (char *) "fuse_bindings_dummy",
-    (char *) mntopts
-  };
-
-  struct fuse_args args = FUSE_ARGS_INIT(_argc, _argv);
-  struct fuse_chan *ch = fuse_mount(mnt, &args);
+  napi_handle_scope scope;
+  napi_open_handle_scope(env, &scope);
 
-  if (ch == NULL) {
-    napi_throw_error(env, "fuse failed", "fuse failed");
-    return NULL;
-  }
+  napi_value ctx;
+  napi_get_reference_value(env, ft->ctx, &ctx);
+  napi_value callback;
+  napi_get_reference_value(env, ref, &callback);
 
-  struct fuse *fuse = fuse_new(ch, &args, &ops, sizeof(struct fuse_operations), ft);
+  napi_value argv[1];
+  napi_get_null(env, &(argv[0]));
 
-  uv_mutex_init(&(ft->mut));
-  uv_sem_init(&(ft->sem), 0);
+  napi_delete_reference(env, ref);
 
-  strncpy(ft->mnt, mnt, 1024);
-  strncpy(ft->mntopts, mntopts, 1024);
-  ft->fuse = fuse;
-  ft->ch = ch;
-  ft->mounted++;
+  NAPI_MAKE_CALLBACK(env, NULL, ctx, callback, 1, argv, NULL)
+  napi_close_handle_scope(env, scope);
+}
 
-  int err = uv_async_init(uv_default_loop(), &(ft->async), (uv_async_cb) fuse_native_async_init);
+static void fuse_native_unmount_stopped (uv_async_t *handle) {
+  fuse_native_unmount_done((fuse_native_unmount_t *) handle->data);
+}
+
+static void fuse_native_unmount_timeout (uv_timer_t *handle) {
+  fuse_native_unmount_done((fuse_native_unmount_t *) handle->data);
+}
+
+NAPI_METHOD(fuse_native_unmount) {
+  NAPI_ARGV(3)
+  NAPI_ARGV_UTF8(mnt, 1024, 0);
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 1);
+  napi_value callback = argv[2];
 
-  if (fuse == NULL || err < 0) {
+  fuse_native_unmount_t *u = calloc(1, sizeof(fuse_native_unmount_t));
+  if (u == NULL) {
+    napi_throw_error(env, "fuse failed", "out of memory");
+    return NULL;
+  }
+
+  uv_loop_t *loop;
+  napi_get_uv_event_loop(env, &loop);
+
+  int err = uv_async_init(loop, &(u->stopped), (uv_async_cb) fuse_native_unmount_stopped);
+  if (err < 0) {
+    free(u);
     napi_throw_error(env, "fuse failed", "fuse failed");
     return NULL;
   }
 
-  pthread_attr_init(&(ft->attr));
-  pthread_create(&(ft->thread), &(ft->attr), start_fuse_thread, ft);
+  uv_timer_init(loop, &(u->timeout));
+  u->stopped.data = u;
+  u->timeout.data = u;
+  u->ft = ft;
+  napi_create_reference(env, callback, 1, &(u->callback));
+
+  uv_timer_start(&(u->timeout), fuse_native_unmount_timeout, FUSE_NATIVE_UNMOUNT_TIMEOUT, 0);
+
+  uv_mutex_lock(&(ft->stop_lock));
+  ft->unmount = u;
+  if (ft->stopped) fuse_native_unmount_notify(ft);
+  uv_mutex_unlock(&(ft->stop_lock));
 
   return NULL;
 }
 
-NAPI_METHOD(fuse_native_unmount) {
-  NAPI_ARGV(2)
-  NAPI_ARGV_UTF8(mnt, 1024, 0);
-  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 1);
+// Frees the locals, caches and references of a mount once its threads and workers are gone, after which
+// the JS side holding ft is all that is left of it. A mount whose threads never stopped is left alone.
+NAPI_METHOD(fuse_native_reclaim) {
+  NAPI_ARGV(1)
+  NAPI_ARGV_BUFFER_CAST(fuse_thread_t *, ft, 0);
+
+  if (!ft->stopped || ft->ctx == NULL) return NULL;
 
-  if (ft != NULL && ft->mounted) {
-    // TODO: Investigate why the FUSE thread is not always killed after fusermount.
-    // pthread_join(ft->thread, NULL);
+  if (IS_ARRAY_BUFFER_DETACH_SUPPORTED == 1) {
+    while (ft->locals != NULL) fuse_native_locals_free(env, ft->locals);
   }
 
-  // TODO: fix the async holding the loop
-  uv_unref((uv_handle_t *) &(ft->async));
-  ft->mounted--;
+  if (ft->group == NULL) {
+    napi_async_destroy(env, ft->dispatch_ctx);
+    uv_mutex_destroy(&(ft->mut));
+    uv_sem_destroy(&(ft->sem));
+  }
 
+  fuse_native_mount_free(env, ft);
   return NULL;
 }
 
+static void fuse_native_thread_locals_key (void) {
+  pthread_key_create(&(thread_locals_key), fuse_native_thread_locals_destroy);
+}
+
 NAPI_INIT() {
   const napi_node_version* version;
   assert(napi_get_node_version(env, &version) == napi_ok);
@@ -909,12 +6904,21 @@ NAPI_INIT() {
     IS_ARRAY_BUFFER_DETACH_SUPPORTED = 1;
   }
 
-  pthread_key_create(&(thread_locals_key), NULL); // TODO: add destructor
+  // Every worker_thread loading the addon runs this again, the key is process wide.
+  static pthread_once_t thread_locals_once = PTHREAD_ONCE_INIT;
+  pthread_once(&thread_locals_once, fuse_native_thread_locals_key);
 
   NAPI_EXPORT_SIZEOF(fuse_thread_t)
 
   NAPI_EXPORT_FUNCTION(fuse_native_mount)
   NAPI_EXPORT_FUNCTION(fuse_native_unmount)
+  NAPI_EXPORT_FUNCTION(fuse_native_reclaim)
+  NAPI_EXPORT_FUNCTION(fuse_native_configure_shared)
+  NAPI_EXPORT_FUNCTION(fuse_native_invalidate)
+  NAPI_EXPORT_FUNCTION(fuse_native_invalidate_entry)
+  NAPI_EXPORT_FUNCTION(fuse_native_populate)
+  NAPI_EXPORT_FUNCTION(fuse_native_stats)
+  NAPI_EXPORT_FUNCTION(fuse_native_worker_attach)
 
   NAPI_EXPORT_FUNCTION(fuse_native_signal_getattr)
   NAPI_EXPORT_FUNCTION(fuse_native_signal_init)
@@ -950,6 +6954,9 @@ NAPI_INIT() {
   NAPI_EXPORT_FUNCTION(fuse_native_signal_symlink)
   NAPI_EXPORT_FUNCTION(fuse_native_signal_mkdir)
   NAPI_EXPORT_FUNCTION(fuse_native_signal_rmdir)
+  NAPI_EXPORT_FUNCTION(fuse_native_signal_lookup)
+  NAPI_EXPORT_FUNCTION(fuse_native_signal_readbuf)
+  NAPI_EXPORT_FUNCTION(fuse_native_signal_writebuf)
 
   NAPI_EXPORT_UINT32(op_getattr)
   NAPI_EXPORT_UINT32(op_init)
@@ -986,4 +6993,55 @@ NAPI_INIT() {
   NAPI_EXPORT_UINT32(op_symlink)
   NAPI_EXPORT_UINT32(op_mkdir)
   NAPI_EXPORT_UINT32(op_rmdir)
+  NAPI_EXPORT_UINT32(op_lookup)
+  NAPI_EXPORT_UINT32(op_readbuf)
+  NAPI_EXPORT_UINT32(op_writebuf)
+  NAPI_EXPORT_UINT32(op_abort)
+
+  NAPI_EXPORT_UINT32(config_lowlevel)
+  NAPI_EXPORT_UINT32(config_entry_timeout)
+  NAPI_EXPORT_UINT32(config_attr_timeout)
+  NAPI_EXPORT_UINT32(config_attr_cache_size)
+  NAPI_EXPORT_UINT32(config_cache_timeout)
+  NAPI_EXPORT_UINT32(config_negative_timeout)
+  NAPI_EXPORT_UINT32(config_stats)
+  NAPI_EXPORT_UINT32(config_workers)
+  NAPI_EXPORT_UINT32(config_path_cache_size)
+  NAPI_EXPORT_UINT32(config_max_threads)
+  NAPI_EXPORT_UINT32(config_max_idle_threads)
+  NAPI_EXPORT_UINT32(config_single_threaded)
+  NAPI_EXPORT_UINT32(config_interrupts)
+  NAPI_EXPORT_UINT32(config_read_cache_size)
+  NAPI_EXPORT_UINT32(config_read_cache_block_size)
+  NAPI_EXPORT_UINT32(config_write_back_size)
+  NAPI_EXPORT_UINT32(config_write_back_age)
+  NAPI_EXPORT_UINT32(config_handles)
+  NAPI_EXPORT_UINT32(config_shared)
+  NAPI_EXPORT_UINT32(config_memory)
+  NAPI_EXPORT_UINT32(config_memory_size)
+  NAPI_EXPORT_UINT32(config_use_ino)
+  NAPI_EXPORT_UINT32(config_length)
+  NAPI_EXPORT_UINT32(max_workers)
+
+  uint32_t intr_signal = (uint32_t) FUSE_NATIVE_INTR_SIGNAL;
+  NAPI_EXPORT_UINT32(intr_signal)
+
+  uint32_t thread_locals_stat_slot = offsetof(fuse_thread_locals_t, stat_slot);
+  uint32_t thread_locals_ino_slot = offsetof(fuse_thread_locals_t, ino_slot);
+  NAPI_EXPORT_UINT32(stat_length)
+  NAPI_EXPORT_UINT32(utime_omit)
+  NAPI_EXPORT_UINT32(thread_locals_stat_slot)
+  NAPI_EXPORT_UINT32(thread_locals_ino_slot)
+
+  uint32_t stats_length = sizeof(fuse_native_op_stats_t) / sizeof(uint64_t);
+  uint32_t stats_errnos_offset = offsetof(fuse_native_op_stats_t, errnos) / sizeof(uint64_t);
+  uint32_t stats_queue_wait_offset = offsetof(fuse_native_op_stats_t, queue_wait) / sizeof(uint64_t);
+  uint32_t stats_service_time_offset = offsetof(fuse_native_op_stats_t, service_time) / sizeof(uint64_t);
+  NAPI_EXPORT_UINT32(op_count)
+  NAPI_EXPORT_UINT32(stats_errnos)
+  NAPI_EXPORT_UINT32(stats_buckets)
+  NAPI_EXPORT_UINT32(stats_length)
+  NAPI_EXPORT_UINT32(stats_errnos_offset)
+  NAPI_EXPORT_UINT32(stats_queue_wait_offset)
+  NAPI_EXPORT_UINT32(stats_service_time_offset)
 }
@@ -12,8 +12,14 @@ const IS_OSX = os.platform() === 'darwin'
 const OSX_FOLDER_ICON = '/System/Library/CoreServices/CoreTypes.bundle/Contents/Resources/GenericFolderIcon.icns'
 const HAS_FOLDER_ICON = IS_OSX && fs.existsSync(OSX_FOLDER_ICON)
 const DEFAULT_TIMEOUT = 15 * 1000
-const TIMEOUT_ERRNO = IS_OSX ? -60 : -110
+const DEFAULT_PATH_CACHE_SIZE = 1024
+const DEFAULT_READ_CACHE_BLOCK_SIZE = 65536
+const DEFAULT_WRITE_BACK_AGE = 1000
 const ENOTCONN = IS_OSX ? -57 : -107
+const EMPTY_STAT = {}
+const EMPTY_STATS = new Uint32Array(0)
+const UINT32_BIG = BigInt(4294967296)
+const NS_PER_SEC_BIG = BigInt(1e9)
 
 const OpcodesAndDefaults = new Map([
   ['init', {
@@ -32,11 +38,13 @@ const OpcodesAndDefaults = new Map([
   }],
   ['fgetattr', {
     op: binding.op_fgetattr,
-    defaults: [getStatArray()]
+    defaults: [getStatArray()],
+    stat: true
   }],
   ['getattr', {
     op: binding.op_getattr,
-    defaults: [getStatArray()]
+    defaults: [getStatArray()],
+    stat: true
   }],
   ['flush', {
     op: binding.op_flush
@@ -49,7 +57,7 @@ const OpcodesAndDefaults = new Map([
   }],
   ['readdir', {
     op: binding.op_readdir,
-    defaults: [[], []]
+    defaults: [[], EMPTY_STATS]
   }],
   ['truncate', {
     op: binding.op_truncate
@@ -128,13 +136,163 @@ const OpcodesAndDefaults = new Map([
   }],
   ['rmdir', {
     op: binding.op_rmdir
+  }],
+  ['lookup', {
+    op: binding.op_lookup,
+    defaults: [getStatArray()],
+    stat: true
+  }],
+  ['readbuf', {
+    op: binding.op_readbuf,
+    defaults: [new Float64Array(0)],
+    fds: true
+  }],
+  ['writebuf', {
+    op: binding.op_writebuf,
+    defaults: [0],
+    fds: true
   }]
 ])
 
+for (const [name, entry] of OpcodesAndDefaults) {
+  entry.signal = binding[`fuse_native_signal_${name}`]
+}
+
+// The in-flight request of one FUSE thread. Created once per thread along with every completion callback a
+// handler can be given, so dispatching a request and replying to it allocate nothing on their own.
+class Request {
+  constructor (fuse, handle) {
+    this.fuse = fuse
+    this.handle = handle
+    this.entry = null
+
+    // Stat replies are encoded in place in the thread's own slot instead of a fresh array per call.
+    this.stat = new Uint32Array(handle.buffer, handle.byteOffset + binding.thread_locals_stat_slot, binding.stat_length)
+    // Low-level mode, the inode number of the path, see fuse_native_ll_ino.
+    this.inoSlot = new Uint32Array(handle.buffer, handle.byteOffset + binding.thread_locals_ino_slot, 2)
+
+    // Arguments the completions need
+    this.buf = null
+    this.cursor = 0
+
+    // Set while the handler runs, a reply given before it returns is sent right away
+    this.sync = false
+
+    // A fresh controller per request when interrupts are on, its signal is handed to the handler
+    this.controller = null
+    this.abortSignal = undefined
+
+    // Passed after the signal in low-level mode, undefined if the kernel has no inode for the path yet
+    this.ino = undefined
+
+    // Reply
+    this.err = 0
+    this.a = undefined
+    this.b = undefined
+    this.c = undefined
+    this.d = undefined
+
+    this.onerror = err => this.reply(err)
+    this.onvalue = (err, value) => this.reply(err, value)
+    this.onstat = (err, stat) => err ? this.reply(err) : this.reply(0, stat)
+    this.onstatfs = (err, statfs) => err ? this.reply(err) : this.reply(0, getStatfsArray(statfs))
+    this.onio = (err, bytes) => this.reply(err, bytes || 0, this.buf.buffer)
+    this.onsegments = (err, segments) => err ? this.reply(err) : this.reply(0, getSegmentsArray(segments))
+    this.ontarget = (err, target) => this.onTarget(err, target)
+    this.onreaddir = (err, names, stats) => err ? this.reply(err) : this.reply(0, names, stats ? getStatsArray(stats) : EMPTY_STATS)
+    this.onreaddirpage = (err, names, stats, next) => err ? this.reply(err) : this.reply(0, names || [], stats ? getStatsArray(stats) : EMPTY_STATS, getNextCursor(this.cursor, names, next))
+    this.onsetxattr = err => this.reply(err, this.buf.buffer)
+    this.ongetxattr = (err, value) => this.onGetxattr(err, value)
+    this.onlistxattr = (err, list) => this.onListxattr(err, list)
+  }
+
+  reply (err, a, b, c, d) {
+    const entry = this.entry
+
+    if (entry.defaults && a === undefined && b === undefined && c === undefined && d === undefined) {
+      a = entry.defaults[0]
+      b = entry.defaults[1]
+    }
+
+    if (entry.stat && !(a instanceof Uint32Array)) a = getStatArray(a, this.stat)
+
+    this.err = err
+    this.a = a
+    this.b = b
+    this.c = c
+    this.d = d
+    this.buf = null
+
+    // Replies naming file descriptors are sent right away, the native side duplicates them before the handler
+    // gets to close its own.
+    if (this.sync || entry.fds) this.send()
+    else this.fuse._complete(this)
+  }
+
+  send () {
+    const { a, b, c, d } = this
+    this.a = this.b = this.c = this.d = undefined
+    this.entry.signal(this.handle, this.err, a, b, c, d)
+  }
+
+  // The kernel interrupted the request and it was already answered with EINTR, any reply from here on is dropped.
+  abort () {
+    const controller = this.controller
+    this.controller = null
+    if (controller) controller.abort()
+  }
+
+  onTarget (err, target) {
+    if (err) return this.reply(err)
+    if (!target) return this.reply(Fuse.EIO)
+    return this.reply(target.fd, target.position || 0)
+  }
+
+  onGetxattr (err, value) {
+    const valueBuf = this.buf
+    if (!err) {
+      if (!value) return this.reply(IS_OSX ? -93 : -61, valueBuf.buffer)
+      value.copy(valueBuf)
+      return this.reply(value.length, valueBuf.buffer)
+    }
+    return this.reply(err, valueBuf.buffer)
+  }
+
+  onListxattr (err, list) {
+    const listBuf = this.buf
+    if (list && !err) {
+      if (!listBuf.length) {
+        let size = 0
+        for (const name of list) size += Buffer.byteLength(name) + 1
+        size += 128 // fuse yells if we do not signal room for some mac stuff also
+        return this.reply(size, listBuf.buffer)
+      }
+
+      let ptr = 0
+      for (const name of list) {
+        listBuf.write(name, ptr)
+        ptr += Buffer.byteLength(name)
+        listBuf[ptr++] = 0
+      }
+
+      return this.reply(ptr, listBuf.buffer)
+    }
+    return this.reply(err, listBuf.buffer)
+  }
+}
+
 class Fuse extends Nanoresource {
   constructor (mnt, ops, opts = {}) {
     super()
 
+    // Handlers given as a module path can be loaded again by every worker.
+    if (typeof ops === 'string') {
+      this._opsModule = ops
+      ops = loadOps(ops)
+    } else {
+      this._opsModule = null
+    }
+
     this.opts = opts
     this.mnt = path.resolve(mnt)
     this.ops = ops
@@ -142,24 +300,52 @@ class Fuse extends Nanoresource {
 
     this._force = !!opts.force
     this._mkdir = !!opts.mkdir
+    this._lowlevel = !!opts.lowlevel
     this._thread = null
     this._handlers = this._makeHandlerArray()
-    this._threads = new Set()
-
-    const implemented = [binding.op_init, binding.op_error, binding.op_getattr]
+    // Keyed by the thread locals handle, which goes away with its FUSE thread, see fuse_native_retire.
+    this._requests = new WeakMap()
+    this._completions = []
+    this._completionsLength = 0
+    this._flushCompletions = this._flush.bind(this)
+    this._pathCacheSize = typeof opts.pathCacheSize === 'number' ? opts.pathCacheSize : DEFAULT_PATH_CACHE_SIZE
+    this._workerCount = Math.min(opts.workers || 0, binding.max_workers)
+    this._interrupts = !!opts.interrupts
+    this._handles = !!opts.handles
+    this._shared = !!opts.shared
+    this._passthrough = opts.passthrough ? path.resolve(opts.passthrough) : null
+    this._memory = !!opts.memory
+    // Prefixes are matched per path component natively, '/' intercepts everything.
+    this._intercept = (opts.intercept || ['/']).map(p => p.split('/').filter(Boolean).map(c => '/' + c).join(''))
+    this._workers = null
+    this._worker = null
+
+    if (this._workerCount && !this._opsModule) throw new Error('Workers need the handlers as a module path')
+    if (this._interrupts && typeof AbortController !== 'function') throw new Error('Interrupts need AbortController')
+    if (this._handles && this._workerCount) throw new Error('Handles cannot be used with workers')
+    if (this._shared && this._workerCount) throw new Error('Shared mounts cannot be used with workers')
+    if (this._passthrough && this._lowlevel) throw new Error('Passthrough cannot be used in low-level mode')
+    if (this._passthrough && IS_OSX) throw new Error('Passthrough is only supported on Linux')
+    if (this._memory && this._lowlevel) throw new Error('Memory mounts cannot be used in low-level mode')
+    if (this._memory && IS_OSX) throw new Error('Memory mounts are only supported on Linux')
+    if (this._memory && this._passthrough) throw new Error('A mount cannot be both passthrough and memory')
+
+    // Passthrough and memory mounts stat natively unless getattr is intercepted.
+    const implemented = [binding.op_init, binding.op_error]
+    if (!this._passthrough && !this._memory) implemented.push(binding.op_getattr)
     if (ops) {
       for (const [name, { op }] of OpcodesAndDefaults) {
         if (ops[name]) implemented.push(op)
       }
+      if (ops.readdirPage) implemented.push(binding.op_readdir)
     }
+    // The binding frees the handle table slots as releases are dispatched.
+    if (this._handles) implemented.push(binding.op_release, binding.op_releasedir)
     this._implemented = new Set(implemented)
-
-    // Used to determine if the user-defined callback needs to be nextTick'd.
-    this._sync = true
   }
 
   _getImplementedArray () {
-    const implemented = new Uint32Array(35)
+    const implemented = new Uint32Array(binding.op_count)
     for (const impl of this._implemented) {
       implemented[impl] = 1
     }
@@ -173,25 +359,37 @@ class Fuse extends Nanoresource {
     if (this.opts.allowOther) options.push('allow_other')
     if (this.opts.allowRoot) options.push('allow_root')
     if (this.opts.autoUnmount) options.push('auto_unmount')
-    if (this.opts.defaultPermissions) options.push('default_permissions')
+    // Passthrough and memory ops run as the daemon and never check the caller, the kernel does.
+    if (this.opts.defaultPermissions || this._passthrough || this._memory) options.push('default_permissions')
     if (this.opts.blkdev) options.push('blkdev')
     if (this.opts.blksize) options.push('blksize=' + this.opts.blksize)
     if (this.opts.maxRead) options.push('max_read=' + this.opts.maxRead)
+    if ((this.opts.bigWrites || this.opts.maxWrite) && !IS_OSX) options.push('big_writes')
+    if (this.opts.maxWrite) options.push('max_write=' + this.opts.maxWrite)
     if (this.opts.fd) options.push('fd=' + this.opts.fd)
     if (this.opts.userId) options.push('user_id=', this.opts.userId)
     if (this.opts.fsname) options.push('fsname=' + this.opts.fsname)
     if (this.opts.subtype) options.push('subtype=' + this.opts.subtype)
-    if (this.opts.kernelCache) options.push('kernel_cache')
-    if (this.opts.autoCache) options.push('auto_cache')
-    if (this.opts.umask) options.push('umask=' + this.opts.umask)
-    if (this.opts.uid) options.push('uid=' + this.opts.uid)
-    if (this.opts.gid) options.push('gid=' + this.opts.gid)
-    if (this.opts.entryTimeout) options.push('entry_timeout=' + this.opts.entryTimeout)
-    if (this.opts.attrTimeout) options.push('attr_timeout=' + this.opts.attrTimeout)
-    if (this.opts.acAttrTimeout) options.push('ac_attr_timeout=' + this.opts.acAttrTimeout)
-    if (this.opts.noforget) options.push('noforget')
-    if (this.opts.remember) options.push('remember=' + this.opts.remember)
-    if (this.opts.modules) options.push('modules=' + this.opts.modules)
+    // The low-level session picks inode numbers natively, see config_use_ino.
+    if (this.opts.useIno && !this._lowlevel) options.push('use_ino')
+
+    // These are parsed by the high-level library, the low-level session rejects them.
+    if (!this._lowlevel) {
+      if (this._interrupts) options.push('intr', 'intr_signal=' + binding.intr_signal)
+      if (this.opts.kernelCache) options.push('kernel_cache')
+      if (this.opts.autoCache) options.push('auto_cache')
+      if (this.opts.directIo) options.push('direct_io')
+      if (this.opts.umask) options.push('umask=' + this.opts.umask)
+      if (this.opts.uid) options.push('uid=' + this.opts.uid)
+      if (this.opts.gid) options.push('gid=' + this.opts.gid)
+      if (this.opts.entryTimeout) options.push('entry_timeout=' + this.opts.entryTimeout)
+      if (this.opts.attrTimeout) options.push('attr_timeout=' + this.opts.attrTimeout)
+      if (this.opts.negativeTimeout) options.push('negative_timeout=' + this.opts.negativeTimeout)
+      if (this.opts.acAttrTimeout) options.push('ac_attr_timeout=' + this.opts.acAttrTimeout)
+      if (this.opts.noforget) options.push('noforget')
+      if (this.opts.remember) options.push('remember=' + this.opts.remember)
+      if (this.opts.modules) options.push('modules=' + this.opts.modules)
+    }
 
     if (this.opts.displayFolder && IS_OSX) { // only works on osx
       options.push('volname=' + path.basename(this.opts.name || this.mnt))
@@ -201,86 +399,175 @@ class Fuse extends Nanoresource {
     return options.length ? '-o' + options.join(',') : ''
   }
 
-  _malloc (size) {
-    const buf = Buffer.alloc(size)
-    this._threads.add(buf)
-    return buf
+  _getConfigArray () {
+    const config = new Float64Array(binding.config_length)
+
+    config[binding.config_lowlevel] = this._lowlevel ? 1 : 0
+    config[binding.config_entry_timeout] = getTimeoutOption(this.opts.entryTimeout)
+    config[binding.config_attr_timeout] = getTimeoutOption(this.opts.attrTimeout)
+    config[binding.config_attr_cache_size] = this.opts.attrCacheSize || 0
+    config[binding.config_cache_timeout] = typeof this.opts.cacheTimeout === 'number' ? this.opts.cacheTimeout : config[binding.config_attr_timeout]
+    config[binding.config_negative_timeout] = this.opts.negativeTimeout || 0
+    config[binding.config_stats] = this.opts.stats ? 1 : 0
+    config[binding.config_workers] = this._workerCount
+    config[binding.config_path_cache_size] = this._pathCacheSize
+    config[binding.config_max_threads] = this.opts.maxThreads || 0
+    config[binding.config_max_idle_threads] = this.opts.maxIdleThreads || 0
+    config[binding.config_single_threaded] = this.opts.singleThreaded ? 1 : 0
+    config[binding.config_interrupts] = this._interrupts ? 1 : 0
+    config[binding.config_read_cache_size] = this.opts.readCacheSize || 0
+    config[binding.config_read_cache_block_size] = this.opts.readCacheBlockSize || DEFAULT_READ_CACHE_BLOCK_SIZE
+    config[binding.config_write_back_size] = this.opts.writeBackSize || 0
+    config[binding.config_write_back_age] = typeof this.opts.writeBackAge === 'number' ? this.opts.writeBackAge : DEFAULT_WRITE_BACK_AGE
+    config[binding.config_handles] = this._handles ? 1 : 0
+    config[binding.config_shared] = this._shared ? 1 : 0
+    config[binding.config_memory] = this._memory ? 1 : 0
+    config[binding.config_memory_size] = this.opts.memorySize || 0
+    config[binding.config_use_ino] = this.opts.useIno ? 1 : 0
+
+    return config
+  }
+
+  _request (handle) {
+    let req = this._requests.get(handle)
+    if (req) return req
+    req = new Request(this, handle)
+    this._requests.set(handle, req)
+    return req
+  }
+
+  // Replies given after the handler returned are sent on the next tick, batched: one tick drains every reply
+  // queued before it. Replies given while it runs skip this, see Request#reply.
+  _complete (req) {
+    this._completions[this._completionsLength++] = req
+    if (this._completionsLength === 1) process.nextTick(this._flushCompletions)
+  }
+
+  _flush () {
+    for (let i = 0; i < this._completionsLength; i++) {
+      const req = this._completions[i]
+      this._completions[i] = null
+      req.send()
+    }
+    this._completionsLength = 0
   }
 
   _makeHandlerArray () {
     const self = this
-    const handlers = new Array(OpcodesAndDefaults.size)
+    const handlers = new Array(binding.op_count)
 
-    for (const [name, { op, defaults }] of OpcodesAndDefaults) {
-      const nativeSignal = binding[`fuse_native_signal_${name}`]
-      if (!nativeSignal) continue
+    for (const [name, entry] of OpcodesAndDefaults) {
+      if (!entry.signal) continue
+      handlers[entry.op] = makeHandler(entry, this[`_op_${name}`])
+    }
 
-      handlers[op] = makeHandler(name, op, defaults, nativeSignal)
+    // The FUSE thread left these locals behind, see fuse_native_abort.
+    handlers[binding.op_abort] = function (handle) {
+      const req = self._requests.get(handle)
+      if (!req) return
+      self._requests.delete(handle)
+      req.abort()
     }
 
     return handlers
 
-    function makeHandler (name, op, defaults, nativeSignal) {
-      let to = self.timeout
+    // Fixed arity so every opcode gets its own monomorphic entry point, the request object is reused per FUSE thread.
+    function makeHandler (entry, fn) {
+      return function (handle, opCode, a, b, c, d, e, f) {
+        const req = self._request(handle)
+        req.entry = entry
+        if (self._interrupts) {
+          req.controller = new AbortController()
+          req.abortSignal = req.controller.signal
+        }
+        if (self._lowlevel) req.ino = (req.inoSlot[0] + req.inoSlot[1] * 4294967296) || undefined
+        req.sync = true
+        if (!fn || !self._implemented.has(entry.op)) req.reply(-1)
+        else fn.call(self, req, a, b, c, d, e, f)
+        req.sync = false
+      }
+    }
+  }
+
+  // Deadlines are enforced natively (see the timeout wheel in fuse-native.c), in ms per op, 0 for none.
+  _getTimeoutArray () {
+    const timeouts = new Uint32Array(binding.op_count)
+
+    for (const [name, { op }] of OpcodesAndDefaults) {
+      let to = this.timeout
       if (typeof to === 'object' && to) {
         const defaultTimeout = to.default || DEFAULT_TIMEOUT
         to = to[name]
         if (!to && to !== false) to = defaultTimeout
       }
+      timeouts[op] = to || 0
+    }
 
-      return function (nativeHandler, opCode, ...args) {
-        const sig = signal.bind(null, nativeHandler)
-        const input = [...args]
-        const boundSignal = to ? autoTimeout(sig, input) : sig
-        const funcName = `_op_${name}`
-        if (!self[funcName] || !self._implemented.has(op)) return boundSignal(-1, ...defaults)
-        return self[funcName].apply(self, [boundSignal, ...args])
-      }
+    return timeouts
+  }
 
-      function signal (nativeHandler, err, ...args) {
-        var arr = [nativeHandler, err, ...args]
+  // Workers
 
-        if (defaults) {
-          while (arr.length > 2 && arr[arr.length - 1] === undefined) arr.pop()
-          if (arr.length === 2) arr = arr.concat(defaults)
+  _startWorkers (cb) {
+    const { Worker } = require('worker_threads')
+    const self = this
+    // The workers register their dispatchers in the mount's own state, so it has to be shared memory.
+    const shared = new SharedArrayBuffer(binding.sizeof_fuse_thread_t)
+    let missing = this._workerCount
+    let failed = false
+
+    this._thread = Buffer.from(shared)
+    this._workers = []
+
+    for (let i = 0; i < this._workerCount; i++) {
+      const worker = new Worker(path.join(__dirname, 'worker.js'), {
+        workerData: {
+          thread: shared,
+          index: i,
+          mnt: this.mnt,
+          ops: this._opsModule,
+          opts: { pathCacheSize: this._pathCacheSize, interrupts: this._interrupts, lowlevel: this._lowlevel }
         }
+      })
 
-        return process.nextTick(nativeSignal, ...arr)
-      }
+      worker.once('message', onready)
+      worker.on('error', onerror)
+      this._workers.push(worker)
+    }
 
-      function autoTimeout (cb, input) {
-        let called = false
-        const timeout = setTimeout(timeoutWrap, to, TIMEOUT_ERRNO)
-        return timeoutWrap
-
-        function timeoutWrap (err, ...args) {
-          if (called) return
-          called = true
-
-          clearTimeout(timeout)
-
-          if (err === TIMEOUT_ERRNO) {
-            switch (name) {
-              case 'write':
-              case 'read':
-                return cb(TIMEOUT_ERRNO, 0, input[2].buffer)
-              case 'setxattr':
-                return cb(TIMEOUT_ERRNO, input[2].buffer)
-              case 'getxattr':
-                return cb(TIMEOUT_ERRNO, input[2].buffer)
-              case 'listxattr':
-                return cb(TIMEOUT_ERRNO, input[1].buffer)
-            }
-          }
-
-          cb(err, ...args)
-        }
-      }
+    function onready () {
+      if (!failed && --missing === 0) cb(null)
+    }
+
+    function onerror (err) {
+      // Once mounted a crashed worker is treated like a crash of the main thread's handlers.
+      if (!missing) throw err
+      if (failed) return
+      failed = true
+      self._stopWorkers(() => cb(err))
     }
   }
 
+  _stopWorkers (cb) {
+    const workers = this._workers
+    this._workers = null
+
+    if (!workers) return cb(null)
+    Promise.all(workers.map(w => w.terminate())).then(() => cb(null), cb)
+  }
+
+  // Called inside a worker_thread, makes this (unmounted) instance serve its share of the requests of the mount.
+  _attachWorker (thread, index) {
+    this._worker = Buffer.alloc(binding.sizeof_fuse_thread_t)
+    binding.fuse_native_worker_attach(thread, this._worker, index, this, this._handlers, this._pathCacheSize)
+  }
+
   // Static methods
 
+  static configureShared (opts = {}) {
+    binding.fuse_native_configure_shared(opts.maxThreads || 0, opts.maxIdleThreads || 0)
+  }
+
   static unmount (mnt, cb) {
     mnt = JSON.stringify(mnt)
     const cmd = IS_OSX ? `diskutil unmount force ${mnt}` : `fusermount -uz ${mnt}`
@@ -312,6 +599,9 @@ class Fuse extends Nanoresource {
 
       const opts = self._fuseOptions()
       const implemented = self._getImplementedArray()
+      const config = self._getConfigArray()
+      const timeouts = self._getTimeoutArray()
+      const cpus = Uint32Array.from(self.opts.cpus || [])
 
       return fs.stat(self.mnt, (err, stat) => {
         if (err && err.errno !== -2) return cb(err)
@@ -332,14 +622,30 @@ class Fuse extends Nanoresource {
       function onexists (stat) {
         fs.stat(path.join(self.mnt, '..'), (_, parent) => {
           if (parent && parent.dev !== stat.dev) return cb(new Error('Mountpoint in use'))
-          try {
-            // TODO: asyncify
-            binding.fuse_native_mount(self.mnt, opts, self._thread, self, self._malloc, self._handlers, implemented)
-          } catch (err) {
-            return cb(err)
-          }
+          if (self._workerCount) return self._startWorkers(onworkers)
+          mount()
         })
       }
+
+      function onworkers (err) {
+        if (err) return cb(err)
+        mount()
+      }
+
+      // fuse_mount and fuse_new run on the libuv threadpool, the mount is done once init arrives (see _op_init).
+      function mount () {
+        try {
+          binding.fuse_native_mount(self.mnt, opts, self._thread, self, self._handlers, implemented, config, timeouts, cpus, self._passthrough || '', self._intercept, onmount)
+        } catch (err) {
+          return onmount(err)
+        }
+      }
+
+      function onmount (err) {
+        if (!err) return
+        self._openCallback = null
+        self._stopWorkers(() => cb(err))
+      }
     }
   }
 
@@ -354,281 +660,226 @@ class Fuse extends Nanoresource {
       nativeUnmount()
     })
 
+    // Waits for the FUSE threads without blocking the loop, see fuse_native_unmount.
     function nativeUnmount () {
       try {
-        binding.fuse_native_unmount(self.mnt, self._thread)
+        binding.fuse_native_unmount(self.mnt, self._thread, onunmount)
       } catch (err) {
         return cb(err)
       }
-      return cb(null)
+    }
+
+    // Nothing runs on the mount anymore once the workers are gone, so its native state can go too.
+    function onunmount () {
+      self._stopWorkers(function (err) {
+        binding.fuse_native_reclaim(self._thread)
+        cb(err)
+      })
     }
   }
 
   // Handlers
 
-  _op_init (signal) {
+  _op_init (req) {
     if (this._openCallback) {
       process.nextTick(this._openCallback, null)
       this._openCallback = null
     }
     if (!this.ops.init) {
-      signal(0)
+      req.reply(0)
       return
     }
-    this.ops.init(err => {
-      return signal(err)
-    })
+    this.ops.init(req.onerror)
   }
 
-  _op_error (signal) {
+  _op_error (req) {
     if (!this.ops.error) {
-      signal(0)
+      req.reply(0)
       return
     }
-    this.ops.error(err => {
-      return signal(err)
-    })
+    this.ops.error(req.onerror)
   }
 
-  _op_statfs (signal, path) {
-    this.ops.statfs(path, (err, statfs) => {
-      if (err) return signal(err)
-      const arr = getStatfsArray(statfs)
-      return signal(0, arr)
-    })
+  _op_statfs (req, path) {
+    this.ops.statfs(path, req.onstatfs, req.abortSignal, req.ino)
   }
 
-  _op_getattr (signal, path) {
+  _op_getattr (req, path) {
     if (!this.ops.getattr) {
       if (path !== '/') {
-        signal(Fuse.EPERM)
+        req.reply(Fuse.EPERM)
       } else {
-        signal(0, getStatArray({ mtime: new Date(0), atime: new Date(0), ctime: new Date(0), mode: 16877, size: 4096 }))
+        req.reply(0, { mtime: new Date(0), atime: new Date(0), ctime: new Date(0), mode: 16877, size: 4096 })
       }
       return
     }
 
-    this.ops.getattr(path, (err, stat) => {
-      if (err) return signal(err, getStatArray())
-      return signal(0, getStatArray(stat))
-    })
+    this.ops.getattr(path, req.onstat, req.abortSignal, req.ino)
+  }
+
+  _op_lookup (req, parent, name) {
+    this.ops.lookup(parent, name, req.onstat, req.abortSignal)
   }
 
-  _op_fgetattr (signal, path, fd) {
+  _op_fgetattr (req, path, fd) {
     if (!this.ops.fgetattr) {
       if (path !== '/') {
-        signal(Fuse.EPERM)
+        req.reply(Fuse.EPERM)
       } else {
-        signal(0, getStatArray({ mtime: new Date(0), atime: new Date(0), ctime: new Date(0), mode: 16877, size: 4096 }))
+        req.reply(0, { mtime: new Date(0), atime: new Date(0), ctime: new Date(0), mode: 16877, size: 4096 })
       }
       return
     }
-    this.ops.getattr(path, (err, stat) => {
-      if (err) return signal(err)
-      return signal(0, getStatArray(stat))
-    })
+    this.ops.getattr(path, req.onstat, req.abortSignal, req.ino)
   }
 
-  _op_access (signal, path, mode) {
-    this.ops.access(path, mode, err => {
-      return signal(err)
-    })
+  _op_access (req, path, mode) {
+    this.ops.access(path, mode, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_open (signal, path, flags) {
-    this.ops.open(path, flags, (err, fd) => {
-      return signal(err, fd)
-    })
+  _op_open (req, path, flags) {
+    this.ops.open(path, flags, req.onvalue, req.abortSignal, req.ino)
   }
 
-  _op_opendir (signal, path, flags) {
-    this.ops.opendir(path, flags, (err, fd) => {
-      return signal(err, fd)
-    })
+  _op_opendir (req, path, flags) {
+    this.ops.opendir(path, flags, req.onvalue, req.abortSignal, req.ino)
   }
 
-  _op_create (signal, path, mode) {
-    this.ops.create(path, mode, (err, fd) => {
-      return signal(err, fd)
-    })
+  _op_create (req, path, mode) {
+    this.ops.create(path, mode, req.onvalue, req.abortSignal, req.ino)
   }
 
-  _op_utimens (signal, path, atimeLow, atimeHigh, mtimeLow, mtimeHigh) {
-    const atime = getDoubleArg(atimeLow, atimeHigh)
-    const mtime = getDoubleArg(mtimeLow, mtimeHigh)
-    this.ops.utimens(path, atime, mtime, err => {
-      return signal(err)
-    })
+  _op_utimens (req, path, atimeSec, atimeNsec, mtimeSec, mtimeNsec) {
+    const omitted = atimeNsec === binding.utime_omit || mtimeNsec === binding.utime_omit
+    const atime = getTimeArg(atimeSec, atimeNsec)
+    const mtime = getTimeArg(mtimeSec, mtimeNsec)
+
+    if (!omitted || !this.ops.getattr) return this.ops.utimens(path, atime, mtime, req.onerror, req.abortSignal, req.ino)
+
+    // touch -a / -m only set one of them, the handler gets the current value of the other one.
+    this.ops.getattr(path, (err, st) => {
+      if (err) return req.reply(err)
+      const a = atimeNsec === binding.utime_omit ? getStatTimeMs(st, 'atime') : atime
+      const m = mtimeNsec === binding.utime_omit ? getStatTimeMs(st, 'mtime') : mtime
+      this.ops.utimens(path, a, m, req.onerror, req.abortSignal, req.ino)
+    }, req.abortSignal, req.ino)
   }
 
-  _op_release (signal, path, fd) {
-    this.ops.release(path, fd, err => {
-      return signal(err)
-    })
+  _op_release (req, path, fd) {
+    if (!this.ops.release) return req.onerror(0)
+    this.ops.release(path, fd, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_releasedir (signal, path, fd) {
-    this.ops.releasedir(path, fd, err => {
-      return signal(err)
-    })
+  _op_releasedir (req, path, fd) {
+    if (!this.ops.releasedir) return req.onerror(0)
+    this.ops.releasedir(path, fd, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_read (signal, path, fd, buf, len, offsetLow, offsetHigh) {
-    this.ops.read(path, fd, buf, len, getDoubleArg(offsetLow, offsetHigh), (err, bytesRead) => {
-      return signal(err, bytesRead || 0, buf.buffer)
-    })
+  _op_read (req, path, fd, buf, len, offsetLow, offsetHigh) {
+    req.buf = buf
+    this.ops.read(path, fd, buf, len, getDoubleArg(offsetLow, offsetHigh), req.onio, req.abortSignal, req.ino)
   }
 
-  _op_write (signal, path, fd, buf, len, offsetLow, offsetHigh) {
-    this.ops.write(path, fd, buf, len, getDoubleArg(offsetLow, offsetHigh), (err, bytesWritten) => {
-      return signal(err, bytesWritten || 0, buf.buffer)
-    })
+  _op_readbuf (req, path, fd, len, offsetLow, offsetHigh) {
+    this.ops.readbuf(path, fd, len, getDoubleArg(offsetLow, offsetHigh), req.onsegments, req.abortSignal, req.ino)
   }
 
-  _op_readdir (signal, path) {
-    this.ops.readdir(path, (err, names, stats) => {
-      if (err) return signal(err)
-      if (stats) stats = stats.map(getStatArray)
-      return signal(0, names, stats || [])
-    })
+  _op_write (req, path, fd, buf, len, offsetLow, offsetHigh) {
+    req.buf = buf
+    this.ops.write(path, fd, buf, len, getDoubleArg(offsetLow, offsetHigh), req.onio, req.abortSignal, req.ino)
   }
 
-  _op_setxattr (signal, path, name, value, position, flags) {
-    this.ops.setxattr(path, name, value, position, flags, err => {
-      return signal(err, value.buffer)
-    })
+  _op_writebuf (req, path, fd, len, offsetLow, offsetHigh) {
+    this.ops.writebuf(path, fd, len, getDoubleArg(offsetLow, offsetHigh), req.ontarget, req.abortSignal, req.ino)
   }
 
-  _op_getxattr (signal, path, name, valueBuf, position) {
-    this.ops.getxattr(path, name, position, (err, value) => {
-      if (!err) {
-        if (!value) return signal(IS_OSX ? -93 : -61, valueBuf.buffer)
-        value.copy(valueBuf)
-        return signal(value.length, valueBuf.buffer)
-      }
-      return signal(err, valueBuf.buffer)
-    })
+  _op_readdir (req, path, cursor) {
+    if (this.ops.readdirPage) {
+      req.cursor = cursor
+      return this.ops.readdirPage(path, cursor, req.onreaddirpage, req.abortSignal, req.ino)
+    }
+    this.ops.readdir(path, req.onreaddir, req.abortSignal, req.ino)
   }
 
-  _op_listxattr (signal, path, listBuf) {
-    this.ops.listxattr(path, (err, list) => {
-      if (list && !err) {
-        if (!listBuf.length) {
-          let size = 0
-          for (const name of list) size += Buffer.byteLength(name) + 1
-          size += 128 // fuse yells if we do not signal room for some mac stuff also
-          return signal(size, listBuf.buffer)
-        }
+  _op_setxattr (req, path, name, value, position, flags) {
+    req.buf = value
+    this.ops.setxattr(path, name, value, position, flags, req.onsetxattr, req.abortSignal, req.ino)
+  }
 
-        let ptr = 0
-        for (const name of list) {
-          listBuf.write(name, ptr)
-          ptr += Buffer.byteLength(name)
-          listBuf[ptr++] = 0
-        }
+  _op_getxattr (req, path, name, valueBuf, position) {
+    req.buf = valueBuf
+    this.ops.getxattr(path, name, position, req.ongetxattr, req.abortSignal, req.ino)
+  }
 
-        return signal(ptr, listBuf.buffer)
-      }
-      return signal(err, listBuf.buffer)
-    })
+  _op_listxattr (req, path, listBuf) {
+    req.buf = listBuf
+    this.ops.listxattr(path, req.onlistxattr, req.abortSignal, req.ino)
   }
 
-  _op_removexattr (signal, path, name) {
-    this.ops.removexattr(path, name, err => {
-      return signal(err)
-    })
+  _op_removexattr (req, path, name) {
+    this.ops.removexattr(path, name, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_flush (signal, path, fd) {
-    this.ops.flush(path, fd, err => {
-      return signal(err)
-    })
+  _op_flush (req, path, fd) {
+    this.ops.flush(path, fd, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_fsync (signal, path, datasync, fd) {
-    this.ops.fsync(path, datasync, fd, err => {
-      return signal(err)
-    })
+  _op_fsync (req, path, datasync, fd) {
+    this.ops.fsync(path, datasync, fd, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_fsyncdir (signal, path, datasync, fd) {
-    this.ops.fsyncdir(path, datasync, fd, err => {
-      return signal(err)
-    })
+  _op_fsyncdir (req, path, datasync, fd) {
+    this.ops.fsyncdir(path, datasync, fd, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_truncate (signal, path, sizeLow, sizeHigh) {
+  _op_truncate (req, path, sizeLow, sizeHigh) {
     const size = getDoubleArg(sizeLow, sizeHigh)
-    this.ops.truncate(path, size, err => {
-      return signal(err)
-    })
+    this.ops.truncate(path, size, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_ftruncate (signal, path, fd, sizeLow, sizeHigh) {
+  _op_ftruncate (req, path, fd, sizeLow, sizeHigh) {
     const size = getDoubleArg(sizeLow, sizeHigh)
-    this.ops.ftruncate(path, fd, size, err => {
-      return signal(err)
-    })
+    this.ops.ftruncate(path, fd, size, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_readlink (signal, path) {
-    this.ops.readlink(path, (err, linkname) => {
-      return signal(err, linkname)
-    })
+  _op_readlink (req, path) {
+    this.ops.readlink(path, req.onvalue, req.abortSignal, req.ino)
   }
 
-  _op_chown (signal, path, uid, gid) {
-    this.ops.chown(path, uid, gid, err => {
-      return signal(err)
-    })
+  _op_chown (req, path, uid, gid) {
+    this.ops.chown(path, uid, gid, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_chmod (signal, path, mode) {
-    this.ops.chmod(path, mode, err => {
-      return signal(err)
-    })
+  _op_chmod (req, path, mode) {
+    this.ops.chmod(path, mode, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_mknod (signal, path, mode, dev) {
-    this.ops.mknod(path, mode, dev, err => {
-      return signal(err)
-    })
+  _op_mknod (req, path, mode, dev) {
+    this.ops.mknod(path, mode, dev, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_unlink (signal, path) {
-    this.ops.unlink(path, err => {
-      return signal(err)
-    })
+  _op_unlink (req, path) {
+    this.ops.unlink(path, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_rename (signal, src, dest) {
-    this.ops.rename(src, dest, err => {
-      return signal(err)
-    })
+  _op_rename (req, src, dest) {
+    this.ops.rename(src, dest, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_link (signal, src, dest) {
-    this.ops.link(src, dest, err => {
-      return signal(err)
-    })
+  _op_link (req, src, dest) {
+    this.ops.link(src, dest, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_symlink (signal, src, dest) {
-    this.ops.symlink(src, dest, err => {
-      return signal(err)
-    })
+  _op_symlink (req, src, dest) {
+    this.ops.symlink(src, dest, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_mkdir (signal, path, mode) {
-    this.ops.mkdir(path, mode, err => {
-      return signal(err)
-    })
+  _op_mkdir (req, path, mode) {
+    this.ops.mkdir(path, mode, req.onerror, req.abortSignal, req.ino)
   }
 
-  _op_rmdir (signal, path) {
-    this.ops.rmdir(path, err => {
-      return signal(err)
-    })
+  _op_rmdir (req, path) {
+    this.ops.rmdir(path, req.onerror, req.abortSignal, req.ino)
   }
 
   // Public API
@@ -641,6 +892,53 @@ class Fuse extends Nanoresource {
     return this.close(cb)
   }
 
+  invalidate (path, offset = 0, length = 0) {
+    if (!this.opened || this.closing || this.closed) return
+    const err = binding.fuse_native_invalidate(this._thread, path, offset, length)
+    if (err < 0) throw new Error('invalidate failed: ' + err)
+  }
+
+  invalidateEntry (parent, name) {
+    if (!this.opened || this.closing || this.closed) return
+    const err = binding.fuse_native_invalidate_entry(this._thread, parent, name)
+    if (err < 0) throw new Error('invalidateEntry failed: ' + err)
+  }
+
+  populate (path, data = null, mode = 0) {
+    if (!this._thread || !this._memory) throw new Error('populate needs a mounted memory filesystem')
+    if (typeof data === 'string') data = Buffer.from(data)
+    const err = binding.fuse_native_populate(this._thread, path, data, mode)
+    if (err < 0) throw new Error('populate failed: ' + err)
+  }
+
+  stats () {
+    if (!this._thread) return null
+    const buf = binding.fuse_native_stats(this._thread)
+    if (!buf) return null
+
+    const words = new BigUint64Array(buf.buffer, buf.byteOffset, buf.length / 8)
+    const stats = {}
+
+    for (const [name, { op }] of OpcodesAndDefaults) {
+      const base = op * binding.stats_length
+      const calls = Number(words[base])
+      const inFlight = Number(words[base + 3])
+      if (!calls && !inFlight) continue
+
+      stats[name] = {
+        calls,
+        errors: Number(words[base + 1]),
+        bytes: Number(words[base + 2]),
+        inFlight,
+        errnos: getErrnoCounts(words, base + binding.stats_errnos_offset),
+        queueWait: getHistogram(words, base + binding.stats_queue_wait_offset, Number(words[base + 4])),
+        serviceTime: getHistogram(words, base + binding.stats_service_time_offset, Number(words[base + 5]))
+      }
+    }
+
+    return stats
+  }
+
   errno (code) {
     return (code && Fuse[code.toUpperCase()]) || -1
   }
@@ -803,32 +1101,147 @@ function setDoubleInt (arr, idx, num) {
   arr[idx + 1] = (num - arr[idx]) / 4294967296
 }
 
+// A handlers module exports the ops, or a function returning them so every worker gets its own instance.
+function loadOps (filename) {
+  const ops = require(filename)
+  return typeof ops === 'function' ? ops() : ops
+}
+
+function getTimeoutOption (seconds) {
+  // Same default as the high-level library uses for entry_timeout/attr_timeout.
+  return typeof seconds === 'number' ? seconds : 1
+}
+
+function getSegmentsArray (segments) {
+  if (!segments) segments = []
+  else if (!Array.isArray(segments)) segments = [segments]
+
+  const arr = new Float64Array(segments.length * 3)
+  for (let i = 0; i < segments.length; i++) {
+    arr[i * 3] = segments[i].fd
+    arr[i * 3 + 1] = segments[i].position || 0
+    arr[i * 3 + 2] = segments[i].length
+  }
+  return arr
+}
+
+function getErrnoCounts (words, offset) {
+  const counts = {}
+  for (let i = 1; i < binding.stats_errnos; i++) {
+    const n = Number(words[offset + i])
+    if (n) counts[getErrnoName(-i)] = n
+  }
+  return counts
+}
+
+let errnoNames = null
+
+function getErrnoName (errno) {
+  if (!errnoNames) {
+    errnoNames = new Map()
+    for (const key of Object.keys(Fuse)) {
+      if (/^E[A-Z0-9]+$/.test(key) && !errnoNames.has(Fuse[key])) errnoNames.set(Fuse[key], key)
+    }
+  }
+  return errnoNames.get(errno) || String(errno)
+}
+
+// Buckets are log-linear, four per power of two nanoseconds, see fuse_native_stats_bucket.
+function getHistogram (words, offset, totalNs) {
+  const buckets = []
+  let count = 0
+
+  for (let i = 0; i < binding.stats_buckets; i++) {
+    const n = Number(words[offset + i])
+    if (!n) continue
+    const ns = i < 4 ? i : (4 + i % 4) * Math.pow(2, Math.floor(i / 4) - 1)
+    buckets.push([ns, n])
+    count += n
+  }
+
+  return { count, totalNs, buckets }
+}
+
 function getDoubleArg (a, b) {
   return a + b * 4294967296
 }
 
+// The cursor readdirPage passed for the next page, or the count of entries so far if it passed none.
+// null ends the listing after this page.
+function getNextCursor (cursor, names, next) {
+  if (next !== undefined) return next
+  return typeof cursor === 'number' ? cursor + (names ? names.length : 0) : null
+}
+
+// Milliseconds like fs.Stats#atimeMs, the nanoseconds go in the fraction. undefined if the time is omitted.
+function getTimeArg (sec, nsec) {
+  if (nsec === binding.utime_omit) return undefined
+  return sec * 1000 + nsec / 1e6
+}
+
+function getStatTimeMs (st, name) {
+  if (!st) return undefined
+  if (typeof st[name + 'Ns'] === 'bigint') return Number(st[name + 'Ns']) / 1e6
+  if (typeof st[name + 'Ms'] === 'number') return st[name + 'Ms']
+  return st[name] === undefined ? undefined : toDateMS(st[name])
+}
+
 function toDateMS (st) {
   if (typeof st === 'number') return st
   if (!st) return Date.now()
   return st.getTime()
 }
 
-function getStatArray (stat) {
-  const ints = new Uint32Array(18)
-
-  ints[0] = (stat && stat.mode) || 0
-  ints[1] = (stat && stat.uid) || 0
-  ints[2] = (stat && stat.gid) || 0
-  setDoubleInt(ints, 3, (stat && stat.size) || 0)
-  ints[5] = (stat && stat.dev) || 0
-  ints[6] = (stat && stat.nlink) || 1
-  ints[7] = (stat && stat.ino) || 0
-  ints[8] = (stat && stat.rdev) || 0
-  ints[9] = (stat && stat.blksize) || 0
-  setDoubleInt(ints, 10, (stat && stat.blocks) || 0)
-  setDoubleInt(ints, 12, toDateMS(stat && stat.atime))
-  setDoubleInt(ints, 14, toDateMS(stat && stat.mtime))
-  setDoubleInt(ints, 16, toDateMS(stat && stat.ctime))
+function setUint64 (arr, idx, num) {
+  if (typeof num === 'bigint') {
+    arr[idx] = Number(num % UINT32_BIG)
+    arr[idx + 1] = Number(num / UINT32_BIG)
+  } else {
+    setDoubleInt(arr, idx, num || 0)
+  }
+}
+
+function setTimespec (arr, idx, ns, ms, date) {
+  // BigIntStats carry exact nanoseconds, fs.Stats fractional milliseconds, plain objects a Date or a number.
+  if (typeof ns === 'bigint') {
+    setUint64(arr, idx, ns / NS_PER_SEC_BIG)
+    arr[idx + 2] = Number(ns % NS_PER_SEC_BIG)
+    return
+  }
+
+  if (typeof ms !== 'number') ms = toDateMS(date)
+  const sec = Math.floor(ms / 1000)
+  setDoubleInt(arr, idx, sec)
+  arr[idx + 2] = Math.min(999999999, Math.round((ms - sec * 1000) * 1e6))
+}
+
+function toUint32 (num) {
+  return typeof num === 'bigint' ? Number(num) : (num || 0)
+}
+
+// Accepts plain stat objects as well as fs.Stats and fs.BigIntStats.
+function getStatArray (stat, ints = new Uint32Array(binding.stat_length), idx = 0) {
+  if (!stat) stat = EMPTY_STAT
+
+  ints[idx] = toUint32(stat.mode)
+  ints[idx + 1] = toUint32(stat.uid)
+  ints[idx + 2] = toUint32(stat.gid)
+  setUint64(ints, idx + 3, stat.size)
+  setUint64(ints, idx + 5, stat.dev)
+  ints[idx + 7] = toUint32(stat.nlink) || 1
+  setUint64(ints, idx + 8, stat.ino)
+  setUint64(ints, idx + 10, stat.rdev)
+  ints[idx + 12] = toUint32(stat.blksize)
+  setUint64(ints, idx + 13, stat.blocks)
+  setTimespec(ints, idx + 15, stat.atimeNs, stat.atimeMs, stat.atime)
+  setTimespec(ints, idx + 18, stat.mtimeNs, stat.mtimeMs, stat.mtime)
+  setTimespec(ints, idx + 21, stat.ctimeNs, stat.ctimeMs, stat.ctime)
+
+  return ints
+}
 
+function getStatsArray (stats) {
+  const ints = new Uint32Array(stats.length * binding.stat_length)
+  for (let i = 0; i < stats.length; i++) getStatArray(stats[i], ints, i * binding.stat_length)
   return ints
 }
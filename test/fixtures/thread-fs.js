@@ -0,0 +1,17 @@
+// Every path but / is a file whose size is the id of the thread that ran getattr, for the workers tests.
+
+const { threadId } = require('worker_threads')
+const simpleFS = require('./simple-fs')
+const stat = require('./stat')
+
+module.exports = function () {
+  const ops = simpleFS()
+  const getattr = ops.getattr
+
+  ops.getattr = function (path, cb) {
+    if (path === '/') return getattr(path, cb)
+    return process.nextTick(cb, null, stat({ mode: 'file', size: threadId }))
+  }
+
+  return ops
+}
@@ -0,0 +1,199 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+const { execFile } = require('child_process')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('getattr accepts BigIntStats and keeps nanosecond times', function (t) {
+  const backing = fs.statSync(__filename, { bigint: true })
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/test') return process.nextTick(cb, 0, backing)
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'test'), { bigint: true }, function (err, st) {
+      t.error(err, 'no error')
+      t.same(st.size, backing.size, 'same size')
+      t.same(st.mode, backing.mode, 'same mode')
+      t.same(st.mtimeNs, backing.mtimeNs, 'same mtime down to the nanosecond')
+      t.same(st.ctimeNs, backing.ctimeNs, 'same ctime down to the nanosecond')
+
+      unmount(fuse, function () {
+        t.end()
+      })
+    })
+  })
+})
+
+tape('getattr keeps 64 bit sizes', function (t) {
+  const size = Math.pow(2, 40) + 7
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/big') return process.nextTick(cb, 0, stat({ mode: 'file', size }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'big'), function (err, st) {
+      t.error(err, 'no error')
+      t.same(st.size, size, 'size survived the round trip')
+
+      unmount(fuse, function () {
+        t.end()
+      })
+    })
+  })
+})
+
+tape('getattr sees the right paths when the path cache recycles entries', function (t) {
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path.startsWith('/file-')) return process.nextTick(cb, 0, stat({ mode: 'file', size: Number(path.slice(6)) }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, pathCacheSize: 2 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    let i = 0
+    loop()
+
+    function loop () {
+      if (i === 20) {
+        return unmount(fuse, function () {
+          t.end()
+        })
+      }
+
+      const n = i++ % 5
+      fs.stat(path.join(mnt, 'file-' + n), function (err, st) {
+        t.error(err, 'no error')
+        t.same(st.size, n, 'stat of file-' + n)
+        loop()
+      })
+    }
+  })
+})
+
+tape('getattr can reply synchronously', function (t) {
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return cb(0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/sync') return cb(0, stat({ mode: 'file', size: 42 }))
+      return cb(Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'sync'), function (err, st) {
+      t.error(err, 'no error')
+      t.same(st.size, 42, 'sync reply')
+
+      fs.stat(path.join(mnt, 'missing'), function (err) {
+        t.same(err && err.code, 'ENOENT', 'sync error')
+
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+})
+
+tape('utimens gets both times with their sub-millisecond part', function (t) {
+  const times = []
+  let atimeMs = 1000
+  let mtimeMs = 1000
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/test') return process.nextTick(cb, 0, { ...stat({ mode: 'file', size: 11 }), atimeMs, mtimeMs })
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    utimens: function (path, atime, mtime, cb) {
+      times.push([atime, mtime])
+      atimeMs = atime
+      mtimeMs = mtime
+      return process.nextTick(cb, 0)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, attrTimeout: 0 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.utimes(path.join(mnt, 'test'), 2000.5, 3000.25, function (err) {
+      t.error(err, 'no error')
+      t.same(times.pop(), [2000500, 3000250], 'atime and mtime in ms')
+
+      // touch -m leaves the atime alone (UTIME_OMIT), the handler gets the current one.
+      execFile('touch', ['-m', '-d', '@4000', path.join(mnt, 'test')], function (err) {
+        t.error(err, 'no error')
+        t.same(times.pop(), [2000500, 4000000], 'omitted atime kept')
+
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+})
+
+tape('useIno reports the 64 bit inode numbers of the handlers', function (t) {
+  const ino = 2n ** 40n + 5n
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/test') return process.nextTick(cb, 0, { ...stat({ mode: 'file', size: 11 }), ino })
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  run({}, function () {
+    run({ lowlevel: true }, function () {
+      t.end()
+    })
+  })
+
+  function run (opts, cb) {
+    const fuse = new Fuse(mnt, ops, { force: true, useIno: true, ...opts })
+    fuse.mount(function (err) {
+      t.error(err, 'no error')
+
+      fs.stat(path.join(mnt, 'test'), { bigint: true }, function (err, st) {
+        t.error(err, 'no error')
+        t.same(st.ino, ino, opts.lowlevel ? 'same ino in low-level mode' : 'same ino')
+
+        unmount(fuse, cb)
+      })
+    })
+  }
+})
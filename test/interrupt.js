@@ -0,0 +1,77 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+const { spawn } = require('child_process')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('interrupted reads abort the handler and fail with EINTR', function (t) {
+  run(t, {})
+})
+
+if (process.platform !== 'darwin') {
+  tape('interrupted reads abort the handler in low-level mode', function (t) {
+    run(t, { lowlevel: true })
+  })
+}
+
+function run (t, opts) {
+  let child = null
+  let killed = 0
+  let aborted = false
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/slow' || path === '/fast') return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    open: function (path, flags, cb) {
+      return process.nextTick(cb, 0, 42)
+    },
+    read: function (path, fd, buf, len, pos, cb, signal) {
+      if (path === '/fast') {
+        const str = 'hello world'.slice(pos, pos + len)
+        if (str) buf.write(str)
+        return process.nextTick(cb, str.length)
+      }
+
+      t.ok(signal, 'got a signal')
+      t.notOk(signal.aborted, 'not aborted yet')
+      signal.addEventListener('abort', function () {
+        aborted = true
+        // Dropped, the FUSE thread already moved on.
+        cb(5)
+      })
+      killed = Date.now()
+      child.kill('SIGTERM')
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, directIo: true, interrupts: true, ...opts })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    child = spawn('cat', [path.join(mnt, 'slow')], { stdio: 'ignore' })
+    child.on('exit', function (code, signal) {
+      t.same(signal, 'SIGTERM', 'reader was killed')
+      // Without the interrupt the timeout answers the read, the reader exits all the same but much later.
+      t.ok(Date.now() - killed < 5000, 'reader exited well before the timeout')
+
+      fs.readFile(path.join(mnt, 'fast'), function (err, buf) {
+        t.error(err, 'no error')
+        t.same(buf, Buffer.from('hello world'), 'next request is served')
+        // The abort was queued before this read was.
+        t.ok(aborted, 'handler was aborted')
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+}
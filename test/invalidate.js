@@ -0,0 +1,92 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('getattr results are cached natively until invalidated', function (t) {
+  let size = 11
+  let getattrs = 0
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path !== '/test') return process.nextTick(cb, Fuse.ENOENT)
+      getattrs++
+      return process.nextTick(cb, 0, stat({ mode: 'file', size }))
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, attrTimeout: 0, entryTimeout: 0, attrCacheSize: 1024, cacheTimeout: 60 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'test'), function (err, st) {
+      t.error(err, 'no error')
+      t.same(st.size, 11, 'first stat')
+
+      size = 42
+
+      fs.stat(path.join(mnt, 'test'), function (err, st) {
+        t.error(err, 'no error')
+        t.same(st.size, 11, 'served from the native cache')
+        t.same(getattrs, 1, 'one getattr reached JS')
+
+        fuse.invalidate('/test')
+
+        fs.stat(path.join(mnt, 'test'), function (err, st) {
+          t.error(err, 'no error')
+          t.same(st.size, 42, 'fresh stat after invalidate')
+          t.same(getattrs, 2, 'invalidate sent the next getattr to JS')
+
+          unmount(fuse, function () {
+            t.end()
+          })
+        })
+      })
+    })
+  })
+})
+
+tape('invalidateEntry drops negative entries', function (t) {
+  let exists = false
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/later' && exists) return process.nextTick(cb, 0, stat({ mode: 'file', size: 1 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, lowlevel: true, attrTimeout: 0, entryTimeout: 0, negativeTimeout: 60 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'later'), function (err) {
+      t.ok(err, 'missing at first')
+
+      exists = true
+
+      fs.stat(path.join(mnt, 'later'), function (err) {
+        t.ok(err, 'miss is remembered')
+
+        fuse.invalidateEntry('/', 'later')
+
+        fs.stat(path.join(mnt, 'later'), function (err, st) {
+          t.error(err, 'found after invalidateEntry')
+          t.same(st.size, 1, 'fresh stat')
+
+          unmount(fuse, function () {
+            t.end()
+          })
+        })
+      })
+    })
+  })
+})
@@ -0,0 +1,158 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const simpleFS = require('./fixtures/simple-fs')
+
+const { unmount } = require('./helpers')
+const mnt = createMountpoint()
+
+tape('lowlevel read through the path handlers', function (t) {
+  const testFS = simpleFS({
+    release: function (path, fd) {
+      t.same(path, '/test', 'path was resolved from the inode')
+      t.same(fd, 42, 'fd was passed to release')
+    }
+  })
+  const fuse = new Fuse(mnt, testFS, { lowlevel: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readdir(mnt, function (err, list) {
+      t.error(err, 'no error')
+      t.same(list, ['test'], 'readdir')
+
+      fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+        t.error(err, 'no error')
+        t.same(buf, Buffer.from('hello world'), 'read file')
+
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+})
+
+tape('lowlevel readdir lists a directory once per open', function (t) {
+  const names = []
+  let listings = 0
+
+  for (let i = 0; i < 20000; i++) names.push('entry-with-a-longish-name-' + i)
+
+  const ops = {
+    readdir: function (path, cb) {
+      listings++
+      return process.nextTick(cb, 0, names)
+    },
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { lowlevel: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readdir(mnt, function (err, list) {
+      t.error(err, 'no error')
+      t.same(list.sort(), names.slice().sort(), 'listed every entry once')
+      t.same(listings, 1, 'continuations were served natively')
+
+      unmount(fuse, function () {
+        t.end()
+      })
+    })
+  })
+})
+
+tape('lowlevel lookup gets the parent inode and name', function (t) {
+  const inodes = new Map()
+  const ops = {
+    lookup: function (parent, name, cb) {
+      if (parent === 1 && name === 'dir') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (parent !== 1 && name === 'file') {
+        inodes.set(name, parent)
+        return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+      }
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/dir') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/dir/file') return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { lowlevel: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'dir', 'file'), function (err, st) {
+      t.error(err, 'no error')
+      t.same(st.size, 11, 'stat from lookup')
+      t.ok(inodes.get('file') > 1, 'nested lookup got the inode of dir')
+
+      fs.stat(path.join(mnt, 'missing'), function (err) {
+        t.same(err && err.code, 'ENOENT', 'lookup error is passed through')
+
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+})
+
+tape('lowlevel handlers get the inode number after the path', function (t) {
+  const inos = new Map()
+  const ops = {
+    getattr: function (path, cb, signal, ino) {
+      if (!inos.has(path)) inos.set(path, [])
+      inos.get(path).push(ino)
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/file') return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    open: function (path, flags, cb, signal, ino) {
+      inos.set('open ' + path, ino)
+      return process.nextTick(cb, 0, 42)
+    },
+    release: function (path, fd, cb) {
+      return process.nextTick(cb, 0)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { lowlevel: true, attrTimeout: 0 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(mnt, function (err) {
+      t.error(err, 'no error')
+      t.ok(inos.get('/').every(ino => ino === 1), 'the root is inode 1')
+
+      fs.stat(path.join(mnt, 'file'), function (err, st) {
+        t.error(err, 'no error')
+        t.ok(st.ino > 1, 'the file got an inode')
+
+        fs.open(path.join(mnt, 'file'), 'r', function (err, fd) {
+          t.error(err, 'no error')
+          // The first getattr comes from the lookup that creates the inode.
+          t.ok(inos.get('/file').every(ino => ino === undefined || ino === st.ino), 'getattr got the inode the kernel knows the file by')
+          t.same(inos.get('open /file'), st.ino, 'so did open')
+
+          fs.close(fd, function () {
+            unmount(fuse, function () {
+              t.end()
+            })
+          })
+        })
+      })
+    })
+  })
+})
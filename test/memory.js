@@ -0,0 +1,113 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('memory mount serves files without handlers', function (t) {
+  const fuse = new Fuse(mnt, null, { force: true, memory: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    // Nothing here reaches JS, so sync calls on the mount are fine.
+    fs.mkdirSync(path.join(mnt, 'dir'))
+    fs.writeFileSync(path.join(mnt, 'dir', 'file'), 'hello world')
+    t.same(fs.readFileSync(path.join(mnt, 'dir', 'file'), 'utf8'), 'hello world', 'read back what was written')
+    t.same(fs.statSync(path.join(mnt, 'dir', 'file')).size, 11, 'size is tracked')
+
+    const fd = fs.openSync(path.join(mnt, 'dir', 'file'), 'r+')
+    fs.writeSync(fd, Buffer.from('!'), 0, 1, 200000)
+    fs.closeSync(fd)
+    const sparse = fs.readFileSync(path.join(mnt, 'dir', 'file'))
+    t.same(sparse.length, 200001, 'grew past a hole')
+    t.ok(sparse.slice(11, 200000).every(b => b === 0), 'holes read as zeros')
+
+    fs.truncateSync(path.join(mnt, 'dir', 'file'), 5)
+    fs.renameSync(path.join(mnt, 'dir', 'file'), path.join(mnt, 'moved'))
+    fs.symlinkSync('moved', path.join(mnt, 'link'))
+    t.same(fs.readFileSync(path.join(mnt, 'link'), 'utf8'), 'hello', 'renamed, truncated and linked')
+    t.same(fs.readdirSync(mnt).sort(), ['dir', 'link', 'moved'], 'listed')
+
+    t.throws(() => fs.rmdirSync(mnt + '/nope'), /ENOENT/, 'missing paths fail')
+    fs.writeFileSync(path.join(mnt, 'dir', 'other'), 'x')
+    t.throws(() => fs.rmdirSync(path.join(mnt, 'dir')), /ENOTEMPTY/, 'full directories stay')
+
+    fs.unlinkSync(path.join(mnt, 'dir', 'other'))
+    fs.rmdirSync(path.join(mnt, 'dir'))
+    fs.unlinkSync(path.join(mnt, 'link'))
+    fs.unlinkSync(path.join(mnt, 'moved'))
+    t.same(fs.readdirSync(mnt), [], 'removed')
+
+    unmount(fuse, function () {
+      t.end()
+    })
+  })
+})
+
+tape('memory mount lists every entry while they are removed', function (t) {
+  const fuse = new Fuse(mnt, null, { force: true, memory: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    // Many FUSE readdir calls, each resuming after entries that were unlinked since the last.
+    const dir = path.join(mnt, 'big')
+    fs.mkdirSync(dir)
+    for (let i = 0; i < 2000; i++) fs.writeFileSync(path.join(dir, 'file-with-a-long-name-' + i), '')
+
+    const handle = fs.opendirSync(dir)
+    let entry
+    let seen = 0
+    while ((entry = handle.readSync()) !== null) {
+      fs.unlinkSync(path.join(dir, entry.name))
+      seen++
+    }
+    handle.closeSync()
+
+    t.same(seen, 2000, 'every entry was listed once')
+    t.same(fs.readdirSync(dir), [], 'none were left behind')
+
+    unmount(fuse, function () {
+      t.end()
+    })
+  })
+})
+
+tape('memory mount populated from JS', function (t) {
+  const reads = []
+  const ops = {
+    read (path, fd, buf, len, pos, cb) {
+      reads.push(path)
+      const data = Buffer.from('from js').slice(pos, pos + len)
+      data.copy(buf)
+      process.nextTick(cb, data.length)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, memory: true, intercept: ['/js'], memorySize: 1024 * 1024 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fuse.populate('/hot/a/file', 'populated')
+    fuse.populate('/js/file', Buffer.from('from js'))
+    fuse.populate('/empty')
+    t.throws(() => fuse.populate('/hot/a/file/below', 'x'), /populate failed/, 'files are not directories')
+
+    t.same(fs.readFileSync(path.join(mnt, 'hot', 'a', 'file'), 'utf8'), 'populated', 'served natively')
+    t.ok(fs.statSync(path.join(mnt, 'empty')).isDirectory(), 'directories too')
+    t.throws(() => fs.writeFileSync(path.join(mnt, 'big'), Buffer.alloc(2 * 1024 * 1024)), /ENOSPC/, 'memorySize caps the data')
+
+    fs.readFile(path.join(mnt, 'js', 'file'), 'utf8', function (err, data) {
+      t.error(err, 'no error')
+      t.same(data, 'from js', 'intercepted read went to JS')
+      t.ok(reads.length > 0 && reads.every(p => p === '/js/file'), 'only the intercepted path reached JS')
+
+      unmount(fuse, function () {
+        t.end()
+      })
+    })
+  })
+})
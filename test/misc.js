@@ -22,6 +22,73 @@ tape('mount', function (t) {
   })
 })
 
+tape('many mounts at once keep the event loop going', function (t) {
+  const mounts = []
+  for (let i = 0; i < 8; i++) mounts.push(new Fuse(createMountpoint({ doNotCreate: true }) + '-' + i, {}, { force: true, mkdir: true }))
+
+  let ticks = 0
+  const timer = setInterval(() => ticks++, 1)
+  let missing = mounts.length
+
+  for (const fuse of mounts) {
+    fuse.mount(function (err) {
+      t.error(err, 'no error')
+      if (--missing) return
+
+      clearInterval(timer)
+      t.ok(ticks > 0, 'timers ran while mounting')
+      unmountAll()
+    })
+  }
+
+  function unmountAll () {
+    const fuse = mounts.pop()
+    if (!fuse) return t.end()
+    unmount(fuse, unmountAll)
+  }
+})
+
+tape('unmount joins the FUSE threads', function (t) {
+  const ops = simpleFS({})
+  const getattr = ops.getattr
+  // Slow enough that every stat below gets a FUSE thread of its own.
+  ops.getattr = (path, cb) => setTimeout(getattr, 20, path, cb)
+
+  // The first round starts the libuv threadpool.
+  cycle(function () {
+    const before = threads()
+    let rounds = 3
+
+    cycle(function loop () {
+      if (--rounds) return cycle(loop)
+      t.ok(threads() <= before, 'no threads left behind')
+      t.end()
+    })
+  })
+
+  function cycle (cb) {
+    const fuse = new Fuse(mnt, ops, { force: true })
+    fuse.mount(function (err) {
+      t.error(err, 'no error')
+      let missing = 16
+      for (let i = 0; i < 16; i++) {
+        fs.stat(mnt + '/test', function (err) {
+          t.error(err, 'no error')
+          if (--missing) return
+          fuse.unmount(function (err) {
+            t.error(err, 'no error')
+            cb()
+          })
+        })
+      }
+    })
+  }
+
+  function threads () {
+    return Number(/^Threads:\s+(\d+)/m.exec(fs.readFileSync('/proc/self/status', 'utf8'))[1])
+  }
+})
+
 tape('mount + unmount + mount', function (t) {
   const fuse1 = new Fuse(mnt, {}, { force: true, debug: false })
   const fuse2 = new Fuse(mnt, {}, { force: true, debug: false })
@@ -0,0 +1,85 @@
+const tape = require('tape')
+const fs = require('fs')
+const os = require('os')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('passthrough serves the backing directory', function (t) {
+  const backing = fs.mkdtempSync(path.join(os.tmpdir(), 'fuse-native-backing-'))
+  fs.writeFileSync(path.join(backing, 'hello'), 'hello world')
+  fs.mkdirSync(path.join(backing, 'dir'))
+
+  const fuse = new Fuse(mnt, null, { force: true, passthrough: backing })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    t.same(fs.readFileSync(path.join(mnt, 'hello'), 'utf8'), 'hello world', 'read from the backing file')
+    t.same(fs.readdirSync(mnt).sort(), ['dir', 'hello'], 'listed the backing directory')
+
+    fs.writeFileSync(path.join(mnt, 'dir', 'new'), 'written')
+    t.same(fs.readFileSync(path.join(backing, 'dir', 'new'), 'utf8'), 'written', 'created in the backing directory')
+
+    fs.renameSync(path.join(mnt, 'dir', 'new'), path.join(mnt, 'moved'))
+    fs.truncateSync(path.join(mnt, 'moved'), 4)
+    t.same(fs.readFileSync(path.join(backing, 'moved'), 'utf8'), 'writ', 'renamed and truncated')
+
+    fs.unlinkSync(path.join(mnt, 'moved'))
+    t.notOk(fs.existsSync(path.join(backing, 'moved')), 'unlinked')
+
+    unmount(fuse, function () {
+      fs.rmdirSync(path.join(backing, 'dir'))
+      fs.unlinkSync(path.join(backing, 'hello'))
+      fs.rmdirSync(backing)
+      t.end()
+    })
+  })
+})
+
+tape('passthrough calls handlers for intercepted paths only', function (t) {
+  const backing = fs.mkdtempSync(path.join(os.tmpdir(), 'fuse-native-backing-'))
+  fs.writeFileSync(path.join(backing, 'plain'), 'plain')
+  fs.mkdirSync(path.join(backing, 'upper'))
+  fs.writeFileSync(path.join(backing, 'upper', 'file'), 'shout')
+  fs.writeFileSync(path.join(backing, 'uppercase'), 'not intercepted')
+
+  const reads = []
+  const ops = {
+    read (path, fd, buf, len, pos, cb) {
+      reads.push(path)
+      const data = Buffer.from(fs.readFileSync(backing + path, 'utf8').toUpperCase()).slice(pos, pos + len)
+      data.copy(buf)
+      process.nextTick(cb, data.length)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, passthrough: backing, intercept: ['/upper/'] })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    // Sync reads of native paths never need the loop, the intercepted one does.
+    t.same(fs.readFileSync(path.join(mnt, 'plain'), 'utf8'), 'plain', 'other reads stay native')
+    t.same(fs.readFileSync(path.join(mnt, 'uppercase'), 'utf8'), 'not intercepted', 'prefixes match whole path components')
+
+    fs.readFile(path.join(mnt, 'upper', 'file'), 'utf8', function (err, data) {
+      t.error(err, 'no error')
+      t.same(data, 'SHOUT', 'intercepted read went to JS')
+      t.same(reads[0], '/upper/file', 'only the intercepted file reached JS')
+      t.ok(reads.every(p => p === '/upper/file'), 'no other path reached JS')
+      unmount(fuse, cleanup)
+    })
+
+    function cleanup () {
+      fs.unlinkSync(path.join(backing, 'upper', 'file'))
+      fs.rmdirSync(path.join(backing, 'upper'))
+      fs.unlinkSync(path.join(backing, 'uppercase'))
+      fs.unlinkSync(path.join(backing, 'plain'))
+      fs.rmdirSync(backing)
+      t.end()
+    }
+  })
+})
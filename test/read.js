@@ -1,6 +1,7 @@
 const tape = require('tape')
 const fs = require('fs')
 const path = require('path')
+const os = require('os')
 const concat = require('concat-stream')
 
 const Fuse = require('../')
@@ -45,6 +46,209 @@ tape('read', function (t) {
   })
 })
 
+tape('file handles keep 64 bits', function (t) {
+  const fh = 2 ** 40 + 7
+  const testFS = simpleFS({
+    read: function (path, fd) {
+      t.same(fd, fh, 'fd was passed to read')
+    },
+    release: function (path, fd) {
+      t.same(fd, fh, 'fd was passed to release')
+    }
+  })
+  testFS.open = function (path, flags, cb) {
+    process.nextTick(cb, 0, fh)
+  }
+
+  const fuse = new Fuse(mnt, testFS, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+      t.error(err, 'no error')
+      t.same(buf, Buffer.from('hello world'), 'read file')
+
+      unmount(fuse, function () {
+        t.end()
+      })
+    })
+  })
+})
+
+tape('handles pass the value open returned to the ops on the file', function (t) {
+  const opened = []
+  const testFS = simpleFS({
+    read: function (path, fd) {
+      t.ok(opened.includes(fd), 'read got the value open returned')
+      fd.reads++
+    }
+  })
+  testFS.open = function (path, flags, cb) {
+    const handle = { path, reads: 0 }
+    opened.push(handle)
+    process.nextTick(cb, 0, handle)
+  }
+  delete testFS.release
+
+  const fuse = new Fuse(mnt, testFS, { force: true, handles: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+      t.error(err, 'no error')
+      t.same(buf, Buffer.from('hello world'), 'read file')
+
+      fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+        t.error(err, 'no error')
+        t.same(buf, Buffer.from('hello world'), 'read file again')
+        t.same(opened.length, 2, 'opened twice')
+        t.ok(opened.every(h => h.path === '/test' && h.reads > 0), 'each handle saw its reads')
+
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+})
+
+tape('reads are served from the native block cache until invalidated', function (t) {
+  let data = Buffer.from('hello world')
+  let reads = 0
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/test') return process.nextTick(cb, 0, stat({ mode: 'file', size: data.length }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    open: function (path, flags, cb) {
+      return process.nextTick(cb, 0, 42)
+    },
+    read: function (path, fd, buf, len, pos, cb) {
+      reads++
+      return process.nextTick(cb, data.copy(buf, 0, Math.min(pos, data.length), Math.min(pos + len, data.length)))
+    },
+    write: function (path, fd, buf, len, pos, cb) {
+      buf.copy(data, pos, 0, len)
+      return process.nextTick(cb, len)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, attrTimeout: 0, readCacheSize: 1024 * 1024, readCacheBlockSize: 4096 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+      t.error(err, 'no error')
+      t.same(buf, Buffer.from('hello world'), 'read file')
+      const first = reads
+
+      fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+        t.error(err, 'no error')
+        t.same(buf, Buffer.from('hello world'), 'read file again')
+        t.same(reads, first, 'served natively')
+
+        const fd = fs.openSync(path.join(mnt, 'test'), 'r+')
+        fs.writeSync(fd, Buffer.from('HELLO'), 0, 5, 0)
+        fs.closeSync(fd)
+
+        fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+          t.error(err, 'no error')
+          t.same(buf, Buffer.from('HELLO world'), 'write dropped the cached block')
+          t.ok(reads > first, 'read reached JS')
+
+          data = Buffer.from('bye world!!')
+          fuse.invalidate('/test')
+
+          fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+            t.error(err, 'no error')
+            t.same(buf, Buffer.from('bye world!!'), 'fresh data after invalidate')
+
+            unmount(fuse, function () {
+              t.end()
+            })
+          })
+        })
+      })
+    })
+  })
+})
+
+tape('readbuf splices from a backing fd', function (t) {
+  const backing = path.join(os.tmpdir(), 'fuse-native-readbuf-' + process.pid)
+  fs.writeFileSync(backing, '--hello world')
+  const backingFd = fs.openSync(backing, 'r')
+
+  const testFS = simpleFS()
+  testFS.readbuf = function (path, fd, len, pos, cb) {
+    if (pos >= 11) return process.nextTick(cb, 0, [])
+    len = Math.min(len, 11 - pos)
+    // Split in two segments to check they are concatenated in order
+    const half = Math.ceil(len / 2)
+    return process.nextTick(cb, 0, [
+      { fd: backingFd, position: 2 + pos, length: half },
+      { fd: backingFd, position: 2 + pos + half, length: len - half }
+    ])
+  }
+
+  const fuse = new Fuse(mnt, testFS, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+      t.error(err, 'no error')
+      t.same(buf, Buffer.from('hello world'), 'read file through the backing fd')
+
+      fs.createReadStream(path.join(mnt, 'test'), { start: 6, end: 10 }).pipe(concat(function (buf) {
+        t.same(buf, Buffer.from('world'), 'partial read file + start offset')
+
+        unmount(fuse, function () {
+          fs.closeSync(backingFd)
+          fs.unlinkSync(backing)
+          t.end()
+        })
+      }))
+    })
+  })
+})
+
+tape('readbuf handlers may close their fd right after replying', function (t) {
+  const backing = path.join(os.tmpdir(), 'fuse-native-readbuf-' + process.pid)
+  const decoy = backing + '-decoy'
+  const decoys = []
+  fs.writeFileSync(backing, 'hello world')
+  fs.writeFileSync(decoy, 'XXXXXXXXXXX')
+
+  const testFS = simpleFS()
+  testFS.readbuf = function (path, fd, len, pos, cb) {
+    fs.open(backing, 'r', function (err, backingFd) {
+      if (err) return cb(Fuse.EIO)
+      cb(0, { fd: backingFd, position: pos, length: Math.max(0, Math.min(len, 11 - pos)) })
+      fs.closeSync(backingFd)
+      // Likely to get the number just closed, a splice from it would read the wrong file.
+      decoys.push(fs.openSync(decoy, 'r'))
+    })
+  }
+
+  const fuse = new Fuse(mnt, testFS, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+      t.error(err, 'no error')
+      t.same(buf, Buffer.from('hello world'), 'read the file that was replied with')
+
+      unmount(fuse, function () {
+        for (const fd of decoys) fs.closeSync(fd)
+        fs.unlinkSync(backing)
+        fs.unlinkSync(decoy)
+        t.end()
+      })
+    })
+  })
+})
+
 // Skipped because this test takes 2 minutes to run.
 tape.skip('read timeout does not force unmount', function (t) {
   var ops = {
@@ -0,0 +1,155 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('readdir stats are served to getattr natively', function (t) {
+  const names = []
+  const stats = []
+  let getattrs = 0
+
+  for (let i = 0; i < 5000; i++) {
+    names.push('file-' + i)
+    stats.push(stat({ mode: 'file', size: i }))
+  }
+
+  const ops = {
+    readdir: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, names, stats)
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      getattrs++
+      const i = names.indexOf(path.slice(1))
+      if (i === -1) return process.nextTick(cb, Fuse.ENOENT)
+      return process.nextTick(cb, 0, stats[i])
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, attrTimeout: 60, attrCacheSize: 65536 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readdir(mnt, function (err, list) {
+      t.error(err, 'no error')
+      t.same(list.length, names.length, 'listed every entry')
+
+      let missing = list.length
+      let sizes = 0
+
+      for (const name of list) {
+        fs.stat(path.join(mnt, name), function (err, st) {
+          if (!err && st.size === names.indexOf(name)) sizes++
+          if (--missing) return
+          t.same(sizes, names.length, 'stats came from readdir')
+          t.same(getattrs, 0, 'no getattr reached JS')
+
+          unmount(fuse, function () {
+            t.end()
+          })
+        })
+      }
+    })
+  })
+})
+
+tape('readdirPage resumes from the cursor it handed out', function (t) {
+  const keys = new Set()
+  const cursors = []
+
+  for (let i = 0; i < 5000; i++) keys.add('key-with-a-longish-name-' + String(i).padStart(5, '0'))
+
+  const ops = {
+    // Like an object store, a page starts after the last key of the one before.
+    readdirPage: function (path, cursor, cb) {
+      cursors.push(cursor)
+      const page = [...keys].sort().filter(k => cursor === 0 || k > cursor).slice(0, 500)
+      return process.nextTick(cb, 0, page, null, page.length ? page[page.length - 1] : null)
+    },
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (keys.has(path.slice(1))) return process.nextTick(cb, 0, stat({ mode: 'file', size: 0 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    unlink: function (path, cb) {
+      keys.delete(path.slice(1))
+      return process.nextTick(cb, 0)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.opendir(mnt, function (err, dir) {
+      t.error(err, 'no error')
+      let seen = 0
+      next()
+
+      // Every entry is removed as soon as it is seen, none may be skipped.
+      function next () {
+        dir.read(function (err, entry) {
+          t.error(err)
+          if (entry === null) return dir.close(done)
+          seen++
+          fs.unlink(path.join(mnt, entry.name), function (err) {
+            t.error(err)
+            next()
+          })
+        })
+      }
+
+      function done () {
+        t.same(seen, 5000, 'every entry was listed')
+        t.same(keys.size, 0, 'none were left behind')
+        t.same(cursors[0], 0, 'first page starts at 0')
+        t.ok(cursors.slice(1).every(c => typeof c === 'string'), 'later pages got the cursor back')
+        unmount(fuse, function () {
+          t.end()
+        })
+      }
+    })
+  })
+})
+
+tape('readdirPage lists a directory one page at a time', function (t) {
+  const names = []
+  const offsets = []
+
+  for (let i = 0; i < 20000; i++) names.push('entry-with-a-longish-name-' + i)
+
+  const ops = {
+    readdirPage: function (path, offset, cb) {
+      if (path !== '/') return process.nextTick(cb, Fuse.ENOENT)
+      offsets.push(offset)
+      return process.nextTick(cb, 0, names.slice(offset, offset + 1000))
+    },
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readdir(mnt, function (err, list) {
+      t.error(err, 'no error')
+      t.same(list.sort(), names.slice().sort(), 'listed every entry once')
+      t.same(offsets[0], 0, 'first page starts at 0')
+      t.ok(offsets.length > names.length / 1000, 'fetched in several pages')
+
+      unmount(fuse, function () {
+        t.end()
+      })
+    })
+  })
+})
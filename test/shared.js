@@ -0,0 +1,68 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const base = createMountpoint({ doNotCreate: true })
+
+tape('shared mounts keep their own handlers and stats', function (t) {
+  const mounts = []
+  for (let i = 0; i < 4; i++) {
+    mounts.push(new Fuse(base + '-' + i, createOps(i), { force: true, mkdir: true, shared: true, stats: true }))
+  }
+
+  let missing = mounts.length
+  for (const fuse of mounts) {
+    fuse.mount(function (err) {
+      t.error(err, 'no error')
+      if (--missing === 0) readAll()
+    })
+  }
+
+  function readAll () {
+    let missing = mounts.length
+    mounts.forEach(function (fuse, i) {
+      fs.readFile(path.join(fuse.mnt, 'file'), 'utf8', function (err, data) {
+        t.error(err, 'no error')
+        t.same(data, 'mount ' + i, 'served by its own handlers')
+        if (--missing === 0) check()
+      })
+    })
+  }
+
+  function check () {
+    for (const fuse of mounts) {
+      t.same(fuse.stats().open.calls, 1, 'stats are kept per mount')
+    }
+    unmountAll()
+  }
+
+  function unmountAll () {
+    const fuse = mounts.pop()
+    if (!fuse) return t.end()
+    unmount(fuse, unmountAll)
+  }
+})
+
+function createOps (i) {
+  const content = Buffer.from('mount ' + i)
+
+  return {
+    getattr (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/file') return process.nextTick(cb, 0, stat({ mode: 'file', size: content.length }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    open (path, flags, cb) {
+      return process.nextTick(cb, 0, 42)
+    },
+    read (path, fd, buf, len, pos, cb) {
+      const n = content.copy(buf, 0, pos, Math.min(content.length, pos + len))
+      return process.nextTick(cb, n)
+    }
+  }
+}
@@ -0,0 +1,50 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const simpleFS = require('./fixtures/simple-fs')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('stats are null unless enabled', function (t) {
+  const fuse = new Fuse(mnt, simpleFS(), { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+    t.same(fuse.stats(), null, 'no stats')
+    unmount(fuse, function () {
+      t.end()
+    })
+  })
+})
+
+tape('stats count calls, errors, bytes and latencies per op', function (t) {
+  const fuse = new Fuse(mnt, simpleFS(), { force: true, stats: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.readFile(path.join(mnt, 'test'), function (err, buf) {
+      t.error(err, 'no error')
+
+      fs.stat(path.join(mnt, 'missing'), function (err) {
+        t.ok(err, 'missing file')
+
+        const stats = fuse.stats()
+
+        t.ok(stats.getattr.calls > 0, 'getattr calls counted')
+        t.ok(stats.getattr.errnos.ENOENT > 0, 'ENOENT counted')
+        t.same(stats.getattr.inFlight, 0, 'nothing in flight')
+        t.same(stats.getattr.serviceTime.count, stats.getattr.calls, 'one service time sample per call')
+        t.same(stats.getattr.queueWait.count, stats.getattr.calls, 'one queue wait sample per call')
+        t.same(stats.read.bytes, buf.length, 'read bytes counted')
+        t.ok(stats.read.serviceTime.totalNs > 0, 'service time recorded')
+
+        unmount(fuse, function () {
+          t.end()
+        })
+      })
+    })
+  })
+})
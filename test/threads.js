@@ -0,0 +1,65 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('a bounded pool serves concurrent requests', function (t) {
+  run(t, { maxThreads: 2, maxIdleThreads: 1 }, function (inFlight) {
+    t.ok(inFlight <= 2, 'no more requests in flight than threads')
+    t.end()
+  })
+})
+
+tape('single threaded mounts serve one request at a time', function (t) {
+  run(t, { singleThreaded: true }, function (inFlight) {
+    t.same(inFlight, 1, 'one request in flight at a time')
+    t.end()
+  })
+})
+
+function run (t, opts, cb) {
+  let inFlight = 0
+  let maxInFlight = 0
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      const i = Number(path.slice('/file-'.length))
+      if (!path.startsWith('/file-') || !(i >= 0)) return process.nextTick(cb, Fuse.ENOENT)
+
+      maxInFlight = Math.max(maxInFlight, ++inFlight)
+      // Long enough for the others to pile up behind this one.
+      setTimeout(function () {
+        inFlight--
+        cb(0, stat({ mode: 'file', size: i }))
+      }, 10)
+    }
+  }
+
+  // Every stat has to reach a FUSE thread.
+  const fuse = new Fuse(mnt, ops, { force: true, attrTimeout: 0, entryTimeout: 0, ...opts })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    let missing = 32
+    let sizes = 0
+
+    for (let i = 0; i < 32; i++) {
+      fs.stat(path.join(mnt, 'file-' + i), function (err, st) {
+        if (!err && st.size === i) sizes++
+        if (--missing) return
+
+        t.same(sizes, 32, 'every stat got its own result')
+        unmount(fuse, function () {
+          cb(maxInFlight)
+        })
+      })
+    }
+  })
+}
@@ -0,0 +1,52 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const stat = require('./fixtures/stat')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('overdue requests fail with ETIMEDOUT and late replies are ignored', function (t) {
+  let late = null
+
+  const ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, 0, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/slow') {
+        // Reply long after the deadline, this must not complete any other request.
+        late = setTimeout(cb, 500, 0, stat({ mode: 'file', size: 1 }))
+        return
+      }
+      if (path === '/fast') return process.nextTick(cb, 0, stat({ mode: 'file', size: 11 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, timeout: { getattr: 100 } })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.stat(path.join(mnt, 'slow'), function (err) {
+      t.ok(err, 'timed out')
+      t.same(err && err.code, 'ETIMEDOUT', 'ETIMEDOUT')
+
+      let missing = 10
+      for (let i = 0; i < 10; i++) {
+        setTimeout(function () {
+          fs.stat(path.join(mnt, 'fast'), function (err, st) {
+            t.error(err, 'no error')
+            t.same(st.size, 11, 'right reply')
+            if (--missing) return
+            clearTimeout(late)
+            unmount(fuse, function () {
+              t.end()
+            })
+          })
+        }, i * 100)
+      }
+    })
+  })
+})
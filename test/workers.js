@@ -0,0 +1,44 @@
+const tape = require('tape')
+const fs = require('fs')
+const path = require('path')
+
+const Fuse = require('../')
+const createMountpoint = require('./fixtures/mnt')
+const { unmount } = require('./helpers')
+
+const mnt = createMountpoint()
+
+tape('workers need the handlers as a module path', function (t) {
+  t.throws(() => new Fuse(mnt, {}, { workers: 2 }), /module path/)
+  t.end()
+})
+
+tape('handlers run on the workers', function (t) {
+  const fuse = new Fuse(mnt, require.resolve('./fixtures/thread-fs'), { force: true, workers: 2 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    const threads = new Set()
+    let missing = 16
+
+    for (let i = 0; i < 16; i++) {
+      fs.stat(path.join(mnt, 'file-' + i), function (err, st) {
+        t.error(err, 'no error')
+        threads.add(st.size)
+        if (--missing) return
+
+        t.notOk(threads.has(0), 'never ran on the main thread')
+        t.same(threads.size, 2, 'spread over both workers')
+
+        fs.readdir(mnt, function (err, list) {
+          t.error(err, 'no error')
+          t.same(list, ['test'], 'readdir through a worker')
+
+          unmount(fuse, function () {
+            t.end()
+          })
+        })
+      })
+    }
+  })
+})
@@ -1,6 +1,7 @@
 const tape = require('tape')
 const fs = require('fs')
 const path = require('path')
+const os = require('os')
 
 const Fuse = require('../')
 const createMountpoint = require('./fixtures/mnt')
@@ -57,3 +58,241 @@ tape('write', function (t) {
     })
   })
 })
+
+tape('writebuf splices into a backing fd with big writes', function (t) {
+  const backing = path.join(os.tmpdir(), 'fuse-native-writebuf-' + process.pid)
+  const backingFd = fs.openSync(backing, 'w+')
+  const data = Buffer.alloc(1024 * 1024, 'abcdefgh')
+  var created = false
+  var size = 0
+  var calls = 0
+
+  var ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, null, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/hello' && created) return process.nextTick(cb, 0, stat({ mode: 'file', size: size }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    create: function (path, flags, cb) {
+      created = true
+      process.nextTick(cb, 0, 42)
+    },
+    truncate: function (path, size, cb) {
+      process.nextTick(cb, 0)
+    },
+    release: function (path, fd, cb) {
+      process.nextTick(cb, 0)
+    },
+    writebuf: function (path, fd, len, pos, cb) {
+      calls++
+      size = Math.max(pos + len, size)
+      process.nextTick(cb, 0, { fd: backingFd, position: pos })
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, maxWrite: 131072 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.writeFile(path.join(mnt, 'hello'), data, function (err) {
+      t.error(err, 'no error')
+      t.same(fs.readFileSync(backing), data, 'data was spliced into the backing file')
+      t.ok(calls <= data.length / 65536, 'writes arrived in big chunks')
+
+      unmount(fuse, function () {
+        fs.closeSync(backingFd)
+        fs.unlinkSync(backing)
+        t.end()
+      })
+    })
+  })
+})
+
+tape('writebuf handlers may close their fd right after replying', function (t) {
+  const backing = path.join(os.tmpdir(), 'fuse-native-writebuf-' + process.pid)
+  const decoy = backing + '-decoy'
+  const decoys = []
+  var created = false
+  var size = 0
+
+  fs.writeFileSync(backing, '')
+  fs.writeFileSync(decoy, '')
+
+  var ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, null, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/hello' && created) return process.nextTick(cb, 0, stat({ mode: 'file', size: size }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    create: function (path, flags, cb) {
+      created = true
+      process.nextTick(cb, 0, 42)
+    },
+    truncate: function (path, size, cb) {
+      process.nextTick(cb, 0)
+    },
+    release: function (path, fd, cb) {
+      process.nextTick(cb, 0)
+    },
+    writebuf: function (path, fd, len, pos, cb) {
+      fs.open(backing, 'r+', function (err, backingFd) {
+        if (err) return cb(Fuse.EIO)
+        size = Math.max(pos + len, size)
+        cb(0, { fd: backingFd, position: pos })
+        fs.closeSync(backingFd)
+        // Likely to get the number just closed, a splice into it would write the wrong file.
+        decoys.push(fs.openSync(decoy, 'r+'))
+      })
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.writeFile(path.join(mnt, 'hello'), 'hello world', function (err) {
+      t.error(err, 'no error')
+      t.same(fs.readFileSync(backing, 'utf8'), 'hello world', 'data went to the file that was replied with')
+      t.same(fs.readFileSync(decoy, 'utf8'), '', 'and nowhere else')
+
+      unmount(fuse, function () {
+        for (const fd of decoys) fs.closeSync(fd)
+        fs.unlinkSync(backing)
+        fs.unlinkSync(decoy)
+        t.end()
+      })
+    })
+  })
+})
+
+tape('write-back collects small sequential writes into one', function (t) {
+  const data = Buffer.alloc(1024)
+  const writes = []
+  var created = false
+  var size = 0
+
+  var ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, null, stat({ mode: 'dir', size: 4096 }))
+      if ((path === '/hello' || path === '/broken') && created) return process.nextTick(cb, 0, stat({ mode: 'file', size: size }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    create: function (path, flags, cb) {
+      created = true
+      process.nextTick(cb, 0, path === '/broken' ? 43 : 42)
+    },
+    truncate: function (path, size, cb) {
+      process.nextTick(cb, 0)
+    },
+    write: function (path, fd, buf, len, pos, cb) {
+      if (path === '/broken') return process.nextTick(cb, Fuse.EIO)
+      writes.push([pos, len])
+      buf.slice(0, len).copy(data, pos)
+      size = Math.max(pos + len, size)
+      process.nextTick(cb, len)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, directIo: true, attrTimeout: 0, writeBackSize: 65536 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.open(path.join(mnt, 'hello'), 'w', function (err, fd) {
+      t.error(err, 'no error')
+      let i = 0
+      loop()
+
+      function loop () {
+        if (i === 16) return collected(fd)
+        fs.write(fd, 'hello world!', i++ * 12, function (err) {
+          t.error(err, 'no error')
+          loop()
+        })
+      }
+    })
+  })
+
+  function collected (fd) {
+    t.same(writes, [], 'writes were acknowledged natively')
+
+    fs.fstat(fd, function (err, st) {
+      t.error(err, 'no error')
+      t.same(st.size, 16 * 12, 'stat sees the collected writes')
+      t.same(writes, [[0, 16 * 12]], 'collected writes went out as one')
+
+      fs.write(fd, 'hello world!', 16 * 12, function (err) {
+        t.error(err, 'no error')
+        fs.close(fd, function (err) {
+          t.error(err, 'no error')
+          t.same(writes, [[0, 16 * 12], [16 * 12, 12]], 'close sent out the rest')
+          t.same(data.slice(0, size), Buffer.from('hello world!'.repeat(17)), 'data was written')
+          broken()
+        })
+      })
+    })
+  }
+
+  function broken () {
+    fs.open(path.join(mnt, 'broken'), 'w', function (err, fd) {
+      t.error(err, 'no error')
+      fs.write(fd, 'hello world!', 0, function (err) {
+        t.error(err, 'write was acknowledged')
+        fs.close(fd, function (err) {
+          t.same(err && err.code, 'EIO', 'close reports the failed write')
+          unmount(fuse, function () {
+            t.end()
+          })
+        })
+      })
+    })
+  }
+})
+
+tape('write-back sends out idle writes after writeBackAge', function (t) {
+  const writes = []
+  var created = false
+
+  var ops = {
+    getattr: function (path, cb) {
+      if (path === '/') return process.nextTick(cb, null, stat({ mode: 'dir', size: 4096 }))
+      if (path === '/hello' && created) return process.nextTick(cb, 0, stat({ mode: 'file', size: 0 }))
+      return process.nextTick(cb, Fuse.ENOENT)
+    },
+    create: function (path, flags, cb) {
+      created = true
+      process.nextTick(cb, 0, 42)
+    },
+    truncate: function (path, size, cb) {
+      process.nextTick(cb, 0)
+    },
+    write: function (path, fd, buf, len, pos, cb) {
+      writes.push([pos, len])
+      process.nextTick(cb, len)
+    }
+  }
+
+  const fuse = new Fuse(mnt, ops, { force: true, directIo: true, attrTimeout: 0, writeBackSize: 65536, writeBackAge: 100 })
+  fuse.mount(function (err) {
+    t.error(err, 'no error')
+
+    fs.open(path.join(mnt, 'hello'), 'w', function (err, fd) {
+      t.error(err, 'no error')
+      fs.write(fd, 'hello world!', 0, function (err) {
+        t.error(err, 'no error')
+        t.same(writes, [], 'write was acknowledged natively')
+
+        // No further writes and the file stays open, only its age sends it out.
+        setTimeout(function () {
+          t.same(writes, [[0, 12]], 'idle write went out')
+          fs.close(fd, function (err) {
+            t.error(err, 'no error')
+            t.same(writes, [[0, 12]], 'nothing left for close')
+            unmount(fuse, function () {
+              t.end()
+            })
+          })
+        }, 500)
+      })
+    })
+  })
+})
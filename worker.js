@@ -0,0 +1,10 @@
+// Entry point of the worker_threads started by the workers option, see Fuse#_startWorkers.
+
+const { workerData, parentPort } = require('worker_threads')
+const Fuse = require('./')
+
+const { thread, index, mnt, ops, opts } = workerData
+const fuse = new Fuse(mnt, ops, opts)
+
+fuse._attachWorker(Buffer.from(thread), index)
+parentPort.postMessage('ready')